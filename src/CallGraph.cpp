@@ -0,0 +1,277 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "CallGraph.h"
+#include <algorithm>
+#include <utility>
+
+namespace calc4
+{
+CallGraph::CallGraph(const CompilationContext& context, bool useSourceOperators)
+{
+    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    {
+        nodeIds.emplace(it->first, static_cast<int>(nodes.size()));
+        nodes.push_back(Node{ it->first, {} });
+    }
+
+    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    {
+        auto& node = nodes[nodeIds.at(it->first)];
+
+        auto& summary = useSourceOperators ? it->second.GetSourceCallSummary()
+                                           : it->second.GetCallSummary();
+        node.hasSideEffects = summary.hasSideEffects;
+        for (auto& name : summary.callees)
+        {
+            auto id = nodeIds.find(name);
+            if (id == nodeIds.end())
+            {
+                // The callee has not been implemented yet, so we cannot assume anything about it
+                node.hasSideEffects = true;
+            }
+            else
+            {
+                node.callees.push_back(id->second);
+            }
+        }
+
+        std::sort(node.callees.begin(), node.callees.end());
+        node.callees.erase(std::unique(node.callees.begin(), node.callees.end()),
+                           node.callees.end());
+    }
+
+    ComputeComponents();
+    ComputeFlags();
+}
+
+void CallGraph::ComputeComponents()
+{
+    // Tarjan's algorithm with an explicit stack, so that long call chains do not overflow the
+    // native stack
+    constexpr int Unvisited = -1;
+    std::vector<int> order(nodes.size(), Unvisited);
+    std::vector<int> lowLink(nodes.size());
+    std::vector<bool> isOnStack(nodes.size());
+    std::vector<int> componentStack;
+    std::vector<std::pair<int, size_t>> callStack;
+    int nextOrder = 0;
+
+    for (int root = 0; root < static_cast<int>(nodes.size()); root++)
+    {
+        if (order[root] != Unvisited)
+        {
+            continue;
+        }
+
+        callStack.emplace_back(root, 0);
+        order[root] = lowLink[root] = nextOrder++;
+        componentStack.push_back(root);
+        isOnStack[root] = true;
+
+        while (!callStack.empty())
+        {
+            auto& [v, next] = callStack.back();
+            if (next < nodes[v].callees.size())
+            {
+                int w = nodes[v].callees[next++];
+                if (order[w] == Unvisited)
+                {
+                    order[w] = lowLink[w] = nextOrder++;
+                    componentStack.push_back(w);
+                    isOnStack[w] = true;
+                    callStack.emplace_back(w, 0);
+                }
+                else if (isOnStack[w])
+                {
+                    lowLink[v] = std::min(lowLink[v], order[w]);
+                }
+                continue;
+            }
+
+            int finished = v;
+            callStack.pop_back();
+            if (!callStack.empty())
+            {
+                int parent = callStack.back().first;
+                lowLink[parent] = std::min(lowLink[parent], lowLink[finished]);
+            }
+
+            if (lowLink[finished] == order[finished])
+            {
+                std::vector<int> component;
+                int w;
+                do
+                {
+                    w = componentStack.back();
+                    componentStack.pop_back();
+                    isOnStack[w] = false;
+                    nodes[w].component = static_cast<int>(components.size());
+                    component.push_back(w);
+                } while (w != finished);
+
+                components.push_back(std::move(component));
+            }
+        }
+    }
+}
+
+void CallGraph::ComputeFlags()
+{
+    // Every component comes after its callees, so the callees outside the component have already
+    // been decided. Mutually recursive operators stay pure unless one of them has side effects.
+    for (auto& component : components)
+    {
+        bool isRecursive = component.size() > 1;
+        bool isPure = true;
+        for (int v : component)
+        {
+            isPure &= !nodes[v].hasSideEffects;
+            for (int w : nodes[v].callees)
+            {
+                if (w == v)
+                {
+                    isRecursive = true;
+                }
+                else if (nodes[w].component != nodes[v].component)
+                {
+                    isPure &= nodes[w].isPure;
+                }
+            }
+        }
+
+        for (int v : component)
+        {
+            nodes[v].isRecursive = isRecursive;
+            nodes[v].isPure = isPure;
+        }
+    }
+}
+
+std::vector<bool> CallGraph::FindReachableNodes(const std::shared_ptr<const Operator>& op) const
+{
+    auto summary = SummarizeCalls(op);
+
+    std::vector<bool> isReachable(nodes.size());
+    std::vector<int> worklist;
+    for (auto& name : summary->callees)
+    {
+        auto id = nodeIds.find(name);
+        if (id != nodeIds.end() && !isReachable[id->second])
+        {
+            isReachable[id->second] = true;
+            worklist.push_back(id->second);
+        }
+    }
+
+    while (!worklist.empty())
+    {
+        int v = worklist.back();
+        worklist.pop_back();
+        for (int w : nodes[v].callees)
+        {
+            if (!isReachable[w])
+            {
+                isReachable[w] = true;
+                worklist.push_back(w);
+            }
+        }
+    }
+
+    return isReachable;
+}
+
+bool CallGraph::Contains(const std::string& name) const
+{
+    return nodeIds.count(name) > 0;
+}
+
+std::vector<std::string> CallGraph::GetCallees(const std::string& name) const
+{
+    std::vector<std::string> result;
+    for (int w : nodes[nodeIds.at(name)].callees)
+    {
+        result.push_back(nodes[w].name);
+    }
+
+    return result;
+}
+
+bool CallGraph::IsRecursive(const std::string& name) const
+{
+    auto id = nodeIds.find(name);
+    return id != nodeIds.end() && nodes[id->second].isRecursive;
+}
+
+bool CallGraph::IsPure(const std::string& name) const
+{
+    auto id = nodeIds.find(name);
+    return id != nodeIds.end() && nodes[id->second].isPure;
+}
+
+std::unordered_set<std::string> CallGraph::GetPureOperators() const
+{
+    std::unordered_set<std::string> result;
+    for (auto& node : nodes)
+    {
+        if (node.isPure)
+        {
+            result.insert(node.name);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::vector<std::string>> CallGraph::GetStronglyConnectedComponents() const
+{
+    std::vector<std::vector<std::string>> result;
+    for (auto& component : components)
+    {
+        auto& names = result.emplace_back();
+        for (int v : component)
+        {
+            names.push_back(nodes[v].name);
+        }
+    }
+
+    return result;
+}
+
+std::unordered_set<std::string> CallGraph::GetReachableOperators(
+    const std::shared_ptr<const Operator>& op) const
+{
+    auto isReachable = FindReachableNodes(op);
+
+    std::unordered_set<std::string> result;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (isReachable[i])
+        {
+            result.insert(nodes[i].name);
+        }
+    }
+
+    return result;
+}
+
+bool CallGraph::HasRecursiveCall(const std::shared_ptr<const Operator>& op) const
+{
+    auto isReachable = FindReachableNodes(op);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (isReachable[i] && nodes[i].isRecursive)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+}
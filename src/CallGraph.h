@@ -0,0 +1,83 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include "Operators.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace calc4
+{
+// Call graph of the user-defined operators in a compilation context. It is built in linear time
+// of the operator bodies, and then answers which operators are recursive, which are pure and
+// which are reachable from an expression. The graph is a snapshot, so it must be rebuilt after the
+// operators in the context are redefined.
+class CallGraph
+{
+private:
+    struct Node
+    {
+        std::string name;
+        std::vector<int> callees;
+
+        // True if the body accesses variables, the global array, input or output, or calls an
+        // operator which is not in the context
+        bool hasSideEffects = false;
+
+        bool isRecursive = false;
+        bool isPure = false;
+        int component = -1;
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, int> nodeIds;
+
+    // Strongly connected components in reverse topological order, that is, every component comes
+    // after the components it calls
+    std::vector<std::vector<int>> components;
+
+    void ComputeComponents();
+    void ComputeFlags();
+    std::vector<bool> FindReachableNodes(const std::shared_ptr<const Operator>& op) const;
+
+public:
+    // The graph is built from the current bodies of the operators, or from their bodies before
+    // optimization if "useSourceOperators" is true
+    explicit CallGraph(const CompilationContext& context, bool useSourceOperators = false);
+
+    bool Contains(const std::string& name) const;
+
+    // Returns the operators called by the given operator directly
+    std::vector<std::string> GetCallees(const std::string& name) const;
+
+    // Returns true if the given operator can call itself directly or indirectly
+    bool IsRecursive(const std::string& name) const;
+
+    // Returns true if the given operator is pure. A pure operator neither accesses variables, the
+    // global array, input or output nor calls impure operators, so its result depends only on its
+    // operands.
+    bool IsPure(const std::string& name) const;
+
+    std::unordered_set<std::string> GetPureOperators() const;
+
+    // Returns the strongly connected components in reverse topological order
+    std::vector<std::vector<std::string>> GetStronglyConnectedComponents() const;
+
+    // Returns the operators which the given expression can call directly or indirectly
+    std::unordered_set<std::string> GetReachableOperators(
+        const std::shared_ptr<const Operator>& op) const;
+
+    // Returns true if the given expression can call a recursive operator
+    bool HasRecursiveCall(const std::shared_ptr<const Operator>& op) const;
+};
+}
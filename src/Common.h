@@ -43,6 +43,18 @@ struct CharPosition
     size_t index;
     int lineNo;
     int charNo;
+
+    // The source which this position refers to, given by "CompilationContext::AddSource". The
+    // positions whose sources are unknown, such as the ones read from bytecode, have zero.
+    int sourceId = 0;
+};
+
+// Text of a source given by "CompilationContext::AddSource", which is shared by the operators
+// defined in it
+struct SourceText
+{
+    int id;
+    std::string text;
 };
 
 class AnyNumber
@@ -8,6 +8,7 @@
  *****/
 
 #include "CppEmitter.h"
+#include "CallGraph.h"
 #include "Common.h"
 #include <algorithm>
 #include <malloc.h>
@@ -17,7 +18,7 @@
 #include <vector>
 
 #ifdef ENABLE_GMP
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 using namespace std::string_view_literals;
@@ -36,7 +37,7 @@ InstantiateEmitCppCode(__int128_t);
 #endif // ENABLE_INT128
 
 #ifdef ENABLE_GMP
-InstantiateEmitCppCode(mpz_class);
+InstantiateEmitCppCode(HybridInteger);
 #endif // ENABLE_GMP
 
 namespace
@@ -142,8 +143,9 @@ constexpr std::string_view TypeName()
     }
 #endif // ENABLE_INT128
 #ifdef ENABLE_GMP
-    else if constexpr (std::is_same_v<TNumber, mpz_class>)
+    else if constexpr (std::is_same_v<TNumber, HybridInteger>)
     {
+        // The emitted code uses GMP directly
         return "mpz_class"sv;
     }
 #endif // ENABLE_GMP
@@ -621,7 +623,7 @@ void EmitCppCode(const std::shared_ptr<const Operator>& op, const CompilationCon
     ostream << "#include <cstdint>" << std::endl;
 
 #ifdef ENABLE_GMP
-    if constexpr (std::is_same_v<TNumber, mpz_class>)
+    if constexpr (std::is_same_v<TNumber, HybridInteger>)
     {
         ostream << "#include <gmpxx.h>" << std::endl;
     }
@@ -649,9 +651,14 @@ void EmitCppCode(const std::shared_ptr<const Operator>& op, const CompilationCon
     std::vector<OperatorInformation> infos;
     infos.emplace_back(OperatorDefinition(std::string(MainOperatorName), 0), op, true);
 
+    // Operators which the main function cannot call are not emitted
+    auto reachableOperators = CallGraph(context).GetReachableOperators(op);
     for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
     {
-        infos.emplace_back(it->second.GetDefinition(), it->second.GetOperator(), false);
+        if (reachableOperators.count(it->first) > 0)
+        {
+            infos.emplace_back(it->second.GetDefinition(), it->second.GetOperator(), false);
+        }
     }
 
     std::sort(infos.begin() + 1, infos.end(), [](auto& left, auto& right) {
@@ -11,10 +11,12 @@
 
 #include "Exceptions.h"
 #include "ExecutionState.h"
+#include "Memoization.h"
 #include "Operators.h"
+#include "Profiler.h"
 
 #ifdef ENABLE_GMP
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 namespace calc4
@@ -27,23 +29,32 @@ template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNum
 TNumber Evaluate(
     const CompilationContext& context,
     ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const std::shared_ptr<const Operator>& op)
+    const std::shared_ptr<const Operator>& op, Profiler* profiler = nullptr, bool memoize = false)
 {
     class Evaluator : public OperatorVisitor
     {
     private:
         const CompilationContext* context;
         ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>* state;
+        Profiler* profiler;
         std::stack<TNumber*> arguments;
 
+        // Tables of the pure operators, which are empty if memoization is disabled
+        std::unordered_map<std::string, MemoizationTable<TNumber>> memoizationTables;
+
     public:
         TNumber value;
 
         Evaluator(const CompilationContext* context,
                   ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
-                                 TPrinter>* state)
-            : context(context), state(state)
+                                 TPrinter>* state,
+                  Profiler* profiler, bool memoize)
+            : context(context), state(state), profiler(profiler)
         {
+            if (memoize)
+            {
+                memoizationTables = CreateMemoizationTables<TNumber>(*context);
+            }
         }
 
         virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
@@ -87,17 +98,7 @@ TNumber Evaluate(
         {
             op->GetCharacter()->Accept(*this);
 
-            char c;
-#ifdef ENABLE_GMP
-            if constexpr (std::is_same_v<TNumber, mpz_class>)
-            {
-                c = static_cast<char>(value.get_si());
-            }
-            else
-#endif // ENABLE_GMP
-            {
-                c = static_cast<char>(value);
-            }
+            char c = static_cast<char>(value);
 
             state->PrintChar(c);
             value = static_cast<TNumber>(0);
@@ -186,14 +187,14 @@ TNumber Evaluate(
             case BinaryType::Div:
                 if (right == 0)
                 {
-                    throw Exceptions::ZeroDivisionException(std::nullopt);
+                    throw Exceptions::ZeroDivisionException(op->GetPosition());
                 }
                 value = left / right;
                 break;
             case BinaryType::Mod:
                 if (right == 0)
                 {
-                    throw Exceptions::ZeroDivisionException(std::nullopt);
+                    throw Exceptions::ZeroDivisionException(op->GetPosition());
                 }
                 value = left % right;
                 break;
@@ -245,7 +246,7 @@ TNumber Evaluate(
             size_t size = op->GetDefinition().GetNumOperands();
             TNumber* arg =
 #ifdef ENABLE_GMP
-                std::is_same<TNumber, mpz_class>::value ? new TNumber[size] :
+                std::is_same<TNumber, HybridInteger>::value ? new TNumber[size] :
 #endif // ENABLE_GMP
                                                         STACK_ALLOC(TNumber, size);
 
@@ -256,14 +257,49 @@ TNumber Evaluate(
                 arg[i] = value;
             }
 
-            arguments.push(arg);
-            context->GetOperatorImplement(op->GetDefinition().GetName())
-                .GetOperator()
-                ->Accept(*this);
-            arguments.pop();
+            if (profiler != nullptr)
+            {
+                profiler->Enter(profiler->GetOperatorId(op->GetDefinition().GetName()));
+            }
+
+            // Pure operators return the memoized results without being evaluated
+            MemoizationTable<TNumber>* table = nullptr;
+            const TNumber* memoized = nullptr;
+            if (!memoizationTables.empty())
+            {
+                auto it = memoizationTables.find(op->GetDefinition().GetName());
+                if (it != memoizationTables.end())
+                {
+                    table = &it->second;
+                    memoized = table->Find(arg);
+                }
+            }
+
+            if (memoized != nullptr)
+            {
+                value = *memoized;
+            }
+            else
+            {
+                arguments.push(arg);
+                context->GetOperatorImplement(op->GetDefinition().GetName())
+                    .GetOperator()
+                    ->Accept(*this);
+                arguments.pop();
+
+                if (table != nullptr)
+                {
+                    table->Insert(arg, value);
+                }
+            }
+
+            if (profiler != nullptr)
+            {
+                profiler->Exit();
+            }
 
 #ifdef ENABLE_GMP
-            if (std::is_same<TNumber, mpz_class>::value)
+            if (std::is_same<TNumber, HybridInteger>::value)
             {
                 delete[] arg;
             }
@@ -271,7 +307,7 @@ TNumber Evaluate(
         }
     };
 
-    Evaluator evaluator(&context, &state);
+    Evaluator evaluator(&context, &state, profiler, memoize);
     op->Accept(evaluator);
     return evaluator.value;
 }
@@ -171,6 +171,24 @@ private:
     }
 };
 
+class InvalidBytecodeException : public Calc4Exception
+{
+public:
+    InvalidBytecodeException(const std::optional<CharPosition>& position,
+                             std::string_view message)
+        : Calc4Exception(position, CreateMessage(message))
+    {
+    }
+
+private:
+    static std::string CreateMessage(std::string_view message)
+    {
+        std::string text = "Invalid bytecode: ";
+        text += message;
+        return text;
+    }
+};
+
 class AssertionErrorException : public Calc4Exception
 {
 public:
@@ -10,13 +10,14 @@
 #pragma once
 
 #include "Common.h"
+#include <deque>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #ifdef ENABLE_GMP
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 namespace calc4
@@ -169,15 +170,18 @@ template<typename TNumber>
 class DefaultVariableSource
 {
 private:
-    std::unordered_map<std::string, TNumber> variables;
+    // Each variable is interned into a slot. The slots are never moved, so the executors access
+    // the variables through the addresses of their slots instead of looking up their names.
+    std::unordered_map<std::string, size_t> slotIndices;
+    std::deque<TNumber> slots;
 
 public:
     TNumber Get(const std::string& variableName) const
     {
-        auto it = variables.find(variableName);
-        if (it != variables.end())
+        auto it = slotIndices.find(variableName);
+        if (it != slotIndices.end())
         {
-            return it->second;
+            return slots[it->second];
         }
         else
         {
@@ -187,21 +191,34 @@ public:
 
     void Set(const std::string& variableName, const TNumber& value)
     {
-        variables[variableName] = value;
+        *GetSlot(variableName) = value;
     }
 
     const TNumber* TryGet(const std::string& variableName) const
     {
-        auto it = variables.find(variableName);
-        if (it != variables.end())
+        auto it = slotIndices.find(variableName);
+        if (it != slotIndices.end())
         {
-            return &*it;
+            return &slots[it->second];
         }
         else
         {
             return nullptr;
         }
     }
+
+    // Returns the slot of the given variable, which is created with zero if it does not exist.
+    // The address stays valid as long as this source does.
+    TNumber* GetSlot(const std::string& variableName)
+    {
+        auto [it, inserted] = slotIndices.try_emplace(variableName, slots.size());
+        if (inserted)
+        {
+            slots.emplace_back(static_cast<TNumber>(0));
+        }
+
+        return &slots[it->second];
+    }
 };
 
 template<typename TNumber>
@@ -269,6 +286,18 @@ public:
         }
     }
 
+    // The values at the indices in [0, GetDenseArraySize()) are stored contiguously from
+    // GetDenseArray(). The array is never reallocated, so the JIT compiler accesses it directly.
+    TNumber* GetDenseArray()
+    {
+        return array.data();
+    }
+
+    IndexType GetDenseArraySize() const
+    {
+        return static_cast<IndexType>(array.size());
+    }
+
 private:
     bool IsInArray(IndexType index) const
     {
@@ -279,14 +308,14 @@ private:
     static IndexType ToIndexType(const TNumber& value)
     {
 #ifdef ENABLE_GMP
-        if constexpr (std::is_same<TNumber, mpz_class>::value)
+        if constexpr (std::is_same<TNumber, HybridInteger>::value)
         {
-            if (!value.fits_slong_p())
+            if (!value.FitsInt64())
             {
                 throw std::overflow_error("Index is out of range.");
             }
 
-            return static_cast<IndexType>(value.get_si());
+            return static_cast<IndexType>(value.GetInt64());
         }
         else
 #endif // ENABLE_GMP
@@ -0,0 +1,149 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "GuardedStack.h"
+#include <new>
+
+#ifdef USE_GUARD_PAGE
+#include <mutex>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // USE_GUARD_PAGE
+
+namespace calc4
+{
+#ifdef USE_GUARD_PAGE
+namespace
+{
+thread_local GuardPageScope* currentScope = nullptr;
+
+struct sigaction previousSegvAction;
+struct sigaction previousBusAction;
+
+void HandleFault(int signal, siginfo_t* info, void* context)
+{
+    GuardPageScope* scope = GuardPageScope::GetCurrent();
+    if (scope != nullptr && scope->IsGuardAddress(info->si_addr))
+    {
+        scope->Jump();
+    }
+
+    // This fault is not caused by our stacks, so we pass it to the previous handler
+    struct sigaction& previous = signal == SIGBUS ? previousBusAction : previousSegvAction;
+    if (previous.sa_flags & SA_SIGINFO)
+    {
+        previous.sa_sigaction(signal, info, context);
+    }
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+    {
+        previous.sa_handler(signal);
+    }
+    else
+    {
+        // Returning from this handler raises the same fault again with the default action
+        sigaction(signal, &previous, nullptr);
+    }
+}
+
+void InstallFaultHandler()
+{
+    static std::once_flag flag;
+    std::call_once(flag, []() {
+        struct sigaction action = {};
+        action.sa_sigaction = HandleFault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+
+        sigaction(SIGSEGV, &action, &previousSegvAction);
+        sigaction(SIGBUS, &action, &previousBusAction);
+    });
+}
+}
+
+GuardedMemory::~GuardedMemory()
+{
+    if (address != nullptr)
+    {
+        munmap(address, size + guardSize);
+    }
+}
+
+void GuardedMemory::Allocate(size_t requiredSize)
+{
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t newSize = (requiredSize + pageSize - 1) / pageSize * pageSize;
+    if (newSize <= size)
+    {
+        return;
+    }
+
+#ifdef MAP_NORESERVE
+    constexpr int Flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#else
+    constexpr int Flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif // MAP_NORESERVE
+
+    void* newAddress = mmap(nullptr, newSize + pageSize, PROT_READ | PROT_WRITE, Flags, -1, 0);
+    if (newAddress == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+
+    if (mprotect(static_cast<char*>(newAddress) + newSize, pageSize, PROT_NONE) != 0)
+    {
+        munmap(newAddress, newSize + pageSize);
+        throw std::bad_alloc();
+    }
+
+    // The contents are not preserved, because stacks are allocated before executions
+    if (address != nullptr)
+    {
+        munmap(address, size + guardSize);
+    }
+
+    address = newAddress;
+    size = newSize;
+    guardSize = pageSize;
+}
+
+GuardPageScope::GuardPageScope(const GuardedMemory* memory1, const GuardedMemory* memory2,
+                               sigjmp_buf& buffer)
+    : memories{ memory1, memory2 }, buffer(&buffer), previous(currentScope)
+{
+    InstallFaultHandler();
+    currentScope = this;
+}
+
+GuardPageScope::~GuardPageScope()
+{
+    currentScope = previous;
+}
+
+GuardPageScope* GuardPageScope::GetCurrent()
+{
+    return currentScope;
+}
+
+GuardPageSuspension::GuardPageSuspension() : suspended(std::exchange(currentScope, nullptr)) {}
+
+GuardPageSuspension::~GuardPageSuspension()
+{
+    currentScope = suspended;
+}
+#else
+GuardedMemory::~GuardedMemory() {}
+
+void GuardedMemory::Allocate(size_t)
+{
+    // Guard pages are not supported on this platform
+    throw std::bad_alloc();
+}
+#endif // USE_GUARD_PAGE
+}
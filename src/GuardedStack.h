@@ -0,0 +1,214 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_GUARD_PAGE
+#include <setjmp.h>
+#endif // defined(__unix__) || defined(__APPLE__)
+
+namespace calc4
+{
+#ifdef USE_GUARD_PAGE
+inline constexpr bool IsGuardPageSupported = true;
+#else
+inline constexpr bool IsGuardPageSupported = false;
+#endif // USE_GUARD_PAGE
+
+// Memory region reserved in the virtual address space and followed by an inaccessible guard page.
+// Physical pages are committed by the OS when they are touched for the first time, so a large
+// region can be reserved without consuming memory.
+class GuardedMemory
+{
+private:
+    void* address = nullptr;
+    size_t size = 0;
+    size_t guardSize = 0;
+
+public:
+    GuardedMemory() = default;
+    GuardedMemory(const GuardedMemory&) = delete;
+    GuardedMemory(GuardedMemory&& other) noexcept
+        : address(std::exchange(other.address, nullptr)), size(std::exchange(other.size, 0)),
+          guardSize(std::exchange(other.guardSize, 0))
+    {
+    }
+    ~GuardedMemory();
+
+    GuardedMemory& operator=(const GuardedMemory&) = delete;
+    GuardedMemory& operator=(GuardedMemory&& other) noexcept
+    {
+        std::swap(address, other.address);
+        std::swap(size, other.size);
+        std::swap(guardSize, other.guardSize);
+        return *this;
+    }
+
+    // Reserves at least "requiredSize" bytes. The actual size is rounded up to the page size.
+    // Throws std::bad_alloc if the address space cannot be reserved.
+    void Allocate(size_t requiredSize);
+
+    void* GetAddress() const
+    {
+        return address;
+    }
+
+    size_t GetSize() const
+    {
+        return size;
+    }
+
+    bool IsGuardAddress(const void* faultAddress) const
+    {
+        auto begin = static_cast<const char*>(address) + size;
+        auto p = static_cast<const char*>(faultAddress);
+        return address != nullptr && begin <= p && p < begin + guardSize;
+    }
+};
+
+// Stack array whose overflow is detected by the guard page instead of explicit bounds checks.
+// The whole array is reserved at once on the first allocation.
+template<typename T>
+class GuardedStackArray
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Elements of GuardedStackArray are never constructed or destructed");
+
+private:
+    GuardedMemory memory;
+
+public:
+    void Allocate(size_t requiredSize)
+    {
+        memory.Allocate(requiredSize * sizeof(T));
+    }
+
+    T* begin()
+    {
+        return static_cast<T*>(memory.GetAddress());
+    }
+
+    size_t size() const
+    {
+        return memory.GetSize() / sizeof(T);
+    }
+
+    const GuardedMemory& GetMemory() const
+    {
+        return memory;
+    }
+};
+
+template<typename TArray>
+inline constexpr bool IsGuardedStackArray = false;
+
+template<typename T>
+inline constexpr bool IsGuardedStackArray<GuardedStackArray<T>> = true;
+
+// Grows the given stack array so that it has at least "requiredSize" elements. Returns false if
+// the required size exceeds "maxSize". A GuardedStackArray is reserved up to "maxSize" at once,
+// and the other arrays grow geometrically from "initialSize", so that deep recursions do not
+// reallocate them too many times.
+template<typename TArray>
+bool ReserveStackArray(TArray& array, size_t requiredSize, size_t maxSize, size_t initialSize)
+{
+    if (requiredSize <= array.size())
+    {
+        return true;
+    }
+
+    if (requiredSize > maxSize)
+    {
+        return false;
+    }
+
+    if constexpr (IsGuardedStackArray<TArray>)
+    {
+        // Only the address space is reserved here. Its pages are committed on demand.
+        array.Allocate(maxSize);
+    }
+    else
+    {
+        size_t newSize = std::max(array.size(), initialSize);
+        while (newSize < requiredSize)
+        {
+            newSize *= 2;
+        }
+
+        array.resize(std::min(newSize, maxSize));
+    }
+
+    return true;
+}
+
+// Guard pages are used where they are supported. Stacks of types requiring construction, such as
+// infinite-precision integers, are always checked explicitly.
+template<typename T>
+using DefaultStackArray =
+    std::conditional_t<IsGuardPageSupported && std::is_trivially_copyable_v<T>,
+                       GuardedStackArray<T>, std::vector<T>>;
+
+#ifdef USE_GUARD_PAGE
+// While this object is alive, a fault on the guard pages of the given memories makes the current
+// thread jump to the given buffer by siglongjmp. Null memories are ignored. The fault handler is
+// installed on the first use and passes other faults to the previously installed handler.
+class GuardPageScope
+{
+private:
+    const GuardedMemory* memories[2];
+    sigjmp_buf* buffer;
+    GuardPageScope* previous;
+
+public:
+    GuardPageScope(const GuardedMemory* memory1, const GuardedMemory* memory2,
+                   sigjmp_buf& buffer);
+    ~GuardPageScope();
+
+    GuardPageScope(const GuardPageScope&) = delete;
+    GuardPageScope& operator=(const GuardPageScope&) = delete;
+
+    // Returns the innermost scope of the current thread, or nullptr if there is no scope
+    static GuardPageScope* GetCurrent();
+
+    bool IsGuardAddress(const void* faultAddress) const
+    {
+        return (memories[0] != nullptr && memories[0]->IsGuardAddress(faultAddress)) ||
+            (memories[1] != nullptr && memories[1]->IsGuardAddress(faultAddress));
+    }
+
+    [[noreturn]] void Jump() const
+    {
+        siglongjmp(*buffer, 1);
+    }
+};
+
+// While this object is alive, faults on the guard pages are not handled by the scopes of the
+// current thread. Code whose frames may require destruction runs in this object, so that
+// siglongjmp never skips over its frames. A fault there is reported as an ordinary fault.
+class GuardPageSuspension
+{
+private:
+    GuardPageScope* suspended;
+
+public:
+    GuardPageSuspension();
+    ~GuardPageSuspension();
+
+    GuardPageSuspension(const GuardPageSuspension&) = delete;
+    GuardPageSuspension& operator=(const GuardPageSuspension&) = delete;
+};
+#endif // USE_GUARD_PAGE
+}
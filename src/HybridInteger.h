@@ -0,0 +1,281 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include <gmpxx.h>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+namespace calc4
+{
+// Infinite-precision integer which holds values fitting in 64 bits inline and promotes them to
+// "mpz_class" only when an operation overflows. Values are always normalized, that is, "big" is
+// allocated if and only if the value does not fit in "int64_t", so that arithmetic on small
+// values needs neither GMP calls nor heap allocations.
+class HybridInteger
+{
+private:
+    static_assert(sizeof(long) == sizeof(int64_t), "GMP must support 64-bit integers natively");
+
+    int64_t small = 0;
+    mpz_class* big = nullptr;
+
+public:
+    HybridInteger() = default;
+
+    template<typename T, std::enable_if_t<std::is_integral_v<T>, std::nullptr_t> = nullptr>
+    HybridInteger(T value)
+    {
+        static_assert(sizeof(T) <= sizeof(int64_t));
+
+        if constexpr (std::is_unsigned_v<T> && sizeof(T) == sizeof(int64_t))
+        {
+            if (value > static_cast<T>(std::numeric_limits<int64_t>::max()))
+            {
+                big = new mpz_class(static_cast<unsigned long>(value));
+                return;
+            }
+        }
+
+        small = static_cast<int64_t>(value);
+    }
+
+    HybridInteger(mpz_class value)
+    {
+        if (value.fits_slong_p())
+        {
+            small = value.get_si();
+        }
+        else
+        {
+            big = new mpz_class(std::move(value));
+        }
+    }
+
+    HybridInteger(const HybridInteger& other)
+        : small(other.small), big(other.big != nullptr ? new mpz_class(*other.big) : nullptr)
+    {
+    }
+
+    HybridInteger(HybridInteger&& other) noexcept
+        : small(other.small), big(std::exchange(other.big, nullptr))
+    {
+    }
+
+    ~HybridInteger()
+    {
+        delete big;
+    }
+
+    HybridInteger& operator=(const HybridInteger& other)
+    {
+        if (other.big == nullptr)
+        {
+            delete big;
+            big = nullptr;
+        }
+        else if (big == nullptr)
+        {
+            big = new mpz_class(*other.big);
+        }
+        else
+        {
+            *big = *other.big;
+        }
+
+        small = other.small;
+        return *this;
+    }
+
+    HybridInteger& operator=(HybridInteger&& other) noexcept
+    {
+        small = other.small;
+        std::swap(big, other.big);
+        return *this;
+    }
+
+    // Returns true if the value fits in "int64_t", in which case GetInt64() returns it
+    bool FitsInt64() const
+    {
+        return big == nullptr;
+    }
+
+    int64_t GetInt64() const
+    {
+        return small;
+    }
+
+    mpz_class GetMpz() const
+    {
+        return big != nullptr ? *big : mpz_class(static_cast<long>(small));
+    }
+
+    // Conversions to built-in integers truncate the value as "mpz_class::get_si" does
+    template<typename T, std::enable_if_t<std::is_integral_v<T>, std::nullptr_t> = nullptr>
+    explicit operator T() const
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return big != nullptr || small != 0;
+        }
+        else
+        {
+            return static_cast<T>(big != nullptr ? big->get_si() : small);
+        }
+    }
+
+    friend HybridInteger operator+(const HybridInteger& a, const HybridInteger& b)
+    {
+        int64_t result;
+        if (a.big == nullptr && b.big == nullptr &&
+            !__builtin_add_overflow(a.small, b.small, &result))
+        {
+            return result;
+        }
+
+        return HybridInteger(a.GetMpz() + b.GetMpz());
+    }
+
+    friend HybridInteger operator-(const HybridInteger& a, const HybridInteger& b)
+    {
+        int64_t result;
+        if (a.big == nullptr && b.big == nullptr &&
+            !__builtin_sub_overflow(a.small, b.small, &result))
+        {
+            return result;
+        }
+
+        return HybridInteger(a.GetMpz() - b.GetMpz());
+    }
+
+    friend HybridInteger operator*(const HybridInteger& a, const HybridInteger& b)
+    {
+        int64_t result;
+        if (a.big == nullptr && b.big == nullptr &&
+            !__builtin_mul_overflow(a.small, b.small, &result))
+        {
+            return result;
+        }
+
+        return HybridInteger(a.GetMpz() * b.GetMpz());
+    }
+
+    // Division and modulo truncate toward zero as both built-in integers and "mpz_class" do. The
+    // only overflowing case is "INT64_MIN / -1".
+    friend HybridInteger operator/(const HybridInteger& a, const HybridInteger& b)
+    {
+        if (a.big == nullptr && b.big == nullptr && b.small != -1)
+        {
+            return a.small / b.small;
+        }
+
+        return HybridInteger(a.GetMpz() / b.GetMpz());
+    }
+
+    friend HybridInteger operator%(const HybridInteger& a, const HybridInteger& b)
+    {
+        if (a.big == nullptr && b.big == nullptr)
+        {
+            return b.small != -1 ? a.small % b.small : 0;
+        }
+
+        return HybridInteger(a.GetMpz() % b.GetMpz());
+    }
+
+    HybridInteger operator-() const
+    {
+        if (big == nullptr && small != std::numeric_limits<int64_t>::min())
+        {
+            return -small;
+        }
+
+        return HybridInteger(-GetMpz());
+    }
+
+    HybridInteger& operator+=(const HybridInteger& other)
+    {
+        return *this = *this + other;
+    }
+
+    HybridInteger& operator-=(const HybridInteger& other)
+    {
+        return *this = *this - other;
+    }
+
+    HybridInteger& operator*=(const HybridInteger& other)
+    {
+        return *this = *this * other;
+    }
+
+    HybridInteger& operator/=(const HybridInteger& other)
+    {
+        return *this = *this / other;
+    }
+
+    HybridInteger& operator%=(const HybridInteger& other)
+    {
+        return *this = *this % other;
+    }
+
+    // Normalized values are equal only if both of them are small or both of them are big
+    friend bool operator==(const HybridInteger& a, const HybridInteger& b)
+    {
+        if (a.big == nullptr || b.big == nullptr)
+        {
+            return a.big == b.big && a.small == b.small;
+        }
+
+        return *a.big == *b.big;
+    }
+
+    friend bool operator!=(const HybridInteger& a, const HybridInteger& b)
+    {
+        return !(a == b);
+    }
+
+    friend bool operator<(const HybridInteger& a, const HybridInteger& b)
+    {
+        if (a.big == nullptr && b.big == nullptr)
+        {
+            return a.small < b.small;
+        }
+
+        return a.GetMpz() < b.GetMpz();
+    }
+
+    friend bool operator<=(const HybridInteger& a, const HybridInteger& b)
+    {
+        return !(b < a);
+    }
+
+    friend bool operator>(const HybridInteger& a, const HybridInteger& b)
+    {
+        return b < a;
+    }
+
+    friend bool operator>=(const HybridInteger& a, const HybridInteger& b)
+    {
+        return !(a < b);
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const HybridInteger& value)
+    {
+        if (value.big != nullptr)
+        {
+            return out << *value.big;
+        }
+
+        return out << value.small;
+    }
+};
+}
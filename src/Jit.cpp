@@ -12,17 +12,29 @@
 #endif // !ENABLE_JIT
 
 #include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <set>
 #include <sstream>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
-#include "llvm/ExecutionEngine/GenericValue.h"
-#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
@@ -36,15 +48,27 @@
 #include "llvm/IR/Type.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO.h"
 
+#include "CallGraph.h"
 #include "Exceptions.h"
 #include "Jit.h"
+#include "Memoization.h"
 #include "Operators.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif // defined(__unix__) || defined(__APPLE__)
+
 namespace calc4
 {
 /* Explicit instantiation of "EvaluateByJIT" Function */
@@ -54,7 +78,9 @@ namespace calc4
         const CompilationContext& context,                                                         \
         ExecutionState<TNumber, DefaultVariableSource<TNumber>, DefaultGlobalArraySource<TNumber>, \
                        TInputSource, TPrinter>& state,                                             \
-        const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option)
+        const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option,      \
+        JITSession<TNumber, DefaultVariableSource<TNumber>, DefaultGlobalArraySource<TNumber>,     \
+                   TInputSource, TPrinter>* session)
 
 InstantiateEvaluateByJIT(int32_t, DefaultInputSource, DefaultPrinter);
 InstantiateEvaluateByJIT(int64_t, DefaultInputSource, DefaultPrinter);
@@ -68,218 +94,1449 @@ InstantiateEvaluateByJIT(__int128_t, BufferedInputSource, BufferedPrinter);
 InstantiateEvaluateByJIT(__int128_t, StreamInputSource, StreamPrinter);
 #endif // ENABLE_INT128
 
+/* Explicit instantiation of "JITSession" Class */
+#define InstantiateJITSession(TNumber, TInputSource, TPrinter)                                     \
+    template class JITSession<TNumber, DefaultVariableSource<TNumber>,                             \
+                              DefaultGlobalArraySource<TNumber>, TInputSource, TPrinter>
+
+InstantiateJITSession(int32_t, DefaultInputSource, DefaultPrinter);
+InstantiateJITSession(int64_t, DefaultInputSource, DefaultPrinter);
+InstantiateJITSession(int32_t, BufferedInputSource, BufferedPrinter);
+InstantiateJITSession(int64_t, BufferedInputSource, BufferedPrinter);
+InstantiateJITSession(int32_t, StreamInputSource, StreamPrinter);
+InstantiateJITSession(int64_t, StreamInputSource, StreamPrinter);
+#ifdef ENABLE_INT128
+InstantiateJITSession(__int128_t, DefaultInputSource, DefaultPrinter);
+InstantiateJITSession(__int128_t, BufferedInputSource, BufferedPrinter);
+InstantiateJITSession(__int128_t, StreamInputSource, StreamPrinter);
+#endif // ENABLE_INT128
+
+/* Explicit instantiation of "JITTieredCompiler" Class */
+#define InstantiateJITTieredCompiler(TNumber, TInputSource, TPrinter)                              \
+    template class JITTieredCompiler<TNumber, DefaultVariableSource<TNumber>,                      \
+                                     DefaultGlobalArraySource<TNumber>, TInputSource, TPrinter>
+
+InstantiateJITTieredCompiler(int32_t, DefaultInputSource, DefaultPrinter);
+InstantiateJITTieredCompiler(int64_t, DefaultInputSource, DefaultPrinter);
+InstantiateJITTieredCompiler(int32_t, BufferedInputSource, BufferedPrinter);
+InstantiateJITTieredCompiler(int64_t, BufferedInputSource, BufferedPrinter);
+InstantiateJITTieredCompiler(int32_t, StreamInputSource, StreamPrinter);
+InstantiateJITTieredCompiler(int64_t, StreamInputSource, StreamPrinter);
+#ifdef ENABLE_INT128
+InstantiateJITTieredCompiler(__int128_t, DefaultInputSource, DefaultPrinter);
+InstantiateJITTieredCompiler(__int128_t, BufferedInputSource, BufferedPrinter);
+InstantiateJITTieredCompiler(__int128_t, StreamInputSource, StreamPrinter);
+#endif // ENABLE_INT128
+
 namespace
 {
 constexpr const char* MainFunctionName = "__[Main]__";
 constexpr const char* EntryBlockName = "entry";
 constexpr const char* GlobalVariableNamePrefix = "variable_";
 
+// Suffix of the functions called from the stack machine, which take the operands as an array
+constexpr const char* EntryFunctionSuffix = "$entry";
+
+// Separator between the name of an operator and its version in the symbols of "JITSession"
+constexpr const char* VersionSeparator = "$";
+
+// Prefix of the symbols of the functions which the compiled code calls back
+constexpr const char* InternalFunctionNamePrefix = "calc4.";
+
+// Symbol of "nativeStackLimit", which the operators compiled with "checkStackOverflow" load
+constexpr const char* NativeStackLimitVariableName = "calc4.native_stack_limit";
+
+// Bytes of the native stack left to the functions called from the compiled code, such as the ones
+// throwing exceptions, when the compiled code reaches the limit. This is also much larger than
+// the frames of the compiled code, so that none of them skips the guard page of the stack.
+constexpr uintptr_t NativeStackMargin = 256 * 1024;
+
+// Size of the native stack assumed on the platforms whose stacks cannot be queried
+constexpr uintptr_t DefaultNativeStackSize = 1024 * 1024;
+
+// Lowest address of the native stack which the compiled code may use. "SetNativeStackLimit" sets
+// it for the thread executing the code.
+uintptr_t nativeStackLimit = 0;
+
+// Prefix of the global variables holding the addresses of the memoization tables
+constexpr const char* MemoizationTableNamePrefix = "memoization_table_";
+
+// Global variables holding the dense region of the global array, which "PublishArrayRegion" sets
+constexpr const char* ArrayDataVariableName = "array_data";
+constexpr const char* ArraySizeVariableName = "array_size";
+
+// Module flag marking the modules optimized before they are added to the JIT
+constexpr const char* OptimizedModuleFlagName = "calc4.optimized";
+
+// Names of the objects in the cache. Changing how the code is generated requires incrementing the
+// version, so that the objects generated by the older versions are not used.
+constexpr const char* CacheKeyPrefix = "calc4-jit-cache-";
+constexpr int CacheFormatVersion = 5;
+
 template<typename TNumber>
 size_t IntegerBits = sizeof(TNumber) * 8;
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-void GenerateIR(
-    const CompilationContext& context, const JITCodeGenerationOption& option,
-    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const std::shared_ptr<const Operator>& op, llvm::LLVMContext* llvmContext,
-    llvm::Module* llvmModule);
+// The generated code accesses the dense region of "DefaultGlobalArraySource" directly
+template<typename TNumber, typename TGlobalArraySource>
+constexpr bool HasDenseArray =
+    std::is_same_v<TGlobalArraySource, DefaultGlobalArraySource<TNumber>>;
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+llvm::orc::ThreadSafeModule GenerateMainModule(
+    const CompilationContext& context, const JITCodeGenerationOption& option,
+    const std::shared_ptr<const Operator>& op,
+    const std::unordered_map<std::string, std::string>& symbolNames);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+llvm::orc::ThreadSafeModule GenerateOperatorModule(
+    const CompilationContext& context, const JITCodeGenerationOption& option,
+    const std::string& name, const std::unordered_map<std::string, std::string>& symbolNames,
+    bool generateEntryFunction);
+
+template<typename TNumber>
+llvm::orc::ThreadSafeModule GenerateVariableModule(
+    const std::set<std::string_view>& variableNames,
+    const std::unordered_map<std::string, void*>& memoizationTables);
+
+// Writes the operators which the given callees are linked to
+void DescribeCallees(const std::vector<std::string>& callees,
+                     const std::unordered_map<std::string, std::string>& symbolNames,
+                     std::ostream& out);
+
+// Writes the given operator and its operands, which determine the code generated from them
+void DescribeTree(const std::shared_ptr<const Operator>& op, std::ostream& out);
+
+void OptimizeModule(llvm::Module* llvmModule);
+
+void MarkModuleOptimized(llvm::Module* llvmModule);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void DefineInternalSymbols(llvm::orc::LLJIT& jit);
+
+template<typename TNumber>
+void PublishArrayRegion(llvm::IRBuilder<>& builder, llvm::Module* llvmModule, llvm::Value* state);
+
+// Stores the objects compiled from the modules named by "CreateCacheKey" in a directory, so that
+// they can be loaded instead of being compiled again by later processes
+class JITObjectCache : public llvm::ObjectCache
+{
+private:
+    std::string directory;
+
+    std::string GetPath(llvm::StringRef key) const;
+
+public:
+    explicit JITObjectCache(const std::string& directory);
+
+    // Returns the object stored with the given key, or nullptr if there is no such object
+    std::unique_ptr<llvm::MemoryBuffer> Load(llvm::StringRef key) const;
+
+    virtual void notifyObjectCompiled(const llvm::Module* M, llvm::MemoryBufferRef Obj) override;
+    virtual std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* M) override;
+};
+
+template<typename TJIT, typename TJITBuilder>
+std::unique_ptr<TJIT> CreateJIT(bool optimize, llvm::ObjectCache* objectCache = nullptr);
+
+void ThrowIfFailed(llvm::Error error);
+
+template<typename T>
+T ThrowIfFailed(llvm::Expected<T> value);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+class IRGenerator;
+
+void SetNativeStackLimit();
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void ThrowZeroDivisionException(void* state);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void ThrowStackOverflowException(void* state);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+int GetChar(void* state);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void PrintChar(void* state, char c);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+TNumber LoadArray(void* state, TNumber index);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void StoreArray(void* state, TNumber index, TNumber value);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void GetArrayRegion(void* state, TNumber** data, int64_t* size);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+const TNumber* FindMemoizedValue(void* table, const TNumber* operands);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void InsertMemoizedValue(void* table, const TNumber* operands, TNumber value);
+
+void ProfileEnter(Profiler* profiler, int32_t operatorId);
+
+void ProfileExit(Profiler* profiler);
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+TNumber EvaluateByJIT(
+    const CompilationContext& context,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option,
+    JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>* session)
+{
+    if (session == nullptr)
+    {
+        JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>
+            temporarySession;
+        return temporarySession.Evaluate(context, state, op, option);
+    }
+
+    return session->Evaluate(context, state, op, option);
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+struct JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>::Impl
+{
+    struct CompiledOperator
+    {
+        std::shared_ptr<const Operator> op;
+        std::string symbolName;
+
+        // The symbols of the callees which the code of this operator is linked to
+        std::unordered_map<std::string, std::string> calleeSymbolNames;
+    };
+
+    // The compiled code memoizes the results of the operators in these tables, so they must be
+    // destroyed after the JIT. The tables are keyed on the symbols of the operators.
+    std::unordered_map<std::string, MemoizationTable<TNumber>> memoizationTables;
+
+    // The compiler of the JIT refers to this cache, so it must also be destroyed after the JIT
+    std::unique_ptr<JITObjectCache> objectCache;
+
+    std::unique_ptr<llvm::orc::LLLazyJIT> jit;
+    JITCodeGenerationOption option;
+    std::unordered_map<std::string, CompiledOperator> compiledOperators;
+
+    // The symbols of the old code stay defined, so each version of an operator is given a symbol
+    // of its own
+    std::unordered_map<std::string, size_t> numVersions;
+
+    // The global variables of the JIT holding the addresses of the slots of the variables
+    std::unordered_map<std::string, TNumber**> variableSlots;
+
+    size_t numGeneratedOperators = 0;
+
+    explicit Impl(const JITCodeGenerationOption& option) : option(option)
+    {
+        using namespace llvm;
+
+        // The code reporting to a profiler refers to the profiler by its address
+        if (!option.cacheDirectory.empty() && option.profiler == nullptr)
+        {
+            objectCache = std::make_unique<JITObjectCache>(option.cacheDirectory);
+        }
+
+        jit = CreateJIT<orc::LLLazyJIT, orc::LLLazyJITBuilder>(option.optimize,
+                                                              objectCache.get());
+        DefineInternalSymbols<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                              TPrinter>(*jit);
+
+        // Each module holds a single operator, so there is no need to split the modules further
+        jit->setPartitionFunction(orc::CompileOnDemandLayer::compileWholeModule);
+    }
+
+    // The code reporting to a profiler is never reused, since each execution is given a profiler
+    // of its own, which may even be placed at the same address as the previous one
+    bool IsCompatible(const JITCodeGenerationOption& newOption) const
+    {
+        return option.optimize == newOption.optimize &&
+            option.checkZeroDivision == newOption.checkZeroDivision &&
+            option.memoize == newOption.memoize &&
+            option.checkStackOverflow == newOption.checkStackOverflow &&
+            option.cacheDirectory == newOption.cacheDirectory && option.profiler == nullptr &&
+            newOption.profiler == nullptr;
+    }
+
+    // Returns the key of the code described by the given text. The key also depends on everything
+    // else which affects the code, such as the target and the options.
+    std::string CreateCacheKey(const std::string& description) const
+    {
+        std::ostringstream key;
+        key << CacheFormatVersion << "\n"
+            << "LLVM " << LLVM_VERSION_STRING << " " << LLVM_HOST_TRIPLE << " "
+            << llvm::sys::getHostCPUName().str() << "\n"
+            << "Integer " << IntegerBits<TNumber> << "\n"
+            << "Optimize " << option.optimize << " CheckZeroDivision "
+            << option.checkZeroDivision << " CheckStackOverflow " << option.checkStackOverflow
+            << "\n"
+            << description;
+
+        llvm::SHA1 hash;
+        hash.update(key.str());
+        return CacheKeyPrefix + llvm::toHex(hash.final(), true);
+    }
+
+    std::string CreateSymbolName(const std::string& name)
+    {
+        size_t version = numVersions[name]++;
+        return version == 0 ? name : name + VersionSeparator + std::to_string(version);
+    }
+
+    // Returns the operators to be compiled among the given ones. An operator is compiled again if
+    // its body has changed or its code is linked to an old version of its callees. The callers of
+    // such operators are also compiled again in turn.
+    std::unordered_set<std::string> FindStaleOperators(
+        const CompilationContext& context, const std::unordered_set<std::string>& names) const
+    {
+        std::unordered_set<std::string> staleOperators;
+        for (auto& name : names)
+        {
+            auto it = compiledOperators.find(name);
+            if (it == compiledOperators.end() ||
+                it->second.op != context.GetOperatorImplement(name).GetOperator())
+            {
+                staleOperators.insert(name);
+                continue;
+            }
+
+            for (auto& [callee, symbolName] : it->second.calleeSymbolNames)
+            {
+                auto calleeIt = compiledOperators.find(callee);
+                if (calleeIt == compiledOperators.end() ||
+                    calleeIt->second.symbolName != symbolName)
+                {
+                    staleOperators.insert(name);
+                    break;
+                }
+            }
+        }
+
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for (auto& name : names)
+            {
+                if (staleOperators.count(name) != 0)
+                {
+                    continue;
+                }
+
+                for (auto& callee : context.GetOperatorImplement(name).GetCallSummary().callees)
+                {
+                    if (staleOperators.count(callee) != 0)
+                    {
+                        staleOperators.insert(name);
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        return staleOperators;
+    }
+
+    // Gives new symbols to the stale operators, while the others keep the symbols of their code
+    std::unordered_map<std::string, std::string> CreateSymbolNames(
+        const std::unordered_set<std::string>& names,
+        const std::unordered_set<std::string>& staleOperators)
+    {
+        std::unordered_map<std::string, std::string> symbolNames;
+        for (auto& name : names)
+        {
+            symbolNames[name] = staleOperators.count(name) != 0
+                ? CreateSymbolName(name)
+                : compiledOperators.at(name).symbolName;
+        }
+
+        return symbolNames;
+    }
+
+    // Creates the tables of the stale pure operators, and returns their addresses keyed on the
+    // names of the operators. The same addresses keyed on the symbols are stored into
+    // "newTables".
+    std::unordered_map<std::string, void*> PrepareMemoizationTables(
+        const CompilationContext& context, const std::unordered_set<std::string>& staleOperators,
+        const std::unordered_map<std::string, std::string>& symbolNames,
+        std::unordered_map<std::string, void*>& newTables)
+    {
+        std::unordered_map<std::string, void*> tableAddresses;
+        if (!option.memoize)
+        {
+            return tableAddresses;
+        }
+
+        CallGraph callGraph(context);
+        for (auto& name : staleOperators)
+        {
+            if (callGraph.IsPure(name))
+            {
+                int numOperands =
+                    context.GetOperatorImplement(name).GetDefinition().GetNumOperands();
+                auto& symbolName = symbolNames.at(name);
+                auto result = memoizationTables.emplace(symbolName,
+                                                        MemoizationTable<TNumber>(numOperands));
+                tableAddresses[name] = &result.first->second;
+                newTables[symbolName] = &result.first->second;
+            }
+        }
+
+        return tableAddresses;
+    }
+
+    // Returns the variables whose global variables have not been defined yet
+    std::set<std::string_view> FindNewVariables(
+        const std::set<std::string_view>& variableNames) const
+    {
+        std::set<std::string_view> newVariableNames;
+        for (auto& variableName : variableNames)
+        {
+            if (variableSlots.count(std::string(variableName)) == 0)
+            {
+                newVariableNames.insert(variableName);
+            }
+        }
+
+        return newVariableNames;
+    }
+
+    // Looks up the global variables defined by the module of the given variables
+    void AddVariableSlots(const std::set<std::string_view>& variableNames)
+    {
+        for (auto& variableName : variableNames)
+        {
+            auto symbol =
+                ThrowIfFailed(jit->lookup(GlobalVariableNamePrefix + std::string(variableName)));
+            variableSlots.emplace(variableName, reinterpret_cast<TNumber**>(symbol.getAddress()));
+        }
+    }
+
+    void AddCompiledOperators(const CompilationContext& context,
+                              const std::unordered_set<std::string>& staleOperators,
+                              const std::unordered_map<std::string, std::string>& symbolNames)
+    {
+        for (auto& name : staleOperators)
+        {
+            auto& compiled = compiledOperators[name];
+            compiled.op = context.GetOperatorImplement(name).GetOperator();
+            compiled.symbolName = symbolNames.at(name);
+            compiled.calleeSymbolNames.clear();
+            for (auto& callee : context.GetOperatorImplement(name).GetCallSummary().callees)
+            {
+                compiled.calleeSymbolNames[callee] = symbolNames.at(callee);
+            }
+        }
+    }
+};
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+TNumber JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>::Evaluate(
+    const CompilationContext& context,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option)
+{
+    using namespace llvm;
+
+    if (impl == nullptr || !impl->IsCompatible(option))
+    {
+        impl.reset();
+        impl = std::make_shared<Impl>(option);
+    }
+
+    if (option.checkStackOverflow)
+    {
+        SetNativeStackLimit();
+    }
+
+    /* ***** Find the operators to be compiled ***** */
+    auto reachableOperators = CallGraph(context).GetReachableOperators(op);
+    auto staleOperators = impl->FindStaleOperators(context, reachableOperators);
+    auto symbolNames = impl->CreateSymbolNames(reachableOperators, staleOperators);
+
+    /* ***** Prepare memoization tables ***** */
+    std::unordered_map<std::string, void*> newMemoizationTables;
+    auto memoizationTableAddresses =
+        impl->PrepareMemoizationTables(context, staleOperators, symbolNames, newMemoizationTables);
+
+    JITCodeGenerationOption compilationOption = option;
+    compilationOption.memoizationTables = &memoizationTableAddresses;
+
+    /* ***** Generate LLVM-IR ***** */
+    // Each operator is generated in a module of its own, which is compiled when the operator is
+    // called for the first time. Operators which the main program cannot call are not generated.
+    // If the object cache has the code of a module, the code is loaded instead of the module. The
+    // IR is always generated when it is printed.
+    auto* objectCache = option.dumpProgram ? nullptr : impl->objectCache.get();
+
+    std::vector<orc::ThreadSafeModule> operatorModules;
+    std::vector<std::unique_ptr<MemoryBuffer>> cachedObjects;
+    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    {
+        auto& name = it->first;
+        if (staleOperators.count(name) == 0)
+        {
+            continue;
+        }
+
+        std::string cacheKey;
+        if (impl->objectCache != nullptr)
+        {
+            auto& implement = context.GetOperatorImplement(name);
+            std::ostringstream description;
+            description << "Operator " << symbolNames[name] << " "
+                        << implement.GetDefinition().GetNumOperands() << " "
+                        << (memoizationTableAddresses.count(name) != 0 ? "Memoized" : "") << "\n";
+            DescribeCallees(implement.GetCallSummary().callees, symbolNames, description);
+            DescribeTree(it->second.GetOperator(), description);
+            cacheKey = impl->CreateCacheKey(description.str());
+        }
+
+        if (auto object = objectCache != nullptr ? objectCache->Load(cacheKey) : nullptr)
+        {
+            cachedObjects.push_back(std::move(object));
+            continue;
+        }
+
+        operatorModules.push_back(
+            GenerateOperatorModule<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                                   TPrinter>(context, compilationOption, name, symbolNames,
+                                             false));
+        if (!cacheKey.empty())
+        {
+            operatorModules.back().withModuleDo(
+                [&cacheKey](Module& M) { M.setModuleIdentifier(cacheKey); });
+        }
+    }
+
+    std::string mainCacheKey;
+    if (impl->objectCache != nullptr)
+    {
+        std::ostringstream description;
+        description << "Main\n";
+        DescribeCallees(SummarizeCalls(op)->callees, symbolNames, description);
+        DescribeTree(op, description);
+        mainCacheKey = impl->CreateCacheKey(description.str());
+    }
+
+    auto mainObject = objectCache != nullptr ? objectCache->Load(mainCacheKey) : nullptr;
+    std::optional<orc::ThreadSafeModule> mainModule;
+    if (mainObject == nullptr)
+    {
+        mainModule = GenerateMainModule<TNumber, TVariableSource, TGlobalArraySource,
+                                        TInputSource, TPrinter>(context, compilationOption, op,
+                                                                symbolNames);
+        if (!mainCacheKey.empty())
+        {
+            mainModule->withModuleDo(
+                [&mainCacheKey](Module& M) { M.setModuleIdentifier(mainCacheKey); });
+        }
+    }
+
+    // Only the variables which this execution can access are bound to their slots
+    std::set<std::string_view> variableNames;
+    GatherVariableNamesCore(op, variableNames);
+    for (auto& name : reachableOperators)
+    {
+        GatherVariableNamesCore(context.GetOperatorImplement(name).GetOperator(), variableNames);
+    }
+
+    auto newVariableNames = impl->FindNewVariables(variableNames);
+    auto variableModule = GenerateVariableModule<TNumber>(newVariableNames, newMemoizationTables);
+
+    /* ***** Optimize ***** */
+    // The modules are optimized right before they are compiled unless the optimized IR is printed
+    if (option.dumpProgram)
+    {
+        // PrintIR
+        outs() << "/*\n * LLVM IR\n */\n===============\n";
+        auto Dump = [&option](orc::ThreadSafeModule& module) {
+            module.withModuleDo([&option](Module& M) {
+                if (option.optimize)
+                {
+                    OptimizeModule(&M);
+                }
+
+                outs() << M;
+
+                // The JIT must not optimize the module again
+                if (option.optimize)
+                {
+                    MarkModuleOptimized(&M);
+                }
+            });
+        };
+
+        Dump(*mainModule);
+        Dump(variableModule);
+        for (auto& module : operatorModules)
+        {
+            Dump(module);
+        }
+
+        outs() << "===============\n\n";
+        outs().flush();
+    }
+
+    /* ***** Execute JIT compiled code ***** */
+    // The main program is removed after the execution, while the others stay resident
+    auto& jit = *impl->jit;
+    auto mainTracker = jit.getMainJITDylib().createResourceTracker();
+    if (mainModule)
+    {
+        ThrowIfFailed(jit.addIRModule(mainTracker, std::move(*mainModule)));
+    }
+    else
+    {
+        ThrowIfFailed(jit.addObjectFile(mainTracker, std::move(mainObject)));
+    }
+
+    ThrowIfFailed(jit.addIRModule(std::move(variableModule)));
+    for (auto& module : operatorModules)
+    {
+        ThrowIfFailed(jit.addLazyIRModule(std::move(module)));
+    }
+
+    for (auto& object : cachedObjects)
+    {
+        ThrowIfFailed(jit.addObjectFile(std::move(object)));
+    }
+
+    impl->AddVariableSlots(newVariableNames);
+    impl->AddCompiledOperators(context, staleOperators, symbolNames);
+    impl->numGeneratedOperators += operatorModules.size();
+
+    auto func = (TNumber (*)(
+        ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>*))
+                    ThrowIfFailed(jit.lookup(MainFunctionName)).getAddress();
+
+    // The slots are bound for each execution, since each execution may be given another state
+    for (auto& variableName : variableNames)
+    {
+        std::string name(variableName);
+        *impl->variableSlots.at(name) = state.GetVariableSource().GetSlot(name);
+    }
+
+    TNumber result;
+    try
+    {
+        result = func(&state);
+    }
+    catch (...)
+    {
+        ThrowIfFailed(mainTracker->remove());
+        throw;
+    }
+
+    ThrowIfFailed(mainTracker->remove());
+    return result;
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+size_t JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                  TPrinter>::GetNumGeneratedOperators() const
+{
+    return impl == nullptr ? 0 : impl->numGeneratedOperators;
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                  TPrinter>::JITTieredCompiler(const CompilationContext& context,
+                                               const JITCodeGenerationOption& option,
+                                               uint32_t threshold, bool synchronous)
+    : StackMachineTieredCompiler<TNumber>(threshold), context(nullptr), synchronous(synchronous)
+{
+    Configure(context, option);
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                  TPrinter>::~JITTieredCompiler()
+{
+    Wait();
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::Configure(const CompilationContext& context,
+                                            const JITCodeGenerationOption& option)
+{
+    Wait();
+    this->context = &context;
+    this->option = option;
+
+    // The stack machine reports the calls of operators by itself, and the IR must not be printed
+    // in the middle of the execution. The entry functions are never stored in the object cache.
+    this->option.profiler = nullptr;
+    this->option.dumpProgram = false;
+    this->option.cacheDirectory.clear();
+
+    // Unlike the stack machine, the native code runs on the stack of the thread
+    this->option.checkStackOverflow = true;
+
+    if (session.impl != nullptr && !session.impl->IsCompatible(this->option))
+    {
+        session.impl.reset();
+        counts.clear();
+    }
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::Prepare(const StackMachineModule<TNumber>& module,
+                                          TNumber* const* variables, uint32_t* counters,
+                                          std::atomic<StackMachineNativeFunction<TNumber>>*
+                                              nativeFunctions)
+{
+    SetNativeStackLimit();
+
+    auto& userDefinedOperators = module.GetUserDefinedOperators();
+    std::unordered_set<std::string> names;
+    for (auto& userDefined : userDefinedOperators)
+    {
+        names.insert(userDefined.GetDefinition().GetName());
+    }
+
+    std::unordered_set<std::string> staleOperators = names;
+    if (session.impl != nullptr)
+    {
+        auto& impl = *session.impl;
+        staleOperators = impl.FindStaleOperators(*context, names);
+
+        // The slots are bound for each execution, since each execution may be given another
+        // state. They must be bound before the code is called.
+        auto& variableNames = module.GetVariables();
+        for (size_t i = 0; i < variableNames.size(); i++)
+        {
+            auto it = impl.variableSlots.find(variableNames[i]);
+            if (it != impl.variableSlots.end())
+            {
+                *it->second = variables[i];
+            }
+        }
+
+        for (size_t i = 0; i < userDefinedOperators.size(); i++)
+        {
+            auto& name = userDefinedOperators[i].GetDefinition().GetName();
+            if (staleOperators.count(name) != 0)
+            {
+                continue;
+            }
+
+            auto symbol = impl.jit->lookup(impl.compiledOperators.at(name).symbolName +
+                                           EntryFunctionSuffix);
+            if (!symbol)
+            {
+                // The stack machine interprets the operator when its code cannot be found
+                llvm::consumeError(symbol.takeError());
+                staleOperators.insert(name);
+                continue;
+            }
+
+            nativeFunctions[module.GetStartAddresses()[i]].store(
+                reinterpret_cast<StackMachineNativeFunction<TNumber>>(symbol->getAddress()),
+                std::memory_order_release);
+        }
+    }
+
+    // An operator which is still hot but has no code reaches the threshold on its next call
+    for (size_t i = 0; i < userDefinedOperators.size(); i++)
+    {
+        auto& name = userDefinedOperators[i].GetDefinition().GetName();
+        auto it = counts.find(name);
+        if (staleOperators.count(name) != 0 && it != counts.end() &&
+            it->second.op == context->GetOperatorImplement(name).GetOperator())
+        {
+            counters[module.GetStartAddresses()[i]] =
+                std::min(it->second.count, std::max(this->GetThreshold(), 1u) - 1);
+        }
+    }
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::Start(const StackMachineModule<TNumber>& module,
+                                        TNumber* const* variables,
+                                        std::atomic<StackMachineNativeFunction<TNumber>>*
+                                            nativeFunctions)
+{
+    Wait();
+    isCompiled = false;
+
+    if (synchronous)
+    {
+        Compile(module, variables, nativeFunctions);
+    }
+    else
+    {
+        thread = std::thread([this, &module, variables, nativeFunctions]() {
+            Compile(module, variables, nativeFunctions);
+        });
+    }
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::Wait()
+{
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::Finish(const StackMachineModule<TNumber>& module,
+                                         const uint32_t* counters)
+{
+    auto& userDefinedOperators = module.GetUserDefinedOperators();
+    for (size_t i = 0; i < userDefinedOperators.size(); i++)
+    {
+        auto& name = userDefinedOperators[i].GetDefinition().GetName();
+        counts[name] = { context->GetOperatorImplement(name).GetOperator(),
+                         counters[module.GetStartAddresses()[i]] };
+    }
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+bool JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::IsCompiled() const
+{
+    return isCompiled;
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+size_t JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                         TPrinter>::GetNumGeneratedOperators() const
+{
+    return session.GetNumGeneratedOperators();
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                       TPrinter>::Compile(const StackMachineModule<TNumber>& module,
+                                          TNumber* const* variables,
+                                          std::atomic<StackMachineNativeFunction<TNumber>>*
+                                              nativeFunctions)
+{
+    using namespace llvm;
+
+    try
+    {
+        if (session.impl == nullptr)
+        {
+            session.impl = std::make_shared<typename decltype(session)::Impl>(option);
+        }
+
+        auto& impl = *session.impl;
+        auto& jit = *impl.jit;
+
+        /* ***** Find the operators to be compiled ***** */
+        std::unordered_set<std::string> names;
+        for (auto& userDefined : module.GetUserDefinedOperators())
+        {
+            names.insert(userDefined.GetDefinition().GetName());
+        }
+
+        auto staleOperators = impl.FindStaleOperators(*context, names);
+        auto symbolNames = impl.CreateSymbolNames(names, staleOperators);
+
+        std::unordered_map<std::string, void*> newMemoizationTables;
+        auto memoizationTableAddresses = impl.PrepareMemoizationTables(
+            *context, staleOperators, symbolNames, newMemoizationTables);
+
+        JITCodeGenerationOption compilationOption = option;
+        compilationOption.memoizationTables = &memoizationTableAddresses;
+
+        /* ***** Bind the variables ***** */
+        // The slots of the variables are shared with the stack machine. The global variables
+        // holding them are defined and bound before any code accessing them is published.
+        auto& variableNames = module.GetVariables();
+        auto newVariableNames = impl.FindNewVariables(
+            std::set<std::string_view>(variableNames.begin(), variableNames.end()));
+        if (!newVariableNames.empty() || !newMemoizationTables.empty())
+        {
+            ThrowIfFailed(jit.addIRModule(
+                GenerateVariableModule<TNumber>(newVariableNames, newMemoizationTables)));
+        }
+
+        impl.AddVariableSlots(newVariableNames);
+        for (size_t i = 0; i < variableNames.size(); i++)
+        {
+            if (newVariableNames.count(variableNames[i]) != 0)
+            {
+                *impl.variableSlots.at(variableNames[i]) = variables[i];
+            }
+        }
+
+        /* ***** Generate LLVM-IR ***** */
+        // The main program keeps running on the stack machine, so we only need the operators in
+        // the module. They are compiled eagerly, since they are already hot.
+        orc::SymbolLookupSet entryNames;
+        for (auto& name : staleOperators)
+        {
+            ThrowIfFailed(jit.addIRModule(
+                GenerateOperatorModule<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                                       TPrinter>(*context, compilationOption, name, symbolNames,
+                                                 true)));
+            entryNames.add(jit.mangleAndIntern(symbolNames[name] + EntryFunctionSuffix));
+        }
+
+        /* ***** Publish JIT compiled code ***** */
+        // Looking up all the entry functions at once lets ORC compile the modules concurrently
+        auto symbols = ThrowIfFailed(jit.getExecutionSession().lookup(
+            orc::makeJITDylibSearchOrder(&jit.getMainJITDylib()), entryNames));
+
+        impl.AddCompiledOperators(*context, staleOperators, symbolNames);
+        impl.numGeneratedOperators += staleOperators.size();
+        isCompiled = true;
+
+        auto& userDefinedOperators = module.GetUserDefinedOperators();
+        for (size_t i = 0; i < userDefinedOperators.size(); i++)
+        {
+            auto& name = userDefinedOperators[i].GetDefinition().GetName();
+            if (staleOperators.count(name) != 0)
+            {
+                auto symbol = symbols[jit.mangleAndIntern(symbolNames[name] + EntryFunctionSuffix)];
+                nativeFunctions[module.GetStartAddresses()[i]].store(
+                    reinterpret_cast<StackMachineNativeFunction<TNumber>>(symbol.getAddress()),
+                    std::memory_order_release);
+            }
+        }
+    }
+    catch (...)
+    {
+        // The stack machine keeps interpreting the operators when the compilation fails
+    }
+}
+
+namespace
+{
+// Creates a module in a context of its own, so that ORC can compile the modules concurrently
+llvm::orc::ThreadSafeModule CreateModule(
+    const std::string& name, const std::function<void(llvm::LLVMContext*, llvm::Module*)>& generate)
+{
+    auto llvmContext = std::make_unique<llvm::LLVMContext>();
+    auto llvmModule = std::make_unique<llvm::Module>(name, *llvmContext);
+    llvmModule->setTargetTriple(LLVM_HOST_TRIPLE);
+    generate(llvmContext.get(), llvmModule.get());
+    return llvm::orc::ThreadSafeModule(std::move(llvmModule), std::move(llvmContext));
+}
+
+// Declares the functions of the given user-defined operators, which are named after the symbols
+// of the operators. The functions defined in the other modules are resolved by ORC when this
+// module is linked.
+template<typename TNumber>
+std::unordered_map<std::string, llvm::Function*> DeclareFunctions(
+    const CompilationContext& context, const std::vector<std::string>& names,
+    const std::unordered_map<std::string, std::string>& symbolNames,
+    llvm::LLVMContext* llvmContext, llvm::Module* llvmModule)
+{
+    llvm::Type* integerType = llvm::Type::getIntNTy(*llvmContext, IntegerBits<TNumber>);
+    llvm::Type* executionStateType = llvm::PointerType::get(llvm::Type::getVoidTy(*llvmContext), 0);
+
+    std::unordered_map<std::string, llvm::Function*> functionMap;
+    for (auto& name : names)
+    {
+        if (functionMap.count(name) != 0)
+        {
+            continue;
+        }
+
+        auto& definition = context.GetOperatorImplement(name).GetDefinition();
+
+        // Make arguments
+        //  - The first argument is ExecutionState, and the rests are integers
+        std::vector<llvm::Type*> argumentTypes(definition.GetNumOperands() + 1);
+        argumentTypes[0] = executionStateType;
+        std::fill(argumentTypes.begin() + 1, argumentTypes.end(), integerType);
+
+        llvm::FunctionType* functionType =
+            llvm::FunctionType::get(integerType, argumentTypes, false);
+        functionMap[name] = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage,
+                                                   symbolNames.at(name), llvmModule);
+    }
+
+    return functionMap;
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void EmitFunction(const JITCodeGenerationOption& option,
+                  const std::unordered_map<std::string, llvm::Function*>& functionMap,
+                  llvm::Function* function, std::string_view operatorName,
+                  const std::shared_ptr<const Operator>& op, bool isMainFunction,
+                  llvm::LLVMContext* llvmContext, llvm::Module* llvmModule)
+{
+    llvm::BasicBlock* block = llvm::BasicBlock::Create(*llvmContext, EntryBlockName, function);
+    auto builder = std::make_shared<llvm::IRBuilder<>>(block);
+
+    IRGenerator<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter> generator(
+        llvmModule, llvmContext, function, operatorName, builder, functionMap, option,
+        isMainFunction);
+    generator.BeginFunction();
+    op->Accept(generator);
+    generator.EndFunction();
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+llvm::orc::ThreadSafeModule GenerateMainModule(
+    const CompilationContext& context, const JITCodeGenerationOption& option,
+    const std::shared_ptr<const Operator>& op,
+    const std::unordered_map<std::string, std::string>& symbolNames)
+{
+    return CreateModule("calc4-jit-main-module", [&](llvm::LLVMContext* llvmContext,
+                                                     llvm::Module* llvmModule) {
+        auto summary = SummarizeCalls(op);
+        auto functionMap = DeclareFunctions<TNumber>(context, summary->callees, symbolNames,
+                                                     llvmContext, llvmModule);
+
+        llvm::Type* integerType = llvm::Type::getIntNTy(*llvmContext, IntegerBits<TNumber>);
+        llvm::Type* executionStateType =
+            llvm::PointerType::get(llvm::Type::getVoidTy(*llvmContext), 0);
+        llvm::FunctionType* funcType =
+            llvm::FunctionType::get(integerType, { executionStateType }, false);
+        llvm::Function* mainFunction = llvm::Function::Create(
+            funcType, llvm::Function::ExternalLinkage, MainFunctionName, llvmModule);
+
+        EmitFunction<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>(
+            option, functionMap, mainFunction, MainFunctionName, op, true,
+            llvmContext, llvmModule);
+    });
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+llvm::orc::ThreadSafeModule GenerateOperatorModule(
+    const CompilationContext& context, const JITCodeGenerationOption& option,
+    const std::string& name, const std::unordered_map<std::string, std::string>& symbolNames,
+    bool generateEntryFunction)
+{
+    auto& implement = context.GetOperatorImplement(name);
+    auto& symbolName = symbolNames.at(name);
+    return CreateModule("calc4-jit-module-" + symbolName, [&](llvm::LLVMContext* llvmContext,
+                                                               llvm::Module* llvmModule) {
+        std::vector<std::string> names = implement.GetCallSummary().callees;
+        names.push_back(name);
+        auto functionMap =
+            DeclareFunctions<TNumber>(context, names, symbolNames, llvmContext, llvmModule);
+
+        llvm::Function* function = functionMap.at(name);
+        EmitFunction<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>(
+            option, functionMap, function, name, implement.GetOperator(), false,
+            llvmContext, llvmModule);
+
+        if (!generateEntryFunction)
+        {
+            return;
+        }
+
+        // The function called from the stack machine, which loads the operands from the array
+        // and calls the operator
+        llvm::Type* integerType = llvm::Type::getIntNTy(*llvmContext, IntegerBits<TNumber>);
+        llvm::Type* pointerType = llvm::PointerType::get(llvm::Type::getVoidTy(*llvmContext), 0);
+        llvm::FunctionType* entryType =
+            llvm::FunctionType::get(integerType, { pointerType, pointerType }, false);
+        llvm::Function* entry = llvm::Function::Create(
+            entryType, llvm::Function::ExternalLinkage, symbolName + EntryFunctionSuffix,
+            llvmModule);
+
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*llvmContext, EntryBlockName, entry));
+        if constexpr (HasDenseArray<TNumber, TGlobalArraySource>)
+        {
+            PublishArrayRegion<TNumber>(builder, llvmModule, entry->getArg(0));
+        }
+
+        std::vector<llvm::Value*> arguments{ entry->getArg(0) };
+        for (int i = 0; i < implement.GetDefinition().GetNumOperands(); i++)
+        {
+            auto address = builder.CreateConstInBoundsGEP1_64(integerType, entry->getArg(1), i);
+            arguments.push_back(builder.CreateLoad(integerType, address));
+        }
+
+        builder.CreateRet(builder.CreateCall(function, arguments));
+    });
+}
+
+// Defines the global variables which the other modules declare, which hold the addresses of the
+// slots of the variables, and the pointers to the memoization tables of the given symbols. The
+// slots and the tables are referred to through these variables, so that the code of the operators
+// does not depend on the addresses in this process.
+template<typename TNumber>
+llvm::orc::ThreadSafeModule GenerateVariableModule(
+    const std::set<std::string_view>& variableNames,
+    const std::unordered_map<std::string, void*>& memoizationTables)
+{
+    return CreateModule("calc4-jit-variable-module", [&](llvm::LLVMContext* llvmContext,
+                                                         llvm::Module* llvmModule) {
+        auto slotType = llvm::PointerType::get(
+            llvm::Type::getIntNTy(*llvmContext, IntegerBits<TNumber>), 0);
+        for (auto& variableName : variableNames)
+        {
+            new llvm::GlobalVariable(*llvmModule, slotType, false,
+                                     llvm::GlobalVariable::LinkageTypes::ExternalLinkage,
+                                     llvm::ConstantPointerNull::get(slotType),
+                                     GlobalVariableNamePrefix + std::string(variableName));
+        }
+
+        auto tableType = llvm::Type::getInt8PtrTy(*llvmContext);
+        for (auto& [symbolName, table] : memoizationTables)
+        {
+            auto address = llvm::ConstantInt::get(llvm::Type::getIntNTy(*llvmContext,
+                                                                        IntegerBits<void*>),
+                                                  reinterpret_cast<uint64_t>(table));
+            new llvm::GlobalVariable(*llvmModule, tableType, true,
+                                     llvm::GlobalVariable::LinkageTypes::ExternalLinkage,
+                                     llvm::ConstantExpr::getIntToPtr(address, tableType),
+                                     MemoizationTableNamePrefix + symbolName);
+        }
+    });
+}
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-class IRGenerator;
+void DescribeCallees(const std::vector<std::string>& callees,
+                     const std::unordered_map<std::string, std::string>& symbolNames,
+                     std::ostream& out)
+{
+    for (auto& callee : callees)
+    {
+        auto it = symbolNames.find(callee);
+        out << "Callee " << callee << " " << (it != symbolNames.end() ? it->second : "") << "\n";
+    }
 }
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-void ThrowZeroDivisionException(void* state);
+void DescribeTree(const std::shared_ptr<const Operator>& op, std::ostream& out)
+{
+    out << op->ToString() << "\n";
+    if (auto parenthesis = std::dynamic_pointer_cast<const ParenthesisOperator>(op))
+    {
+        for (auto& child : parenthesis->GetOperators())
+        {
+            DescribeTree(child, out);
+        }
+    }
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-int GetChar(void* state);
+    for (auto& operand : op->GetOperands())
+    {
+        DescribeTree(operand, out);
+    }
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-void PrintChar(void* state, char c);
+    out << "End\n";
+}
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-TNumber LoadVariable(void* state, const char* variableName);
+void OptimizeModule(llvm::Module* llvmModule)
+{
+    using namespace llvm;
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-void StoreVariable(void* state, const char* variableName, TNumber value);
+    static const OptimizationLevel& OptLevel = OptimizationLevel::O3;
+    static constexpr ThinOrFullLTOPhase LTOPhase = ThinOrFullLTOPhase::None;
+
+    // Prepare PassBuilder
+    PassBuilder PB;
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    // We have to make a copy of M->functions because new functions may be added during
+    // optimization. The functions only declared in this module are defined in the others.
+    std::vector<Function*> functions;
+    for (auto& func : llvmModule->functions())
+    {
+        if (!func.isDeclaration())
+        {
+            functions.emplace_back(&func);
+        }
+    }
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-TNumber LoadArray(void* state, TNumber index);
+    // Optimize each function
+    FunctionPassManager FPM = PB.buildFunctionSimplificationPipeline(OptLevel, LTOPhase);
+    for (auto func : functions)
+    {
+        FPM.run(*func, FAM);
+    }
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-void StoreArray(void* state, TNumber index, TNumber value);
+    // Optimize this module
+    ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(OptLevel);
+    MPM.run(*llvmModule, MAM);
+}
+
+void MarkModuleOptimized(llvm::Module* llvmModule)
+{
+    llvmModule->addModuleFlag(llvm::Module::Warning, OptimizedModuleFlagName, 1);
+}
 
+// Defines the functions which the generated code calls by the names of "DeclareInternalFunction",
+// so that the code does not depend on the addresses of the functions in this process, and the
+// global variables holding the region of the global array
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
-TNumber EvaluateByJIT(
-    const CompilationContext& context,
-    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option)
+void DefineInternalSymbols(llvm::orc::LLJIT& jit)
 {
     using namespace llvm;
-    LLVMContext Context;
 
-    /* ***** Create module ***** */
-    std::unique_ptr<Module> Owner = std::make_unique<Module>("calc4-jit-module", Context);
-    Module* M = Owner.get();
-    M->setTargetTriple(LLVM_HOST_TRIPLE);
+    orc::SymbolMap symbols;
+    auto Define = [&](const char* name, auto function) {
+        symbols[jit.mangleAndIntern(std::string(InternalFunctionNamePrefix) + name)] =
+            JITEvaluatedSymbol(pointerToJITTargetAddress(function),
+                               JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+    };
 
-    /* ***** Generate LLVM-IR ***** */
-    GenerateIR<TNumber>(context, option, state, op, &Context, M);
+#define DEFINE_INTERNAL_FUNCTION(NAME)                                                             \
+    Define(#NAME, &NAME<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>)
 
-    /* ***** Optimize ***** */
-    if (option.optimize)
-    {
-        static const OptimizationLevel& OptLevel = OptimizationLevel::O3;
-        static constexpr ThinOrFullLTOPhase LTOPhase = ThinOrFullLTOPhase::None;
-
-        // Prepare PassBuilder
-        PassBuilder PB;
-        LoopAnalysisManager LAM;
-        FunctionAnalysisManager FAM;
-        CGSCCAnalysisManager CGAM;
-        ModuleAnalysisManager MAM;
-        PB.registerModuleAnalyses(MAM);
-        PB.registerCGSCCAnalyses(CGAM);
-        PB.registerFunctionAnalyses(FAM);
-        PB.registerLoopAnalyses(LAM);
-        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-
-        // We have to make a copy of M->functions because new functions may be added during
-        // optimization.
-        std::vector<Function*> functions;
-        for (auto& func : M->functions())
-        {
-            functions.emplace_back(&func);
-        }
+    DEFINE_INTERNAL_FUNCTION(ThrowZeroDivisionException);
+    DEFINE_INTERNAL_FUNCTION(ThrowStackOverflowException);
+    DEFINE_INTERNAL_FUNCTION(GetChar);
+    DEFINE_INTERNAL_FUNCTION(PrintChar);
+    DEFINE_INTERNAL_FUNCTION(LoadArray);
+    DEFINE_INTERNAL_FUNCTION(StoreArray);
+    DEFINE_INTERNAL_FUNCTION(GetArrayRegion);
+    DEFINE_INTERNAL_FUNCTION(FindMemoizedValue);
+    DEFINE_INTERNAL_FUNCTION(InsertMemoizedValue);
+    Define("ProfileEnter", &ProfileEnter);
+    Define("ProfileExit", &ProfileExit);
 
-        // Optimize each function
-        FunctionPassManager FPM = PB.buildFunctionSimplificationPipeline(OptLevel, LTOPhase);
-        for (auto func : functions)
-        {
-            FPM.run(*func, FAM);
-        }
+#undef DEFINE_INTERNAL_FUNCTION
+
+    symbols[jit.mangleAndIntern(NativeStackLimitVariableName)] = JITEvaluatedSymbol(
+        pointerToJITTargetAddress(&nativeStackLimit), JITSymbolFlags::Exported);
 
-        // Optimize this module
-        ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(OptLevel);
-        MPM.run(*M, MAM);
+    ThrowIfFailed(jit.getMainJITDylib().define(orc::absoluteSymbols(std::move(symbols))));
+
+    if constexpr (HasDenseArray<TNumber, TGlobalArraySource>)
+    {
+        ThrowIfFailed(jit.addIRModule(CreateModule(
+            "calc4-jit-array-module", [](LLVMContext* llvmContext, Module* llvmModule) {
+                auto integerType = Type::getIntNTy(*llvmContext, IntegerBits<TNumber>);
+                auto dataType = PointerType::get(integerType, 0);
+                auto sizeType = Type::getInt64Ty(*llvmContext);
+                new GlobalVariable(*llvmModule, dataType, false, GlobalVariable::ExternalLinkage,
+                                   ConstantPointerNull::get(dataType), ArrayDataVariableName);
+                new GlobalVariable(*llvmModule, sizeType, false, GlobalVariable::ExternalLinkage,
+                                   ConstantInt::get(sizeType, 0), ArraySizeVariableName);
+            })));
     }
+}
 
-    if (option.dumpProgram)
+// Stores the dense region of the global array of the given state to the global variables, which
+// the generated functions load at their entries. The entry points of the generated code call it.
+template<typename TNumber>
+void PublishArrayRegion(llvm::IRBuilder<>& builder, llvm::Module* llvmModule, llvm::Value* state)
+{
+    auto dataType = llvm::PointerType::get(builder.getIntNTy(IntegerBits<TNumber>), 0);
+    auto sizeType = builder.getInt64Ty();
+    auto functionType = llvm::FunctionType::get(
+        builder.getVoidTy(),
+        { state->getType(), llvm::PointerType::get(dataType, 0),
+          llvm::PointerType::get(sizeType, 0) },
+        false);
+    auto function = llvmModule->getOrInsertFunction(
+        std::string(InternalFunctionNamePrefix) + "GetArrayRegion", functionType);
+
+    auto dataVariable = llvmModule->getOrInsertGlobal(ArrayDataVariableName, dataType);
+    auto sizeVariable = llvmModule->getOrInsertGlobal(ArraySizeVariableName, sizeType);
+    builder.CreateCall(function, { state, dataVariable, sizeVariable });
+}
+
+JITObjectCache::JITObjectCache(const std::string& directory) : directory(directory)
+{
+}
+
+std::string JITObjectCache::GetPath(llvm::StringRef key) const
+{
+    llvm::SmallString<256> path(directory);
+    llvm::sys::path::append(path, key + ".o");
+    return std::string(path);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> JITObjectCache::Load(llvm::StringRef key) const
+{
+    if (!key.startswith(CacheKeyPrefix))
     {
-        // PrintIR
-        outs() << "/*\n * LLVM IR\n */\n===============\n" << *M << "===============\n\n";
-        outs().flush();
+        return nullptr;
     }
 
-    /* ***** Execute JIT compiled code ***** */
-    EngineBuilder ebuilder(std::move(Owner));
-    std::string error;
-    ebuilder.setErrorStr(&error).setEngineKind(EngineKind::Kind::JIT);
-    ExecutionEngine* EE = ebuilder.create();
+    auto buffer = llvm::MemoryBuffer::getFile(GetPath(key), false, false);
+    return buffer ? std::move(*buffer) : nullptr;
+}
 
-    if (!error.empty())
+void JITObjectCache::notifyObjectCompiled(const llvm::Module* M, llvm::MemoryBufferRef Obj)
+{
+    // Only the modules named by their keys can be cached. Failing to store an object is not an
+    // error, since it is compiled again in the next time.
+    auto key = M->getModuleIdentifier();
+    if (!llvm::StringRef(key).startswith(CacheKeyPrefix) ||
+        llvm::sys::fs::create_directories(directory))
     {
-        throw error;
+        return;
     }
 
-    auto func = (TNumber (*)(
-        ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>*))
-                    EE->getFunctionAddress(MainFunctionName);
+    // Write a temporary file and rename it, so that other processes never load partial objects
+    int fd;
+    llvm::SmallString<256> temporaryPath;
+    if (llvm::sys::fs::createUniqueFile(GetPath(key + ".%%%%%%%%.tmp"), fd, temporaryPath))
+    {
+        return;
+    }
 
-    if (!error.empty())
     {
-        throw error;
+        llvm::raw_fd_ostream out(fd, true);
+        out << Obj.getBuffer();
+        out.close();
+        if (out.has_error())
+        {
+            out.clear_error();
+            llvm::sys::fs::remove(temporaryPath);
+            return;
+        }
     }
 
-    TNumber result = func(&state);
-    delete EE;
-    return result;
+    if (llvm::sys::fs::rename(temporaryPath, GetPath(key)))
+    {
+        llvm::sys::fs::remove(temporaryPath);
+    }
 }
 
-namespace
+std::unique_ptr<llvm::MemoryBuffer> JITObjectCache::getObject(const llvm::Module* M)
 {
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter>
-void GenerateIR(
-    const CompilationContext& context, const JITCodeGenerationOption& option,
-    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const std::shared_ptr<const Operator>& op, llvm::LLVMContext* llvmContext,
-    llvm::Module* llvmModule)
+    return Load(M->getModuleIdentifier());
+}
+
+template<typename TJIT, typename TJITBuilder>
+std::unique_ptr<TJIT> CreateJIT(bool optimize, llvm::ObjectCache* objectCache)
 {
-    /* ***** Initialize variables ***** */
-    llvm::Type* integerType = llvm::Type::getIntNTy(*llvmContext, IntegerBits<TNumber>);
-    llvm::Type* usedDefinedReturnType = integerType;
-    llvm::Type* executionStateType = llvm::PointerType::get(llvm::Type::getVoidTy(*llvmContext), 0);
+    using namespace llvm;
 
-    /* ***** Make function map (operator's name -> LLVM function) and the functions ***** */
-    std::unordered_map<std::string, llvm::Function*> functionMap;
-    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    // The modules are compiled concurrently by the threads of the dispatcher. We do not use
+    // "setNumCompileThreads" because LLVM 14 fails to run the initializers of the modules cloned
+    // for the compile threads.
+    auto processControl = ThrowIfFailed(orc::SelfExecutorProcessControl::Create(
+        nullptr, std::make_unique<orc::DynamicThreadPoolTaskDispatcher>()));
+    auto createCompiler = [objectCache](orc::JITTargetMachineBuilder targetMachineBuilder)
+        -> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+        return std::make_unique<orc::ConcurrentIRCompiler>(std::move(targetMachineBuilder),
+                                                           objectCache);
+    };
+    auto jit = ThrowIfFailed(TJITBuilder()
+                                 .setExecutorProcessControl(std::move(processControl))
+                                 .setCompileFunctionCreator(createCompiler)
+                                 .create());
+
+    // Optimizations may introduce calls of library functions such as "memset"
+    jit->getMainJITDylib().addGenerator(
+        ThrowIfFailed(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            jit->getDataLayout().getGlobalPrefix())));
+
+    if (optimize)
     {
-        auto& definition = it->second.GetDefinition();
+        jit->getIRTransformLayer().setTransform(
+            [](orc::ThreadSafeModule module,
+               orc::MaterializationResponsibility&) -> Expected<orc::ThreadSafeModule> {
+                module.withModuleDo([](Module& M) {
+                    if (M.getModuleFlag(OptimizedModuleFlagName) == nullptr)
+                    {
+                        OptimizeModule(&M);
+                    }
+                });
+                return module;
+            });
+    }
 
-        // Make arguments
-        //  - The first argument is ExecutionState, and the rests are integers
-        std::vector<llvm::Type*> argumentTypes(definition.GetNumOperands() + 1);
-        argumentTypes[0] = executionStateType;
-        std::fill(argumentTypes.begin() + 1, argumentTypes.end(), integerType);
+    return jit;
+}
 
-        llvm::FunctionType* functionType =
-            llvm::FunctionType::get(usedDefinedReturnType, argumentTypes, false);
-        functionMap[definition.GetName()] = llvm::Function::Create(
-            functionType, llvm::Function::ExternalLinkage, definition.GetName(), llvmModule);
-    }
-
-    /* ***** Gather variable names ***** */
-    auto variableNames = GatherVariableNames(op, context);
-
-    /* ***** Make main function ***** */
-    llvm::FunctionType* funcType =
-        llvm::FunctionType::get(integerType, { executionStateType }, false);
-    llvm::Function* mainFunction = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
-                                                          MainFunctionName, llvmModule);
-
-    /* ***** Generate IR ****** */
-    // Local helper function
-    auto Emit = [llvmModule, llvmContext, &functionMap, &option,
-                 &variableNames](llvm::Function* function,
-                                 const std::shared_ptr<const Operator>& op, bool isMainFunction) {
-        llvm::BasicBlock* block = llvm::BasicBlock::Create(*llvmContext, EntryBlockName, function);
-        auto builder = std::make_shared<llvm::IRBuilder<>>(block);
-
-        IRGenerator<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter> generator(
-            llvmModule, llvmContext, function, builder, functionMap, option, variableNames,
-            isMainFunction);
-        generator.BeginFunction();
-        op->Accept(generator);
-        generator.EndFunction();
-    };
+void SetNativeStackLimit()
+{
+    // The stack of each thread is queried only once
+    thread_local uintptr_t limit = []() {
+        char here;
+        uintptr_t current = reinterpret_cast<uintptr_t>(&here);
+        uintptr_t lowest = current > DefaultNativeStackSize ? current - DefaultNativeStackSize : 0;
+
+#if defined(__APPLE__)
+        pthread_t self = pthread_self();
+        lowest = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(self)) -
+            pthread_get_stacksize_np(self);
+#elif defined(__unix__)
+        pthread_attr_t attributes;
+        if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+        {
+            void* address;
+            size_t size;
+            if (pthread_attr_getstack(&attributes, &address, &size) == 0)
+            {
+                lowest = reinterpret_cast<uintptr_t>(address);
+            }
 
-    // Main function
-    Emit(mainFunction, op, true);
+            pthread_attr_destroy(&attributes);
+        }
+#endif // defined(__APPLE__)
 
-    // User-defined operators
-    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+        return lowest + NativeStackMargin;
+    }();
+
+    nativeStackLimit = limit;
+}
+
+void ThrowIfFailed(llvm::Error error)
+{
+    if (error)
+    {
+        throw llvm::toString(std::move(error));
+    }
+}
+
+template<typename T>
+T ThrowIfFailed(llvm::Expected<T> value)
+{
+    if (!value)
     {
-        auto& definition = it->second.GetDefinition();
-        auto& name = definition.GetName();
-        Emit(functionMap[name], context.GetOperatorImplement(name).GetOperator(), false);
+        throw llvm::toString(value.takeError());
     }
+
+    return std::move(*value);
 }
 
 struct InternalFunction
 {
     llvm::FunctionType* type;
-    llvm::Value* address;
+    llvm::Value* function;
 };
 
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
@@ -290,59 +1547,69 @@ protected:
     llvm::Module* module;
     llvm::LLVMContext* context;
     llvm::Function* function;
+    std::string_view operatorName;
     std::shared_ptr<llvm::IRBuilder<>> builder;
     std::unordered_map<std::string, llvm::Function*> functionMap;
     JITCodeGenerationOption option;
-    const std::set<std::string_view>& variableNames;
     bool isMainFunction;
 
-    InternalFunction throwZeroDivision, getChar, printChar, loadVariable, storeVariable, loadArray,
-        storeArray;
+    InternalFunction throwZeroDivision, throwStackOverflow, getChar, printChar, loadArray,
+        storeArray, findMemoizedValue, insertMemoizedValue, profileEnter, profileExit;
 
 public:
     IRGeneratorBase(llvm::Module* module, llvm::LLVMContext* context, llvm::Function* function,
+                    std::string_view operatorName,
                     const std::shared_ptr<llvm::IRBuilder<>>& builder,
                     const std::unordered_map<std::string, llvm::Function*>& functionMap,
-                    const JITCodeGenerationOption& option,
-                    const std::set<std::string_view>& variableNames, bool isMainFunction)
-        : module(module), context(context), function(function), builder(builder),
-          functionMap(functionMap), option(option), variableNames(variableNames),
+                    const JITCodeGenerationOption& option, bool isMainFunction)
+        : module(module), context(context), function(function), operatorName(operatorName),
+          builder(builder), functionMap(functionMap), option(option),
           isMainFunction(isMainFunction)
     {
 #define GET_LLVM_FUNCTION_TYPE(RETURN_TYPE, ...)                                                   \
     llvm::FunctionType::get(RETURN_TYPE, { __VA_ARGS__ }, false)
 
-#define GET_LLVM_FUNCTION_ADDRESS(NAME)                                                            \
-    this->builder->getIntN(                                                                        \
-        IntegerBits<void*>,                                                                        \
-        reinterpret_cast<uint64_t>(                                                                \
-            &NAME<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>))
-
 #define GET_INTERNAL_FUNCTION(NAME, RETURN_TYPE, ...)                                              \
-    { GET_LLVM_FUNCTION_TYPE(RETURN_TYPE, __VA_ARGS__), GET_LLVM_FUNCTION_ADDRESS(NAME) }
+    DeclareInternalFunction(#NAME, GET_LLVM_FUNCTION_TYPE(RETURN_TYPE, __VA_ARGS__))
 
         llvm::Type* voidType = llvm::Type::getVoidTy(*this->context);
         llvm::Type* voidPointerType = llvm::PointerType::get(voidType, 0);
         llvm::Type* integerType = builder->getIntNTy(IntegerBits<TNumber>);
-        llvm::Type* stringType = llvm::PointerType::get(builder->getInt8Ty(), 0);
+        llvm::Type* integerPointerType = llvm::PointerType::get(integerType, 0);
 
         throwZeroDivision = GET_INTERNAL_FUNCTION(
             ThrowZeroDivisionException, llvm::Type::getVoidTy(*this->context), { voidPointerType });
+        throwStackOverflow =
+            GET_INTERNAL_FUNCTION(ThrowStackOverflowException, voidType, { voidPointerType });
 
         getChar = GET_INTERNAL_FUNCTION(GetChar, this->builder->getInt32Ty(), { voidPointerType });
         printChar = GET_INTERNAL_FUNCTION(PrintChar, llvm::Type::getVoidTy(*this->context),
                                           { voidPointerType, this->builder->getInt8Ty() });
-        loadVariable =
-            GET_INTERNAL_FUNCTION(LoadVariable, integerType, { voidPointerType, stringType });
-        storeVariable = GET_INTERNAL_FUNCTION(StoreVariable, voidType,
-                                              { voidPointerType, stringType, integerType });
         loadArray = GET_INTERNAL_FUNCTION(LoadArray, integerType, { voidPointerType, integerType });
         storeArray = GET_INTERNAL_FUNCTION(StoreArray, voidType,
                                            { voidPointerType, integerType, integerType });
+        findMemoizedValue = GET_INTERNAL_FUNCTION(FindMemoizedValue, integerPointerType,
+                                                  { voidPointerType, integerPointerType });
+        insertMemoizedValue =
+            GET_INTERNAL_FUNCTION(InsertMemoizedValue, voidType,
+                                  { voidPointerType, integerPointerType, integerType });
+
+        profileEnter = GET_INTERNAL_FUNCTION(ProfileEnter, voidType,
+                                             { voidPointerType, this->builder->getInt32Ty() });
+        profileExit = GET_INTERNAL_FUNCTION(ProfileExit, voidType, { voidPointerType });
     }
 
     virtual void BeginFunction() = 0;
     virtual void EndFunction() = 0;
+
+private:
+    // The internal functions are called by their symbols instead of their addresses, so that the
+    // compiled code can be cached across processes. "DefineInternalFunctions" resolves them.
+    InternalFunction DeclareInternalFunction(const char* name, llvm::FunctionType* type)
+    {
+        std::string symbolName = InternalFunctionNamePrefix + std::string(name);
+        return { type, module->getOrInsertFunction(symbolName, type).getCallee() };
+    }
 };
 
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
@@ -353,54 +1620,73 @@ class IRGenerator
 private:
     llvm::Value* value;
 
+    // The memoization table of this operator and the array of its operands, which are set by
+    // "BeginFunction" if the operator is memoized
+    llvm::Value* memoizationTable = nullptr;
+    llvm::Value* memoizedOperands = nullptr;
+
+    // The dense region of the global array, which is loaded by "BeginFunction"
+    llvm::Value* arrayData = nullptr;
+    llvm::Value* arraySize = nullptr;
+
 public:
     using IRGeneratorBase<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
                           TPrinter>::IRGeneratorBase;
 
     virtual void BeginFunction() override
     {
-        if (this->isMainFunction)
+        if (!this->isMainFunction && this->option.checkStackOverflow)
+        {
+            CheckStackOverflow();
+        }
+
+        if constexpr (HasDenseArray<TNumber, TGlobalArraySource>)
+        {
+            // The main function is an entry point of the generated code
+            if (this->isMainFunction)
+            {
+                PublishArrayRegion<TNumber>(*this->builder, this->module,
+                                            &*this->function->arg_begin());
+            }
+
+            auto dataType = llvm::PointerType::get(GetIntegerType(), 0);
+            auto sizeType = this->builder->getInt64Ty();
+            arrayData = this->builder->CreateLoad(
+                dataType, this->module->getOrInsertGlobal(ArrayDataVariableName, dataType));
+            arraySize = this->builder->CreateLoad(
+                sizeType, this->module->getOrInsertGlobal(ArraySizeVariableName, sizeType));
+        }
+
+        if (!this->isMainFunction && this->option.profiler != nullptr)
         {
-            // If this is the main function, we need to exchange variables with TVariableSource. We
-            // restore all variables at the beginning and pass the modified ones at the end.
+            // Report the entry of this operator. Its id is resolved at compile time.
+            int operatorId = this->option.profiler->GetOperatorId(this->operatorName);
+            CallInternalFunction(this->profileEnter,
+                                 { GetProfilerPointer(), this->builder->getInt32(operatorId) },
+                                 this->builder.get());
+        }
 
-            for (auto& variableName : this->variableNames)
+        if (!this->isMainFunction && this->option.memoizationTables != nullptr)
+        {
+            if (this->option.memoizationTables->count(std::string(this->operatorName)) != 0)
             {
-                llvm::StringRef variableNameRef(variableName.data(), variableName.size());
-                llvm::GlobalVariable* variableNameStr =
-                    this->builder->CreateGlobalString(variableNameRef);
-                llvm::GlobalVariable* variable = GetGlobalVariable(variableName);
-
-                // Restore the value from TVariableSource
-                auto value = CallInternalFunction(
-                    this->loadVariable, { &*this->function->arg_begin(), variableNameStr },
-                    this->builder.get());
-
-                // Store it in the JITed global variable
-                this->builder->CreateStore(value, variable);
+                BeginMemoizedFunction();
             }
         }
     }
 
     virtual void EndFunction() override
     {
-        if (this->isMainFunction)
+        if (memoizationTable != nullptr)
         {
-            for (auto& variableName : this->variableNames)
-            {
-                llvm::StringRef variableNameRef(variableName.data(), variableName.size());
-                llvm::GlobalVariable* variableNameStr =
-                    this->builder->CreateGlobalString(variableNameRef);
-                llvm::GlobalVariable* variable = GetGlobalVariable(variableName);
-
-                // Load value from the JITed global variable
-                auto value = this->builder->CreateLoad(GetIntegerType(), variable);
-
-                // Store it in TVariableSource
-                CallInternalFunction(this->storeVariable,
-                                     { &*this->function->arg_begin(), variableNameStr, value },
-                                     this->builder.get());
-            }
+            CallInternalFunction(this->insertMemoizedValue,
+                                 { memoizationTable, memoizedOperands, this->value },
+                                 this->builder.get());
+        }
+
+        if (!this->isMainFunction && this->option.profiler != nullptr)
+        {
+            CallInternalFunction(this->profileExit, { GetProfilerPointer() }, this->builder.get());
         }
 
         this->builder->CreateRet(this->value);
@@ -435,7 +1721,7 @@ public:
 
     virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
     {
-        auto variable = GetGlobalVariable(op->GetVariableName());
+        auto variable = GetVariableAddress(op->GetVariableName());
         this->value = this->builder->CreateLoad(GetIntegerType(), variable);
     };
 
@@ -458,8 +1744,36 @@ public:
     {
         op->GetIndex()->Accept(*this);
         auto index = value;
-        this->value = CallInternalFunction(
-            this->loadArray, { &*this->function->arg_begin(), index }, this->builder.get());
+
+        if constexpr (HasDenseArray<TNumber, TGlobalArraySource>)
+        {
+            // Only the indices out of the dense region are passed to TGlobalArraySource
+            llvm::BasicBlock* outOfRange =
+                llvm::BasicBlock::Create(*this->context, "", this->function);
+            llvm::BasicBlock* endBlock =
+                llvm::BasicBlock::Create(*this->context, "", this->function);
+
+            auto address = BeginDenseArrayAccess(index, outOfRange);
+            auto inRangeValue = this->builder->CreateLoad(GetIntegerType(), address);
+            auto inRangeBlock = this->builder->GetInsertBlock();
+            this->builder->CreateBr(endBlock);
+
+            llvm::IRBuilder<> outOfRangeBuilder(outOfRange);
+            auto outOfRangeValue = CallInternalFunction(
+                this->loadArray, { &*this->function->arg_begin(), index }, &outOfRangeBuilder);
+            outOfRangeBuilder.CreateBr(endBlock);
+
+            this->builder = std::make_shared<llvm::IRBuilder<>>(endBlock);
+            auto phi = this->builder->CreatePHI(GetIntegerType(), 2);
+            phi->addIncoming(inRangeValue, inRangeBlock);
+            phi->addIncoming(outOfRangeValue, outOfRange);
+            this->value = phi;
+        }
+        else
+        {
+            this->value = CallInternalFunction(
+                this->loadArray, { &*this->function->arg_begin(), index }, this->builder.get());
+        }
     };
 
     virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
@@ -494,7 +1808,7 @@ public:
     virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
     {
         op->GetOperand()->Accept(*this);
-        auto variable = GetGlobalVariable(op->GetVariableName());
+        auto variable = GetVariableAddress(op->GetVariableName());
         this->builder->CreateStore(this->value, variable);
     }
 
@@ -506,9 +1820,32 @@ public:
         op->GetIndex()->Accept(*this);
         auto index = value;
 
-        CallInternalFunction(this->storeArray,
-                             { &*this->function->arg_begin(), index, valueToBeStored },
-                             this->builder.get());
+        if constexpr (HasDenseArray<TNumber, TGlobalArraySource>)
+        {
+            llvm::BasicBlock* outOfRange =
+                llvm::BasicBlock::Create(*this->context, "", this->function);
+            llvm::BasicBlock* endBlock =
+                llvm::BasicBlock::Create(*this->context, "", this->function);
+
+            auto address = BeginDenseArrayAccess(index, outOfRange);
+            this->builder->CreateStore(valueToBeStored, address);
+            this->builder->CreateBr(endBlock);
+
+            llvm::IRBuilder<> outOfRangeBuilder(outOfRange);
+            CallInternalFunction(this->storeArray,
+                                 { &*this->function->arg_begin(), index, valueToBeStored },
+                                 &outOfRangeBuilder);
+            outOfRangeBuilder.CreateBr(endBlock);
+
+            this->builder = std::make_shared<llvm::IRBuilder<>>(endBlock);
+        }
+        else
+        {
+            CallInternalFunction(this->storeArray,
+                                 { &*this->function->arg_begin(), index, valueToBeStored },
+                                 this->builder.get());
+        }
+
         this->value = valueToBeStored;
     }
 
@@ -585,7 +1922,7 @@ public:
         {
             // We share the same logic among Div and Mod operations
 
-            if (this->option.checkZeroDivision)
+            if (this->option.checkZeroDivision && !op->IsDivisorNonZero())
             {
                 llvm::BasicBlock* whenDivisorIsZero =
                     llvm::BasicBlock::Create(*this->context, "", this->function);
@@ -695,8 +2032,10 @@ public:
                                  const std::shared_ptr<const Operator>& op) {
             auto builder = std::make_shared<llvm::IRBuilder<>>(block);
             IRGenerator<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>
-                generator(this->module, this->context, this->function, builder, this->functionMap,
-                          this->option, this->variableNames, this->isMainFunction);
+                generator(this->module, this->context, this->function, this->operatorName, builder,
+                          this->functionMap, this->option, this->isMainFunction);
+            generator.arrayData = this->arrayData;
+            generator.arraySize = this->arraySize;
             op->Accept(generator);
             generator.builder->CreateStore(generator.value, temp);
             return (this->builder = generator.builder);
@@ -734,31 +2073,137 @@ public:
     }
 
 private:
+    // Emits the bounds check of "index" against the dense region of the global array, which
+    // branches to "outOfRange" if the index is out of the region. Returns the address of the
+    // element, with the builder moved to the block where the index is in the region.
+    llvm::Value* BeginDenseArrayAccess(llvm::Value* index, llvm::BasicBlock* outOfRange)
+    {
+        // Negative indices are out of the region since they are compared as unsigned integers.
+        // 128-bit indices are compared without being truncated, so the ones which do not fit in
+        // 64 bits are passed to TGlobalArraySource, which truncates them.
+        auto indexType = this->builder->getIntNTy(std::max<size_t>(IntegerBits<TNumber>, 64));
+        auto extendedIndex = this->builder->CreateSExtOrTrunc(index, indexType);
+        auto size = this->builder->CreateZExtOrTrunc(arraySize, indexType);
+
+        llvm::BasicBlock* inRange = llvm::BasicBlock::Create(*this->context, "", this->function);
+        this->builder->CreateCondBr(this->builder->CreateICmpULT(extendedIndex, size), inRange,
+                                    outOfRange);
+
+        this->builder = std::make_shared<llvm::IRBuilder<>>(inRange);
+        auto offset = this->builder->CreateTrunc(extendedIndex, this->builder->getInt64Ty());
+        return this->builder->CreateInBoundsGEP(GetIntegerType(), arrayData, offset);
+    }
+
+    // Throws StackOverflowException if the frame of this operator is below "nativeStackLimit"
+    void CheckStackOverflow()
+    {
+        auto addressType = this->builder->getIntNTy(IntegerBits<void*>);
+        auto frameAddress = this->builder->CreateIntrinsic(
+            llvm::Intrinsic::frameaddress, { this->builder->getInt8PtrTy() },
+            { this->builder->getInt32(0) });
+        auto limitVariable =
+            this->module->getOrInsertGlobal(NativeStackLimitVariableName, addressType);
+        auto limit = this->builder->CreateLoad(addressType, limitVariable);
+        auto cond = this->builder->CreateICmpULT(
+            this->builder->CreatePtrToInt(frameAddress, addressType), limit);
+
+        llvm::BasicBlock* whenOverflowed =
+            llvm::BasicBlock::Create(*this->context, "", this->function);
+        llvm::BasicBlock* body = llvm::BasicBlock::Create(*this->context, "", this->function);
+        this->builder->CreateCondBr(cond, whenOverflowed, body);
+
+        llvm::IRBuilder<> whenOverflowedBuilder(whenOverflowed);
+        CallInternalFunction(this->throwStackOverflow, { &*this->function->arg_begin() },
+                             &whenOverflowedBuilder);
+        whenOverflowedBuilder.CreateUnreachable();
+
+        this->builder = std::make_shared<llvm::IRBuilder<>>(body);
+    }
+
+    // Returns the memoized result if this operator has been called with the same operands, and
+    // continues to its body otherwise
+    void BeginMemoizedFunction()
+    {
+        // The address of the table is held by a global variable defined in the module of the
+        // global variables
+        llvm::Type* tableType = llvm::PointerType::get(llvm::Type::getVoidTy(*this->context), 0);
+        auto tableVariable = this->module->getOrInsertGlobal(
+            MemoizationTableNamePrefix + this->function->getName().str(), tableType);
+        memoizationTable = this->builder->CreateLoad(tableType, tableVariable);
+
+        // Pass the operands to the table as an array
+        size_t numOperands = this->function->arg_size() - 1 /* ExecutionState */;
+        memoizedOperands = this->builder->CreateAlloca(
+            GetIntegerType(), this->builder->getInt32(static_cast<uint32_t>(numOperands)));
+        for (size_t i = 0; i < numOperands; i++)
+        {
+            auto address =
+                this->builder->CreateConstInBoundsGEP1_64(GetIntegerType(), memoizedOperands, i);
+            this->builder->CreateStore(this->function->getArg(i + 1), address);
+        }
+
+        auto memoized = CallInternalFunction(this->findMemoizedValue,
+                                             { memoizationTable, memoizedOperands },
+                                             this->builder.get());
+
+        llvm::BasicBlock* whenMemoized =
+            llvm::BasicBlock::Create(*this->context, "", this->function);
+        llvm::BasicBlock* whenNotMemoized =
+            llvm::BasicBlock::Create(*this->context, "", this->function);
+        this->builder->CreateCondBr(this->builder->CreateIsNotNull(memoized), whenMemoized,
+                                    whenNotMemoized);
+
+        // Code generation for when the result is memoized
+        {
+            llvm::IRBuilder<> whenMemoizedBuilder(whenMemoized);
+            if (this->option.profiler != nullptr)
+            {
+                CallInternalFunction(this->profileExit, { GetProfilerPointer() },
+                                     &whenMemoizedBuilder);
+            }
+
+            whenMemoizedBuilder.CreateRet(
+                whenMemoizedBuilder.CreateLoad(GetIntegerType(), memoized));
+        }
+
+        this->builder = std::make_shared<llvm::IRBuilder<>>(whenNotMemoized);
+    }
+
     llvm::CallInst* CallInternalFunction(const InternalFunction& func,
                                          llvm::ArrayRef<llvm::Value*> arguments,
                                          llvm::IRBuilder<>* builder)
     {
-        auto functionPtr = builder->CreateCast(llvm::Instruction::CastOps::IntToPtr, func.address,
-                                               llvm::PointerType::get(func.type, 0));
-        return builder->CreateCall(func.type, functionPtr, arguments);
+        return builder->CreateCall(func.type, func.function, arguments);
     }
 
-    llvm::GlobalVariable* GetGlobalVariable(std::string_view variableName)
+    llvm::Value* GetProfilerPointer()
     {
-        // First, try to find the global variable from our module
-        std::string actualVariableName = GlobalVariableNamePrefix + std::string(variableName);
-        auto variable = this->module->getGlobalVariable(actualVariableName);
-        if (variable != nullptr)
-        {
-            return variable;
-        }
+        auto address = this->builder->getIntN(
+            IntegerBits<void*>, reinterpret_cast<uint64_t>(this->option.profiler));
+        return this->builder->CreateIntToPtr(
+            address, llvm::PointerType::get(llvm::Type::getVoidTy(*this->context), 0));
+    }
 
-        // If it does not exist, create a new one
-        variable = new llvm::GlobalVariable(*this->module, GetIntegerType(), false,
-                                            llvm::GlobalVariable::LinkageTypes::CommonLinkage,
-                                            llvm::ConstantInt::get(GetIntegerType(), 0),
-                                            actualVariableName);
-        return variable;
+    llvm::Value* GetVariableAddress(std::string_view variableName)
+    {
+        // The address of the slot is loaded from the global variable, which is defined in the
+        // module of the global variables. The global variable is rewritten before each
+        // execution, so the load is not invariant, but it always points to a valid slot, which
+        // lets LLVM move the accesses to the variable as freely as the accesses to a global
+        // variable.
+        auto slotType = llvm::PointerType::get(GetIntegerType(), 0);
+        auto slot = this->builder->CreateLoad(
+            slotType, this->module->getOrInsertGlobal(GlobalVariableNamePrefix +
+                                                          std::string(variableName),
+                                                      slotType));
+        auto slotSize = llvm::ConstantAsMetadata::get(this->builder->getInt64(sizeof(TNumber)));
+        auto slotAlign = llvm::ConstantAsMetadata::get(this->builder->getInt64(alignof(TNumber)));
+        slot->setMetadata(llvm::LLVMContext::MD_nonnull, llvm::MDNode::get(*this->context, {}));
+        slot->setMetadata(llvm::LLVMContext::MD_dereferenceable,
+                          llvm::MDNode::get(*this->context, { slotSize }));
+        slot->setMetadata(llvm::LLVMContext::MD_align,
+                          llvm::MDNode::get(*this->context, { slotAlign }));
+        return slot;
     }
 
     llvm::Type* GetIntegerType() const
@@ -784,6 +2229,21 @@ void ThrowZeroDivisionException(void* state)
 #endif // _MSC_VER
 }
 
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void ThrowStackOverflowException(void* state)
+{
+#ifdef _MSC_VER
+    // TODO: Exceptions thrown in the Jitted functions are not handled on Windows systems, as
+    // described in "ThrowZeroDivisionException".
+    std::cout << "Error: " << Exceptions::StackOverflowException(std::nullopt).what() << std::endl
+              << "The program will be terminated immediately." << std::endl;
+    exit(EXIT_FAILURE);
+#else
+    throw Exceptions::StackOverflowException(std::nullopt);
+#endif // _MSC_VER
+}
+
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
 int GetChar(void* state)
@@ -805,42 +2265,65 @@ void PrintChar(void* state, char c)
 
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
-TNumber LoadVariable(void* state, const char* variableName)
+TNumber LoadArray(void* state, TNumber index)
+{
+    return reinterpret_cast<ExecutionState<TNumber, TVariableSource, TGlobalArraySource,
+                                           TInputSource, TPrinter>*>(state)
+        ->GetArraySource()
+        .Get(index);
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+void StoreArray(void* state, TNumber index, TNumber value)
 {
     return reinterpret_cast<ExecutionState<TNumber, TVariableSource, TGlobalArraySource,
                                            TInputSource, TPrinter>*>(state)
-        ->GetVariableSource()
-        .Get(variableName);
+        ->GetArraySource()
+        .Set(index, value);
 }
 
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
-void StoreVariable(void* state, const char* variableName, TNumber value)
+void GetArrayRegion(void* state, TNumber** data, int64_t* size)
 {
-    reinterpret_cast<
-        ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>*>(
-        state)
-        ->GetVariableSource()
-        .Set(variableName, value);
+    auto& arraySource = reinterpret_cast<ExecutionState<TNumber, TVariableSource,
+                                                         TGlobalArraySource, TInputSource,
+                                                         TPrinter>*>(state)
+                            ->GetArraySource();
+    if constexpr (HasDenseArray<TNumber, TGlobalArraySource>)
+    {
+        *data = arraySource.GetDenseArray();
+        *size = arraySource.GetDenseArraySize();
+    }
+    else
+    {
+        *data = nullptr;
+        *size = 0;
+    }
 }
 
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
-TNumber LoadArray(void* state, TNumber index)
+const TNumber* FindMemoizedValue(void* table, const TNumber* operands)
 {
-    return reinterpret_cast<ExecutionState<TNumber, TVariableSource, TGlobalArraySource,
-                                           TInputSource, TPrinter>*>(state)
-        ->GetArraySource()
-        .Get(index);
+    return reinterpret_cast<const MemoizationTable<TNumber>*>(table)->Find(operands);
 }
 
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
-void StoreArray(void* state, TNumber index, TNumber value)
+void InsertMemoizedValue(void* table, const TNumber* operands, TNumber value)
 {
-    return reinterpret_cast<ExecutionState<TNumber, TVariableSource, TGlobalArraySource,
-                                           TInputSource, TPrinter>*>(state)
-        ->GetArraySource()
-        .Set(index, value);
+    reinterpret_cast<MemoizationTable<TNumber>*>(table)->Insert(operands, value);
+}
+
+void ProfileEnter(Profiler* profiler, int32_t operatorId)
+{
+    profiler->Enter(operatorId);
+}
+
+void ProfileExit(Profiler* profiler)
+{
+    profiler->Exit();
 }
 }
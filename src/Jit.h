@@ -11,23 +11,152 @@
 
 #include "ExecutionState.h"
 #include "Operators.h"
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "Profiler.h"
+#include "StackMachine.h"
+#include "llvm-c/Target.h"
 #include "llvm/Support/ManagedStatic.h"
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 namespace calc4
 {
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+class JITTieredCompiler;
+
 struct JITCodeGenerationOption
 {
     bool optimize = true;
     bool checkZeroDivision = false;
     bool dumpProgram = false;
+
+    // If not null, the generated code reports calls of user-defined operators to this profiler
+    Profiler* profiler = nullptr;
+
+    // Memoizes the results of pure operators
+    bool memoize = false;
+
+    // If not empty, "JITSession" stores the compiled code in this directory and loads it in the
+    // later executions instead of compiling the same operators again
+    std::string cacheDirectory;
+
+    // If not null, the results of the operators in this map are memoized in the
+    // "MemoizationTable"s at the given addresses. The tables are created from "memoize" when the
+    // code is compiled.
+    const std::unordered_map<std::string, void*>* memoizationTables = nullptr;
+
+    // Makes the user-defined operators check the depth of the native stack at their entries, so
+    // that deep recursions throw StackOverflowException instead of overrunning the stack
+    bool checkStackOverflow = false;
+};
+
+// Keeps the operators compiled by "EvaluateByJIT" resident across executions, such as the inputs
+// of the REPL. Only the operators which have been defined or redefined since the previous
+// execution, and the callers of them, are compiled again. The others are linked to the code
+// compiled before. Changing the options discards all the compiled code.
+template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
+         typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
+         typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter>
+class JITSession
+{
+private:
+    struct Impl;
+
+    // "Impl" is created by the first execution. Since "std::shared_ptr" does not need its
+    // definition to destroy it, sessions can be declared even for the integer types which the JIT
+    // does not support.
+    std::shared_ptr<Impl> impl;
+
+    // The tiered compiler keeps its operators in a session of its own
+    friend class JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource,
+                                   TPrinter>;
+
+public:
+    TNumber Evaluate(
+        const CompilationContext& context,
+        ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+        const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option);
+
+    // Returns the number of user-defined operators which have been generated in this session
+    size_t GetNumGeneratedOperators() const;
 };
 
+// Compiles the given program with ORC and runs it. Each user-defined operator is optimized and
+// compiled when it is called for the first time, so that the operators which are never executed
+// cost nothing but the generation of their IR. If "session" is given, the compiled operators are
+// reused by the subsequent executions in the same session.
 template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
          typename TInputSource, typename TPrinter>
 TNumber EvaluateByJIT(
     const CompilationContext& context,
     ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option);
+    const std::shared_ptr<const Operator>& op, const JITCodeGenerationOption& option,
+    JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>* session =
+        nullptr);
+
+// Compiles the user-defined operators for the tiered execution of the stack machine. The
+// operators are compiled with the same pipeline as "EvaluateByJIT" on a background thread, and
+// the compiled code shares the variables with the stack machine. Unlike "EvaluateByJIT", which
+// compiles each operator when it is called for the first time, all the operators are compiled
+// eagerly and concurrently. The compiled code stays resident in a "JITSession" as long as the
+// compiler lives, so the later executions given the same compiler call it from the beginning, and
+// only compile the operators which have been redefined since then.
+template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
+         typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
+         typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter>
+class JITTieredCompiler : public StackMachineTieredCompiler<TNumber>
+{
+private:
+    struct OperatorCount
+    {
+        std::shared_ptr<const Operator> op;
+        uint32_t count;
+    };
+
+    const CompilationContext* context;
+    JITCodeGenerationOption option;
+    bool synchronous;
+    std::thread thread;
+    bool isCompiled = false;
+    JITSession<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter> session;
+
+    // The counts of the operators left by the previous executions, which are discarded when the
+    // operators are redefined
+    std::unordered_map<std::string, OperatorCount> counts;
+
+public:
+    // If "synchronous" is true, the operators are compiled on the calling thread, which makes the
+    // execution deterministic
+    JITTieredCompiler(const CompilationContext& context, const JITCodeGenerationOption& option,
+                      uint32_t threshold = StackMachineTieredCompiler<TNumber>::DefaultThreshold,
+                      bool synchronous = false);
+    virtual ~JITTieredCompiler() override;
+
+    // Gives the context and the options of the next executions. Changing the options discards all
+    // the compiled code.
+    void Configure(const CompilationContext& context, const JITCodeGenerationOption& option);
+
+    virtual void Prepare(
+        const StackMachineModule<TNumber>& module, TNumber* const* variables, uint32_t* counters,
+        std::atomic<StackMachineNativeFunction<TNumber>>* nativeFunctions) override;
+    virtual void Start(
+        const StackMachineModule<TNumber>& module, TNumber* const* variables,
+        std::atomic<StackMachineNativeFunction<TNumber>>* nativeFunctions) override;
+    virtual void Wait() override;
+    virtual void Finish(const StackMachineModule<TNumber>& module,
+                        const uint32_t* counters) override;
+
+    // Returns true if the last compilation has produced native code
+    bool IsCompiled() const;
+
+    // Returns the number of user-defined operators which have been compiled by this compiler
+    size_t GetNumGeneratedOperators() const;
+
+private:
+    void Compile(const StackMachineModule<TNumber>& module, TNumber* const* variables,
+                 std::atomic<StackMachineNativeFunction<TNumber>>* nativeFunctions);
+};
 }
@@ -16,12 +16,13 @@
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <optional>
 #include <sstream>
 #include <streambuf>
 #include <string_view>
 
 #ifdef ENABLE_GMP
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 using namespace calc4;
@@ -33,16 +34,30 @@ namespace CommandLineArgs
 constexpr std::string_view Help = "--help";
 constexpr std::string_view EnableJit = "--enable-jit";
 constexpr std::string_view DisableJit = "--disable-jit";
+constexpr std::string_view Executor = "--executor";
+constexpr std::string_view ExecutorWithValue = "--executor=";
 constexpr std::string_view NoUseTreeTraversalEvaluator = "--no-tree";
 constexpr std::string_view ForceTreeTraversalEvaluator = "--force-tree";
 constexpr std::string_view IntegerSize = "--size";
 constexpr std::string_view IntegerSizeShort = "-s";
+constexpr std::string_view MaxStackSize = "--max-stack";
+constexpr std::string_view MaxStackSizeWithValue = "--max-stack=";
 constexpr std::string_view EnableOptimization = "-O1";
 constexpr std::string_view DisableOptimization = "-O0";
+constexpr std::string_view Memoize = "--memoize";
+constexpr std::string_view JitCache = "--jit-cache";
 constexpr std::string_view InfinitePrecisionInteger = "inf";
+constexpr std::string_view ExecutorJit = "jit";
+constexpr std::string_view ExecutorTiered = "tiered";
+constexpr std::string_view ExecutorStackMachine = "stack";
+constexpr std::string_view ExecutorRegisterMachine = "register";
+constexpr std::string_view ExecutorTreeTraversal = "tree";
 constexpr std::string_view EmitCpp = "--emit-cpp";
 constexpr std::string_view EmitWat = "--emit-wat";
+constexpr std::string_view EmitBytecode = "--emit-bytecode";
+constexpr std::string_view RunBytecode = "--run-bytecode";
 constexpr std::string_view DumpProgram = "--dump";
+constexpr std::string_view Profile = "--profile";
 }
 
 namespace ReplCommands
@@ -65,6 +80,12 @@ void RunSources(const Option& option, const std::vector<const char*>& sources);
 template<typename TNumber>
 void RunAsRepl(Option& option);
 
+void RunBytecodes(const Option& option, const std::vector<const char*>& paths);
+
+template<typename TNumber>
+void RunBytecode(const Option& option, std::string_view bytecode, const char* path);
+
+std::optional<size_t> ParseByteSize(std::string_view str);
 inline const char* GetIntegerSizeDescription(int size);
 inline bool IsSupportedIntegerSize(int size);
 void PrintHelp(int argc, char** argv);
@@ -83,7 +104,8 @@ int main(int argc, char** argv)
 
 #ifdef ENABLE_JIT
     /* ***** Initialize LLVM if needed ***** */
-    if (performTest || option.executorType == ExecutorType::JIT)
+    if (performTest || option.executorType == ExecutorType::JIT ||
+        option.executorType == ExecutorType::Tiered)
     {
         LLVMInitializeNativeTarget();
         LLVMInitializeNativeAsmPrinter();
@@ -91,30 +113,38 @@ int main(int argc, char** argv)
     }
 #endif // ENABLE_JIT
 
-    switch (option.integerSize)
+    if (option.runBytecode)
     {
-    case 32:
-        Run<int32_t>(option, sources);
-        break;
-    case 64:
-        Run<int64_t>(option, sources);
-        break;
+        // The integer size is given by each bytecode file
+        RunBytecodes(option, sources);
+    }
+    else
+    {
+        switch (option.integerSize)
+        {
+        case 32:
+            Run<int32_t>(option, sources);
+            break;
+        case 64:
+            Run<int64_t>(option, sources);
+            break;
 
 #ifdef ENABLE_INT128
-    case 128:
-        Run<__int128_t>(option, sources);
-        break;
+        case 128:
+            Run<__int128_t>(option, sources);
+            break;
 #endif // ENABLE_INT128
 
 #ifdef ENABLE_GMP
-    case InfinitePrecisionIntegerSize:
-        Run<mpz_class>(option, sources);
-        break;
+        case InfinitePrecisionIntegerSize:
+            Run<HybridInteger>(option, sources);
+            break;
 #endif // ENABLE_GMP
 
-    default:
-        UNREACHABLE();
-        break;
+        default:
+            UNREACHABLE();
+            break;
+        }
     }
 
 #ifdef ENABLE_JIT
@@ -172,6 +202,49 @@ std::tuple<Option, std::vector<const char*>, bool> ParseCommandLineArgs(int argc
         {
             option.executorType = ExecutorType::StackMachine;
         }
+        else if (str == CommandLineArgs::Executor ||
+                 std::string_view(str).substr(0, CommandLineArgs::ExecutorWithValue.length()) ==
+                     CommandLineArgs::ExecutorWithValue)
+        {
+            // Both "--executor <type>" and "--executor=<type>" are accepted
+            std::string_view arg =
+                str == CommandLineArgs::Executor
+                    ? GetNextArgument()
+                    : std::string_view(str).substr(CommandLineArgs::ExecutorWithValue.length());
+
+            if (arg == CommandLineArgs::ExecutorJit)
+            {
+#ifdef ENABLE_JIT
+                option.executorType = ExecutorType::JIT;
+#else
+                ReportError("Jit compilation is not supported");
+#endif // ENABLE_JIT
+            }
+            else if (arg == CommandLineArgs::ExecutorTiered)
+            {
+#ifdef ENABLE_JIT
+                option.executorType = ExecutorType::Tiered;
+#else
+                ReportError("Jit compilation is not supported");
+#endif // ENABLE_JIT
+            }
+            else if (arg == CommandLineArgs::ExecutorStackMachine)
+            {
+                option.executorType = ExecutorType::StackMachine;
+            }
+            else if (arg == CommandLineArgs::ExecutorRegisterMachine)
+            {
+                option.executorType = ExecutorType::RegisterMachine;
+            }
+            else if (arg == CommandLineArgs::ExecutorTreeTraversal)
+            {
+                option.treeExecutorMode = TreeTraversalExecutorMode::Always;
+            }
+            else
+            {
+                ReportError("Unknown executor \"" + std::string(arg) + '\"');
+            }
+        }
         else if (str == CommandLineArgs::NoUseTreeTraversalEvaluator)
         {
             option.treeExecutorMode = TreeTraversalExecutorMode::Never;
@@ -204,6 +277,24 @@ std::tuple<Option, std::vector<const char*>, bool> ParseCommandLineArgs(int argc
                 ReportError("Unsupported integer size \"" + std::string(arg) + '\"');
             }
         }
+        else if (str == CommandLineArgs::MaxStackSize ||
+                 std::string_view(str).substr(0, CommandLineArgs::MaxStackSizeWithValue.length()) ==
+                     CommandLineArgs::MaxStackSizeWithValue)
+        {
+            // Both "--max-stack <size>" and "--max-stack=<size>" are accepted
+            std::string_view arg =
+                str == CommandLineArgs::MaxStackSize
+                    ? GetNextArgument()
+                    : std::string_view(str).substr(CommandLineArgs::MaxStackSizeWithValue.length());
+
+            auto size = ParseByteSize(arg);
+            if (!size || *size == 0)
+            {
+                ReportError("Invalid stack size \"" + std::string(arg) + '\"');
+            }
+
+            option.maxStackSize = *size;
+        }
         else if (str == CommandLineArgs::EnableOptimization)
         {
             option.optimize = true;
@@ -212,6 +303,18 @@ std::tuple<Option, std::vector<const char*>, bool> ParseCommandLineArgs(int argc
         {
             option.optimize = false;
         }
+        else if (str == CommandLineArgs::Memoize)
+        {
+            option.memoize = true;
+        }
+        else if (str == CommandLineArgs::JitCache)
+        {
+#ifdef ENABLE_JIT
+            option.jitCacheDirectory = GetNextArgument();
+#else
+            ReportError("Jit compilation is not supported");
+#endif // ENABLE_JIT
+        }
         else if (str == CommandLineArgs::EmitCpp)
         {
             option.emitCpp = true;
@@ -220,10 +323,22 @@ std::tuple<Option, std::vector<const char*>, bool> ParseCommandLineArgs(int argc
         {
             option.emitWat = true;
         }
+        else if (str == CommandLineArgs::EmitBytecode)
+        {
+            option.emitBytecode = true;
+        }
+        else if (str == CommandLineArgs::RunBytecode)
+        {
+            option.runBytecode = true;
+        }
         else if (str == CommandLineArgs::DumpProgram)
         {
             option.dumpProgram = true;
         }
+        else if (str == CommandLineArgs::Profile)
+        {
+            option.profile = true;
+        }
         else
         {
             sources.push_back(str);
@@ -244,6 +359,25 @@ std::tuple<Option, std::vector<const char*>, bool> ParseCommandLineArgs(int argc
         option.emitWat = false;
     }
 
+    if (sources.empty() && option.emitBytecode)
+    {
+        ReportWarning('\"' + std::string(CommandLineArgs::EmitBytecode) +
+                      "\" option was specified, but it will be ignored in the repl mode.");
+        option.emitBytecode = false;
+    }
+
+    if (option.runBytecode && sources.empty())
+    {
+        ReportError('\"' + std::string(CommandLineArgs::RunBytecode) +
+                    "\" option requires bytecode files.");
+    }
+
+    if (option.runBytecode && (option.emitCpp || option.emitWat || option.emitBytecode))
+    {
+        ReportError('\"' + std::string(CommandLineArgs::RunBytecode) +
+                    "\" option cannot be used with code generation options.");
+    }
+
     if (option.emitWat && (option.integerSize != 32 && option.integerSize != 64))
     {
         ReportError(
@@ -278,6 +412,14 @@ std::tuple<Option, std::vector<const char*>, bool> ParseCommandLineArgs(int argc
         ReportWarning(
             "Jit compilation is disabled because it does not support infinite precision integers.");
     }
+
+    if (option.executorType == ExecutorType::Tiered &&
+        option.integerSize == InfinitePrecisionIntegerSize)
+    {
+        option.executorType = ExecutorType::StackMachine;
+        ReportWarning("Tiered execution is disabled because the Jit compilation does not support "
+                      "infinite precision integers.");
+    }
 #endif // defined(ENABLE_JIT) && defined(ENABLE_GMP)
 
     if (option.treeExecutorMode == TreeTraversalExecutorMode::Always)
@@ -311,6 +453,9 @@ void Run(Option& option, const std::vector<const char*>& sources)
 template<typename TNumber>
 void RunSources(const Option& option, const std::vector<const char*>& sources)
 {
+    // The stacks of the executors are shared among all the given sources
+    ExecutorResources<TNumber> resources(option);
+
     for (auto path : sources)
     {
         std::ifstream ifs(path);
@@ -325,10 +470,70 @@ void RunSources(const Option& option, const std::vector<const char*>& sources)
 
         CompilationContext context;
         ExecutionState<TNumber> state;
-        ExecuteSource(source, path, context, state, option, std::cout);
+        ExecuteSource(source, path, context, state, resources, option, std::cout);
+    }
+}
+
+void RunBytecodes(const Option& option, const std::vector<const char*>& paths)
+{
+    for (auto path : paths)
+    {
+        // Bytecode files are memory-mapped and executed without being copied into strings
+        MappedFile file(path);
+        if (!file.IsOpen())
+        {
+            std::cerr << "Error: Could not open \"" << path << "\"" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        int integerSize;
+        try
+        {
+            integerSize = GetStackMachineBytecodeIntegerSize(file.GetContent());
+        }
+        catch (Exceptions::Calc4Exception& error)
+        {
+            std::cout << path << ": Error: " << error.what() << std::endl;
+            continue;
+        }
+
+        switch (integerSize)
+        {
+        case 32:
+            RunBytecode<int32_t>(option, file.GetContent(), path);
+            break;
+        case 64:
+            RunBytecode<int64_t>(option, file.GetContent(), path);
+            break;
+
+#ifdef ENABLE_INT128
+        case 128:
+            RunBytecode<__int128_t>(option, file.GetContent(), path);
+            break;
+#endif // ENABLE_INT128
+
+#ifdef ENABLE_GMP
+        case InfinitePrecisionBytecodeIntegerSize:
+            RunBytecode<HybridInteger>(option, file.GetContent(), path);
+            break;
+#endif // ENABLE_GMP
+
+        default:
+            std::cout << path << ": Error: Unsupported integer size " << integerSize
+                      << std::endl;
+            break;
+        }
     }
 }
 
+template<typename TNumber>
+void RunBytecode(const Option& option, std::string_view bytecode, const char* path)
+{
+    ExecutorResources<TNumber> resources(option);
+    ExecutionState<TNumber> state;
+    ExecuteBytecode(bytecode, path, state, resources, option, std::cout);
+}
+
 template<typename TNumber>
 void RunAsRepl(Option& option)
 {
@@ -345,6 +550,7 @@ void RunAsRepl(Option& option)
 
     CompilationContext context;
     ExecutionState<TNumber> state;
+    ExecutorResources<TNumber> resources(option);
 
     while (true)
     {
@@ -388,11 +594,66 @@ void RunAsRepl(Option& option)
             continue;
         }
 
-        ExecuteSource<TNumber>(line, nullptr, context, state, option, std::cout);
+        ExecuteSource<TNumber>(line, nullptr, context, state, resources, option, std::cout);
         std::cout << std::endl;
     }
 }
 
+// Parses sizes such as "512", "64K", "16M" and "4G"
+std::optional<size_t> ParseByteSize(std::string_view str)
+{
+    size_t value = 0;
+    size_t i = 0;
+
+    for (; i < str.length() && '0' <= str[i] && str[i] <= '9'; i++)
+    {
+        if (value > (std::numeric_limits<size_t>::max() - 9) / 10)
+        {
+            return std::nullopt;
+        }
+
+        value = value * 10 + (str[i] - '0');
+    }
+
+    if (i == 0)
+    {
+        return std::nullopt;
+    }
+
+    int shift = 0;
+    if (i + 1 == str.length())
+    {
+        switch (str[i])
+        {
+        case 'K':
+        case 'k':
+            shift = 10;
+            break;
+        case 'M':
+        case 'm':
+            shift = 20;
+            break;
+        case 'G':
+        case 'g':
+            shift = 30;
+            break;
+        default:
+            return std::nullopt;
+        }
+    }
+    else if (i != str.length())
+    {
+        return std::nullopt;
+    }
+
+    if (value > (std::numeric_limits<size_t>::max() >> shift))
+    {
+        return std::nullopt;
+    }
+
+    return value << shift;
+}
+
 inline const char* GetIntegerSizeDescription(int size)
 {
     switch (size)
@@ -465,10 +726,32 @@ void PrintHelp(int argc, char** argv)
          << CommandLineArgs::EnableJit << endl
          << Indent << "Enable JIT compilation (default)" << endl
 #endif // ENABLE_JIT
+         << CommandLineArgs::Executor << " <type>" << endl
+         << Indent << "Specify the executor" << endl
+         << Indent << "type: "
+#ifdef ENABLE_JIT
+         << CommandLineArgs::ExecutorJit << " (default), " << CommandLineArgs::ExecutorTiered
+         << ", "
+#endif // ENABLE_JIT
+         << CommandLineArgs::ExecutorStackMachine
+#ifndef ENABLE_JIT
+         << " (default)"
+#endif // ENABLE_JIT
+         << ", " << CommandLineArgs::ExecutorRegisterMachine << ", "
+         << CommandLineArgs::ExecutorTreeTraversal << endl
+         << CommandLineArgs::MaxStackSize << " <size>" << endl
+         << Indent << "Specify the maximum size of the stacks used by the executors" << endl
+         << Indent << "size: bytes with an optional suffix K, M or G (e.g. 4G)" << endl
          << CommandLineArgs::DisableOptimization << endl
          << Indent << "Disable optimization" << endl
          << CommandLineArgs::EnableOptimization << endl
          << Indent << "Enable optimization (default)" << endl
+         << CommandLineArgs::Memoize << endl
+         << Indent << "Memoize the results of user-defined operators without side effects" << endl
+#ifdef ENABLE_JIT
+         << CommandLineArgs::JitCache << " <directory>" << endl
+         << Indent << "Cache the code compiled by the JIT executor in the directory" << endl
+#endif // ENABLE_JIT
          << CommandLineArgs::NoUseTreeTraversalEvaluator << endl
          << Indent << "Always use the JIT or stack machine executors" << endl
          << Indent
@@ -481,8 +764,16 @@ void PrintHelp(int argc, char** argv)
          << Indent << "Emit C++ code for source input (experimental feature)" << endl
          << CommandLineArgs::EmitWat << endl
          << Indent << "Emit WebAssembly Text Format for source input (experimental feature)" << endl
+         << CommandLineArgs::EmitBytecode << endl
+         << Indent << "Emit stack machine bytecode (.c4b) for source input" << endl
+         << CommandLineArgs::RunBytecode << endl
+         << Indent << "Execute the given bytecode files instead of source files" << endl
          << CommandLineArgs::DumpProgram << endl
          << Indent << "Dump the given program's structures such as an abstract syntax tree" << endl
+         << CommandLineArgs::Profile << endl
+         << Indent << "Print the call counts and times of user-defined operators" << endl
+         << Indent << "(The call stacks are also written to a .folded file for flamegraph tools)"
+         << endl
          << endl
          << "During the Repl mode, the following commands are available:" << endl
          << Indent << ReplCommands::DumpOff << endl
@@ -499,9 +790,13 @@ const char* GetExecutorTypeString(ExecutorType type)
 #ifdef ENABLE_JIT
     case ExecutorType::JIT:
         return "JIT";
+    case ExecutorType::Tiered:
+        return "Tiered";
 #endif // ENABLE_JIT
     case ExecutorType::StackMachine:
         return "StackMachine";
+    case ExecutorType::RegisterMachine:
+        return "RegisterMachine";
     case ExecutorType::TreeTraversal:
         return "TreeTraversal";
     default:
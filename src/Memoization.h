@@ -0,0 +1,149 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include "CallGraph.h"
+#include "Operators.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef ENABLE_GMP
+#include "HybridInteger.h"
+#endif // ENABLE_GMP
+
+namespace calc4
+{
+template<typename TNumber>
+uint64_t HashNumber(const TNumber& value)
+{
+#ifdef ENABLE_GMP
+    if constexpr (std::is_same_v<TNumber, HybridInteger>)
+    {
+        return value.FitsInt64() ? static_cast<uint64_t>(value.GetInt64())
+                                 : std::hash<std::string>{}(value.GetMpz().get_str(16));
+    }
+    else
+#endif // ENABLE_GMP
+    {
+        if constexpr (sizeof(TNumber) > sizeof(uint64_t))
+        {
+            return static_cast<uint64_t>(value) ^ static_cast<uint64_t>(value >> 64);
+        }
+        else
+        {
+            return static_cast<uint64_t>(value);
+        }
+    }
+}
+
+// Cache of the results of a pure operator keyed on its operands. The cache is direct-mapped, that
+// is, a new result evicts the one at the same slot, so that its memory usage is bounded. The slots
+// are allocated when the first result is inserted.
+template<typename TNumber>
+class MemoizationTable
+{
+private:
+    int numOperands;
+    int numIndexBits;
+
+    // Each slot holds the operands followed by the result
+    std::vector<TNumber> slots;
+    std::vector<bool> isUsed;
+
+    size_t GetIndex(const TNumber* operands) const
+    {
+        uint64_t hash = 0;
+        for (int i = 0; i < numOperands; i++)
+        {
+            hash = (hash ^ HashNumber(operands[i])) * UINT64_C(0x9e3779b97f4a7c15);
+        }
+
+        // The upper bits are mixed best by the multiplication
+        return numOperands == 0 ? 0 : static_cast<size_t>(hash >> (64 - numIndexBits));
+    }
+
+public:
+    static constexpr int DefaultNumIndexBits = 16;
+
+    explicit MemoizationTable(int numOperands, int numIndexBits = DefaultNumIndexBits)
+        : numOperands(numOperands), numIndexBits(numIndexBits)
+    {
+        assert(numIndexBits > 0 && numIndexBits < 64);
+    }
+
+    int GetNumOperands() const
+    {
+        return numOperands;
+    }
+
+    // Returns the memoized result for the given operands, or nullptr if there is no such result
+    const TNumber* Find(const TNumber* operands) const
+    {
+        if (slots.empty())
+        {
+            return nullptr;
+        }
+
+        size_t index = GetIndex(operands);
+        if (!isUsed[index])
+        {
+            return nullptr;
+        }
+
+        const TNumber* slot = &slots[index * (numOperands + 1)];
+        for (int i = 0; i < numOperands; i++)
+        {
+            if (!(slot[i] == operands[i]))
+            {
+                return nullptr;
+            }
+        }
+
+        return slot + numOperands;
+    }
+
+    void Insert(const TNumber* operands, const TNumber& result)
+    {
+        if (slots.empty())
+        {
+            size_t numSlots = numOperands == 0 ? 1 : (static_cast<size_t>(1) << numIndexBits);
+            slots.resize(numSlots * (numOperands + 1));
+            isUsed.resize(numSlots);
+        }
+
+        size_t index = GetIndex(operands);
+        TNumber* slot = &slots[index * (numOperands + 1)];
+        std::copy(operands, operands + numOperands, slot);
+        slot[numOperands] = result;
+        isUsed[index] = true;
+    }
+};
+
+// Creates an empty table for each pure operator in the given context
+template<typename TNumber>
+std::unordered_map<std::string, MemoizationTable<TNumber>> CreateMemoizationTables(
+    const CompilationContext& context)
+{
+    std::unordered_map<std::string, MemoizationTable<TNumber>> tables;
+    for (auto& name : CallGraph(context).GetPureOperators())
+    {
+        int numOperands = context.GetOperatorImplement(name).GetDefinition().GetNumOperands();
+        tables.emplace(name, MemoizationTable<TNumber>(numOperands));
+    }
+
+    return tables;
+}
+}
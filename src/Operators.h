@@ -10,6 +10,7 @@
 #pragma once
 
 #include "Common.h"
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <optional>
@@ -92,19 +93,80 @@ public:
     }
 };
 
+// User-defined operators called in an operator, and whether the operator has side effects by
+// itself, that is, accesses variables, the global array, input or output
+struct CallSummary
+{
+    std::vector<std::string> callees;
+    bool hasSideEffects = false;
+};
+
+inline std::shared_ptr<const CallSummary> SummarizeCalls(const std::shared_ptr<const Operator>& op);
+
 class OperatorImplement
 {
 private:
     OperatorDefinition definition;
     std::shared_ptr<const Operator> op;
 
+    // The operator before optimization. The optimizer starts over from it, so that the operators
+    // inlined into others can be redefined later.
+    std::shared_ptr<const Operator> sourceOp;
+
+    // Version of "sourceOp", which is assigned by CompilationContext when the operator is defined
+    uint64_t version = 0;
+
+    // Largest version among this operator and the ones it can call when "op" was optimized, or
+    // zero if "op" is not optimized yet. The optimizer skips the operators whose versions have not
+    // changed since then.
+    uint64_t optimizedVersion = 0;
+
+    // The calls in "op" and "sourceOp", which are gathered once so that the call graph is built
+    // without walking the bodies of the operators
+    std::shared_ptr<const CallSummary> callSummary;
+    std::shared_ptr<const CallSummary> sourceCallSummary;
+
+    // The source defining this operator, which is kept to print the errors raised in it
+    std::shared_ptr<const SourceText> source;
+
+    friend class CompilationContext;
+
 public:
     OperatorImplement(const OperatorDefinition& definition,
                       const std::shared_ptr<const Operator>& op)
-        : definition(definition), op(op)
+        : definition(definition), op(op), sourceOp(op), callSummary(SummarizeCalls(op)),
+          sourceCallSummary(callSummary)
     {
     }
 
+    OperatorImplement(const OperatorDefinition& definition,
+                      const std::shared_ptr<const Operator>& op,
+                      const std::shared_ptr<const SourceText>& source)
+        : definition(definition), op(op), sourceOp(op), callSummary(SummarizeCalls(op)),
+          sourceCallSummary(callSummary), source(source)
+    {
+    }
+
+    OperatorImplement(const OperatorDefinition& definition,
+                      const std::shared_ptr<const Operator>& op,
+                      const std::shared_ptr<const Operator>& sourceOp)
+        : definition(definition), op(op), sourceOp(sourceOp), callSummary(SummarizeCalls(op)),
+          sourceCallSummary(SummarizeCalls(sourceOp))
+    {
+    }
+
+    // Returns a copy of this operator whose body is replaced with the optimized one, keeping the
+    // source operator and its version
+    OperatorImplement WithOptimizedOperator(const std::shared_ptr<const Operator>& optimizedOp,
+                                            uint64_t newOptimizedVersion = 0) const
+    {
+        OperatorImplement result = *this;
+        result.op = optimizedOp;
+        result.callSummary = SummarizeCalls(optimizedOp);
+        result.optimizedVersion = newOptimizedVersion;
+        return result;
+    }
+
     const OperatorDefinition& GetDefinition() const
     {
         return definition;
@@ -114,21 +176,65 @@ public:
     {
         return op;
     }
+
+    const std::shared_ptr<const Operator>& GetSourceOperator() const
+    {
+        return sourceOp;
+    }
+
+    uint64_t GetVersion() const
+    {
+        return version;
+    }
+
+    uint64_t GetOptimizedVersion() const
+    {
+        return optimizedVersion;
+    }
+
+    const CallSummary& GetCallSummary() const
+    {
+        return *callSummary;
+    }
+
+    const CallSummary& GetSourceCallSummary() const
+    {
+        return *sourceCallSummary;
+    }
+
+    const std::shared_ptr<const SourceText>& GetSource() const
+    {
+        return source;
+    }
 };
 
 class CompilationContext
 {
 private:
     std::map<std::string, OperatorImplement> userDefinedOperators;
+    uint64_t latestVersion = 0;
+
+    // Id of the latest source lexed with this context
+    int latestSourceId = 0;
 
 public:
+    // Adds or replaces the given operator. A new source operator is given a new version, which is
+    // larger than any other, while an optimized operator keeps the version of its source.
     void AddOperatorImplement(const OperatorImplement& implement)
     {
         auto p = userDefinedOperators.insert(
             std::make_pair(implement.GetDefinition().GetName(), implement));
-        if (!p.second)
+        auto& added = p.first->second;
+        if (p.second)
         {
-            p.first->second = implement;
+            added.version = ++latestVersion;
+        }
+        else
+        {
+            bool isSameSource = added.sourceOp == implement.sourceOp;
+            uint64_t version = isSameSource ? added.version : ++latestVersion;
+            added = implement;
+            added.version = version;
         }
     }
 
@@ -152,6 +258,29 @@ public:
         }
     }
 
+    // Gives the given source text an id, which the positions in it refer to. The ids start from
+    // one. The context does not keep the text by itself, but the operators defined in it do.
+    std::shared_ptr<const SourceText> AddSource(std::string_view text)
+    {
+        return std::make_shared<const SourceText>(
+            SourceText{ ++latestSourceId, std::string(text) });
+    }
+
+    // Returns the text of the given source, or nullptr if no operator defined in it is left in
+    // this context
+    const std::string* FindSource(int sourceId) const
+    {
+        for (auto& [name, implement] : userDefinedOperators)
+        {
+            if (implement.source != nullptr && implement.source->id == sourceId)
+            {
+                return &implement.source->text;
+            }
+        }
+
+        return nullptr;
+    }
+
     decltype(userDefinedOperators.cbegin()) UserDefinedOperatorBegin() const
     {
         return userDefinedOperators.cbegin();
@@ -612,10 +741,14 @@ class BinaryOperator : public Operator, public std::enable_shared_from_this<Bina
 private:
     std::shared_ptr<const Operator> left, right;
     BinaryType type;
+    std::optional<CharPosition> position;
+    bool isDivisorNonZero;
 
     BinaryOperator(const std::shared_ptr<const Operator>& left,
-                   const std::shared_ptr<const Operator>& right, BinaryType type)
-        : left(left), right(right), type(type)
+                   const std::shared_ptr<const Operator>& right, BinaryType type,
+                   const std::optional<CharPosition>& position, bool isDivisorNonZero)
+        : left(left), right(right), type(type), position(position),
+          isDivisorNonZero(isDivisorNonZero)
     {
     }
 
@@ -624,9 +757,11 @@ private:
 public:
     static std::shared_ptr<const BinaryOperator> Create(
         const std::shared_ptr<const Operator>& left, const std::shared_ptr<const Operator>& right,
-        BinaryType type)
+        BinaryType type, const std::optional<CharPosition>& position = std::nullopt,
+        bool isDivisorNonZero = false)
     {
-        return AllocateHelper<BinaryOperator>::Allocate(left, right, type);
+        return AllocateHelper<BinaryOperator>::Allocate(left, right, type, position,
+                                                        isDivisorNonZero);
     }
 
     BinaryType GetType() const
@@ -634,6 +769,19 @@ public:
         return type;
     }
 
+    // True if the optimizer has proven that the right operand of a division or modulo is never
+    // zero, in which case the backends omit the check for zero division
+    bool IsDivisorNonZero() const
+    {
+        return isDivisorNonZero;
+    }
+
+    // Position of the token in the source code, which is used to report runtime errors
+    const std::optional<CharPosition>& GetPosition() const
+    {
+        return position;
+    }
+
     const std::shared_ptr<const Operator>& GetLeft() const
     {
         return left;
@@ -660,7 +808,13 @@ public:
                                                  "LogicalAnd",
                                                  "LogicalOr" };
         std::ostringstream oss;
-        oss << "BinaryOperator [Type = " << BinaryTypeTable[(size_t)type] << "]";
+        oss << "BinaryOperator [Type = " << BinaryTypeTable[(size_t)type];
+        if (type == BinaryType::Div || type == BinaryType::Mod)
+        {
+            oss << ", IsDivisorNonZero = " << (isDivisorNonZero ? "True" : "False");
+        }
+
+        oss << "]";
         return oss.str();
     }
 
@@ -723,11 +877,13 @@ private:
     OperatorDefinition definition;
     std::vector<std::shared_ptr<const Operator>> operands;
     std::optional<bool> isTailCall;
+    std::optional<CharPosition> position;
 
     UserDefinedOperator(const OperatorDefinition& definition,
                         const std::vector<std::shared_ptr<const Operator>>& operands,
-                        std::optional<bool> isTailCall = std::nullopt)
-        : definition(definition), operands(operands), isTailCall(isTailCall)
+                        std::optional<bool> isTailCall,
+                        const std::optional<CharPosition>& position)
+        : definition(definition), operands(operands), isTailCall(isTailCall), position(position)
     {
     }
 
@@ -737,9 +893,11 @@ public:
     static std::shared_ptr<const UserDefinedOperator> Create(
         const OperatorDefinition& definition,
         const std::vector<std::shared_ptr<const Operator>>& operands,
-        std::optional<bool> isTailCall = std::nullopt)
+        std::optional<bool> isTailCall = std::nullopt,
+        const std::optional<CharPosition>& position = std::nullopt)
     {
-        return AllocateHelper<UserDefinedOperator>::Allocate(definition, operands, isTailCall);
+        return AllocateHelper<UserDefinedOperator>::Allocate(definition, operands, isTailCall,
+                                                             position);
     }
 
     const OperatorDefinition& GetDefinition() const
@@ -752,6 +910,12 @@ public:
         return isTailCall;
     }
 
+    // Position of the token in the source code, which is used to report runtime errors
+    const std::optional<CharPosition>& GetPosition() const
+    {
+        return position;
+    }
+
     // TODO:
     std::vector<std::shared_ptr<const Operator>> GetOperands() const override
     {
@@ -810,4 +974,99 @@ inline std::set<std::string_view> GatherVariableNames(const std::shared_ptr<cons
 
     return result;
 }
+
+class CallSummaryVisitor : public OperatorVisitor
+{
+public:
+    CallSummary summary;
+
+    virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override {}
+
+    virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override {}
+
+    virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override {}
+
+    virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override {}
+
+    virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+    {
+        summary.hasSideEffects = true;
+    }
+
+    virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+    {
+        summary.hasSideEffects = true;
+    }
+
+    virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+    {
+        summary.hasSideEffects = true;
+        op->GetIndex()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+    {
+        summary.hasSideEffects = true;
+        op->GetCharacter()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+    {
+        for (auto& child : op->GetOperators())
+        {
+            child->Accept(*this);
+        }
+    }
+
+    virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+    {
+        op->GetOperand()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+    {
+        summary.hasSideEffects = true;
+        op->GetOperand()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+    {
+        summary.hasSideEffects = true;
+        op->GetValue()->Accept(*this);
+        op->GetIndex()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+    {
+        op->GetLeft()->Accept(*this);
+        op->GetRight()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+    {
+        op->GetCondition()->Accept(*this);
+        op->GetIfTrue()->Accept(*this);
+        op->GetIfFalse()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+    {
+        summary.callees.push_back(op->GetDefinition().GetName());
+        for (auto& operand : op->GetOperands())
+        {
+            operand->Accept(*this);
+        }
+    }
+};
+
+inline std::shared_ptr<const CallSummary> SummarizeCalls(const std::shared_ptr<const Operator>& op)
+{
+    CallSummaryVisitor visitor;
+    if (op != nullptr)
+    {
+        op->Accept(visitor);
+    }
+
+    return std::make_shared<CallSummary>(std::move(visitor.summary));
+}
 }
@@ -8,23 +8,232 @@
  *****/
 
 #include "Optimizer.h"
+#include "CallGraph.h"
 #include "Operators.h"
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <limits>
+#include <optional>
 #include <stack>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #ifdef ENABLE_GMP
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 namespace calc4
 {
 namespace
 {
+// Maximum number of operators evaluated for each call evaluated at compile time
+constexpr int MaxConstantEvaluationSteps = 100000;
+
+// Maximum depth of calls evaluated at compile time, which keeps the evaluation from overflowing
+// the native stack
+constexpr int MaxConstantEvaluationDepth = 1000;
+
+// Thrown when a call cannot be evaluated at compile time, in which case it is left to runtime
+struct ConstantEvaluationAbortedException
+{
+};
+
+// Evaluates calls of pure operators whose operands are constants
+template<typename TNumber>
+class ConstantEvaluator : public OperatorVisitor
+{
+private:
+    const CompilationContext& context;
+    int steps = 0;
+    std::stack<const TNumber*> arguments;
+
+    TNumber Evaluate(const std::shared_ptr<const Operator>& op)
+    {
+        if (++steps > MaxConstantEvaluationSteps)
+        {
+            throw ConstantEvaluationAbortedException();
+        }
+
+        op->Accept(*this);
+        return value;
+    }
+
+public:
+    TNumber value;
+
+    ConstantEvaluator(const CompilationContext& context) : context(context) {}
+
+    TNumber EvaluateCall(const OperatorDefinition& definition, const TNumber* operands)
+    {
+        if (arguments.size() >= MaxConstantEvaluationDepth)
+        {
+            throw ConstantEvaluationAbortedException();
+        }
+
+        arguments.push(operands);
+        TNumber result = Evaluate(context.GetOperatorImplement(definition.GetName()).GetOperator());
+        arguments.pop();
+        return result;
+    }
+
+    virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
+    {
+        value = 0;
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override
+    {
+        value = op->GetValue<TNumber>();
+    }
+
+    virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
+    {
+        value = arguments.top()[op->GetIndex()];
+    }
+
+    virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
+    {
+        value = 0;
+    }
+
+    // Pure operators never access variables, the global array, input or output
+    virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+    {
+        throw ConstantEvaluationAbortedException();
+    }
+
+    virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+    {
+        throw ConstantEvaluationAbortedException();
+    }
+
+    virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+    {
+        throw ConstantEvaluationAbortedException();
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+    {
+        throw ConstantEvaluationAbortedException();
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+    {
+        throw ConstantEvaluationAbortedException();
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+    {
+        throw ConstantEvaluationAbortedException();
+    }
+
+    virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+    {
+        TNumber result = 0;
+        for (auto& op2 : op->GetOperators())
+        {
+            result = Evaluate(op2);
+        }
+
+        value = result;
+    }
+
+    virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+    {
+        value = Evaluate(op->GetOperand()) * 10 + op->GetValue();
+    }
+
+    virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+    {
+        TNumber left = Evaluate(op->GetLeft());
+
+        switch (op->GetType())
+        {
+        case BinaryType::LogicalAnd:
+            value = (left != 0 && Evaluate(op->GetRight()) != 0) ? 1 : 0;
+            return;
+        case BinaryType::LogicalOr:
+            value = (left != 0 || Evaluate(op->GetRight()) != 0) ? 1 : 0;
+            return;
+        default:
+            break;
+        }
+
+        TNumber right = Evaluate(op->GetRight());
+
+        switch (op->GetType())
+        {
+        case BinaryType::Add:
+            value = left + right;
+            break;
+        case BinaryType::Sub:
+            value = left - right;
+            break;
+        case BinaryType::Mult:
+            value = left * right;
+            break;
+        case BinaryType::Div:
+        case BinaryType::Mod:
+            // Errors and overflows are reported at runtime
+            if (right == 0 || right == -1)
+            {
+                throw ConstantEvaluationAbortedException();
+            }
+
+            value = op->GetType() == BinaryType::Div ? left / right : left % right;
+            break;
+        case BinaryType::Equal:
+            value = (left == right) ? 1 : 0;
+            break;
+        case BinaryType::NotEqual:
+            value = (left != right) ? 1 : 0;
+            break;
+        case BinaryType::LessThan:
+            value = (left < right) ? 1 : 0;
+            break;
+        case BinaryType::LessThanOrEqual:
+            value = (left <= right) ? 1 : 0;
+            break;
+        case BinaryType::GreaterThanOrEqual:
+            value = (left >= right) ? 1 : 0;
+            break;
+        case BinaryType::GreaterThan:
+            value = (left > right) ? 1 : 0;
+            break;
+        default:
+            UNREACHABLE();
+            break;
+        }
+    }
+
+    virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+    {
+        value = Evaluate(op->GetCondition()) != 0 ? Evaluate(op->GetIfTrue())
+                                                  : Evaluate(op->GetIfFalse());
+    }
+
+    virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+    {
+        auto operands = op->GetOperands();
+        std::vector<TNumber> evaluated(operands.size());
+        for (size_t i = 0; i < operands.size(); i++)
+        {
+            evaluated[i] = Evaluate(operands[i]);
+        }
+
+        value = EvaluateCall(op->GetDefinition(), evaluated.data());
+    }
+};
+
 template<typename TNumber>
 class PrecomputeVisitor : public OperatorVisitor
 {
 private:
     CompilationContext& context;
+    const CallGraph& callGraph;
 
     std::shared_ptr<const Operator> Precompute(const std::shared_ptr<const Operator>& op)
     {
@@ -48,7 +257,10 @@ private:
 public:
     std::shared_ptr<const Operator> value;
 
-    PrecomputeVisitor(CompilationContext& context) : context(context) {}
+    PrecomputeVisitor(CompilationContext& context, const CallGraph& callGraph)
+        : context(context), callGraph(callGraph)
+    {
+    }
 
     virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
     {
@@ -172,10 +384,10 @@ public:
                 }
                 value = BinaryOperator::Create(right,
                                                PrecomputedOperator::Create(static_cast<TNumber>(0)),
-                                               BinaryType::NotEqual);
+                                               BinaryType::NotEqual, op->GetPosition());
                 return;
             }
-            value = BinaryOperator::Create(left, right, op->GetType());
+            value = BinaryOperator::Create(left, right, op->GetType(), op->GetPosition());
             return;
         }
 
@@ -196,10 +408,10 @@ public:
                 }
                 value = BinaryOperator::Create(right,
                                                PrecomputedOperator::Create(static_cast<TNumber>(0)),
-                                               BinaryType::NotEqual);
+                                               BinaryType::NotEqual, op->GetPosition());
                 return;
             }
-            value = BinaryOperator::Create(left, right, op->GetType());
+            value = BinaryOperator::Create(left, right, op->GetType(), op->GetPosition());
             return;
         }
 
@@ -258,7 +470,7 @@ public:
         }
         else
         {
-            value = BinaryOperator::Create(left, right, op->GetType());
+            value = BinaryOperator::Create(left, right, op->GetType(), op->GetPosition());
         }
     };
 
@@ -281,37 +493,236 @@ public:
 
     virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
     {
+        auto originalOperands = op->GetOperands();
         std::vector<std::shared_ptr<const Operator>> operands;
+        std::vector<TNumber> operandValues(originalOperands.size());
+        bool allPrecomputed = true;
 
-        for (auto& op2 : op->GetOperands())
+        for (size_t i = 0; i < originalOperands.size(); i++)
+        {
+            operands.push_back(Precompute(originalOperands[i]));
+            if (!TryGetPrecomputedValue(operands[i], &operandValues[i]))
+            {
+                allPrecomputed = false;
+            }
+        }
+
+        // Calls of pure operators with constant operands are evaluated now if they finish within
+        // the budget
+        if (allPrecomputed && callGraph.IsPure(op->GetDefinition().GetName()))
         {
-            operands.push_back(Precompute(op2));
+            try
+            {
+                ConstantEvaluator<TNumber> evaluator(context);
+                value = PrecomputedOperator::Create(
+                    evaluator.EvaluateCall(op->GetDefinition(), operandValues.data()));
+                return;
+            }
+            catch (const ConstantEvaluationAbortedException&)
+            {
+            }
         }
 
-        value = UserDefinedOperator::Create(op->GetDefinition(), std::move(operands));
+        value = UserDefinedOperator::Create(op->GetDefinition(), std::move(operands), std::nullopt,
+                                            op->GetPosition());
     };
 };
 
-class TailCallVisitor : public OperatorVisitor
+// Maximum number of operators in the bodies of inlined operators
+constexpr int MaxInlinedOperatorSize = 16;
+
+// Each round of inlining makes the callers of leaf operators leaves in turn, so this limits the
+// depth of the call chains inlined
+constexpr int MaxInliningRounds = 8;
+
+// Gathers the properties of an operator which decide whether it can be inlined or substituted
+// for an operand
+template<typename TNumber>
+class InliningAnalyzer : public OperatorVisitor
 {
 private:
-    std::shared_ptr<const Operator> Process(const std::shared_ptr<const Operator>& op,
-                                            bool isTailCall)
+    int conditionalDepth = 0;
+
+    void AddOperandUse(int index)
     {
-        stack.push(isTailCall);
+        if (numUses.size() <= static_cast<size_t>(index))
+        {
+            numUses.resize(index + 1);
+        }
+
+        numUses[index]++;
+        if (conditionalDepth == 0)
+        {
+            unconditionalUses.push_back(index);
+        }
+    }
+
+    void VisitConditionally(const std::shared_ptr<const Operator>& op)
+    {
+        conditionalDepth++;
         op->Accept(*this);
-        stack.pop();
-        return value;
+        conditionalDepth--;
     }
 
-    bool IsCurrentOperatorInTail() const
+public:
+    int size = 0;
+    bool hasCall = false;
+
+    // True if the operator neither has side effects nor reads variables or the global array, and
+    // never throws. Such operators can be evaluated at any time.
+    bool isSimple = true;
+
+    // Number of uses of each operand, and the operands always used in evaluation order
+    std::vector<int> numUses;
+    std::vector<int> unconditionalUses;
+
+    int GetNumUses(int index) const
     {
-        return stack.top();
+        return static_cast<size_t>(index) < numUses.size() ? numUses[index] : 0;
+    }
+
+    virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
+    {
+        size++;
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override
+    {
+        size++;
+    }
+
+    virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
+    {
+        size++;
+        AddOperandUse(op->GetIndex());
+    }
+
+    virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
+    {
+        size++;
+    }
+
+    virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+    {
+        size++;
+        isSimple = false;
+    }
+
+    virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+    {
+        size++;
+        isSimple = false;
+    }
+
+    virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+    {
+        size++;
+        isSimple = false;
+        op->GetIndex()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+    {
+        size++;
+        isSimple = false;
+        op->GetCharacter()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+    {
+        size++;
+        for (auto& op2 : op->GetOperators())
+        {
+            op2->Accept(*this);
+        }
+    }
+
+    virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+    {
+        size++;
+        op->GetOperand()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+    {
+        size++;
+        isSimple = false;
+        op->GetOperand()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+    {
+        size++;
+        isSimple = false;
+        op->GetValue()->Accept(*this);
+        op->GetIndex()->Accept(*this);
+    }
+
+    virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+    {
+        size++;
+
+        if (op->GetType() == BinaryType::Div || op->GetType() == BinaryType::Mod)
+        {
+            // Only divisions by constants other than 0 and -1 never throw nor overflow
+            auto divisor = std::dynamic_pointer_cast<const PrecomputedOperator>(op->GetRight());
+            if (divisor == nullptr || divisor->GetValue<TNumber>() == 0 ||
+                divisor->GetValue<TNumber>() == -1)
+            {
+                isSimple = false;
+            }
+        }
+
+        op->GetLeft()->Accept(*this);
+        if (op->GetType() == BinaryType::LogicalAnd || op->GetType() == BinaryType::LogicalOr)
+        {
+            VisitConditionally(op->GetRight());
+        }
+        else
+        {
+            op->GetRight()->Accept(*this);
+        }
+    }
+
+    virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+    {
+        size++;
+        op->GetCondition()->Accept(*this);
+        VisitConditionally(op->GetIfTrue());
+        VisitConditionally(op->GetIfFalse());
+    }
+
+    virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+    {
+        size++;
+        hasCall = true;
+        isSimple = false;
+        for (auto& op2 : op->GetOperands())
+        {
+            op2->Accept(*this);
+        }
+    }
+};
+
+// Replaces the operands in the body of an inlined operator with the given operators
+class SubstituteVisitor : public OperatorVisitor
+{
+private:
+    const std::vector<std::shared_ptr<const Operator>>& operands;
+
+    std::shared_ptr<const Operator> Substitute(const std::shared_ptr<const Operator>& op)
+    {
+        op->Accept(*this);
+        return value;
     }
 
 public:
     std::shared_ptr<const Operator> value;
-    std::stack<bool> stack{ { true } };
+
+    SubstituteVisitor(const std::vector<std::shared_ptr<const Operator>>& operands)
+        : operands(operands)
+    {
+    }
 
     virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
     {
@@ -325,7 +736,7 @@ public:
 
     virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
     {
-        value = op;
+        value = operands[op->GetIndex()];
     };
 
     virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
@@ -345,90 +756,912 @@ public:
 
     virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
     {
-        std::shared_ptr<const Operator> index = Process(op->GetIndex(), false);
-        value = LoadArrayOperator::Create(index);
+        value = LoadArrayOperator::Create(Substitute(op->GetIndex()));
     };
 
     virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
     {
-        std::shared_ptr<const Operator> character = Process(op->GetCharacter(), false);
-        value = PrintCharOperator::Create(character);
+        value = PrintCharOperator::Create(Substitute(op->GetCharacter()));
     };
 
     virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
     {
-        auto& operators = op->GetOperators();
-        std::vector<std::shared_ptr<const Operator>> optimized;
-
-        for (size_t i = 0; i < operators.size(); i++)
+        std::vector<std::shared_ptr<const Operator>> substituted;
+        for (auto& op2 : op->GetOperators())
         {
-            std::shared_ptr<const Operator> processed =
-                Process(operators[i], i < operators.size() - 1 ? false : IsCurrentOperatorInTail());
-            optimized.push_back(processed);
+            substituted.push_back(Substitute(op2));
         }
 
-        value = ParenthesisOperator::Create(std::move(optimized));
+        value = ParenthesisOperator::Create(std::move(substituted));
     };
 
     virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
     {
-        std::shared_ptr<const Operator> precomputed = Process(op->GetOperand(), false);
-        value = DecimalOperator::Create(precomputed, op->GetValue());
+        value = DecimalOperator::Create(Substitute(op->GetOperand()), op->GetValue());
     };
 
     virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
     {
-        std::shared_ptr<const Operator> operand = Process(op->GetOperand(), false);
-        value = StoreVariableOperator::Create(operand, op->GetVariableName());
+        value = StoreVariableOperator::Create(Substitute(op->GetOperand()), op->GetVariableName());
     }
 
     virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
     {
-        std::shared_ptr<const Operator> valueToBeStored = Process(op->GetValue(), false);
-        std::shared_ptr<const Operator> index = Process(op->GetIndex(), false);
+        std::shared_ptr<const Operator> valueToBeStored = Substitute(op->GetValue());
+        std::shared_ptr<const Operator> index = Substitute(op->GetIndex());
         value = StoreArrayOperator::Create(valueToBeStored, index);
     }
 
     virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
     {
-        std::shared_ptr<const Operator> left = Process(op->GetLeft(), false);
+        std::shared_ptr<const Operator> left = Substitute(op->GetLeft());
+        std::shared_ptr<const Operator> right = Substitute(op->GetRight());
+        value = BinaryOperator::Create(left, right, op->GetType(), op->GetPosition());
+    };
+
+    virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+    {
+        std::shared_ptr<const Operator> condition = Substitute(op->GetCondition());
+        std::shared_ptr<const Operator> ifTrue = Substitute(op->GetIfTrue());
+        std::shared_ptr<const Operator> ifFalse = Substitute(op->GetIfFalse());
+        value = ConditionalOperator::Create(condition, ifTrue, ifFalse);
+    };
+
+    virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+    {
+        std::vector<std::shared_ptr<const Operator>> substituted;
+        for (auto& op2 : op->GetOperands())
+        {
+            substituted.push_back(Substitute(op2));
+        }
+
+        value = UserDefinedOperator::Create(op->GetDefinition(), std::move(substituted),
+                                            std::nullopt, op->GetPosition());
+    };
+};
+
+// Inlines calls of small operators which call no other operators. Operands are evaluated once
+// and in order before the body of a call, so an operand is substituted only if it preserves this:
+//  - A simple operand can be evaluated at any time or not at all, but is substituted for more
+//    than one use only if it is a single operator so that no computation is duplicated
+//  - Any other operand must be used exactly once and unconditionally by a simple body, in the
+//    same order as the other such operands
+template<typename TNumber>
+class InlineVisitor : public OperatorVisitor
+{
+private:
+    const CompilationContext& context;
+
+    std::shared_ptr<const Operator> Inline(const std::shared_ptr<const Operator>& op)
+    {
+        op->Accept(*this);
+        return value;
+    }
+
+    bool IsInlinable(const std::shared_ptr<const Operator>& body,
+                     const std::vector<std::shared_ptr<const Operator>>& operands) const
+    {
+        InliningAnalyzer<TNumber> bodyAnalyzer;
+        body->Accept(bodyAnalyzer);
+        if (bodyAnalyzer.hasCall || bodyAnalyzer.size > MaxInlinedOperatorSize)
+        {
+            return false;
+        }
+
+        std::vector<int> orderedOperands;
+        for (size_t i = 0; i < operands.size(); i++)
+        {
+            InliningAnalyzer<TNumber> operandAnalyzer;
+            operands[i]->Accept(operandAnalyzer);
+
+            int numUses = bodyAnalyzer.GetNumUses(static_cast<int>(i));
+            if (operandAnalyzer.isSimple)
+            {
+                if (numUses > 1 && operandAnalyzer.size > 1)
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                if (!bodyAnalyzer.isSimple || numUses != 1)
+                {
+                    return false;
+                }
+
+                orderedOperands.push_back(static_cast<int>(i));
+            }
+        }
+
+        // The ordered operands must appear in the same order among the unconditional uses
+        size_t next = 0;
+        for (int index : bodyAnalyzer.unconditionalUses)
+        {
+            if (next < orderedOperands.size() && orderedOperands[next] == index)
+            {
+                next++;
+            }
+        }
+
+        return next == orderedOperands.size();
+    }
+
+public:
+    std::shared_ptr<const Operator> value;
+    bool isInlined = false;
+
+    InlineVisitor(const CompilationContext& context) : context(context) {}
+
+    virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+    {
+        value = LoadArrayOperator::Create(Inline(op->GetIndex()));
+    };
+
+    virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+    {
+        value = PrintCharOperator::Create(Inline(op->GetCharacter()));
+    };
+
+    virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+    {
+        std::vector<std::shared_ptr<const Operator>> inlined;
+        for (auto& op2 : op->GetOperators())
+        {
+            inlined.push_back(Inline(op2));
+        }
+
+        value = ParenthesisOperator::Create(std::move(inlined));
+    };
+
+    virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+    {
+        value = DecimalOperator::Create(Inline(op->GetOperand()), op->GetValue());
+    };
+
+    virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+    {
+        value = StoreVariableOperator::Create(Inline(op->GetOperand()), op->GetVariableName());
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+    {
+        std::shared_ptr<const Operator> valueToBeStored = Inline(op->GetValue());
+        std::shared_ptr<const Operator> index = Inline(op->GetIndex());
+        value = StoreArrayOperator::Create(valueToBeStored, index);
+    }
+
+    virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+    {
+        std::shared_ptr<const Operator> left = Inline(op->GetLeft());
+        std::shared_ptr<const Operator> right = Inline(op->GetRight());
+        value = BinaryOperator::Create(left, right, op->GetType(), op->GetPosition());
+    };
+
+    virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+    {
+        std::shared_ptr<const Operator> condition = Inline(op->GetCondition());
+        std::shared_ptr<const Operator> ifTrue = Inline(op->GetIfTrue());
+        std::shared_ptr<const Operator> ifFalse = Inline(op->GetIfFalse());
+        value = ConditionalOperator::Create(condition, ifTrue, ifFalse);
+    };
+
+    virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+    {
+        std::vector<std::shared_ptr<const Operator>> operands;
+        for (auto& op2 : op->GetOperands())
+        {
+            operands.push_back(Inline(op2));
+        }
+
+        auto implement = context.TryGetOperatorImplement(op->GetDefinition().GetName());
+        if (implement != nullptr && IsInlinable(implement->GetOperator(), operands))
+        {
+            SubstituteVisitor visitor(operands);
+            implement->GetOperator()->Accept(visitor);
+            value = std::move(visitor.value);
+            isInlined = true;
+        }
+        else
+        {
+            value = UserDefinedOperator::Create(op->GetDefinition(), std::move(operands),
+                                                std::nullopt, op->GetPosition());
+        }
+    };
+};
+
+class TailCallVisitor : public OperatorVisitor
+{
+private:
+    std::shared_ptr<const Operator> Process(const std::shared_ptr<const Operator>& op,
+                                            bool isTailCall)
+    {
+        stack.push(isTailCall);
+        op->Accept(*this);
+        stack.pop();
+        return value;
+    }
+
+    bool IsCurrentOperatorInTail() const
+    {
+        return stack.top();
+    }
+
+public:
+    std::shared_ptr<const Operator> value;
+    std::stack<bool> stack{ { true } };
+
+    virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+    {
+        value = op;
+    };
+
+    virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+    {
+        std::shared_ptr<const Operator> index = Process(op->GetIndex(), false);
+        value = LoadArrayOperator::Create(index);
+    };
+
+    virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+    {
+        std::shared_ptr<const Operator> character = Process(op->GetCharacter(), false);
+        value = PrintCharOperator::Create(character);
+    };
+
+    virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+    {
+        auto& operators = op->GetOperators();
+        std::vector<std::shared_ptr<const Operator>> optimized;
+
+        for (size_t i = 0; i < operators.size(); i++)
+        {
+            std::shared_ptr<const Operator> processed =
+                Process(operators[i], i < operators.size() - 1 ? false : IsCurrentOperatorInTail());
+            optimized.push_back(processed);
+        }
+
+        value = ParenthesisOperator::Create(std::move(optimized));
+    };
+
+    virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+    {
+        std::shared_ptr<const Operator> precomputed = Process(op->GetOperand(), false);
+        value = DecimalOperator::Create(precomputed, op->GetValue());
+    };
+
+    virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+    {
+        std::shared_ptr<const Operator> operand = Process(op->GetOperand(), false);
+        value = StoreVariableOperator::Create(operand, op->GetVariableName());
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+    {
+        std::shared_ptr<const Operator> valueToBeStored = Process(op->GetValue(), false);
+        std::shared_ptr<const Operator> index = Process(op->GetIndex(), false);
+        value = StoreArrayOperator::Create(valueToBeStored, index);
+    }
+
+    virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+    {
+        std::shared_ptr<const Operator> left = Process(op->GetLeft(), false);
         std::shared_ptr<const Operator> right = Process(op->GetRight(), false);
-        value = BinaryOperator::Create(left, right, op->GetType());
+        value = BinaryOperator::Create(left, right, op->GetType(), op->GetPosition());
+    };
+
+    virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+    {
+        std::shared_ptr<const Operator> condition = Process(op->GetCondition(), false);
+        std::shared_ptr<const Operator> ifTrue =
+            Process(op->GetIfTrue(), IsCurrentOperatorInTail());
+        std::shared_ptr<const Operator> ifFalse =
+            Process(op->GetIfFalse(), IsCurrentOperatorInTail());
+        value = ConditionalOperator::Create(condition, ifTrue, ifFalse);
     };
 
+    virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+    {
+        std::vector<std::shared_ptr<const Operator>> operands;
+
+        for (auto& op2 : op->GetOperands())
+        {
+            operands.push_back(Process(op2, false));
+        }
+
+        value = UserDefinedOperator::Create(op->GetDefinition(), std::move(operands),
+                                            IsCurrentOperatorInTail(), op->GetPosition());
+    };
+};
+
+// Range of the values which an operator evaluates to. The bounds of a fixed-width number are always
+// present, while those of an infinite-precision number are empty if the range is unbounded.
+template<typename TNumber>
+struct ValueRange
+{
+    std::optional<TNumber> min, max;
+
+    // True if the value is known to be non-zero although the range may contain zero
+    bool excludesZero = false;
+
+    static ValueRange Full()
+    {
+#ifdef ENABLE_GMP
+        if constexpr (std::is_same_v<TNumber, HybridInteger>)
+        {
+            return {};
+        }
+        else
+#endif // ENABLE_GMP
+#ifdef ENABLE_INT128
+        if constexpr (std::is_same_v<TNumber, __int128_t>)
+        {
+            auto max = static_cast<__int128_t>(~static_cast<__uint128_t>(0) >> 1);
+            return { -max - 1, max };
+        }
+        else
+#endif // ENABLE_INT128
+        {
+            return { std::numeric_limits<TNumber>::min(), std::numeric_limits<TNumber>::max() };
+        }
+    }
+
+    static ValueRange Exactly(const TNumber& value)
+    {
+        return { value, value };
+    }
+
+    // Returns the range between the given bounds. A missing bound of a fixed-width number means
+    // that the result may overflow and wrap around, so the range is not bounded at all.
+    static ValueRange Between(const std::optional<TNumber>& min, const std::optional<TNumber>& max)
+    {
+        auto full = Full();
+        return (min && max) || !full.min ? ValueRange{ min, max } : full;
+    }
+
+    bool IsNonZero() const
+    {
+        return excludesZero || (min && *min > 0) || (max && *max < 0);
+    }
+
+    bool IsExactly(const TNumber& value) const
+    {
+        return min && max && *min == value && *max == value;
+    }
+
+    ValueRange Union(const ValueRange& other) const
+    {
+        ValueRange result;
+        if (min && other.min)
+        {
+            result.min = std::min(*min, *other.min);
+        }
+
+        if (max && other.max)
+        {
+            result.max = std::max(*max, *other.max);
+        }
+
+        result.excludesZero = IsNonZero() && other.IsNonZero();
+        return result;
+    }
+
+    ValueRange Intersect(const ValueRange& other) const
+    {
+        ValueRange result = *this;
+        if (other.min && (!min || *min < *other.min))
+        {
+            result.min = other.min;
+        }
+
+        if (other.max && (!max || *other.max < *max))
+        {
+            result.max = other.max;
+        }
+
+        result.excludesZero = excludesZero || other.excludesZero;
+        return result;
+    }
+};
+
+// Returns true if the given addition, subtraction or multiplication overflows. Otherwise, its
+// result is stored into "result".
+template<typename TNumber>
+bool IsOverflowed(BinaryType type, TNumber a, TNumber b, TNumber* result)
+{
+#ifdef _MSC_VER
+    constexpr TNumber min = std::numeric_limits<TNumber>::min();
+    constexpr TNumber max = std::numeric_limits<TNumber>::max();
+
+    bool isOverflowed;
+    switch (type)
+    {
+    case BinaryType::Add:
+        isOverflowed = b > 0 ? a > max - b : a < min - b;
+        break;
+    case BinaryType::Sub:
+        isOverflowed = b < 0 ? a > max + b : a < min + b;
+        break;
+    default:
+        if (a == 0 || b == 0)
+        {
+            isOverflowed = false;
+        }
+        else if (a > 0)
+        {
+            isOverflowed = b > 0 ? a > max / b : b < min / a;
+        }
+        else
+        {
+            isOverflowed = b > 0 ? a < min / b : a < max / b;
+        }
+        break;
+    }
+
+    if (!isOverflowed)
+    {
+        *result = type == BinaryType::Add ? a + b : type == BinaryType::Sub ? a - b : a * b;
+    }
+
+    return isOverflowed;
+#else
+    return type == BinaryType::Add   ? __builtin_add_overflow(a, b, result)
+           : type == BinaryType::Sub ? __builtin_sub_overflow(a, b, result)
+                                     : __builtin_mul_overflow(a, b, result);
+#endif // _MSC_VER
+}
+
+// Applies an addition, a subtraction or a multiplication to bounds of ranges. Returns std::nullopt
+// if either of the bounds is missing or the result overflows.
+template<typename TNumber>
+std::optional<TNumber> ApplyToBounds(BinaryType type, const std::optional<TNumber>& a,
+                                     const std::optional<TNumber>& b)
+{
+    if (!a || !b)
+    {
+        return std::nullopt;
+    }
+
+#ifdef ENABLE_GMP
+    if constexpr (std::is_same_v<TNumber, HybridInteger>)
+    {
+        return type == BinaryType::Add ? *a + *b : type == BinaryType::Sub ? *a - *b : *a * *b;
+    }
+    else
+#endif // ENABLE_GMP
+    {
+        TNumber result;
+        return IsOverflowed(type, *a, *b, &result) ? std::nullopt : std::optional<TNumber>(result);
+    }
+}
+
+// Computes the ranges of the values in an operator, and marks the divisions and modulos whose
+// divisors are never zero. The ranges of the operands are narrowed by the conditions which guard
+// their uses, such as "x" in "x==0?0?100/x".
+template<typename TNumber>
+class DivisorAnalysisVisitor : public OperatorVisitor
+{
+private:
+    using Range = ValueRange<TNumber>;
+
+    std::vector<Range> operandRanges;
+
+    std::shared_ptr<const Operator> Process(const std::shared_ptr<const Operator>& op)
+    {
+        op->Accept(*this);
+        return value;
+    }
+
+    // Returns the range of an operator which is a constant or an operand, or std::nullopt otherwise
+    std::optional<Range> GetSimpleRange(const std::shared_ptr<const Operator>& op) const
+    {
+        if (auto precomputed = std::dynamic_pointer_cast<const PrecomputedOperator>(op))
+        {
+            return Range::Exactly(precomputed->GetValue<TNumber>());
+        }
+        else if (auto operand = std::dynamic_pointer_cast<const OperandOperator>(op))
+        {
+            return operandRanges[operand->GetIndex()];
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    // Narrows the ranges of the operands assuming that the condition evaluates to the given value
+    void Refine(const std::shared_ptr<const Operator>& condition, bool isTrue)
+    {
+        if (auto operand = std::dynamic_pointer_cast<const OperandOperator>(condition))
+        {
+            Range refined;
+            refined.excludesZero = isTrue;
+            RefineOperand(operand->GetIndex(), isTrue ? refined : Range::Exactly(0));
+            return;
+        }
+
+        auto binary = std::dynamic_pointer_cast<const BinaryOperator>(condition);
+        if (binary == nullptr)
+        {
+            return;
+        }
+
+        // Both sides hold if a conjunction is true or a disjunction is false
+        BinaryType type = binary->GetType();
+        if ((type == BinaryType::LogicalAnd && isTrue) ||
+            (type == BinaryType::LogicalOr && !isTrue))
+        {
+            Refine(binary->GetLeft(), isTrue);
+            Refine(binary->GetRight(), isTrue);
+            return;
+        }
+
+        auto left = std::dynamic_pointer_cast<const OperandOperator>(binary->GetLeft());
+        auto right = std::dynamic_pointer_cast<const OperandOperator>(binary->GetRight());
+        if (left != nullptr)
+        {
+            if (auto other = GetSimpleRange(binary->GetRight()))
+            {
+                RefineComparison(left->GetIndex(), type, *other, isTrue);
+            }
+        }
+
+        if (right != nullptr)
+        {
+            if (auto other = GetSimpleRange(binary->GetLeft()))
+            {
+                RefineComparison(right->GetIndex(), GetSwappedComparison(type), *other, isTrue);
+            }
+        }
+    }
+
+    // Narrows the range of an operand "x" assuming that "x (type) other" evaluates to the given
+    // value
+    void RefineComparison(int index, BinaryType type, const Range& other, bool isTrue)
+    {
+        if (!isTrue)
+        {
+            type = GetNegatedComparison(type);
+        }
+
+        std::optional<TNumber> one = static_cast<TNumber>(1);
+        Range refined;
+        switch (type)
+        {
+        case BinaryType::Equal:
+            refined = other;
+            break;
+        case BinaryType::NotEqual:
+            refined.excludesZero = other.IsExactly(0);
+            break;
+        case BinaryType::LessThan:
+            refined.max = ApplyToBounds(BinaryType::Sub, other.max, one);
+            break;
+        case BinaryType::LessThanOrEqual:
+            refined.max = other.max;
+            break;
+        case BinaryType::GreaterThanOrEqual:
+            refined.min = other.min;
+            break;
+        case BinaryType::GreaterThan:
+            refined.min = ApplyToBounds(BinaryType::Add, other.min, one);
+            break;
+        default:
+            return;
+        }
+
+        RefineOperand(index, refined);
+    }
+
+    void RefineOperand(int index, const Range& refined)
+    {
+        operandRanges[index] = operandRanges[index].Intersect(refined);
+    }
+
+    // Returns the comparison which gives the same result when the operands are swapped
+    static BinaryType GetSwappedComparison(BinaryType type)
+    {
+        switch (type)
+        {
+        case BinaryType::LessThan:
+            return BinaryType::GreaterThan;
+        case BinaryType::LessThanOrEqual:
+            return BinaryType::GreaterThanOrEqual;
+        case BinaryType::GreaterThanOrEqual:
+            return BinaryType::LessThanOrEqual;
+        case BinaryType::GreaterThan:
+            return BinaryType::LessThan;
+        default:
+            return type;
+        }
+    }
+
+    // Returns the comparison which gives the opposite result
+    static BinaryType GetNegatedComparison(BinaryType type)
+    {
+        switch (type)
+        {
+        case BinaryType::Equal:
+            return BinaryType::NotEqual;
+        case BinaryType::NotEqual:
+            return BinaryType::Equal;
+        case BinaryType::LessThan:
+            return BinaryType::GreaterThanOrEqual;
+        case BinaryType::LessThanOrEqual:
+            return BinaryType::GreaterThan;
+        case BinaryType::GreaterThanOrEqual:
+            return BinaryType::LessThan;
+        case BinaryType::GreaterThan:
+            return BinaryType::LessThanOrEqual;
+        default:
+            return type;
+        }
+    }
+
+public:
+    std::shared_ptr<const Operator> value;
+    Range range;
+
+    explicit DivisorAnalysisVisitor(int numOperands) : operandRanges(numOperands, Range::Full()) {}
+
+    virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
+    {
+        value = op;
+        range = Range::Exactly(0);
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override
+    {
+        value = op;
+        range = Range::Exactly(op->GetValue<TNumber>());
+    }
+
+    virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
+    {
+        value = op;
+        range = operandRanges[op->GetIndex()];
+    }
+
+    virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
+    {
+        value = op;
+        range = Range::Exactly(0);
+    }
+
+    virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+    {
+        value = op;
+        range = Range::Full();
+    }
+
+    virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+    {
+        value = op;
+        range = Range::Full();
+    }
+
+    virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+    {
+        value = LoadArrayOperator::Create(Process(op->GetIndex()));
+        range = Range::Full();
+    }
+
+    virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+    {
+        value = PrintCharOperator::Create(Process(op->GetCharacter()));
+        range = Range::Exactly(0);
+    }
+
+    virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+    {
+        std::vector<std::shared_ptr<const Operator>> operators;
+        Range lastRange = Range::Exactly(0);
+        for (auto& op2 : op->GetOperators())
+        {
+            operators.push_back(Process(op2));
+            lastRange = range;
+        }
+
+        value = ParenthesisOperator::Create(std::move(operators));
+        range = lastRange;
+    }
+
+    virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+    {
+        value = DecimalOperator::Create(Process(op->GetOperand()), op->GetValue());
+        range = Range::Full();
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+    {
+        value = StoreVariableOperator::Create(Process(op->GetOperand()), op->GetVariableName());
+    }
+
+    virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+    {
+        std::shared_ptr<const Operator> valueToBeStored = Process(op->GetValue());
+        Range valueRange = range;
+        std::shared_ptr<const Operator> index = Process(op->GetIndex());
+        value = StoreArrayOperator::Create(valueToBeStored, index);
+        range = valueRange;
+    }
+
+    virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+    {
+        BinaryType type = op->GetType();
+        std::shared_ptr<const Operator> left = Process(op->GetLeft());
+        Range leftRange = range;
+
+        // The right operand of a logical operation is evaluated only if the left one does not
+        // decide the result
+        std::shared_ptr<const Operator> right;
+        if (type == BinaryType::LogicalAnd || type == BinaryType::LogicalOr)
+        {
+            auto saved = operandRanges;
+            Refine(left, type == BinaryType::LogicalAnd);
+            right = Process(op->GetRight());
+            operandRanges = std::move(saved);
+        }
+        else
+        {
+            right = Process(op->GetRight());
+        }
+
+        Range rightRange = range;
+        bool isDivisorNonZero = false;
+
+        switch (type)
+        {
+        case BinaryType::Add:
+        case BinaryType::Sub:
+        {
+            // The smallest result comes from the largest right operand in subtractions
+            bool isSub = type == BinaryType::Sub;
+            range = Range::Between(
+                ApplyToBounds(type, leftRange.min, isSub ? rightRange.max : rightRange.min),
+                ApplyToBounds(type, leftRange.max, isSub ? rightRange.min : rightRange.max));
+            break;
+        }
+        case BinaryType::Mult:
+        {
+            std::optional<TNumber> products[] = {
+                ApplyToBounds(type, leftRange.min, rightRange.min),
+                ApplyToBounds(type, leftRange.min, rightRange.max),
+                ApplyToBounds(type, leftRange.max, rightRange.min),
+                ApplyToBounds(type, leftRange.max, rightRange.max),
+            };
+
+            // A product of non-zero numbers may be zero only if it overflows
+            bool isOverflowed = !std::all_of(std::begin(products), std::end(products),
+                                             [](auto& product) { return product.has_value(); });
+            range = isOverflowed
+                ? Range::Full()
+                : Range::Between(*std::min_element(std::begin(products), std::end(products)),
+                                 *std::max_element(std::begin(products), std::end(products)));
+            range.excludesZero = leftRange.IsNonZero() && rightRange.IsNonZero() &&
+                (!isOverflowed || !Range::Full().min);
+            break;
+        }
+        case BinaryType::Div:
+        case BinaryType::Mod:
+            isDivisorNonZero = rightRange.IsNonZero();
+            range = Range::Full();
+            break;
+        default:
+            // Comparisons and logical operations result in either zero or one
+            range = Range{ static_cast<TNumber>(0), static_cast<TNumber>(1) };
+            break;
+        }
+
+        value = BinaryOperator::Create(left, right, type, op->GetPosition(), isDivisorNonZero);
+    }
+
     virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
     {
-        std::shared_ptr<const Operator> condition = Process(op->GetCondition(), false);
-        std::shared_ptr<const Operator> ifTrue =
-            Process(op->GetIfTrue(), IsCurrentOperatorInTail());
-        std::shared_ptr<const Operator> ifFalse =
-            Process(op->GetIfFalse(), IsCurrentOperatorInTail());
+        std::shared_ptr<const Operator> condition = Process(op->GetCondition());
+
+        auto saved = operandRanges;
+        Refine(condition, true);
+        std::shared_ptr<const Operator> ifTrue = Process(op->GetIfTrue());
+        Range ifTrueRange = range;
+
+        operandRanges = saved;
+        Refine(condition, false);
+        std::shared_ptr<const Operator> ifFalse = Process(op->GetIfFalse());
+        Range ifFalseRange = range;
+
+        operandRanges = std::move(saved);
         value = ConditionalOperator::Create(condition, ifTrue, ifFalse);
-    };
+        range = ifTrueRange.Union(ifFalseRange);
+    }
 
     virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
     {
         std::vector<std::shared_ptr<const Operator>> operands;
-
-        for (auto& op2 : op->GetOperands())
+        for (auto& operand : op->GetOperands())
         {
-            operands.push_back(Process(op2, false));
+            operands.push_back(Process(operand));
         }
 
         value = UserDefinedOperator::Create(op->GetDefinition(), std::move(operands),
-                                            IsCurrentOperatorInTail());
-    };
+                                            op->IsTailCall(), op->GetPosition());
+        range = Range::Full();
+    }
 };
 
 template<typename TNumber>
-std::shared_ptr<const Operator> OptimizePrecomputeStep(CompilationContext& context,
-                                                       const std::shared_ptr<const Operator>& op)
+std::shared_ptr<const Operator> OptimizePrecomputeStep(
+    CompilationContext& context, const CallGraph& callGraph,
+    const std::shared_ptr<const Operator>& op)
 {
-    PrecomputeVisitor<TNumber> visitor(context);
+    PrecomputeVisitor<TNumber> visitor(context, callGraph);
     op->Accept(visitor);
     return std::move(visitor.value);
 }
 
+// Returns nullptr if no operators are inlined
+template<typename TNumber>
+std::shared_ptr<const Operator> OptimizeInlineStep(const CompilationContext& context,
+                                                   const std::shared_ptr<const Operator>& op)
+{
+    InlineVisitor<TNumber> visitor(context);
+    op->Accept(visitor);
+    return visitor.isInlined ? std::move(visitor.value) : nullptr;
+}
+
 std::shared_ptr<const Operator> OptimizeMarkTailCallStep(const std::shared_ptr<const Operator>& op)
 {
     TailCallVisitor visitor;
@@ -437,10 +1670,56 @@ std::shared_ptr<const Operator> OptimizeMarkTailCallStep(const std::shared_ptr<c
 }
 
 template<typename TNumber>
-std::shared_ptr<const Operator> OptimizeCore(CompilationContext& context,
-                                             const std::shared_ptr<const Operator>& op)
+std::shared_ptr<const Operator> OptimizeMarkNonZeroDivisorStep(
+    const std::shared_ptr<const Operator>& op, int numOperands)
+{
+    DivisorAnalysisVisitor<TNumber> visitor(numOperands);
+    op->Accept(visitor);
+    return std::move(visitor.value);
+}
+
+// Returns the largest version among each operator and the ones it can call. The operators which
+// have been inlined into others are taken into account, since "sourceCallGraph" is built from the
+// sources.
+std::unordered_map<std::string, uint64_t> GetDependencyVersions(const CompilationContext& context,
+                                                                const CallGraph& sourceCallGraph)
+{
+    // Every component comes after its callees
+    std::unordered_map<std::string, uint64_t> result;
+    for (auto& component : sourceCallGraph.GetStronglyConnectedComponents())
+    {
+        uint64_t version = 0;
+        for (auto& name : component)
+        {
+            version = std::max(version, context.GetOperatorImplement(name).GetVersion());
+            for (auto& callee : sourceCallGraph.GetCallees(name))
+            {
+                auto it = result.find(callee);
+                if (it != result.end())
+                {
+                    version = std::max(version, it->second);
+                }
+            }
+        }
+
+        for (auto& name : component)
+        {
+            result[name] = version;
+        }
+    }
+
+    return result;
+}
+
+template<typename TNumber>
+std::shared_ptr<const Operator> OptimizeInlineAndPrecomputeStep(
+    CompilationContext& context, const CallGraph& callGraph,
+    const std::shared_ptr<const Operator>& op)
 {
-    return OptimizeMarkTailCallStep(OptimizePrecomputeStep<TNumber>(context, op));
+    // The inlined operands may make more operations constant
+    auto inlined = OptimizeInlineStep<TNumber>(context, op);
+    return inlined != nullptr ? OptimizePrecomputeStep<TNumber>(context, callGraph, inlined)
+                              : nullptr;
 }
 }
 
@@ -448,15 +1727,84 @@ template<typename TNumber>
 std::shared_ptr<const Operator> Optimize(CompilationContext& context,
                                          const std::shared_ptr<const Operator>& op)
 {
-    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    // Purity is not changed by the optimization, so the call graph of the current bodies is valid
+    // throughout
+    CallGraph callGraph(context);
+
+    // Only the operators whose sources or callees have been redefined since they were optimized
+    // are optimized again, so that the cost of each REPL input does not grow with the number of
+    // operators defined before. They are listed callee-first, so that the calls folded by the
+    // precomputation see the callees optimized from their current sources.
+    CallGraph sourceCallGraph(context, true);
+    auto dependencyVersions = GetDependencyVersions(context, sourceCallGraph);
+    std::vector<std::string> staleOperators;
+    for (auto& component : sourceCallGraph.GetStronglyConnectedComponents())
+    {
+        for (auto& name : component)
+        {
+            if (context.GetOperatorImplement(name).GetOptimizedVersion() !=
+                dependencyVersions.at(name))
+            {
+                staleOperators.push_back(name);
+            }
+        }
+    }
+
+    // The bodies optimized from the previous sources must not be folded into the others, even by
+    // the mutually recursive operators, which cannot be ordered callee-first
+    for (auto& name : staleOperators)
+    {
+        auto& implement = context.GetOperatorImplement(name);
+        context.AddOperatorImplement(
+            implement.WithOptimizedOperator(implement.GetSourceOperator()));
+    }
+
+    for (auto& name : staleOperators)
     {
-        std::shared_ptr<const Operator> optimized =
-            OptimizeCore<TNumber>(context, it->second.GetOperator());
+        auto& implement = context.GetOperatorImplement(name);
+        std::shared_ptr<const Operator> optimized = OptimizePrecomputeStep<TNumber>(
+            context, callGraph, implement.GetSourceOperator());
+        context.AddOperatorImplement(implement.WithOptimizedOperator(optimized));
+    }
+
+    // Inline the operators bottom-up
+    for (int round = 0; round < MaxInliningRounds; round++)
+    {
+        bool isInlined = false;
+        for (auto& name : staleOperators)
+        {
+            auto& implement = context.GetOperatorImplement(name);
+            if (auto inlined = OptimizeInlineAndPrecomputeStep<TNumber>(context, callGraph,
+                                                                        implement.GetOperator()))
+            {
+                context.AddOperatorImplement(implement.WithOptimizedOperator(inlined));
+                isInlined = true;
+            }
+        }
+
+        if (!isInlined)
+        {
+            break;
+        }
+    }
+
+    for (auto& name : staleOperators)
+    {
+        auto& implement = context.GetOperatorImplement(name);
+        auto marked = OptimizeMarkNonZeroDivisorStep<TNumber>(
+            OptimizeMarkTailCallStep(implement.GetOperator()),
+            implement.GetDefinition().GetNumOperands());
         context.AddOperatorImplement(
-            OperatorImplement(it->second.GetDefinition(), std::move(optimized)));
+            implement.WithOptimizedOperator(marked, dependencyVersions.at(name)));
+    }
+
+    auto optimized = OptimizePrecomputeStep<TNumber>(context, callGraph, op);
+    if (auto inlined = OptimizeInlineAndPrecomputeStep<TNumber>(context, callGraph, optimized))
+    {
+        optimized = std::move(inlined);
     }
 
-    return OptimizeCore<TNumber>(context, op);
+    return OptimizeMarkNonZeroDivisorStep<TNumber>(OptimizeMarkTailCallStep(optimized), 0);
 }
 
 template std::shared_ptr<const Operator> Optimize<int32_t>(
@@ -470,7 +1818,7 @@ template std::shared_ptr<const Operator> Optimize<__int128_t>(
 #endif // ENABLE_INT128
 
 #ifdef ENABLE_GMP
-template std::shared_ptr<const Operator> Optimize<mpz_class>(
+template std::shared_ptr<const Operator> Optimize<HybridInteger>(
     CompilationContext& context, const std::shared_ptr<const Operator>& op);
 #endif // ENABLE_GMP
 }
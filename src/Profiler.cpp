@@ -0,0 +1,184 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "Profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+
+namespace calc4
+{
+namespace
+{
+double ToMilliseconds(Profiler::Clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+}
+
+Profiler::Profiler()
+{
+    // The main program always has the id zero and is the root of the call tree
+    GetOperatorId(MainName);
+    nodes.push_back(CallTreeNode{ 0, -1, Clock::duration::zero(), {} });
+}
+
+int Profiler::GetOperatorId(std::string_view name)
+{
+    auto it = operatorIds.find(std::string(name));
+    if (it != operatorIds.end())
+    {
+        return it->second;
+    }
+
+    int id = static_cast<int>(statistics.size());
+    operatorIds.emplace(name, id);
+    statistics.push_back(OperatorStatistics{ std::string(name) });
+    currentDepths.push_back(0);
+    return id;
+}
+
+void Profiler::Begin()
+{
+    assert(frames.empty());
+    currentDepths[0]++;
+    frames.push_back(Frame{ 0, 0, Clock::now(), Clock::duration::zero() });
+}
+
+void Profiler::End()
+{
+    // Exceptions may leave frames of user-defined operators
+    auto now = Clock::now();
+    while (!frames.empty())
+    {
+        Exit(now);
+    }
+}
+
+void Profiler::Exit(Clock::time_point now)
+{
+    assert(!frames.empty());
+    Frame frame = frames.back();
+    frames.pop_back();
+
+    auto elapsed = now - frame.start;
+    auto selfTime = elapsed - frame.childTime;
+    auto& stat = statistics[frame.operatorId];
+    stat.selfTime += selfTime;
+    nodes[frame.node].selfTime += selfTime;
+
+    if (--currentDepths[frame.operatorId] == 0)
+    {
+        stat.inclusiveTime += elapsed;
+    }
+
+    if (!frames.empty())
+    {
+        frames.back().childTime += elapsed;
+    }
+}
+
+int Profiler::GetChildNode(int parent, int operatorId)
+{
+    for (auto& [childOperatorId, child] : nodes[parent].children)
+    {
+        if (childOperatorId == operatorId)
+        {
+            return child;
+        }
+    }
+
+    // Recursive calls are collapsed into the ancestor calling the same operator
+    int node = parent;
+    while (node != -1 && nodes[node].operatorId != operatorId)
+    {
+        node = nodes[node].parent;
+    }
+
+    if (node == -1)
+    {
+        node = static_cast<int>(nodes.size());
+        nodes.push_back(CallTreeNode{ operatorId, parent, Clock::duration::zero(), {} });
+    }
+
+    // "nodes" may have been reallocated, so we must not use a reference obtained above
+    nodes[parent].children.emplace_back(operatorId, node);
+    return node;
+}
+
+std::vector<Profiler::OperatorStatistics> Profiler::GetStatistics() const
+{
+    std::vector<OperatorStatistics> result(statistics.begin() + 1, statistics.end());
+    std::stable_sort(result.begin(), result.end(),
+                     [](auto& a, auto& b) { return a.selfTime > b.selfTime; });
+    return result;
+}
+
+void Profiler::PrintStatistics(std::ostream& out) const
+{
+    using std::endl;
+    using std::setw;
+
+    static constexpr int NameWidth = 20;
+    static constexpr int CallsWidth = 14;
+    static constexpr int TimeWidth = 16;
+    static constexpr int DepthWidth = 12;
+
+    auto oldFlags = out.flags();
+    auto oldPrecision = out.precision();
+
+    out << "/*" << endl << " * Profile" << endl << " */" << endl;
+    out << std::left << setw(NameWidth) << "Operator" << std::right << setw(CallsWidth) << "Calls"
+        << setw(TimeWidth) << "Self (ms)" << setw(TimeWidth) << "Inclusive (ms)"
+        << setw(DepthWidth) << "Max depth" << endl;
+
+    out << std::fixed << std::setprecision(3);
+    for (auto& stat : GetStatistics())
+    {
+        out << std::left << setw(NameWidth) << stat.name << std::right << setw(CallsWidth)
+            << stat.numCalls << setw(TimeWidth) << ToMilliseconds(stat.selfTime)
+            << setw(TimeWidth) << ToMilliseconds(stat.inclusiveTime) << setw(DepthWidth)
+            << stat.maxRecursionDepth << endl;
+    }
+
+    out << std::left << setw(NameWidth) << MainName << std::right << setw(CallsWidth) << ""
+        << setw(TimeWidth) << ToMilliseconds(statistics[0].selfTime) << setw(TimeWidth)
+        << ToMilliseconds(statistics[0].inclusiveTime) << endl
+        << endl;
+
+    out.flags(oldFlags);
+    out.precision(oldPrecision);
+}
+
+void Profiler::WriteFoldedStacks(std::ostream& out) const
+{
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        auto microseconds =
+            std::chrono::duration_cast<std::chrono::microseconds>(nodes[i].selfTime).count();
+        if (microseconds <= 0)
+        {
+            continue;
+        }
+
+        std::vector<int> path;
+        for (int node = static_cast<int>(i); node != -1; node = nodes[node].parent)
+        {
+            path.push_back(nodes[node].operatorId);
+        }
+
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+        {
+            out << (it == path.rbegin() ? "" : ";") << statistics[*it].name;
+        }
+
+        out << ' ' << microseconds << '\n';
+    }
+}
+}
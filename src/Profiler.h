@@ -0,0 +1,146 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace calc4
+{
+// Collects execution statistics of user-defined operators. Executors report each call through
+// Enter and Exit, and the profiler measures self and inclusive times, call counts, maximum
+// recursion depths and the call stacks. A profiler must not be shared among threads running
+// concurrently.
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Name of the pseudo operator representing the main program
+    static constexpr std::string_view MainName = "<main>";
+
+    struct OperatorStatistics
+    {
+        std::string name;
+        uint64_t numCalls = 0;
+        Clock::duration selfTime = Clock::duration::zero();
+
+        // Time spent in the outermost activations, so recursive calls are not counted twice
+        Clock::duration inclusiveTime = Clock::duration::zero();
+
+        int maxRecursionDepth = 0;
+    };
+
+private:
+    struct Frame
+    {
+        int operatorId;
+        int node;
+        Clock::time_point start;
+        Clock::duration childTime;
+    };
+
+    // Node of the call tree used for the folded stacks. Recursive calls are collapsed into the
+    // node of the outer activation, so the depth of the tree is bounded by the number of
+    // operators.
+    struct CallTreeNode
+    {
+        int operatorId;
+        int parent;
+        Clock::duration selfTime;
+        std::vector<std::pair<int, int>> children;
+    };
+
+    std::vector<OperatorStatistics> statistics;
+    std::unordered_map<std::string, int> operatorIds;
+    std::vector<int> currentDepths;
+    std::vector<Frame> frames;
+    std::vector<CallTreeNode> nodes;
+
+public:
+    Profiler();
+
+    // Returns the id of the given operator, which is given to Enter
+    int GetOperatorId(std::string_view name);
+
+    // Starts measuring the main program
+    void Begin();
+
+    // Stops measuring the main program. Frames left by exceptions are closed here.
+    void End();
+
+    void Enter(int operatorId)
+    {
+        Frame& caller = frames.back();
+        int depth = ++currentDepths[operatorId];
+        if (depth > statistics[operatorId].maxRecursionDepth)
+        {
+            statistics[operatorId].maxRecursionDepth = depth;
+        }
+
+        statistics[operatorId].numCalls++;
+        frames.push_back(
+            Frame{ operatorId, GetChildNode(caller.node, operatorId), Clock::now(), {} });
+    }
+
+    void Exit()
+    {
+        Exit(Clock::now());
+    }
+
+    // Returns the statistics of the operators sorted by their self times in descending order.
+    // The main program is not included.
+    std::vector<OperatorStatistics> GetStatistics() const;
+
+    void PrintStatistics(std::ostream& out) const;
+
+    // Writes the call stacks in the folded format, which is accepted by flamegraph tools. Each
+    // line has a call stack separated by semicolons and its self time in microseconds.
+    void WriteFoldedStacks(std::ostream& out) const;
+
+private:
+    int GetChildNode(int parent, int operatorId);
+    void Exit(Clock::time_point now);
+};
+
+// Measures the main program with the given profiler while this object is alive. A null profiler
+// is ignored.
+class ProfilingScope
+{
+private:
+    Profiler* profiler;
+
+public:
+    explicit ProfilingScope(Profiler* profiler) : profiler(profiler)
+    {
+        if (profiler != nullptr)
+        {
+            profiler->Begin();
+        }
+    }
+
+    ~ProfilingScope()
+    {
+        if (profiler != nullptr)
+        {
+            profiler->End();
+        }
+    }
+
+    ProfilingScope(const ProfilingScope&) = delete;
+    ProfilingScope& operator=(const ProfilingScope&) = delete;
+};
+}
@@ -0,0 +1,1397 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "RegisterMachine.h"
+#include "CallGraph.h"
+#include "Common.h"
+#include "Exceptions.h"
+#include "ExecutionState.h"
+#include "Operators.h"
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#ifdef ENABLE_GMP
+#include "HybridInteger.h"
+#endif // ENABLE_GMP
+
+// We use the computed goto technique to make dispatch faster.
+// This technique is not available on MSVC.
+#if !defined(NO_USE_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define USE_COMPUTED_GOTO
+#endif // !defined(NO_USE_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+
+#ifdef USE_COMPUTED_GOTO
+#define COMPUTED_GOTO_BEGIN() goto*(op->address)
+#define COMPUTED_GOTO_SWITCH()
+#define COMPUTED_GOTO_LABEL_OF(LABEL) COMPUTED_GOTO_LABEL_##LABEL
+#define COMPUTED_GOTO_CASE(NAME) COMPUTED_GOTO_LABEL_OF(NAME) :
+#define COMPUTED_GOTO_DEFAULT()
+#define COMPUTED_GOTO_JUMP(DEST)                                                                   \
+    do                                                                                             \
+    {                                                                                              \
+        op = &operations[(DEST)];                                                                  \
+        goto*(op->address);                                                                        \
+    } while (false)
+#define COMPUTED_GOTO_NEXT_OPERATION()                                                             \
+    do                                                                                             \
+    {                                                                                              \
+        ++op;                                                                                      \
+        goto*(op->address);                                                                        \
+    } while (false)
+
+using ComputedGotoOperation = calc4::RegisterMachineThreadedOperation;
+#else
+#define COMPUTED_GOTO_BEGIN()
+#define COMPUTED_GOTO_SWITCH()                                                                     \
+    LoopBegin:                                                                                     \
+    switch (op->opcode)
+#define COMPUTED_GOTO_LABEL_OF(LABEL) LABEL
+#define COMPUTED_GOTO_CASE(NAME) case RegisterMachineOpcode::NAME:
+#define COMPUTED_GOTO_DEFAULT() default:
+#define COMPUTED_GOTO_JUMP(DEST)                                                                   \
+    do                                                                                             \
+    {                                                                                              \
+        op = &operations[(DEST)];                                                                  \
+        goto LoopBegin;                                                                            \
+    } while (false)
+#define COMPUTED_GOTO_NEXT_OPERATION()                                                             \
+    do                                                                                             \
+    {                                                                                              \
+        ++op;                                                                                      \
+        goto LoopBegin;                                                                            \
+    } while (false)
+#endif // USE_COMPUTED_GOTO
+
+namespace std
+{
+template<>
+struct hash<calc4::OperatorDefinition>
+{
+    size_t operator()(const calc4::OperatorDefinition& definition) const
+    {
+        return hash<std::string>{}(definition.GetName()) ^ hash<int>{}(definition.GetNumOperands());
+    }
+};
+}
+
+namespace calc4
+{
+#define InstantiateGenerateRegisterMachineModule(TNumber)                                          \
+    template RegisterMachineModule<TNumber> GenerateRegisterMachineModule(                         \
+        const std::shared_ptr<const Operator>& op, const CompilationContext& context,              \
+        const RegisterMachineCodeGenerationOption& option)
+
+InstantiateGenerateRegisterMachineModule(int32_t);
+InstantiateGenerateRegisterMachineModule(int64_t);
+
+#ifdef ENABLE_INT128
+InstantiateGenerateRegisterMachineModule(__int128_t);
+#endif // ENABLE_INT128
+
+#ifdef ENABLE_GMP
+InstantiateGenerateRegisterMachineModule(HybridInteger);
+#endif // ENABLE_GMP
+
+/*****/
+
+#define InstantiateExecuteRegisterMachineModule(TNumber, TInputSource, TPrinter)                   \
+    template TNumber ExecuteRegisterMachineModule<TNumber, DefaultVariableSource<TNumber>,         \
+                                                  DefaultGlobalArraySource<TNumber>,               \
+                                                  TInputSource, TPrinter>(                         \
+        const RegisterMachineModule<TNumber>& module,                                              \
+        ExecutionState<TNumber, DefaultVariableSource<TNumber>, DefaultGlobalArraySource<TNumber>, \
+                       TInputSource, TPrinter>& state,                                             \
+        RegisterMachineContext<TNumber>& context, Profiler* profiler)
+
+InstantiateExecuteRegisterMachineModule(int32_t, DefaultInputSource, DefaultPrinter);
+InstantiateExecuteRegisterMachineModule(int32_t, BufferedInputSource, BufferedPrinter);
+InstantiateExecuteRegisterMachineModule(int32_t, StreamInputSource, StreamPrinter);
+InstantiateExecuteRegisterMachineModule(int64_t, DefaultInputSource, DefaultPrinter);
+InstantiateExecuteRegisterMachineModule(int64_t, BufferedInputSource, BufferedPrinter);
+InstantiateExecuteRegisterMachineModule(int64_t, StreamInputSource, StreamPrinter);
+
+#ifdef ENABLE_INT128
+InstantiateExecuteRegisterMachineModule(__int128_t, DefaultInputSource, DefaultPrinter);
+InstantiateExecuteRegisterMachineModule(__int128_t, BufferedInputSource, BufferedPrinter);
+InstantiateExecuteRegisterMachineModule(__int128_t, StreamInputSource, StreamPrinter);
+#endif // ENABLE_INT128
+
+#ifdef ENABLE_GMP
+InstantiateExecuteRegisterMachineModule(HybridInteger, DefaultInputSource, DefaultPrinter);
+InstantiateExecuteRegisterMachineModule(HybridInteger, BufferedInputSource, BufferedPrinter);
+InstantiateExecuteRegisterMachineModule(HybridInteger, StreamInputSource, StreamPrinter);
+#endif // ENABLE_GMP
+
+/*****/
+
+template class RegisterMachineModule<int32_t>;
+template class RegisterMachineModule<int64_t>;
+
+#ifdef ENABLE_INT128
+template class RegisterMachineModule<__int128_t>;
+#endif // ENABLE_INT128
+
+#ifdef ENABLE_GMP
+template class RegisterMachineModule<HybridInteger>;
+#endif // ENABLE_GMP
+
+/*****/
+
+template<typename TNumber>
+std::tuple<std::vector<RegisterMachineOperation>, std::vector<int>, std::vector<int>>
+RegisterMachineModule<TNumber>::FlattenOperations() const
+{
+    size_t totalNumOperations = entryPoint.size() +
+        std::accumulate(userDefinedOperators.begin(), userDefinedOperators.end(),
+                        static_cast<size_t>(0),
+                        [](size_t sum, auto& ud) { return sum + ud.GetOperations().size(); });
+
+    std::vector<RegisterMachineOperation> result(totalNumOperations);
+    std::vector<int> frameSizes(totalNumOperations);
+    std::vector<int> startAddresses(userDefinedOperators.size());
+
+    size_t index = 0;
+
+    for (size_t i = 0; i < entryPoint.size(); i++)
+    {
+        result[index++] = entryPoint[i];
+    }
+
+    for (size_t i = 0; i < userDefinedOperators.size(); i++)
+    {
+        int startAddress = static_cast<int>(index);
+        startAddresses[i] = startAddress;
+
+        auto& operations = userDefinedOperators[i].GetOperations();
+        for (size_t j = 0; j < operations.size(); j++)
+        {
+            result[index] = operations[j];
+
+            // Resolve labels
+            if (IsJumpOpcode(result[index].opcode))
+            {
+                result[index].c += startAddress;
+            }
+
+            index++;
+        }
+    }
+
+    assert(index == result.size());
+
+    // The entry point starts at zero, which is never a target of call operations
+    frameSizes[0] = entryPointNumRegisters;
+
+    // Resolve call operations
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        if (result[i].opcode == RegisterMachineOpcode::Call)
+        {
+            int operatorNo = result[i].c;
+            result[i].c = startAddresses[operatorNo];
+            frameSizes[result[i].c] = userDefinedOperators[operatorNo].GetNumRegisters();
+        }
+    }
+
+    return std::make_tuple(std::move(result), std::move(frameSizes), std::move(startAddresses));
+}
+
+namespace
+{
+// Returns the comparison that holds when the given one does not hold
+BinaryType NegateComparison(BinaryType type)
+{
+    switch (type)
+    {
+    case BinaryType::Equal:
+        return BinaryType::NotEqual;
+    case BinaryType::NotEqual:
+        return BinaryType::Equal;
+    case BinaryType::LessThan:
+        return BinaryType::GreaterThanOrEqual;
+    case BinaryType::LessThanOrEqual:
+        return BinaryType::GreaterThan;
+    case BinaryType::GreaterThanOrEqual:
+        return BinaryType::LessThan;
+    case BinaryType::GreaterThan:
+        return BinaryType::LessThanOrEqual;
+    default:
+        UNREACHABLE();
+        return type;
+    }
+}
+
+// Returns the comparison that holds when the operands of the given one are swapped
+BinaryType SwapComparison(BinaryType type)
+{
+    switch (type)
+    {
+    case BinaryType::Equal:
+    case BinaryType::NotEqual:
+        return type;
+    case BinaryType::LessThan:
+        return BinaryType::GreaterThan;
+    case BinaryType::LessThanOrEqual:
+        return BinaryType::GreaterThanOrEqual;
+    case BinaryType::GreaterThanOrEqual:
+        return BinaryType::LessThanOrEqual;
+    case BinaryType::GreaterThan:
+        return BinaryType::LessThan;
+    default:
+        UNREACHABLE();
+        return type;
+    }
+}
+
+RegisterMachineOpcode GetConditionalGoto(BinaryType type, bool withConst)
+{
+    switch (type)
+    {
+    case BinaryType::Equal:
+        return withConst ? RegisterMachineOpcode::GotoIfEqualConst
+                         : RegisterMachineOpcode::GotoIfEqual;
+    case BinaryType::NotEqual:
+        return withConst ? RegisterMachineOpcode::GotoIfNotEqualConst
+                         : RegisterMachineOpcode::GotoIfNotEqual;
+    case BinaryType::LessThan:
+        return withConst ? RegisterMachineOpcode::GotoIfLessThanConst
+                         : RegisterMachineOpcode::GotoIfLessThan;
+    case BinaryType::LessThanOrEqual:
+        return withConst ? RegisterMachineOpcode::GotoIfLessThanOrEqualConst
+                         : RegisterMachineOpcode::GotoIfLessThanOrEqual;
+    case BinaryType::GreaterThanOrEqual:
+        return withConst ? RegisterMachineOpcode::GotoIfGreaterThanOrEqualConst
+                         : RegisterMachineOpcode::GotoIfGreaterThanOrEqual;
+    case BinaryType::GreaterThan:
+        return withConst ? RegisterMachineOpcode::GotoIfGreaterThanConst
+                         : RegisterMachineOpcode::GotoIfGreaterThan;
+    default:
+        UNREACHABLE();
+        return RegisterMachineOpcode::Goto;
+    }
+}
+}
+
+template<typename TNumber>
+RegisterMachineModule<TNumber> GenerateRegisterMachineModule(
+    const std::shared_ptr<const Operator>& op, const CompilationContext& context,
+    const RegisterMachineCodeGenerationOption& option)
+{
+    static constexpr int OperatorBeginLabel = 0;
+
+    // Registers are allocated in a stack-like manner. After an operator is visited, its result
+    // is held by either a register below the first free one at the time of the visit (i.e., an
+    // argument), or exactly that first free one, which is then marked as used.
+    class Generator : public OperatorVisitor
+    {
+    public:
+        const CompilationContext& context;
+        RegisterMachineCodeGenerationOption option;
+        std::vector<TNumber>& constTable;
+        std::unordered_map<OperatorDefinition, int>& operatorLabels;
+        std::optional<OperatorDefinition> definition;
+        std::unordered_map<std::string, int>& variableIndices;
+
+        std::vector<RegisterMachineOperation> operations;
+        int nextLabel = OperatorBeginLabel;
+        int nextRegister;
+        int numRegisters;
+
+        // The register that holds the result of the last visited operator
+        int result = 0;
+
+        Generator(const CompilationContext& context,
+                  const RegisterMachineCodeGenerationOption& option,
+                  std::vector<TNumber>& constTable,
+                  std::unordered_map<OperatorDefinition, int>& operatorLabels,
+                  const std::optional<OperatorDefinition>& definition,
+                  std::unordered_map<std::string, int>& variableIndices)
+            : context(context), option(option), constTable(constTable),
+              operatorLabels(operatorLabels), definition(definition),
+              variableIndices(variableIndices),
+              nextRegister(definition ? definition->GetNumOperands() : 0),
+              numRegisters(nextRegister)
+        {
+        }
+
+        void Generate(const std::shared_ptr<const Operator>& op)
+        {
+            assert(nextLabel == OperatorBeginLabel);
+            AddOperation(RegisterMachineOpcode::Lavel, 0, 0, nextLabel++);
+
+            int value = EmitOperator(op);
+            AddOperation(definition ? RegisterMachineOpcode::Return : RegisterMachineOpcode::Halt,
+                         value);
+
+            ResolveLabels();
+        }
+
+        void ResolveLabels()
+        {
+            std::vector<RegisterMachineOperation> newVector;
+            std::unordered_map<int, int> labelMap;
+
+            // First pass removes label operations and records their address.
+            for (auto& operation : operations)
+            {
+                if (operation.opcode == RegisterMachineOpcode::Lavel)
+                {
+                    labelMap[operation.c] = static_cast<int>(newVector.size());
+                }
+                else
+                {
+                    newVector.push_back(operation);
+                }
+            }
+
+            // Second pass resolves label operands to absolute indices.
+            for (auto& operation : newVector)
+            {
+                if (IsJumpOpcode(operation.opcode))
+                {
+                    operation.c = labelMap.at(operation.c);
+                }
+            }
+
+            // Third pass compresses Goto chains and replaces Goto with Return when the target is
+            // Return. The number of steps is bounded so that cycles are kept as they are.
+            for (auto& operation : newVector)
+            {
+                if (operation.opcode != RegisterMachineOpcode::Goto)
+                {
+                    continue;
+                }
+
+                int target = operation.c;
+                for (size_t step = 0; step < newVector.size(); step++)
+                {
+                    if (newVector[target].opcode != RegisterMachineOpcode::Goto)
+                    {
+                        break;
+                    }
+
+                    target = newVector[target].c;
+                }
+
+                if (newVector[target].opcode == RegisterMachineOpcode::Return)
+                {
+                    operation = newVector[target];
+                }
+                else
+                {
+                    operation.c = target;
+                }
+            }
+
+            // Fourth pass replaces a move followed by returning the moved value with returning
+            // the source register directly.
+            for (size_t i = 0; i + 1 < newVector.size(); i++)
+            {
+                auto& operation = newVector[i];
+                auto& next = newVector[i + 1];
+
+                if (operation.opcode == RegisterMachineOpcode::Move &&
+                    next.opcode == RegisterMachineOpcode::Return && next.a == operation.a)
+                {
+                    operation = RegisterMachineOperation(RegisterMachineOpcode::Return, operation.b);
+                }
+            }
+
+            operations = std::move(newVector);
+        }
+
+        virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
+        {
+            result = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::LoadConst, result, 0);
+        }
+
+        virtual void Visit(const std::shared_ptr<const PrecomputedOperator>& op) override
+        {
+            result = AllocateRegister();
+            EmitLoadConst(result, op->GetValue<TNumber>());
+        }
+
+        virtual void Visit(const std::shared_ptr<const OperandOperator>& op) override
+        {
+            // Arguments are stored in the first registers of the frame, so we need no operations
+            assert(definition);
+            result = op->GetIndex();
+        };
+
+        virtual void Visit(const std::shared_ptr<const DefineOperator>& op) override
+        {
+            result = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::LoadConst, result, 0);
+        };
+
+        virtual void Visit(const std::shared_ptr<const LoadVariableOperator>& op) override
+        {
+            result = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::LoadVariable, result,
+                         GetOrCreateVariableIndex(op->GetVariableName()));
+        };
+
+        virtual void Visit(const std::shared_ptr<const InputOperator>& op) override
+        {
+            result = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::Input, result);
+        };
+
+        virtual void Visit(const std::shared_ptr<const LoadArrayOperator>& op) override
+        {
+            int mark = nextRegister;
+            int index = EmitOperator(op->GetIndex());
+            nextRegister = mark;
+            result = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::LoadArrayElement, result, index);
+        };
+
+        virtual void Visit(const std::shared_ptr<const PrintCharOperator>& op) override
+        {
+            int mark = nextRegister;
+            int character = EmitOperator(op->GetCharacter());
+            nextRegister = mark;
+            result = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::PrintChar, result, character);
+        };
+
+        virtual void Visit(const std::shared_ptr<const ParenthesisOperator>& op) override
+        {
+            auto& operators = op->GetOperators();
+            int mark = nextRegister;
+
+            if (operators.empty())
+            {
+                result = AllocateRegister();
+                AddOperation(RegisterMachineOpcode::LoadConst, result, 0);
+                return;
+            }
+
+            for (size_t i = 0; i < operators.size() - 1; i++)
+            {
+                EmitOperator(operators[i]);
+                nextRegister = mark;
+            }
+
+            result = EmitOperator(operators.back());
+        }
+
+        virtual void Visit(const std::shared_ptr<const DecimalOperator>& op) override
+        {
+            int mark = nextRegister;
+            int operand = EmitOperator(op->GetOperand());
+            nextRegister = mark;
+
+            int value = AllocateRegister();
+            int ten = AllocateRegister();
+            AddOperation(RegisterMachineOpcode::LoadConst, ten, 10);
+            AddOperation(RegisterMachineOpcode::Mult, value, operand, ten);
+            AddOperation(RegisterMachineOpcode::AddConst, value, value, op->GetValue());
+
+            nextRegister = value + 1;
+            result = value;
+        }
+
+        virtual void Visit(const std::shared_ptr<const StoreVariableOperator>& op) override
+        {
+            int value = EmitOperator(op->GetOperand());
+            AddOperation(RegisterMachineOpcode::StoreVariable,
+                         GetOrCreateVariableIndex(op->GetVariableName()), value);
+            result = value;
+        }
+
+        virtual void Visit(const std::shared_ptr<const StoreArrayOperator>& op) override
+        {
+            int value = EmitOperator(op->GetValue());
+            int mark = nextRegister;
+            int index = EmitOperator(op->GetIndex());
+            nextRegister = mark;
+            AddOperation(RegisterMachineOpcode::StoreArrayElement, value, index);
+            result = value;
+        }
+
+        virtual void Visit(const std::shared_ptr<const BinaryOperator>& op) override
+        {
+            int mark = nextRegister;
+
+            switch (op->GetType())
+            {
+            case BinaryType::Add:
+            case BinaryType::Sub:
+            {
+                int left = EmitOperator(op->GetLeft());
+                if (auto constant = GetSmallConstant(op->GetRight()))
+                {
+                    nextRegister = mark;
+                    result = AllocateRegister();
+                    AddOperation(op->GetType() == BinaryType::Add ? RegisterMachineOpcode::AddConst
+                                                                  : RegisterMachineOpcode::SubConst,
+                                 result, left, *constant);
+                    return;
+                }
+
+                int right = EmitOperator(op->GetRight());
+                nextRegister = mark;
+                result = AllocateRegister();
+                AddOperation(op->GetType() == BinaryType::Add ? RegisterMachineOpcode::Add
+                                                              : RegisterMachineOpcode::Sub,
+                             result, left, right);
+                return;
+            }
+            case BinaryType::Mult:
+                EmitBinaryOperation(op, RegisterMachineOpcode::Mult);
+                return;
+            case BinaryType::Div:
+                EmitBinaryOperation(op, option.checkZeroDivision && !op->IsDivisorNonZero()
+                                            ? RegisterMachineOpcode::DivChecked
+                                            : RegisterMachineOpcode::Div);
+                return;
+            case BinaryType::Mod:
+                EmitBinaryOperation(op, option.checkZeroDivision && !op->IsDivisorNonZero()
+                                            ? RegisterMachineOpcode::ModChecked
+                                            : RegisterMachineOpcode::Mod);
+                return;
+
+                // For comparisons and logical operations, we generate code as "condition" to reduce
+                // redundancy and to keep short-circuit behavior.
+            case BinaryType::Equal:
+            case BinaryType::NotEqual:
+            case BinaryType::LessThan:
+            case BinaryType::LessThanOrEqual:
+            case BinaryType::GreaterThanOrEqual:
+            case BinaryType::GreaterThan:
+            case BinaryType::LogicalAnd:
+            case BinaryType::LogicalOr:
+            {
+                int ifTrueLabel = nextLabel++, endLabel = nextLabel++;
+
+                EmitConditionGoto(op, ifTrueLabel, true);
+                result = AllocateRegister();
+                AddOperation(RegisterMachineOpcode::LoadConst, result, 0);
+                AddOperation(RegisterMachineOpcode::Goto, 0, 0, endLabel);
+                AddOperation(RegisterMachineOpcode::Lavel, 0, 0, ifTrueLabel);
+                AddOperation(RegisterMachineOpcode::LoadConst, result, 1);
+                AddOperation(RegisterMachineOpcode::Lavel, 0, 0, endLabel);
+                return;
+            }
+            default:
+                UNREACHABLE();
+                break;
+            }
+        }
+
+        void EmitBinaryOperation(const std::shared_ptr<const BinaryOperator>& op,
+                                 RegisterMachineOpcode opcode)
+        {
+            int mark = nextRegister;
+            int left = EmitOperator(op->GetLeft());
+            int right = EmitOperator(op->GetRight());
+            nextRegister = mark;
+            result = AllocateRegister();
+            AddOperation(opcode, result, left, right);
+        }
+
+        // Emits operations that jump to the label if the condition is equal to "gotoIfTrue". The
+        // registers used during the evaluation of the condition are released at the end.
+        void EmitConditionGoto(const std::shared_ptr<const Operator>& condition, int label,
+                               bool gotoIfTrue)
+        {
+            int mark = nextRegister;
+
+            if (auto* parenthesis = dynamic_cast<const ParenthesisOperator*>(condition.get());
+                parenthesis != nullptr && !parenthesis->GetOperators().empty())
+            {
+                auto& operators = parenthesis->GetOperators();
+
+                for (size_t i = 0; i < operators.size() - 1; i++)
+                {
+                    EmitOperator(operators[i]);
+                    nextRegister = mark;
+                }
+
+                EmitConditionGoto(operators.back(), label, gotoIfTrue);
+                return;
+            }
+
+            if (auto* binary = dynamic_cast<const BinaryOperator*>(condition.get()))
+            {
+                auto type = binary->GetType();
+
+                switch (type)
+                {
+                case BinaryType::Equal:
+                case BinaryType::NotEqual:
+                case BinaryType::LessThan:
+                case BinaryType::LessThanOrEqual:
+                case BinaryType::GreaterThanOrEqual:
+                case BinaryType::GreaterThan:
+                {
+                    if (!gotoIfTrue)
+                    {
+                        type = NegateComparison(type);
+                    }
+
+                    auto left = binary->GetLeft(), right = binary->GetRight();
+                    if (GetSmallConstant(left) && !GetSmallConstant(right))
+                    {
+                        // Move the constant to the right side
+                        std::swap(left, right);
+                        type = SwapComparison(type);
+                    }
+
+                    int leftRegister = EmitOperator(left);
+                    if (auto constant = GetSmallConstant(right))
+                    {
+                        if (*constant == 0 &&
+                            (type == BinaryType::Equal || type == BinaryType::NotEqual))
+                        {
+                            AddOperation(type == BinaryType::NotEqual
+                                             ? RegisterMachineOpcode::GotoIfTrue
+                                             : RegisterMachineOpcode::GotoIfFalse,
+                                         leftRegister, 0, label);
+                        }
+                        else
+                        {
+                            AddOperation(GetConditionalGoto(type, true), leftRegister, *constant,
+                                         label);
+                        }
+                    }
+                    else
+                    {
+                        int rightRegister = EmitOperator(right);
+                        AddOperation(GetConditionalGoto(type, false), leftRegister, rightRegister,
+                                     label);
+                    }
+
+                    nextRegister = mark;
+                    return;
+                }
+                case BinaryType::LogicalAnd:
+                    if (gotoIfTrue)
+                    {
+                        int ifFalseLabel = nextLabel++;
+                        EmitConditionGoto(binary->GetLeft(), ifFalseLabel, false);
+                        EmitConditionGoto(binary->GetRight(), label, true);
+                        AddOperation(RegisterMachineOpcode::Lavel, 0, 0, ifFalseLabel);
+                    }
+                    else
+                    {
+                        EmitConditionGoto(binary->GetLeft(), label, false);
+                        EmitConditionGoto(binary->GetRight(), label, false);
+                    }
+                    return;
+                case BinaryType::LogicalOr:
+                    if (gotoIfTrue)
+                    {
+                        EmitConditionGoto(binary->GetLeft(), label, true);
+                        EmitConditionGoto(binary->GetRight(), label, true);
+                    }
+                    else
+                    {
+                        int endLabel = nextLabel++;
+                        EmitConditionGoto(binary->GetLeft(), endLabel, true);
+                        EmitConditionGoto(binary->GetRight(), label, false);
+                        AddOperation(RegisterMachineOpcode::Lavel, 0, 0, endLabel);
+                    }
+                    return;
+                default:
+                    break;
+                }
+            }
+
+            int value = EmitOperator(condition);
+            AddOperation(gotoIfTrue ? RegisterMachineOpcode::GotoIfTrue
+                                    : RegisterMachineOpcode::GotoIfFalse,
+                         value, 0, label);
+            nextRegister = mark;
+        }
+
+        virtual void Visit(const std::shared_ptr<const ConditionalOperator>& op) override
+        {
+            int ifTrueLabel = nextLabel++, endLabel = nextLabel++;
+            int mark = nextRegister;
+            EmitConditionGoto(op->GetCondition(), ifTrueLabel, true);
+
+            // Both branches store their results in the same register
+            EmitOperatorTo(op->GetIfFalse(), mark);
+            if (operations.back().opcode != RegisterMachineOpcode::Goto)
+            {
+                // "Last opcode is Goto" means elimination of "Call" (tail-call)
+                AddOperation(RegisterMachineOpcode::Goto, 0, 0, endLabel);
+            }
+
+            AddOperation(RegisterMachineOpcode::Lavel, 0, 0, ifTrueLabel);
+            EmitOperatorTo(op->GetIfTrue(), mark);
+            AddOperation(RegisterMachineOpcode::Lavel, 0, 0, endLabel);
+
+            nextRegister = mark;
+            result = AllocateRegister();
+        };
+
+        virtual void Visit(const std::shared_ptr<const UserDefinedOperator>& op) override
+        {
+            // Evaluate the arguments into consecutive registers, which will be the first
+            // registers of the callee's frame
+            auto operands = op->GetOperands();
+            int base = nextRegister;
+            bool isReplaceableWithJump = IsReplaceableWithJump(op);
+            std::vector<bool> isUnchanged(operands.size(), false);
+
+            for (size_t i = 0; i < operands.size(); i++)
+            {
+                int destination = base + static_cast<int>(i);
+                int value = EmitOperatorTo(operands[i], destination);
+
+                // When the argument of a tail call is passed as is, we need not move it
+                isUnchanged[i] = isReplaceableWithJump && value == static_cast<int>(i);
+            }
+
+            if (isReplaceableWithJump)
+            {
+                for (size_t i = 0; i < operands.size(); i++)
+                {
+                    if (!isUnchanged[i])
+                    {
+                        AddOperation(RegisterMachineOpcode::Move, static_cast<int>(i),
+                                     base + static_cast<int>(i));
+                    }
+                }
+
+                AddOperation(RegisterMachineOpcode::Goto, 0, 0, OperatorBeginLabel);
+            }
+            else
+            {
+                AddOperation(RegisterMachineOpcode::Call, base, base,
+                             operatorLabels[op->GetDefinition()]);
+            }
+
+            // The returned value is stored in the first register of the callee's frame
+            nextRegister = base;
+            result = AllocateRegister();
+        }
+
+        // Visits the given operator and returns the register that holds its result
+        int EmitOperator(const std::shared_ptr<const Operator>& op)
+        {
+            op->Accept(*this);
+            return result;
+        }
+
+        // Visits the given operator and ensures that its result is held in the given register,
+        // which must be the first free one. Returns the register that held the result before it
+        // was moved.
+        int EmitOperatorTo(const std::shared_ptr<const Operator>& op, int destination)
+        {
+            nextRegister = destination;
+            int value = EmitOperator(op);
+            if (value != destination)
+            {
+                AddOperation(RegisterMachineOpcode::Move, destination, value);
+            }
+
+            nextRegister = destination;
+            AllocateRegister();
+            return value;
+        }
+
+        void EmitLoadConst(int destination, const TNumber& value)
+        {
+            if (auto constant = ToSmallConstant(value))
+            {
+                AddOperation(RegisterMachineOpcode::LoadConst, destination, *constant);
+            }
+            else
+            {
+                // The constant value exceeds the limit of RegisterMachineOperation::ValueType, so
+                // we use constTable.
+                int no = static_cast<int>(constTable.size());
+                constTable.push_back(value);
+                AddOperation(RegisterMachineOpcode::LoadConstTable, destination, no);
+            }
+        }
+
+        int AllocateRegister()
+        {
+            int index = nextRegister++;
+            numRegisters = std::max(numRegisters, nextRegister);
+            return index;
+        }
+
+        void AddOperation(RegisterMachineOpcode opcode, RegisterMachineOperation::ValueType a = 0,
+                          RegisterMachineOperation::ValueType b = 0,
+                          RegisterMachineOperation::ValueType c = 0)
+        {
+            operations.emplace_back(opcode, a, b, c);
+        }
+
+        static std::optional<RegisterMachineOperation::ValueType> ToSmallConstant(
+            const TNumber& value)
+        {
+            auto casted = static_cast<RegisterMachineOperation::ValueType>(value);
+
+            if (casted == value)
+            {
+                return casted;
+            }
+            else
+            {
+                return std::nullopt;
+            }
+        }
+
+        // Returns the value of the given operator if it is a constant that fits
+        // RegisterMachineOperation::ValueType
+        static std::optional<RegisterMachineOperation::ValueType> GetSmallConstant(
+            const std::shared_ptr<const Operator>& op)
+        {
+            if (dynamic_cast<const ZeroOperator*>(op.get()) != nullptr)
+            {
+                return 0;
+            }
+
+            if (auto* precomputed = dynamic_cast<const PrecomputedOperator*>(op.get()))
+            {
+                return ToSmallConstant(precomputed->GetValue<TNumber>());
+            }
+
+            return std::nullopt;
+        }
+
+        int GetOrCreateVariableIndex(const std::string& variableName)
+        {
+            auto it = variableIndices.find(variableName);
+            if (it != variableIndices.end())
+            {
+                return it->second;
+            }
+            else
+            {
+                int index = static_cast<int>(variableIndices.size());
+                variableIndices[variableName] = index;
+                return index;
+            }
+        }
+
+        bool IsReplaceableWithJump(const std::shared_ptr<const UserDefinedOperator>& op) const
+        {
+            return definition == op->GetDefinition() && op->IsTailCall().value_or(false);
+        }
+    };
+
+    std::vector<TNumber> constTable;
+    std::vector<RegisterMachineUserDefinedOperator> userDefinedOperators;
+    std::unordered_map<OperatorDefinition, int> operatorLabels;
+    std::unordered_map<std::string, int> variableIndices;
+
+    // Operators which the entry point cannot call are not generated
+    auto reachableOperators = CallGraph(context).GetReachableOperators(op);
+
+    int index = 0;
+    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    {
+        if (reachableOperators.count(it->first) > 0)
+        {
+            operatorLabels[it->second.GetDefinition()] = index++;
+        }
+    }
+
+    // Generate user-defined operators' codes
+    for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
+    {
+        if (reachableOperators.count(it->first) == 0)
+        {
+            continue;
+        }
+
+        auto& implement = it->second;
+        Generator generator(context, option, constTable, operatorLabels, implement.GetDefinition(),
+                            variableIndices);
+        generator.Generate(implement.GetOperator());
+        userDefinedOperators.emplace_back(implement.GetDefinition(),
+                                          std::move(generator.operations), generator.numRegisters);
+    }
+
+    // Generate Main code
+    std::vector<RegisterMachineOperation> entryPoint;
+    int entryPointNumRegisters;
+    {
+        Generator generator(context, option, constTable, operatorLabels, std::nullopt,
+                            variableIndices);
+        generator.Generate(op);
+        entryPoint = std::move(generator.operations);
+        entryPointNumRegisters = generator.numRegisters;
+    }
+
+    std::vector<std::string> variables(variableIndices.size());
+    for (auto& pair : variableIndices)
+    {
+        variables[pair.second] = pair.first;
+    }
+
+    return RegisterMachineModule<TNumber>(entryPoint, entryPointNumRegisters, constTable,
+                                          userDefinedOperators, variables);
+}
+
+namespace
+{
+// The main loop of the register machine. If "Profiled" is true, Call and Return operations report
+// to the given profiler. "profileIds" holds the profiler's id of each operator indexed by its
+// start address.
+template<bool Profiled, typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+TNumber ExecuteRegisterMachineModuleCore(
+    const RegisterMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    RegisterMachineContext<TNumber>& context, const std::vector<TNumber*>& variables,
+    Profiler* profiler, const int* profileIds)
+{
+    // Start execution
+    auto& frameSizes = module.GetFrameSizes();
+    if (!context.ReserveRegisters(std::max(frameSizes[0], 1)) || !context.ReserveFrameStack(2))
+    {
+        throw Exceptions::StackOverflowException(std::nullopt);
+    }
+
+    std::vector<TNumber>& registers = context.GetRegisters();
+    std::vector<int>& frameStack = context.GetFrameStack();
+    TNumber* registersBegin = registers.data();
+    TNumber* registersEnd = registersBegin + registers.size();
+    int* frameStackBegin = frameStack.data();
+    int* frameStackEnd = frameStackBegin + frameStack.size();
+    TNumber* base = registersBegin;
+    int* frameTop = frameStackBegin;
+    auto& constTable = module.GetConstTable();
+    auto& array = state.GetArraySource();
+
+#ifdef USE_COMPUTED_GOTO
+    // This dispatch table must be in the same order as the RegisterMachineOpcode definition
+    static const void* DispatchTable[] = {
+        &&COMPUTED_GOTO_LABEL_OF(LoadConst),
+        &&COMPUTED_GOTO_LABEL_OF(LoadConstTable),
+        &&COMPUTED_GOTO_LABEL_OF(Move),
+        &&COMPUTED_GOTO_LABEL_OF(LoadVariable),
+        &&COMPUTED_GOTO_LABEL_OF(StoreVariable),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArrayElement),
+        &&COMPUTED_GOTO_LABEL_OF(StoreArrayElement),
+        &&COMPUTED_GOTO_LABEL_OF(Input),
+        &&COMPUTED_GOTO_LABEL_OF(PrintChar),
+        &&COMPUTED_GOTO_LABEL_OF(Add),
+        &&COMPUTED_GOTO_LABEL_OF(Sub),
+        &&COMPUTED_GOTO_LABEL_OF(Mult),
+        &&COMPUTED_GOTO_LABEL_OF(Div),
+        &&COMPUTED_GOTO_LABEL_OF(DivChecked),
+        &&COMPUTED_GOTO_LABEL_OF(Mod),
+        &&COMPUTED_GOTO_LABEL_OF(ModChecked),
+        &&COMPUTED_GOTO_LABEL_OF(AddConst),
+        &&COMPUTED_GOTO_LABEL_OF(SubConst),
+        &&COMPUTED_GOTO_LABEL_OF(Goto),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfTrue),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfFalse),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfEqual),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfNotEqual),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfLessThan),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfLessThanOrEqual),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThan),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThanOrEqual),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfNotEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfLessThanConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfLessThanOrEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThanConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThanOrEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(Call),
+        &&COMPUTED_GOTO_LABEL_OF(Return),
+        &&COMPUTED_GOTO_LABEL_OF(Halt),
+        &&COMPUTED_GOTO_LABEL_OF(Lavel),
+    };
+
+    // The target addresses of goto are computed only once per module
+    const ComputedGotoOperation* operations = module.GetThreadedOperations(DispatchTable);
+    const ComputedGotoOperation* op = operations;
+#else
+    const RegisterMachineOperation* operations = module.GetFlattenedOperations().data();
+    const RegisterMachineOperation* op = operations;
+#endif // USE_COMPUTED_GOTO
+
+    COMPUTED_GOTO_BEGIN();
+
+    COMPUTED_GOTO_SWITCH()
+    {
+        COMPUTED_GOTO_CASE(LoadConst)
+        {
+            base[op->a] = static_cast<TNumber>(op->b);
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(LoadConstTable)
+        {
+            base[op->a] = constTable[op->b];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Move)
+        {
+            base[op->a] = base[op->b];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(LoadVariable)
+        {
+            base[op->a] = *variables[op->b];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(StoreVariable)
+        {
+            *variables[op->a] = base[op->b];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(LoadArrayElement)
+        {
+            base[op->a] = array.Get(base[op->b]);
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(StoreArrayElement)
+        {
+            array.Set(base[op->b], base[op->a]);
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Input)
+        {
+            base[op->a] = static_cast<TNumber>(state.GetChar());
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(PrintChar)
+        {
+            state.PrintChar(static_cast<char>(base[op->b]));
+            base[op->a] = 0;
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Add)
+        {
+            base[op->a] = base[op->b] + base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Sub)
+        {
+            base[op->a] = base[op->b] - base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Mult)
+        {
+            base[op->a] = base[op->b] * base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Div)
+        {
+            base[op->a] = base[op->b] / base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(DivChecked)
+        {
+            if (base[op->c] == 0)
+            {
+                throw Exceptions::ZeroDivisionException(std::nullopt);
+            }
+
+            base[op->a] = base[op->b] / base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Mod)
+        {
+            base[op->a] = base[op->b] % base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(ModChecked)
+        {
+            if (base[op->c] == 0)
+            {
+                throw Exceptions::ZeroDivisionException(std::nullopt);
+            }
+
+            base[op->a] = base[op->b] % base[op->c];
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(AddConst)
+        {
+            base[op->a] = base[op->b] + op->c;
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(SubConst)
+        {
+            base[op->a] = base[op->b] - op->c;
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Goto)
+        {
+            COMPUTED_GOTO_JUMP(op->c);
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfTrue)
+        {
+            if (base[op->a] != 0)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfFalse)
+        {
+            if (base[op->a] == 0)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfEqual)
+        {
+            if (base[op->a] == base[op->b])
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfNotEqual)
+        {
+            if (base[op->a] != base[op->b])
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfLessThan)
+        {
+            if (base[op->a] < base[op->b])
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfLessThanOrEqual)
+        {
+            if (base[op->a] <= base[op->b])
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfGreaterThan)
+        {
+            if (base[op->a] > base[op->b])
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfGreaterThanOrEqual)
+        {
+            if (base[op->a] >= base[op->b])
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfEqualConst)
+        {
+            if (base[op->a] == op->b)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfNotEqualConst)
+        {
+            if (base[op->a] != op->b)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfLessThanConst)
+        {
+            if (base[op->a] < op->b)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfLessThanOrEqualConst)
+        {
+            if (base[op->a] <= op->b)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfGreaterThanConst)
+        {
+            if (base[op->a] > op->b)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfGreaterThanOrEqualConst)
+        {
+            if (base[op->a] >= op->b)
+            {
+                COMPUTED_GOTO_JUMP(op->c);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(Call)
+        {
+            // Check stack overflow. The register file and the frame stack are grown when they are
+            // not large enough.
+            if (base + op->b + frameSizes[op->c] > registersEnd)
+            {
+                size_t baseIndex = std::distance(registersBegin, base);
+                if (!context.ReserveRegisters(baseIndex + op->b + frameSizes[op->c]))
+                {
+                    throw Exceptions::StackOverflowException(std::nullopt);
+                }
+
+                registersBegin = registers.data();
+                registersEnd = registersBegin + registers.size();
+                base = registersBegin + baseIndex;
+            }
+
+            if (frameTop + 2 > frameStackEnd)
+            {
+                size_t frameTopIndex = std::distance(frameStackBegin, frameTop);
+                if (!context.ReserveFrameStack(frameTopIndex + 2))
+                {
+                    throw Exceptions::StackOverflowException(std::nullopt);
+                }
+
+                frameStackBegin = frameStack.data();
+                frameStackEnd = frameStackBegin + frameStack.size();
+                frameTop = frameStackBegin + frameTopIndex;
+            }
+
+            // Push current program counter
+            *frameTop = static_cast<int>(std::distance(operations, op));
+            frameTop++;
+
+            // Push current frame base
+            *frameTop = static_cast<int>(std::distance(registersBegin, base));
+            frameTop++;
+
+            // Create new frame, whose first registers hold the arguments
+            base += op->b;
+
+            if constexpr (Profiled)
+            {
+                profiler->Enter(profileIds[op->c]);
+            }
+
+            // Branch
+            COMPUTED_GOTO_JUMP(op->c);
+        }
+
+        COMPUTED_GOTO_CASE(Return)
+        {
+            if constexpr (Profiled)
+            {
+                profiler->Exit();
+            }
+
+            // Pop previous frame base and program counter
+            frameTop--;
+            TNumber* callerBase = registersBegin + *frameTop;
+            frameTop--;
+
+            // Store returning value to the destination of the call operation
+            callerBase[operations[*frameTop].a] = base[op->a];
+            base = callerBase;
+
+            COMPUTED_GOTO_JUMP(*frameTop + 1);
+        }
+
+        COMPUTED_GOTO_CASE(Halt)
+        {
+            return base[op->a];
+        }
+
+        COMPUTED_GOTO_CASE(Lavel)
+        COMPUTED_GOTO_DEFAULT()
+        {
+            UNREACHABLE();
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+    }
+}
+}
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter>
+TNumber ExecuteRegisterMachineModule(
+    const RegisterMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    RegisterMachineContext<TNumber>& context, Profiler* profiler)
+{
+    // The variables are accessed through their slots in ExecutionState
+    std::vector<TNumber*> variables(module.GetVariables().size());
+    for (size_t i = 0; i < variables.size(); i++)
+    {
+        variables[i] = state.GetVariableSource().GetSlot(module.GetVariables()[i]);
+    }
+
+    if (profiler == nullptr)
+    {
+        return ExecuteRegisterMachineModuleCore<false>(module, state, context, variables, nullptr,
+                                                       nullptr);
+    }
+
+    // Map the start address of each operator to its id in the profiler
+    std::vector<int> profileIds(module.GetFlattenedOperations().size());
+    auto& userDefinedOperators = module.GetUserDefinedOperators();
+    for (size_t i = 0; i < userDefinedOperators.size(); i++)
+    {
+        profileIds[module.GetStartAddresses()[i]] =
+            profiler->GetOperatorId(userDefinedOperators[i].GetDefinition().GetName());
+    }
+
+    return ExecuteRegisterMachineModuleCore<true>(module, state, context, variables, profiler,
+                                                  profileIds.data());
+}
+}
@@ -0,0 +1,415 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include "Common.h"
+#include "ExecutionState.h"
+#include "GuardedStack.h"
+#include "Operators.h"
+#include "Profiler.h"
+#include "ThreadedCode.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace calc4
+{
+// Opcodes of the register machine. Each operation has three operands, A, B and C. Registers are
+// indexed relative to the current frame, whose first registers hold the arguments of the
+// operator. The jump targets of branches and calls are always stored in C.
+enum class RegisterMachineOpcode : int8_t
+{
+    LoadConst,                     // R[A] = B
+    LoadConstTable,                // R[A] = ConstTable[B]
+    Move,                          // R[A] = R[B]
+    LoadVariable,                  // R[A] = Variables[B]
+    StoreVariable,                 // Variables[A] = R[B]
+    LoadArrayElement,              // R[A] = Array[R[B]]
+    StoreArrayElement,             // Array[R[B]] = R[A]
+    Input,                         // R[A] = GetChar()
+    PrintChar,                     // PrintChar(R[B]); R[A] = 0
+    Add,                           // R[A] = R[B] + R[C]
+    Sub,                           // R[A] = R[B] - R[C]
+    Mult,                          // R[A] = R[B] * R[C]
+    Div,                           // R[A] = R[B] / R[C]
+    DivChecked,                    // R[A] = R[B] / R[C] (throws if R[C] == 0)
+    Mod,                           // R[A] = R[B] % R[C]
+    ModChecked,                    // R[A] = R[B] % R[C] (throws if R[C] == 0)
+    AddConst,                      // R[A] = R[B] + C
+    SubConst,                      // R[A] = R[B] - C
+    Goto,                          // goto C
+    GotoIfTrue,                    // if (R[A] != 0) goto C
+    GotoIfFalse,                   // if (R[A] == 0) goto C
+    GotoIfEqual,                   // if (R[A] == R[B]) goto C
+    GotoIfNotEqual,                // if (R[A] != R[B]) goto C
+    GotoIfLessThan,                // if (R[A] < R[B]) goto C
+    GotoIfLessThanOrEqual,         // if (R[A] <= R[B]) goto C
+    GotoIfGreaterThan,             // if (R[A] > R[B]) goto C
+    GotoIfGreaterThanOrEqual,      // if (R[A] >= R[B]) goto C
+    GotoIfEqualConst,              // if (R[A] == B) goto C
+    GotoIfNotEqualConst,           // if (R[A] != B) goto C
+    GotoIfLessThanConst,           // if (R[A] < B) goto C
+    GotoIfLessThanOrEqualConst,    // if (R[A] <= B) goto C
+    GotoIfGreaterThanConst,        // if (R[A] > B) goto C
+    GotoIfGreaterThanOrEqualConst, // if (R[A] >= B) goto C
+    Call,                          // R[A] = call C with a new frame starting at R[B]
+    Return,                        // return R[A]
+    Halt,                          // halt with R[A]
+    Lavel,
+};
+
+struct RegisterMachineOperation
+{
+    using ValueType = int32_t;
+
+    RegisterMachineOpcode opcode;
+    ValueType a;
+    ValueType b;
+    ValueType c;
+
+    RegisterMachineOperation()
+        : opcode(static_cast<RegisterMachineOpcode>(0)), a(0), b(0), c(0)
+    {
+    }
+
+    RegisterMachineOperation(RegisterMachineOpcode opcode, ValueType a = 0, ValueType b = 0,
+                             ValueType c = 0)
+        : opcode(opcode), a(a), b(b), c(c)
+    {
+    }
+};
+
+struct RegisterMachineUserDefinedOperator
+{
+private:
+    OperatorDefinition definition;
+    std::vector<RegisterMachineOperation> operations;
+    int numRegisters;
+
+public:
+    RegisterMachineUserDefinedOperator(const OperatorDefinition& definition,
+                                       const std::vector<RegisterMachineOperation>& operations,
+                                       int numRegisters)
+        : definition(definition), operations(operations), numRegisters(numRegisters)
+    {
+    }
+
+    const OperatorDefinition& GetDefinition() const
+    {
+        return definition;
+    }
+
+    const std::vector<RegisterMachineOperation>& GetOperations() const
+    {
+        return operations;
+    }
+
+    int GetNumRegisters() const
+    {
+        return numRegisters;
+    }
+};
+
+// An operation whose opcode is replaced with the address of its handler. This is used by the
+// computed goto dispatcher of the register machine.
+struct RegisterMachineThreadedOperation
+{
+    const void* address;
+    RegisterMachineOperation::ValueType a;
+    RegisterMachineOperation::ValueType b;
+    RegisterMachineOperation::ValueType c;
+
+    static RegisterMachineThreadedOperation Create(const void* address,
+                                                   const RegisterMachineOperation& operation)
+    {
+        return { address, operation.a, operation.b, operation.c };
+    }
+};
+
+using RegisterMachineThreadedCodeCache =
+    ThreadedCodeCache<RegisterMachineOperation, RegisterMachineThreadedOperation>;
+
+template<typename TNumber>
+class RegisterMachineModule
+{
+private:
+    std::vector<RegisterMachineOperation> entryPoint;
+    int entryPointNumRegisters;
+    std::vector<TNumber> constTable;
+    std::vector<RegisterMachineUserDefinedOperator> userDefinedOperators;
+    std::vector<std::string> variables;
+
+    // The following members are computed once on construction and shared by every execution
+    std::vector<RegisterMachineOperation> flattenedOperations;
+    std::vector<int> frameSizes;
+    std::vector<int> startAddresses;
+    std::shared_ptr<RegisterMachineThreadedCodeCache> threadedCodeCache;
+
+public:
+    RegisterMachineModule(
+        const std::vector<RegisterMachineOperation>& entryPoint, int entryPointNumRegisters,
+        const std::vector<TNumber>& constTable,
+        const std::vector<RegisterMachineUserDefinedOperator>& userDefinedOperators,
+        const std::vector<std::string>& variables)
+        : entryPoint(entryPoint), entryPointNumRegisters(entryPointNumRegisters),
+          constTable(constTable), userDefinedOperators(userDefinedOperators),
+          variables(variables),
+          threadedCodeCache(std::make_shared<RegisterMachineThreadedCodeCache>())
+    {
+        std::tie(flattenedOperations, frameSizes, startAddresses) = FlattenOperations();
+    }
+
+    std::tuple<std::vector<RegisterMachineOperation>, std::vector<int>, std::vector<int>>
+    FlattenOperations() const;
+
+    // Returns the operations of the whole module, whose labels and call targets are resolved
+    const std::vector<RegisterMachineOperation>& GetFlattenedOperations() const
+    {
+        return flattenedOperations;
+    }
+
+    // Returns the number of registers of each user-defined operator indexed by its start
+    // address. The element at zero is the one of the entry point.
+    const std::vector<int>& GetFrameSizes() const
+    {
+        return frameSizes;
+    }
+
+    // Returns the start address of each user-defined operator in the flattened operations
+    const std::vector<int>& GetStartAddresses() const
+    {
+        return startAddresses;
+    }
+
+    const RegisterMachineThreadedOperation* GetThreadedOperations(
+        const void* const* dispatchTable) const
+    {
+        return threadedCodeCache->GetOrCreate(dispatchTable, flattenedOperations);
+    }
+
+    const std::vector<RegisterMachineOperation>& GetEntryPoint() const
+    {
+        return entryPoint;
+    }
+
+    int GetEntryPointNumRegisters() const
+    {
+        return entryPointNumRegisters;
+    }
+
+    const std::vector<TNumber>& GetConstTable() const
+    {
+        return constTable;
+    }
+
+    const std::vector<RegisterMachineUserDefinedOperator>& GetUserDefinedOperators() const
+    {
+        return userDefinedOperators;
+    }
+
+    const std::vector<std::string>& GetVariables() const
+    {
+        return variables;
+    }
+};
+
+// Owns the register file and the call frames used by the register machine. Like
+// StackMachineContext, it can be reused across executions, and its arrays grow on demand up to
+// the given maximum sizes. A context must not be shared among threads running concurrently.
+template<typename TNumber>
+class RegisterMachineContext
+{
+public:
+    static constexpr size_t DefaultMaxNumRegisters = 1 << 20;
+    static constexpr size_t DefaultMaxFrameStackSize = 1 << 20;
+    static constexpr size_t InitialSize = 1 << 10;
+
+private:
+    std::vector<TNumber> registers;
+    std::vector<int> frameStack;
+    size_t maxNumRegisters;
+    size_t maxFrameStackSize;
+
+public:
+    RegisterMachineContext(size_t maxNumRegisters = DefaultMaxNumRegisters,
+                           size_t maxFrameStackSize = DefaultMaxFrameStackSize)
+        : maxNumRegisters(maxNumRegisters), maxFrameStackSize(maxFrameStackSize)
+    {
+    }
+
+    std::vector<TNumber>& GetRegisters()
+    {
+        return registers;
+    }
+
+    std::vector<int>& GetFrameStack()
+    {
+        return frameStack;
+    }
+
+    // Grows the register file so that it has at least "requiredSize" elements. Returns false if
+    // the required size exceeds the maximum.
+    bool ReserveRegisters(size_t requiredSize)
+    {
+        return ReserveStackArray(registers, requiredSize, maxNumRegisters, InitialSize);
+    }
+
+    // Grows the frame stack so that it has at least "requiredSize" elements. Returns false if the
+    // required size exceeds the maximum.
+    bool ReserveFrameStack(size_t requiredSize)
+    {
+        return ReserveStackArray(frameStack, requiredSize, maxFrameStackSize, InitialSize);
+    }
+};
+
+struct RegisterMachineCodeGenerationOption
+{
+    bool checkZeroDivision = false;
+};
+
+namespace
+{
+inline constexpr const char* ToString(RegisterMachineOpcode opcode)
+{
+    switch (opcode)
+    {
+    case RegisterMachineOpcode::LoadConst:
+        return "LoadConst";
+    case RegisterMachineOpcode::LoadConstTable:
+        return "LoadConstTable";
+    case RegisterMachineOpcode::Move:
+        return "Move";
+    case RegisterMachineOpcode::LoadVariable:
+        return "LoadVariable";
+    case RegisterMachineOpcode::StoreVariable:
+        return "StoreVariable";
+    case RegisterMachineOpcode::LoadArrayElement:
+        return "LoadArrayElement";
+    case RegisterMachineOpcode::StoreArrayElement:
+        return "StoreArrayElement";
+    case RegisterMachineOpcode::Input:
+        return "Input";
+    case RegisterMachineOpcode::PrintChar:
+        return "PrintChar";
+    case RegisterMachineOpcode::Add:
+        return "Add";
+    case RegisterMachineOpcode::Sub:
+        return "Sub";
+    case RegisterMachineOpcode::Mult:
+        return "Mult";
+    case RegisterMachineOpcode::Div:
+        return "Div";
+    case RegisterMachineOpcode::DivChecked:
+        return "DivChecked";
+    case RegisterMachineOpcode::Mod:
+        return "Mod";
+    case RegisterMachineOpcode::ModChecked:
+        return "ModChecked";
+    case RegisterMachineOpcode::AddConst:
+        return "AddConst";
+    case RegisterMachineOpcode::SubConst:
+        return "SubConst";
+    case RegisterMachineOpcode::Goto:
+        return "Goto";
+    case RegisterMachineOpcode::GotoIfTrue:
+        return "GotoIfTrue";
+    case RegisterMachineOpcode::GotoIfFalse:
+        return "GotoIfFalse";
+    case RegisterMachineOpcode::GotoIfEqual:
+        return "GotoIfEqual";
+    case RegisterMachineOpcode::GotoIfNotEqual:
+        return "GotoIfNotEqual";
+    case RegisterMachineOpcode::GotoIfLessThan:
+        return "GotoIfLessThan";
+    case RegisterMachineOpcode::GotoIfLessThanOrEqual:
+        return "GotoIfLessThanOrEqual";
+    case RegisterMachineOpcode::GotoIfGreaterThan:
+        return "GotoIfGreaterThan";
+    case RegisterMachineOpcode::GotoIfGreaterThanOrEqual:
+        return "GotoIfGreaterThanOrEqual";
+    case RegisterMachineOpcode::GotoIfEqualConst:
+        return "GotoIfEqualConst";
+    case RegisterMachineOpcode::GotoIfNotEqualConst:
+        return "GotoIfNotEqualConst";
+    case RegisterMachineOpcode::GotoIfLessThanConst:
+        return "GotoIfLessThanConst";
+    case RegisterMachineOpcode::GotoIfLessThanOrEqualConst:
+        return "GotoIfLessThanOrEqualConst";
+    case RegisterMachineOpcode::GotoIfGreaterThanConst:
+        return "GotoIfGreaterThanConst";
+    case RegisterMachineOpcode::GotoIfGreaterThanOrEqualConst:
+        return "GotoIfGreaterThanOrEqualConst";
+    case RegisterMachineOpcode::Call:
+        return "Call";
+    case RegisterMachineOpcode::Return:
+        return "Return";
+    case RegisterMachineOpcode::Halt:
+        return "Halt";
+    case RegisterMachineOpcode::Lavel:
+        return "Lavel";
+    default:
+        return "<Unknown>";
+    }
+}
+
+// Returns true if the C operand of the given opcode is a jump target
+inline constexpr bool IsJumpOpcode(RegisterMachineOpcode opcode)
+{
+    switch (opcode)
+    {
+    case RegisterMachineOpcode::Goto:
+    case RegisterMachineOpcode::GotoIfTrue:
+    case RegisterMachineOpcode::GotoIfFalse:
+    case RegisterMachineOpcode::GotoIfEqual:
+    case RegisterMachineOpcode::GotoIfNotEqual:
+    case RegisterMachineOpcode::GotoIfLessThan:
+    case RegisterMachineOpcode::GotoIfLessThanOrEqual:
+    case RegisterMachineOpcode::GotoIfGreaterThan:
+    case RegisterMachineOpcode::GotoIfGreaterThanOrEqual:
+    case RegisterMachineOpcode::GotoIfEqualConst:
+    case RegisterMachineOpcode::GotoIfNotEqualConst:
+    case RegisterMachineOpcode::GotoIfLessThanConst:
+    case RegisterMachineOpcode::GotoIfLessThanOrEqualConst:
+    case RegisterMachineOpcode::GotoIfGreaterThanConst:
+    case RegisterMachineOpcode::GotoIfGreaterThanOrEqualConst:
+        return true;
+    default:
+        return false;
+    }
+}
+}
+
+template<typename TNumber>
+RegisterMachineModule<TNumber> GenerateRegisterMachineModule(
+    const std::shared_ptr<const Operator>& op, const CompilationContext& context,
+    const RegisterMachineCodeGenerationOption& option);
+
+template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
+         typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
+         typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter>
+TNumber ExecuteRegisterMachineModule(
+    const RegisterMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    RegisterMachineContext<TNumber>& context, Profiler* profiler = nullptr);
+
+template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
+         typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
+         typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter>
+TNumber ExecuteRegisterMachineModule(
+    const RegisterMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state)
+{
+    RegisterMachineContext<TNumber> context;
+    return ExecuteRegisterMachineModule(module, state, context);
+}
+}
@@ -1,4 +1,4 @@
-/*****
+﻿/*****
  *
  * The Calc4 Programming Language
  *
@@ -9,12 +9,16 @@
 
 #pragma once
 
+#include "CallGraph.h"
 #include "CppEmitter.h"
 #include "Evaluator.h"
 #include "Exceptions.h"
 #include "Operators.h"
 #include "Optimizer.h"
+#include "Profiler.h"
+#include "RegisterMachine.h"
 #include "StackMachine.h"
+#include "StackMachineBytecode.h"
 #include "SyntaxAnalysis.h"
 #include "WasmTextEmitter.h"
 
@@ -28,6 +32,9 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
 #include <type_traits>
 #include <unordered_map>
 
@@ -49,8 +56,12 @@ enum class ExecutorType
 {
 #ifdef ENABLE_JIT
     JIT,
+
+    // Runs on the stack machine and compiles hot operators with the JIT in the background
+    Tiered,
 #endif // ENABLE_JIT
     StackMachine,
+    RegisterMachine,
     TreeTraversal,
 };
 
@@ -76,66 +87,67 @@ struct Option
         TreeTraversalExecutorMode::WhenNoRecursiveOperators;
     bool optimize = true;
     bool checkZeroDivision = true;
+    bool memoize = false;
     bool dumpProgram = false;
     bool emitCpp = false;
     bool emitWat = false;
-};
+    bool emitBytecode = false;
+    bool runBytecode = false;
+    bool profile = false;
 
-/*****
- * Helper functions to print program structures
- *****/
+    // Maximum size of the stacks in bytes. Zero means the default size of each executor.
+    size_t maxStackSize = 0;
 
-bool HasRecursiveCallInternal(const std::shared_ptr<const Operator>& op,
-                              const CompilationContext& context,
-                              std::unordered_map<const OperatorDefinition*, int>& called)
+    // Directory where the JIT executor caches the compiled code. Empty means no cache.
+    std::string jitCacheDirectory;
+};
+
+// Resources owned by the executors, which can be reused across executions
+template<typename TNumber>
+struct ExecutorResources
 {
-    if (auto userDefined = std::dynamic_pointer_cast<const UserDefinedOperator>(op))
-    {
-        auto& definition = userDefined->GetDefinition();
-        if (++called[&definition] > 1)
-        {
-            // Recursive call detected
-            return true;
-        }
+    StackMachineContext<TNumber> stackMachineContext;
+    RegisterMachineContext<TNumber> registerMachineContext;
 
-        if (HasRecursiveCallInternal(
-                context.GetOperatorImplement(definition.GetName()).GetOperator(), context, called))
-        {
-            --called[&definition];
-            return true;
-        }
-        else
-        {
-            --called[&definition];
-        }
-    }
-    else if (auto parenthesis = std::dynamic_pointer_cast<const ParenthesisOperator>(op))
+    // The operators which have not been redefined since the previous input are not generated again
+    StackMachineCodeCache<TNumber> stackMachineCodeCache;
+
+#ifdef ENABLE_JIT
+    // The operators compiled by the JIT stay resident in the same way
+    JITSession<TNumber> jitSession;
+
+    // The tiered executor also keeps its compiled operators and their counts. The compiler is
+    // created by the first execution, since the JIT does not support all the integer types.
+    std::shared_ptr<JITTieredCompiler<TNumber>> tieredCompiler;
+#endif // ENABLE_JIT
+
+    ExecutorResources() = default;
+
+    // The auxiliary stacks, such as the one holding return addresses, are given the same number
+    // of elements as the value stacks
+    explicit ExecutorResources(const Option& option)
+        : stackMachineContext(
+              GetMaxNumElements(option, StackMachineContext<TNumber>::DefaultMaxStackSize),
+              GetMaxNumElements(option, StackMachineContext<TNumber>::DefaultMaxPtrStackSize)),
+          registerMachineContext(
+              GetMaxNumElements(option, RegisterMachineContext<TNumber>::DefaultMaxNumRegisters),
+              GetMaxNumElements(option,
+                                RegisterMachineContext<TNumber>::DefaultMaxFrameStackSize))
     {
-        for (auto& op2 : parenthesis->GetOperators())
-        {
-            if (HasRecursiveCallInternal(op2, context, called))
-            {
-                return true;
-            }
-        }
     }
 
-    for (auto& operand : op->GetOperands())
+private:
+    static size_t GetMaxNumElements(const Option& option, size_t defaultSize)
     {
-        if (HasRecursiveCallInternal(operand, context, called))
-        {
-            return true;
-        }
+        return option.maxStackSize == 0 ? defaultSize
+                                        : std::max(option.maxStackSize / sizeof(TNumber),
+                                                   static_cast<size_t>(1));
     }
+};
 
-    return false;
-}
-
-bool HasRecursiveCall(const std::shared_ptr<const Operator>& op, const CompilationContext& context)
-{
-    std::unordered_map<const OperatorDefinition*, int> called;
-    return HasRecursiveCallInternal(op, context, called);
-}
+/*****
+ * Helper functions to print program structures
+ *****/
 
 void PrintTreeCore(const std::shared_ptr<const Operator>& op, int depth, std::ostream& out)
 {
@@ -188,16 +200,39 @@ void PrintTree(const CompilationContext& context, const std::shared_ptr<const Op
 }
 
 void PrintStackMachineOperations(const std::vector<StackMachineOperation>& operations,
+                                 const std::vector<StackMachineSourcePosition>& sourcePositions,
                                  std::ostream& out)
 {
     static constexpr int AddressWidth = 6;
-    static constexpr int OpcodeWidth = 25;
+    static constexpr int OpcodeWidth = 30;
 
+    auto sourcePosition = sourcePositions.begin();
     for (size_t i = 0; i < operations.size(); i++)
     {
+        bool hasSourcePosition = sourcePosition != sourcePositions.end() &&
+            static_cast<size_t>(sourcePosition->address) == i;
+
         out << std::right << std::setw(AddressWidth) << i << ": ";
         out << std::left << std::setw(OpcodeWidth) << ToString(operations[i].opcode);
-        out << " [Value = " << operations[i].value << "]" << std::endl;
+        out << " [Value = " << operations[i].value;
+
+        // Superinstructions take their additional operands from the following slots
+        int numOperandSlots = GetNumOperandSlots(operations[i].opcode);
+        for (int j = 0; j < numOperandSlots && i + 1 < operations.size(); j++)
+        {
+            out << ", Operand = " << operations[++i].value;
+        }
+
+        out << "]";
+
+        if (hasSourcePosition)
+        {
+            out << " (" << (sourcePosition->position.lineNo + 1) << ":"
+                << (sourcePosition->position.charNo + 1) << ")";
+            ++sourcePosition;
+        }
+
+        out << std::endl;
     }
 }
 
@@ -209,7 +244,7 @@ void PrintStackMachineModule(const StackMachineModule<TNumber>& module, std::ost
     out << "/*" << endl << " * Stack Machine Codes" << endl << " */" << endl << "{" << endl;
 
     out << "Main:" << endl;
-    PrintStackMachineOperations(module.GetEntryPoint(), out);
+    PrintStackMachineOperations(module.GetEntryPoint(), module.GetEntryPointSourcePositions(), out);
 
     auto& userDefinedOperators = module.GetUserDefinedOperators();
     for (size_t i = 0; i < userDefinedOperators.size(); i++)
@@ -217,7 +252,60 @@ void PrintStackMachineModule(const StackMachineModule<TNumber>& module, std::ost
         auto& userDefined = userDefinedOperators[i];
         out << "Operator \"" << userDefined.GetDefinition().GetName() << "\""
             << " (No = " << i << ")" << endl;
-        PrintStackMachineOperations(userDefined.GetOperations(), out);
+        PrintStackMachineOperations(userDefined.GetOperations(), userDefined.GetSourcePositions(),
+                                    out);
+    }
+
+    auto& constants = module.GetConstTable();
+    if (!constants.empty())
+    {
+        out << "Constants:";
+
+        for (size_t i = 0; i < constants.size(); i++)
+        {
+            out << (i == 0 ? " " : ", ") << "[" << i << "] = " << constants[i];
+        }
+
+        out << endl;
+    }
+
+    out << "}" << endl << endl;
+}
+
+void PrintRegisterMachineOperations(const std::vector<RegisterMachineOperation>& operations,
+                                    std::ostream& out)
+{
+    static constexpr int AddressWidth = 6;
+    static constexpr int OpcodeWidth = 30;
+
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        auto& operation = operations[i];
+        out << std::right << std::setw(AddressWidth) << i << ": ";
+        out << std::left << std::setw(OpcodeWidth) << ToString(operation.opcode);
+        out << " [A = " << operation.a << ", B = " << operation.b << ", C = " << operation.c << "]"
+            << std::endl;
+    }
+}
+
+template<typename TNumber>
+void PrintRegisterMachineModule(const RegisterMachineModule<TNumber>& module, std::ostream& out)
+{
+    using std::endl;
+
+    out << "/*" << endl << " * Register Machine Codes" << endl << " */" << endl << "{" << endl;
+
+    out << "Main (NumRegisters = " << module.GetEntryPointNumRegisters() << "):" << endl;
+    PrintRegisterMachineOperations(module.GetEntryPoint(), out);
+
+    auto& userDefinedOperators = module.GetUserDefinedOperators();
+    for (size_t i = 0; i < userDefinedOperators.size(); i++)
+    {
+        auto& userDefined = userDefinedOperators[i];
+        out << "Operator \"" << userDefined.GetDefinition().GetName() << "\""
+            << " (No = " << i << ", NumRegisters = " << userDefined.GetNumRegisters() << ")"
+            << endl;
+        PrintRegisterMachineOperations(userDefined.GetOperations(), out);
     }
 
     auto& constants = module.GetConstTable();
@@ -236,6 +324,23 @@ void PrintStackMachineModule(const StackMachineModule<TNumber>& module, std::ost
     out << "}" << endl << endl;
 }
 
+// Prints the profile of an execution. The folded stacks are written next to the source file, if
+// any, so that they can be passed to flamegraph tools.
+void PrintProfile(const Profiler& profiler, const char* filePath, std::ostream& out)
+{
+    profiler.PrintStatistics(out);
+
+    if (filePath != nullptr)
+    {
+        std::filesystem::path outputFilePath = filePath;
+        outputFilePath.replace_extension(".folded");
+
+        std::ofstream ofs(outputFilePath);
+        profiler.WriteFoldedStacks(ofs);
+        out << "Folded stacks: " << outputFilePath.string() << std::endl << std::endl;
+    }
+}
+
 /*****
  * Core part of execution
  *****/
@@ -266,13 +371,14 @@ template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNum
 TNumber ExecuteOperator(
     const std::shared_ptr<const Operator>& op, const CompilationContext& context,
     ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const Option& option, std::ostream& out)
+    ExecutorResources<TNumber>& resources, const Option& option, std::ostream& out,
+    Profiler* profiler = nullptr)
 {
     // Determine actual executor
     ExecutorType actualExecutor = option.executorType;
     if (option.executorType != ExecutorType::TreeTraversal &&
         option.treeExecutorMode != TreeTraversalExecutorMode::Never &&
-        !HasRecursiveCall(op, context))
+        !CallGraph(context).HasRecursiveCall(op))
     {
         // The given program has no heavy loops, so we use tree traversal executor.
         actualExecutor = ExecutorType::TreeTraversal;
@@ -283,7 +389,7 @@ TNumber ExecuteOperator(
 #ifdef ENABLE_JIT
     case ExecutorType::JIT:
 #ifdef ENABLE_GMP
-        if constexpr (std::is_same_v<TNumber, mpz_class>)
+        if constexpr (std::is_same_v<TNumber, HybridInteger>)
         {
             throw Exceptions::AssertionErrorException(
                 std::nullopt, "Jit compiler does not support infinite precision integers.");
@@ -291,26 +397,86 @@ TNumber ExecuteOperator(
         else
 #endif // ENABLE_GMP
         {
-            return EvaluateByJIT<TNumber>(
-                context, state, op,
-                { option.optimize, option.checkZeroDivision, option.dumpProgram });
+            JITCodeGenerationOption jitOption;
+            jitOption.optimize = option.optimize;
+            jitOption.checkZeroDivision = option.checkZeroDivision;
+            jitOption.dumpProgram = option.dumpProgram;
+            jitOption.profiler = profiler;
+            jitOption.memoize = option.memoize;
+            jitOption.cacheDirectory = option.jitCacheDirectory;
+            return EvaluateByJIT<TNumber>(context, state, op, jitOption, &resources.jitSession);
         }
         break;
+    case ExecutorType::Tiered:
+    {
+        auto module = GenerateStackMachineModule<TNumber>(
+            op, context, { option.checkZeroDivision, option.optimize, option.memoize },
+            &resources.stackMachineCodeCache);
+
+        if (option.dumpProgram)
+        {
+            PrintStackMachineModule(module, out);
+        }
+
+#ifdef ENABLE_GMP
+        if constexpr (std::is_same_v<TNumber, HybridInteger>)
+        {
+            return ExecuteStackMachineModule(module, state, resources.stackMachineContext,
+                                             profiler);
+        }
+        else
+#endif // ENABLE_GMP
+        {
+            // The stack machine reports to the profiler, and the compiled code is not cached
+            JITCodeGenerationOption jitOption;
+            jitOption.optimize = option.optimize;
+            jitOption.checkZeroDivision = option.checkZeroDivision;
+            jitOption.memoize = option.memoize;
+            if (resources.tieredCompiler == nullptr)
+            {
+                resources.tieredCompiler =
+                    std::make_shared<JITTieredCompiler<TNumber>>(context, jitOption);
+            }
+            else
+            {
+                resources.tieredCompiler->Configure(context, jitOption);
+            }
+
+            JITTieredCompiler<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>&
+                compiler = *resources.tieredCompiler;
+            return ExecuteStackMachineModule(module, state, resources.stackMachineContext,
+                                             profiler, &compiler);
+        }
+    }
 #endif // ENABLE_JIT
     case ExecutorType::StackMachine:
     {
-        auto module =
-            GenerateStackMachineModule<TNumber>(op, context, { option.checkZeroDivision });
+        auto module = GenerateStackMachineModule<TNumber>(
+            op, context, { option.checkZeroDivision, option.optimize, option.memoize },
+            &resources.stackMachineCodeCache);
 
         if (option.dumpProgram)
         {
             PrintStackMachineModule(module, out);
         }
 
-        return ExecuteStackMachineModule(module, state);
+        return ExecuteStackMachineModule(module, state, resources.stackMachineContext, profiler);
+    }
+    case ExecutorType::RegisterMachine:
+    {
+        auto module =
+            GenerateRegisterMachineModule<TNumber>(op, context, { option.checkZeroDivision });
+
+        if (option.dumpProgram)
+        {
+            PrintRegisterMachineModule(module, out);
+        }
+
+        return ExecuteRegisterMachineModule(module, state, resources.registerMachineContext,
+                                            profiler);
     }
     case ExecutorType::TreeTraversal:
-        return Evaluate<TNumber>(context, state, op);
+        return Evaluate<TNumber>(context, state, op, profiler, option.memoize);
     default:
         UNREACHABLE();
         return 0;
@@ -335,7 +501,8 @@ void FormatError(const Exceptions::Calc4Exception& error, std::string_view sourc
 
     out << "Error: " << error.what() << endl;
 
-    if (position)
+    // The source text is not available when running bytecode, so only the position is printed
+    if (position && !source.empty())
     {
         size_t lineStartIndex = source.substr(0, position->index).find_last_of("\r\n");
         lineStartIndex = lineStartIndex == source.npos ? 0 : (lineStartIndex + 1);
@@ -364,7 +531,7 @@ template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNum
 void ExecuteSource(
     std::string_view source, const char* filePath, CompilationContext& context,
     ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
-    const Option& option, std::ostream& out)
+    ExecutorResources<TNumber>& resources, const Option& option, std::ostream& out)
 {
     using namespace std;
 
@@ -380,9 +547,8 @@ void ExecuteSource(
 
         if (option.dumpProgram)
         {
-            out << "Has recursive call: " << (HasRecursiveCall(op, context) ? "True" : "False")
-                << endl
-                << endl;
+            bool hasRecursiveCall = CallGraph(context).HasRecursiveCall(op);
+            out << "Has recursive call: " << (hasRecursiveCall ? "True" : "False") << endl << endl;
             PrintTree(context, op, out);
         }
 
@@ -421,19 +587,117 @@ void ExecuteSource(
             }
         }
 
+        if (option.emitBytecode)
+        {
+            assert(filePath != nullptr);
+
+            std::filesystem::path outputFilePath = filePath;
+            outputFilePath.replace_extension(".c4b");
+
+            auto module = GenerateStackMachineModule<TNumber>(
+                op, context, { option.checkZeroDivision, option.optimize, option.memoize },
+                &resources.stackMachineCodeCache);
+
+            std::ofstream ofs(outputFilePath, std::ios::binary);
+            WriteStackMachineBytecode(module, ofs);
+            emitted = true;
+        }
+
         if (!emitted)
         {
-            TNumber result = ExecuteOperator(op, context, state, option, out);
+            std::optional<Profiler> profiler;
+            if (option.profile)
+            {
+                profiler.emplace();
+            }
+
+            TNumber result;
+            {
+                ProfilingScope scope(profiler ? &*profiler : nullptr);
+                result = ExecuteOperator(op, context, state, resources, option, out,
+                                         profiler ? &*profiler : nullptr);
+            }
             auto end = chrono::high_resolution_clock::now();
 
             out << result << endl
                 << "Elapsed: " << (chrono::duration<double>(end - start).count() * 1000) << " ms"
                 << endl;
+
+            if (profiler)
+            {
+                PrintProfile(*profiler, filePath, out);
+            }
+        }
+    }
+    catch (Exceptions::Calc4Exception& error)
+    {
+        // Errors raised in the operators defined by earlier inputs refer to the sources of them,
+        // which the operators keep. The other errors refer to the current input.
+        auto& position = error.GetPosition();
+        auto errorSource = position ? context.FindSource(position->sourceId) : nullptr;
+        FormatError(error, errorSource != nullptr ? std::string_view(*errorSource) : source,
+                    filePath, out);
+    }
+    catch (std::exception& e)
+    {
+        out << "Fatal error: " << e.what() << endl;
+    }
+    catch (...)
+    {
+        out << "Fatal error" << endl;
+    }
+}
+
+// Executes the given bytecode, which was generated by "WriteStackMachineBytecode", on the stack
+// machine. No lexing, parsing or optimization is performed.
+template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
+         typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
+         typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter>
+void ExecuteBytecode(
+    std::string_view bytecode, const char* filePath,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    ExecutorResources<TNumber>& resources, const Option& option, std::ostream& out)
+{
+    using namespace std;
+
+    try
+    {
+        auto start = chrono::high_resolution_clock::now();
+        auto module = ReadStackMachineBytecode<TNumber>(bytecode);
+
+        if (option.dumpProgram)
+        {
+            PrintStackMachineModule(module, out);
+        }
+
+        std::optional<Profiler> profiler;
+        if (option.profile)
+        {
+            profiler.emplace();
+        }
+
+        TNumber result;
+        {
+            ProfilingScope scope(profiler ? &*profiler : nullptr);
+            result = ExecuteStackMachineModule(module, state, resources.stackMachineContext,
+                                               profiler ? &*profiler : nullptr);
+        }
+        auto end = chrono::high_resolution_clock::now();
+
+        out << result << endl
+            << "Elapsed: " << (chrono::duration<double>(end - start).count() * 1000) << " ms"
+            << endl;
+
+        if (profiler)
+        {
+            PrintProfile(*profiler, filePath, out);
         }
     }
     catch (Exceptions::Calc4Exception& error)
     {
-        FormatError(error, source, filePath, out);
+        // Positions recorded in the bytecode refer to the original source, whose text is not
+        // available here
+        FormatError(error, {}, filePath, out);
     }
     catch (std::exception& e)
     {
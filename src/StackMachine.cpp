@@ -8,19 +8,22 @@
  *****/
 
 #include "StackMachine.h"
+#include "CallGraph.h"
 #include "Common.h"
 #include "Exceptions.h"
 #include "ExecutionState.h"
+#include "Memoization.h"
 #include "Operators.h"
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #ifdef ENABLE_GMP
-#include <gmp.h>
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 // We use the computed goto technique to make dispatch faster.
@@ -47,12 +50,14 @@
         ++op;                                                                                      \
         goto*(op->address);                                                                        \
     } while (false)
+#define COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(NUM_SLOTS)                                           \
+    do                                                                                             \
+    {                                                                                              \
+        op += 1 + (NUM_SLOTS);                                                                     \
+        goto*(op->address);                                                                        \
+    } while (false)
 
-struct ComputedGotoOperation
-{
-    const void* address;
-    calc4::StackMachineOperation::ValueType value;
-};
+using ComputedGotoOperation = calc4::StackMachineThreadedOperation;
 #else
 #define COMPUTED_GOTO_BEGIN()
 #define COMPUTED_GOTO_SWITCH()                                                                     \
@@ -73,6 +78,12 @@ struct ComputedGotoOperation
         ++op;                                                                                      \
         goto LoopBegin;                                                                            \
     } while (false)
+#define COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(NUM_SLOTS)                                           \
+    do                                                                                             \
+    {                                                                                              \
+        op += 1 + (NUM_SLOTS);                                                                     \
+        goto LoopBegin;                                                                            \
+    } while (false)
 #endif // USE_COMPUTED_GOTO
 
 namespace std
@@ -92,7 +103,8 @@ namespace calc4
 #define InstantiateGenerateStackMachineModule(TNumber)                                             \
     template StackMachineModule<TNumber> GenerateStackMachineModule(                               \
         const std::shared_ptr<const Operator>& op, const CompilationContext& context,              \
-        const StackMachineCodeGenerationOption& option)
+        const StackMachineCodeGenerationOption& option,                                            \
+        StackMachineCodeCache<TNumber>* codeCache)
 
 InstantiateGenerateStackMachineModule(int32_t);
 InstantiateGenerateStackMachineModule(int64_t);
@@ -102,7 +114,7 @@ InstantiateGenerateStackMachineModule(__int128_t);
 #endif // ENABLE_INT128
 
 #ifdef ENABLE_GMP
-InstantiateGenerateStackMachineModule(mpz_class);
+InstantiateGenerateStackMachineModule(HybridInteger);
 #endif // ENABLE_GMP
 
 /*****/
@@ -110,10 +122,13 @@ InstantiateGenerateStackMachineModule(mpz_class);
 #define InstantiateExecuteStackMachineModule(TNumber, TInputSource, TPrinter)                      \
     template TNumber ExecuteStackMachineModule<TNumber, DefaultVariableSource<TNumber>,            \
                                                DefaultGlobalArraySource<TNumber>, TInputSource,    \
-                                               TPrinter, std::vector<TNumber>, std::vector<int>>(  \
+                                               TPrinter, DefaultStackArray<TNumber>,               \
+                                               DefaultStackArray<int>>(                            \
         const StackMachineModule<TNumber>& module,                                                 \
         ExecutionState<TNumber, DefaultVariableSource<TNumber>, DefaultGlobalArraySource<TNumber>, \
-                       TInputSource, TPrinter>& state)
+                       TInputSource, TPrinter>& state,                                             \
+        StackMachineContext<TNumber>& context, Profiler* profiler,                                 \
+        StackMachineTieredCompiler<TNumber>* tieredCompiler)
 
 InstantiateExecuteStackMachineModule(int32_t, DefaultInputSource, DefaultPrinter);
 InstantiateExecuteStackMachineModule(int32_t, BufferedInputSource, BufferedPrinter);
@@ -129,16 +144,29 @@ InstantiateExecuteStackMachineModule(__int128_t, StreamInputSource, StreamPrinte
 #endif // ENABLE_INT128
 
 #ifdef ENABLE_GMP
-InstantiateExecuteStackMachineModule(mpz_class, DefaultInputSource, DefaultPrinter);
-InstantiateExecuteStackMachineModule(mpz_class, BufferedInputSource, BufferedPrinter);
-InstantiateExecuteStackMachineModule(mpz_class, StreamInputSource, StreamPrinter);
+InstantiateExecuteStackMachineModule(HybridInteger, DefaultInputSource, DefaultPrinter);
+InstantiateExecuteStackMachineModule(HybridInteger, BufferedInputSource, BufferedPrinter);
+InstantiateExecuteStackMachineModule(HybridInteger, StreamInputSource, StreamPrinter);
+#endif // ENABLE_GMP
+
+/*****/
+
+template class StackMachineModule<int32_t>;
+template class StackMachineModule<int64_t>;
+
+#ifdef ENABLE_INT128
+template class StackMachineModule<__int128_t>;
+#endif // ENABLE_INT128
+
+#ifdef ENABLE_GMP
+template class StackMachineModule<HybridInteger>;
 #endif // ENABLE_GMP
 
 /*****/
 
 template<typename TNumber>
-std::pair<std::vector<StackMachineOperation>, std::vector<int>> StackMachineModule<
-    TNumber>::FlattenOperations() const
+std::tuple<std::vector<StackMachineOperation>, std::vector<int>, std::vector<int>>
+StackMachineModule<TNumber>::FlattenOperations() const
 {
     size_t totalNumOperations = entryPoint.size() +
         std::accumulate(userDefinedOperators.begin(), userDefinedOperators.end(),
@@ -167,21 +195,9 @@ std::pair<std::vector<StackMachineOperation>, std::vector<int>> StackMachineModu
             result[index] = operations[j];
 
             // Resolve labels
-            switch (result[index].opcode)
+            if (IsJumpOpcode(result[index].opcode))
             {
-            case StackMachineOpcode::Goto:
-            case StackMachineOpcode::GotoIfTrue:
-            case StackMachineOpcode::GotoIfFalse:
-            case StackMachineOpcode::GotoIfEqual:
-            case StackMachineOpcode::GotoIfNotEqual:
-            case StackMachineOpcode::GotoIfLessThan:
-            case StackMachineOpcode::GotoIfLessThanOrEqual:
-            case StackMachineOpcode::GotoIfGreaterThan:
-            case StackMachineOpcode::GotoIfGreaterThanOrEqual:
                 result[index].value += startAddress;
-                break;
-            default:
-                break;
             }
 
             index++;
@@ -190,12 +206,16 @@ std::pair<std::vector<StackMachineOperation>, std::vector<int>> StackMachineModu
 
     assert(index == result.size());
 
+    // The entry point starts at zero, which is never a target of call operations
+    maxStackSizes[0] = entryPointMaxStackSize;
+
     // Resolve call operations
     for (size_t i = 0; i < result.size(); i++)
     {
         switch (result[i].opcode)
         {
         case StackMachineOpcode::Call:
+        case StackMachineOpcode::TailCall:
         {
             int operatorNo = result[i].value;
             result[i].value = startAddresses[operatorNo];
@@ -207,13 +227,213 @@ std::pair<std::vector<StackMachineOperation>, std::vector<int>> StackMachineModu
         }
     }
 
-    return std::make_pair(std::move(result), std::move(maxStackSizes));
+    return std::make_tuple(std::move(result), std::move(maxStackSizes), std::move(startAddresses));
+}
+
+template<typename TNumber>
+std::vector<StackMachineSourcePosition> StackMachineModule<TNumber>::FlattenSourcePositions() const
+{
+    // Each table is sorted and the operators are placed in order, so the result is also sorted
+    std::vector<StackMachineSourcePosition> result(entryPointSourcePositions);
+
+    for (size_t i = 0; i < userDefinedOperators.size(); i++)
+    {
+        for (auto& entry : userDefinedOperators[i].GetSourcePositions())
+        {
+            result.push_back({ entry.address + startAddresses[i], entry.position });
+        }
+    }
+
+    return result;
+}
+
+namespace
+{
+// Moves the entries of the source position table to the new addresses after the operations are
+// rearranged. Entries of fused operations are merged into the first one.
+void RemapSourcePositions(std::vector<StackMachineSourcePosition>& sourcePositions,
+                          const std::vector<int>& newAddresses)
+{
+    std::vector<StackMachineSourcePosition> result;
+    for (auto& entry : sourcePositions)
+    {
+        int address = newAddresses[entry.address];
+        if (result.empty() || result.back().address != address)
+        {
+            result.push_back({ address, entry.position });
+        }
+    }
+
+    sourcePositions = std::move(result);
+}
+
+std::optional<StackMachineOpcode> GetConditionalGotoWithConst(StackMachineOpcode opcode)
+{
+    switch (opcode)
+    {
+    case StackMachineOpcode::GotoIfEqual:
+        return StackMachineOpcode::GotoIfEqualConst;
+    case StackMachineOpcode::GotoIfNotEqual:
+        return StackMachineOpcode::GotoIfNotEqualConst;
+    case StackMachineOpcode::GotoIfLessThan:
+        return StackMachineOpcode::GotoIfLessThanConst;
+    case StackMachineOpcode::GotoIfLessThanOrEqual:
+        return StackMachineOpcode::GotoIfLessThanOrEqualConst;
+    case StackMachineOpcode::GotoIfGreaterThan:
+        return StackMachineOpcode::GotoIfGreaterThanConst;
+    case StackMachineOpcode::GotoIfGreaterThanOrEqual:
+        return StackMachineOpcode::GotoIfGreaterThanOrEqualConst;
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<StackMachineOpcode> GetLoadArgWithArg(StackMachineOpcode opcode)
+{
+    switch (opcode)
+    {
+    case StackMachineOpcode::Add:
+        return StackMachineOpcode::LoadArgAddArg;
+    case StackMachineOpcode::Sub:
+        return StackMachineOpcode::LoadArgSubArg;
+    case StackMachineOpcode::Mult:
+        return StackMachineOpcode::LoadArgMultArg;
+    default:
+        return std::nullopt;
+    }
+}
+
+// Peephole pass that fuses common sequences of operations into superinstructions to reduce the
+// number of dispatches. The labels of the given operations must be resolved.
+void FuseOperations(std::vector<StackMachineOperation>& operations,
+                    std::vector<StackMachineSourcePosition>& sourcePositions)
+{
+    // Operations that are jump targets must not be fused into preceding ones
+    std::vector<bool> isJumpTarget(operations.size(), false);
+    for (auto& operation : operations)
+    {
+        if (IsJumpOpcode(operation.opcode))
+        {
+            isJumpTarget[operation.value] = true;
+        }
+    }
+
+    std::vector<StackMachineOperation> result;
+    std::vector<int> newAddresses(operations.size());
+    size_t i = 0;
+
+    // Returns the operation at "i + offset" if it can be fused with the one at "i"
+    auto Peek = [&operations, &isJumpTarget, &i](size_t offset) -> const StackMachineOperation* {
+        size_t index = i + offset;
+        return index < operations.size() && !isJumpTarget[index] ? &operations[index] : nullptr;
+    };
+
+    // Emits a superinstruction that replaces "numFused" operations
+    auto Emit = [&operations, &result, &newAddresses, &i](
+                    StackMachineOpcode opcode, StackMachineOperation::ValueType value,
+                    std::optional<StackMachineOperation::ValueType> operand, size_t numFused) {
+        for (size_t j = 0; j < numFused; j++)
+        {
+            newAddresses[i + j] = static_cast<int>(result.size());
+        }
+
+        result.emplace_back(opcode, value);
+        if (operand)
+        {
+            result.emplace_back(StackMachineOpcode::Operand, *operand);
+        }
+
+        assert(GetNumOperandSlots(opcode) == (operand ? 1 : 0));
+        i += numFused;
+    };
+
+    while (i < operations.size())
+    {
+        auto& current = operations[i];
+        auto second = Peek(1);
+        auto third = second != nullptr ? Peek(2) : nullptr;
+
+        // Operations already taking operand slots are copied with their slots
+        if (int numOperandSlots = GetNumOperandSlots(current.opcode); numOperandSlots > 0)
+        {
+            for (int j = 0; j <= numOperandSlots; j++)
+            {
+                newAddresses[i] = static_cast<int>(result.size());
+                result.push_back(operations[i++]);
+            }
+
+            continue;
+        }
+
+        if (current.opcode == StackMachineOpcode::LoadArg && second != nullptr)
+        {
+            if (second->opcode == StackMachineOpcode::LoadConst && third != nullptr &&
+                (third->opcode == StackMachineOpcode::Add ||
+                 third->opcode == StackMachineOpcode::Sub))
+            {
+                Emit(third->opcode == StackMachineOpcode::Add ? StackMachineOpcode::LoadArgAddConst
+                                                              : StackMachineOpcode::LoadArgSubConst,
+                     current.value, second->value, 3);
+                continue;
+            }
+
+            if (second->opcode == StackMachineOpcode::LoadArg && third != nullptr)
+            {
+                if (auto fused = GetLoadArgWithArg(third->opcode))
+                {
+                    Emit(*fused, current.value, second->value, 3);
+                    continue;
+                }
+            }
+
+            if (second->opcode == StackMachineOpcode::Return)
+            {
+                Emit(StackMachineOpcode::LoadArgReturn, current.value, second->value, 2);
+                continue;
+            }
+        }
+
+        if (current.opcode == StackMachineOpcode::LoadConst && second != nullptr)
+        {
+            if (second->opcode == StackMachineOpcode::Add ||
+                second->opcode == StackMachineOpcode::Sub)
+            {
+                Emit(second->opcode == StackMachineOpcode::Add ? StackMachineOpcode::AddConst
+                                                               : StackMachineOpcode::SubConst,
+                     current.value, std::nullopt, 2);
+                continue;
+            }
+
+            if (auto fused = GetConditionalGotoWithConst(second->opcode))
+            {
+                // The jump target is stored in the value so that labels are handled uniformly
+                Emit(*fused, second->value, current.value, 2);
+                continue;
+            }
+        }
+
+        Emit(current.opcode, current.value, std::nullopt, 1);
+    }
+
+    // Update jump targets
+    for (auto& operation : result)
+    {
+        if (IsJumpOpcode(operation.opcode))
+        {
+            operation.value = static_cast<StackMachineOperation::ValueType>(
+                newAddresses[operation.value]);
+        }
+    }
+
+    operations = std::move(result);
+    RemapSourcePositions(sourcePositions, newAddresses);
+}
 }
 
 template<typename TNumber>
 StackMachineModule<TNumber> GenerateStackMachineModule(
     const std::shared_ptr<const Operator>& op, const CompilationContext& context,
-    const StackMachineCodeGenerationOption& option)
+    const StackMachineCodeGenerationOption& option, StackMachineCodeCache<TNumber>* codeCache)
 {
     static constexpr int OperatorBeginLabel = 0;
 
@@ -222,36 +442,54 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
     public:
         const CompilationContext& context;
         StackMachineCodeGenerationOption option;
-        std::vector<TNumber>& constTable;
-        std::unordered_map<OperatorDefinition, int>& operatorLabels;
         std::optional<OperatorDefinition> definition;
-        std::unordered_map<std::string, int>& variableIndices;
+
+        // Tables referred by the operations, which are local to this operator until the operations
+        // are relocated into a module
+        std::vector<TNumber> constTable;
+        std::vector<std::string> variables;
+        std::vector<OperatorDefinition> callees;
+        std::unordered_map<std::string, int> variableIndices;
+        std::unordered_map<OperatorDefinition, int> calleeIndices;
 
         std::vector<StackMachineOperation> operations;
+        std::vector<StackMachineSourcePosition> sourcePositions;
         int nextLabel = OperatorBeginLabel;
         int stackSize = 0;
         int maxStackSize = 0;
 
+        // True if the results of this operator are memoized
+        bool memoize = false;
+
         Generator(const CompilationContext& context, const StackMachineCodeGenerationOption& option,
-                  std::vector<TNumber>& constTable,
-                  std::unordered_map<OperatorDefinition, int>& operatorLabels,
-                  const std::optional<OperatorDefinition>& definition,
-                  std::unordered_map<std::string, int>& variableIndices)
-            : context(context), option(option), constTable(constTable),
-              operatorLabels(operatorLabels), definition(definition),
-              variableIndices(variableIndices)
+                  const std::optional<OperatorDefinition>& definition)
+            : context(context), option(option), definition(definition)
         {
         }
 
         void Generate(const std::shared_ptr<const Operator>& op)
         {
             assert(nextLabel == OperatorBeginLabel);
+            if (memoize)
+            {
+                // Self tail calls jump to the label below, so the memoized results are looked up
+                // only once per call
+                AddOperation(StackMachineOpcode::LoadMemo,
+                             GetOrCreateCalleeIndex(definition.value()));
+            }
+
             AddOperation(StackMachineOpcode::Lavel, nextLabel++);
 
             if (definition)
             {
                 // Generate user-defined operators' codes
                 op->Accept(*this);
+                if (memoize)
+                {
+                    AddOperation(StackMachineOpcode::StoreMemo,
+                                 GetOrCreateCalleeIndex(definition.value()));
+                }
+
                 AddOperation(StackMachineOpcode::Return, definition.value().GetNumOperands());
             }
             else
@@ -262,16 +500,25 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
             }
 
             ResolveLabels();
+
+            if (option.useSuperinstructions)
+            {
+                FuseOperations(operations, sourcePositions);
+            }
         }
 
         void ResolveLabels()
         {
             std::vector<StackMachineOperation> newVector;
             std::unordered_map<int, int> labelMap;
+            std::vector<int> newAddresses(operations.size());
 
             // First pass removes label operations and records their address.
-            for (auto& operation : operations)
+            for (size_t i = 0; i < operations.size(); i++)
             {
+                auto& operation = operations[i];
+                newAddresses[i] = static_cast<int>(newVector.size());
+
                 switch (operation.opcode)
                 {
                 case StackMachineOpcode::Lavel:
@@ -291,21 +538,9 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
             {
                 auto& operation = newVector[i];
 
-                switch (operation.opcode)
+                if (IsJumpOpcode(operation.opcode))
                 {
-                case StackMachineOpcode::Goto:
-                case StackMachineOpcode::GotoIfTrue:
-                case StackMachineOpcode::GotoIfFalse:
-                case StackMachineOpcode::GotoIfEqual:
-                case StackMachineOpcode::GotoIfNotEqual:
-                case StackMachineOpcode::GotoIfLessThan:
-                case StackMachineOpcode::GotoIfLessThanOrEqual:
-                case StackMachineOpcode::GotoIfGreaterThan:
-                case StackMachineOpcode::GotoIfGreaterThanOrEqual:
                     operation.value = labelMap.at(operation.value);
-                    break;
-                default:
-                    break;
                 }
             }
 
@@ -366,6 +601,7 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
 
             // Populate operations with resolved instructions.
             operations = std::move(newVector);
+            RemapSourcePositions(sourcePositions, newAddresses);
         }
 
         virtual void Visit(const std::shared_ptr<const ZeroOperator>& op) override
@@ -377,17 +613,7 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
         {
             auto value = op->GetValue<TNumber>();
 
-            StackMachineOperation::ValueType casted;
-#ifdef ENABLE_GMP
-            if constexpr (std::is_same_v<TNumber, mpz_class>)
-            {
-                casted = static_cast<StackMachineOperation::ValueType>(value.get_si());
-            }
-            else
-#endif // ENABLE_GMP
-            {
-                casted = static_cast<StackMachineOperation::ValueType>(value);
-            }
+            auto casted = static_cast<StackMachineOperation::ValueType>(value);
 
             if (casted == value)
             {
@@ -397,7 +623,7 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
             else
             {
                 // We cannot emit Opcode.LoadConst,
-                // because the constant value exceeds limit of 16-bit integer.
+                // because the constant value exceeds limit of 32-bit integer.
                 // So we use constTable.
                 int no = static_cast<int>(constTable.size());
                 constTable.push_back(value);
@@ -499,14 +725,18 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
             case BinaryType::Div:
                 op->GetLeft()->Accept(*this);
                 op->GetRight()->Accept(*this);
-                AddOperation(option.checkZeroDivision ? StackMachineOpcode::DivChecked
-                                                      : StackMachineOpcode::Div);
+                AddOperation(option.checkZeroDivision && !op->IsDivisorNonZero()
+                                 ? StackMachineOpcode::DivChecked
+                                 : StackMachineOpcode::Div);
+                AddSourcePosition(op->GetPosition());
                 break;
             case BinaryType::Mod:
                 op->GetLeft()->Accept(*this);
                 op->GetRight()->Accept(*this);
-                AddOperation(option.checkZeroDivision ? StackMachineOpcode::ModChecked
-                                                      : StackMachineOpcode::Mod);
+                AddOperation(option.checkZeroDivision && !op->IsDivisorNonZero()
+                                 ? StackMachineOpcode::ModChecked
+                                 : StackMachineOpcode::Mod);
+                AddSourcePosition(op->GetPosition());
                 break;
 
                 // For comparisons and logical operations, we generate code as "condition" to reduce
@@ -739,9 +969,30 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
                 // We treat as if there are one returning value in the stack.
                 AddStackSize(1);
             }
+            else if (definition && op->IsTailCall().value_or(false))
+            {
+                // Tail calls to other operators reuse the current frame, so that mutually
+                // recursive operators run in constant stack space
+                AddOperation(StackMachineOpcode::TailCall,
+                             GetOrCreateCalleeIndex(op->GetDefinition()));
+                AddSourcePosition(op->GetPosition());
+                AddOperation(StackMachineOpcode::Operand, definition.value().GetNumOperands());
+                AddOperation(StackMachineOpcode::Operand, op->GetDefinition().GetNumOperands());
+            }
             else
             {
-                AddOperation(StackMachineOpcode::Call, operatorLabels[op->GetDefinition()]);
+                AddOperation(StackMachineOpcode::Call, GetOrCreateCalleeIndex(op->GetDefinition()));
+                AddSourcePosition(op->GetPosition());
+            }
+        }
+
+        // Records the given position for the last operation
+        void AddSourcePosition(const std::optional<CharPosition>& position)
+        {
+            if (position)
+            {
+                sourcePositions.push_back(
+                    { static_cast<int>(operations.size()) - 1, position.value() });
             }
         }
 
@@ -754,7 +1005,7 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
                     std::nullopt, "Stack size is negative: " + std::to_string(newStackSize));
             }
 
-            maxStackSize = std::max(stackSize, newStackSize);
+            maxStackSize = std::max(maxStackSize, newStackSize);
             stackSize = newStackSize;
         }
 
@@ -803,16 +1054,15 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
                 AddStackSize(-2);
                 break;
             case StackMachineOpcode::Call:
+            case StackMachineOpcode::TailCall:
             {
-                // Find the corresponding OperatorDefinition
-                auto it = std::find_if(operatorLabels.begin(), operatorLabels.end(),
-                                       [value](auto& pair) { return pair.second == value; });
-                assert(it != operatorLabels.end());
-
-                int numOperands = it->first.GetNumOperands();
+                int numOperands = callees[value].GetNumOperands();
                 AddStackSize(-(numOperands - 1));
                 break;
             }
+            case StackMachineOpcode::LoadMemo:
+            case StackMachineOpcode::StoreMemo:
+            case StackMachineOpcode::Operand:
             case StackMachineOpcode::Lavel:
                 // Do nothing
                 break;
@@ -846,8 +1096,25 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
             }
             else
             {
-                int index = static_cast<int>(variableIndices.size());
+                int index = static_cast<int>(variables.size());
                 variableIndices[variableName] = index;
+                variables.push_back(variableName);
+                return index;
+            }
+        }
+
+        int GetOrCreateCalleeIndex(const OperatorDefinition& callee)
+        {
+            auto it = calleeIndices.find(callee);
+            if (it != calleeIndices.end())
+            {
+                return it->second;
+            }
+            else
+            {
+                int index = static_cast<int>(callees.size());
+                calleeIndices.emplace(callee, index);
+                callees.push_back(callee);
                 return index;
             }
         }
@@ -863,77 +1130,279 @@ StackMachineModule<TNumber> GenerateStackMachineModule(
         }
     };
 
+    using CodeEntry = typename StackMachineCodeCache<TNumber>::Entry;
+
+    auto Generate = [&context, &option](const std::optional<OperatorDefinition>& definition,
+                                        const std::shared_ptr<const Operator>& body,
+                                        bool memoize) {
+        Generator generator(context, option, definition);
+        generator.memoize = memoize;
+        generator.Generate(body);
+
+        if (definition && generator.stackSize != 0)
+        {
+            throw Exceptions::AssertionErrorException(
+                std::nullopt, "Stacksize is not zero: " + std::to_string(generator.stackSize));
+        }
+
+        return CodeEntry{ body,
+                          memoize,
+                          std::move(generator.operations),
+                          generator.maxStackSize,
+                          std::move(generator.sourcePositions),
+                          std::move(generator.constTable),
+                          std::move(generator.variables),
+                          std::move(generator.callees) };
+    };
+
     std::vector<TNumber> constTable;
     std::vector<StackMachineUserDefinedOperator> userDefinedOperators;
     std::unordered_map<OperatorDefinition, int> operatorLabels;
     std::unordered_map<std::string, int> variableIndices;
+    std::vector<std::string> variables;
+
+    // Rewrites the references to the tables local to the given code into the ones of the module
+    auto Relocate = [&](const CodeEntry& code) {
+        int constTableOffset = static_cast<int>(constTable.size());
+        constTable.insert(constTable.end(), code.constTable.begin(), code.constTable.end());
+
+        std::vector<int> variableMap;
+        for (auto& variable : code.variables)
+        {
+            auto [it, isInserted] =
+                variableIndices.emplace(variable, static_cast<int>(variables.size()));
+            if (isInserted)
+            {
+                variables.push_back(variable);
+            }
+
+            variableMap.push_back(it->second);
+        }
+
+        std::vector<int> calleeMap;
+        for (auto& callee : code.callees)
+        {
+            calleeMap.push_back(operatorLabels[callee]);
+        }
+
+        auto operations = code.operations;
+        for (auto& operation : operations)
+        {
+            switch (operation.opcode)
+            {
+            case StackMachineOpcode::LoadConstTable:
+                operation.value += constTableOffset;
+                break;
+            case StackMachineOpcode::LoadVariable:
+            case StackMachineOpcode::StoreVariable:
+                operation.value = variableMap[operation.value];
+                break;
+            case StackMachineOpcode::Call:
+            case StackMachineOpcode::TailCall:
+            case StackMachineOpcode::LoadMemo:
+            case StackMachineOpcode::StoreMemo:
+                operation.value = calleeMap[operation.value];
+                break;
+            default:
+                break;
+            }
+        }
+
+        return operations;
+    };
+
+    // Operators which the entry point cannot call are not generated
+    CallGraph callGraph(context);
+    auto reachableOperators = callGraph.GetReachableOperators(op);
 
     int index = 0;
     for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
     {
-        auto& implement = it->second;
-        operatorLabels[implement.GetDefinition()] = index++;
+        if (reachableOperators.count(it->first) > 0)
+        {
+            operatorLabels[it->second.GetDefinition()] = index++;
+        }
+    }
+
+    if (codeCache != nullptr)
+    {
+        codeCache->SetOption(option);
     }
 
-    // Generate user-defined operators' codes
+    // Generate user-defined operators' codes, reusing the cached ones if possible
     for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
     {
+        if (reachableOperators.count(it->first) == 0)
+        {
+            continue;
+        }
+
         auto& implement = it->second;
-        Generator generator(context, option, constTable, operatorLabels, implement.GetDefinition(),
-                            variableIndices);
-        generator.Generate(implement.GetOperator());
+        bool memoize = option.memoize && callGraph.IsPure(it->first);
 
-        if (generator.stackSize != 0)
+        std::optional<CodeEntry> generated;
+        const CodeEntry* code =
+            codeCache != nullptr ? codeCache->Find(it->first, implement.GetOperator(), memoize)
+                                 : nullptr;
+        if (code == nullptr)
         {
-            throw Exceptions::AssertionErrorException(
-                std::nullopt, "Stacksize is not zero: " + std::to_string(generator.stackSize));
+            generated = Generate(implement.GetDefinition(), implement.GetOperator(), memoize);
+            code = codeCache != nullptr ? &codeCache->Insert(it->first, std::move(*generated))
+                                        : &*generated;
         }
 
-        userDefinedOperators.emplace_back(implement.GetDefinition(),
-                                          std::move(generator.operations), generator.maxStackSize);
+        userDefinedOperators.emplace_back(implement.GetDefinition(), Relocate(*code),
+                                          code->maxStackSize, code->sourcePositions);
     }
 
     // Generate Main code
-    std::vector<StackMachineOperation> entryPoint;
+    auto entryPoint = Generate(std::nullopt, op, false);
+
+    return StackMachineModule<TNumber>(Relocate(entryPoint), entryPoint.maxStackSize, constTable,
+                                       userDefinedOperators, variables,
+                                       entryPoint.sourcePositions);
+}
+
+namespace
+{
+// Tables used by the tiered execution, which are indexed by the start addresses of operators
+template<typename TNumber>
+struct TieringState
+{
+    StackMachineTieredCompiler<TNumber>* compiler;
+    uint32_t threshold;
+    bool isCompilationStarted = false;
+    std::vector<uint32_t> counters;
+    std::vector<int> numOperands;
+    std::vector<std::atomic<StackMachineNativeFunction<TNumber>>> nativeFunctions;
+
+    TieringState(StackMachineTieredCompiler<TNumber>* compiler,
+                 const StackMachineModule<TNumber>& module, TNumber* const* variables)
+        : compiler(compiler), threshold(std::max(compiler->GetThreshold(), 1u)),
+          counters(module.GetFlattenedOperations().size()),
+          numOperands(module.GetFlattenedOperations().size()),
+          nativeFunctions(module.GetFlattenedOperations().size())
     {
-        Generator generator(context, option, constTable, operatorLabels, std::nullopt,
-                            variableIndices);
-        generator.Generate(op);
-        entryPoint = std::move(generator.operations);
+        auto& userDefinedOperators = module.GetUserDefinedOperators();
+        for (size_t i = 0; i < userDefinedOperators.size(); i++)
+        {
+            numOperands[module.GetStartAddresses()[i]] =
+                userDefinedOperators[i].GetDefinition().GetNumOperands();
+        }
+
+        compiler->Prepare(module, variables, counters.data(), nativeFunctions.data());
     }
 
-    std::vector<std::string> variables(variableIndices.size());
-    for (auto& pair : variableIndices)
+    // Counts a call or a back edge of the operator starting at the given address
+    void Count(const StackMachineModule<TNumber>& module, int address, TNumber* const* variables)
     {
-        variables[pair.second] = pair.first;
+        if (++counters[address] == threshold && !isCompilationStarted)
+        {
+            isCompilationStarted = true;
+
+#ifdef USE_GUARD_PAGE
+            // The compiler may compile the operators on this thread
+            GuardPageSuspension suspension;
+#endif // USE_GUARD_PAGE
+            compiler->Start(module, variables, nativeFunctions.data());
+        }
     }
 
-    return StackMachineModule<TNumber>(entryPoint, constTable, userDefinedOperators, variables);
-}
+    // Calls the native code of an operator with the given operands
+    TNumber Call(StackMachineNativeFunction<TNumber> native, void* state, const TNumber* operands)
+    {
+#ifdef USE_GUARD_PAGE
+        // Unlike the interpreter, the native code and the functions called from it may have
+        // frames requiring destruction
+        GuardPageSuspension suspension;
+#endif // USE_GUARD_PAGE
+        return native(state, operands);
+    }
+};
 
-template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
-         typename TInputSource, typename TPrinter, typename TStackArray, typename TPtrStackArray>
-TNumber ExecuteStackMachineModule(
+// Checks stack overflow before calling the operator at "op->value". The stacks are grown when they
+// are not large enough. Guarded stacks are never checked here, because their overflows fault on
+// the guard pages.
+#define STACK_MACHINE_RESERVE_STACKS()                                                             \
+    if constexpr (!IsGuardedStackArray<TStackArray>)                                               \
+    {                                                                                              \
+        if (top + maxStackSizes[op->value] >= stackEnd)                                            \
+        {                                                                                          \
+            TNumber* stackBegin = &*stack.begin();                                                 \
+            size_t topIndex = std::distance(stackBegin, top);                                      \
+            size_t bottomIndex = std::distance(stackBegin, bottom);                                \
+            if (!context.ReserveStack(topIndex + maxStackSizes[op->value] + 1))                    \
+            {                                                                                      \
+                throw Exceptions::StackOverflowException(                                          \
+                    module.FindSourcePosition(std::distance(operations, op)));                     \
+            }                                                                                      \
+                                                                                                   \
+            stackBegin = &*stack.begin();                                                          \
+            stackEnd = stackBegin + stack.size();                                                  \
+            top = stackBegin + topIndex;                                                           \
+            bottom = stackBegin + bottomIndex;                                                     \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    if constexpr (!IsGuardedStackArray<TPtrStackArray>)                                            \
+    {                                                                                              \
+        if (ptrTop + 2 >= ptrStackEnd)                                                             \
+        {                                                                                          \
+            size_t ptrTopIndex = std::distance(ptrStackBegin, ptrTop);                             \
+            if (!context.ReservePtrStack(ptrTopIndex + 3))                                         \
+            {                                                                                      \
+                throw Exceptions::StackOverflowException(                                          \
+                    module.FindSourcePosition(std::distance(operations, op)));                     \
+            }                                                                                      \
+                                                                                                   \
+            ptrStackBegin = &*ptrStack.begin();                                                    \
+            ptrStackEnd = ptrStackBegin + ptrStack.size();                                         \
+            ptrTop = ptrStackBegin + ptrTopIndex;                                                  \
+        }                                                                                          \
+    }
+
+// The main loop of the stack machine. When the stacks are guarded, this function may be exited
+// by siglongjmp on stack overflow, so it must not have local variables requiring destruction
+// while executing the Call operation. Guarded stacks only hold trivially copyable numbers, so
+// "tos" below never requires destruction in that case. The functions called from here, which may
+// have such variables, run in "GuardPageSuspension" unless they never touch the stacks.
+//
+// The value on the top of the stack is cached in "tos", and the stack memory only holds the
+// values below it. When a frame is empty, "tos" holds a dummy value, which is spilled into the
+// memory by the next push just like a real value. Call spills "tos" so that all the operands are
+// addressed by "bottom".
+//
+// If "Profiled" is true, Call and Return operations report to the given profiler. "profileIds"
+// holds the profiler's id of each operator indexed by its start address.
+//
+// If "Tiered" is true, Call and backward Goto operations count the executions of each operator,
+// and Call operations invoke the native code of the callee once it is compiled.
+template<bool Profiled, bool Tiered, typename TNumber, typename TVariableSource,
+         typename TGlobalArraySource, typename TInputSource, typename TPrinter,
+         typename TStackArray, typename TPtrStackArray>
+TNumber ExecuteStackMachineModuleCore(
     const StackMachineModule<TNumber>& module,
-    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state)
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    StackMachineContext<TNumber, TStackArray, TPtrStackArray>& context,
+    const std::vector<TNumber*>& variables, Profiler* profiler, const int* profileIds,
+    TieringState<TNumber>* tiering, MemoizationTable<TNumber>* memoizationTables)
 {
-    static constexpr size_t StackSize = 1 << 20;
-    static constexpr size_t PtrStackSize = 1 << 20;
-
-    // Get variable's values from ExecutionState
-    std::vector<TNumber> variables(module.GetVariables().size());
-    for (size_t i = 0; i < variables.size(); i++)
+    // Start execution
+    auto& maxStackSizes = module.GetMaxStackSizes();
+    if (!context.ReserveStack(maxStackSizes[0] + 1) || !context.ReservePtrStack(2))
     {
-        variables[i] = state.GetVariableSource().Get(module.GetVariables()[i]);
+        throw Exceptions::StackOverflowException(std::nullopt);
     }
 
-    // Start execution
-    auto [operationsOriginal, maxStackSizes] = module.FlattenOperations();
-    TStackArray stack(StackSize);
-    TPtrStackArray ptrStack(PtrStackSize);
+    TStackArray& stack = context.GetStack();
+    TPtrStackArray& ptrStack = context.GetPtrStack();
+    TNumber* stackEnd = &*stack.begin() + stack.size();
+    int* ptrStackBegin = &*ptrStack.begin();
+    int* ptrStackEnd = ptrStackBegin + ptrStack.size();
     TNumber* top = &*stack.begin();
     TNumber* bottom = top;
-    int* ptrTop = &*ptrStack.begin();
+    int* ptrTop = ptrStackBegin;
+    TNumber tos = 0;
     auto& array = state.GetArraySource();
 
 #ifdef USE_COMPUTED_GOTO
@@ -968,22 +1437,35 @@ TNumber ExecuteStackMachineModule(
         &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThan),
         &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThanOrEqual),
         &&COMPUTED_GOTO_LABEL_OF(Call),
+        &&COMPUTED_GOTO_LABEL_OF(TailCall),
         &&COMPUTED_GOTO_LABEL_OF(Return),
         &&COMPUTED_GOTO_LABEL_OF(Halt),
+        &&COMPUTED_GOTO_LABEL_OF(LoadMemo),
+        &&COMPUTED_GOTO_LABEL_OF(StoreMemo),
+        &&COMPUTED_GOTO_LABEL_OF(AddConst),
+        &&COMPUTED_GOTO_LABEL_OF(SubConst),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArgAddConst),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArgSubConst),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArgAddArg),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArgSubArg),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArgMultArg),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfNotEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfLessThanConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfLessThanOrEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThanConst),
+        &&COMPUTED_GOTO_LABEL_OF(GotoIfGreaterThanOrEqualConst),
+        &&COMPUTED_GOTO_LABEL_OF(LoadArgReturn),
+        &&COMPUTED_GOTO_LABEL_OF(Operand),
         &&COMPUTED_GOTO_LABEL_OF(Lavel),
     };
 
-    // Compute the target addresses of goto
-    ComputedGotoOperation operations[operationsOriginal.size()];
-    for (size_t i = 0; i < operationsOriginal.size(); i++)
-    {
-        operations[i].address = DispatchTable[static_cast<size_t>(operationsOriginal[i].opcode)];
-        operations[i].value = operationsOriginal[i].value;
-    }
-    ComputedGotoOperation* op = operations;
+    // The target addresses of goto are computed only once per module
+    const ComputedGotoOperation* operations = module.GetThreadedOperations(DispatchTable);
+    const ComputedGotoOperation* op = operations;
 #else
-    StackMachineOperation* op = &*operationsOriginal.begin();
-    StackMachineOperation* operations = &*operationsOriginal.begin();
+    const StackMachineOperation* operations = module.GetFlattenedOperations().data();
+    const StackMachineOperation* op = operations;
 #endif // USE_COMPUTED_GOTO
 
     COMPUTED_GOTO_BEGIN();
@@ -992,176 +1474,177 @@ TNumber ExecuteStackMachineModule(
     {
         COMPUTED_GOTO_CASE(Push)
         {
-            *top = 0;
+            *top = tos;
             top++;
+            tos = 0;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Pop)
         {
             top--;
+            tos = *top;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(LoadConst)
         {
-            *top = static_cast<TNumber>(op->value);
+            *top = tos;
             top++;
+            tos = static_cast<TNumber>(op->value);
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(LoadConstTable)
         {
-            *top = module.GetConstTable()[op->value];
+            *top = tos;
             top++;
+            tos = module.GetConstTable()[op->value];
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(LoadArg)
         {
-            *top = bottom[-op->value];
+            *top = tos;
             top++;
+            tos = bottom[-op->value];
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(StoreArg)
         {
+            bottom[-op->value] = tos;
             top--;
-            bottom[-op->value] = *top;
+            tos = *top;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(LoadVariable)
         {
-            *top = variables[op->value];
+            *top = tos;
             top++;
+            tos = *variables[op->value];
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(StoreVariable)
         {
-            variables[op->value] = top[-1];
+            *variables[op->value] = tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(LoadArrayElement)
         {
-            top[-1] = array.Get(top[-1]);
+            tos = array.Get(tos);
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(StoreArrayElement)
         {
+            // The index is on the top, and the value below it is left on the stack
             top--;
-            array.Set(*top, top[-1]);
+            array.Set(tos, *top);
+            tos = *top;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Input)
         {
-            *top = static_cast<TNumber>(state.GetChar());
+            *top = tos;
             top++;
+            tos = static_cast<TNumber>(state.GetChar());
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(PrintChar)
         {
-#ifdef ENABLE_GMP
-            if constexpr (std::is_same_v<TNumber, mpz_class>)
-            {
-                state.PrintChar(top[-1].get_si());
-            }
-            else
-#endif // ENABLE_GMP
-            {
-                state.PrintChar(static_cast<char>(top[-1]));
-            }
-            top[-1] = 0;
+            state.PrintChar(static_cast<char>(tos));
+            tos = 0;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Add)
         {
             top--;
-            top[-1] = top[-1] + *top;
+            tos = *top + tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Sub)
         {
             top--;
-            top[-1] = top[-1] - *top;
+            tos = *top - tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Mult)
         {
             top--;
-            top[-1] = top[-1] * *top;
+            tos = *top * tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Div)
         {
             top--;
-            top[-1] = top[-1] / *top;
+            tos = *top / tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(DivChecked)
         {
-            // This block is required in order to ensure that the 'divisor' variable will be
-            // properly destructed before jumping by COMPUTED_GOTO_JUMP macro.
+            if (tos == 0)
             {
-                top--;
-
-                TNumber divisor = *top;
-                if (divisor == 0)
-                {
-                    throw Exceptions::ZeroDivisionException(std::nullopt);
-                }
-
-                top[-1] = top[-1] / divisor;
+                throw Exceptions::ZeroDivisionException(
+                    module.FindSourcePosition(std::distance(operations, op)));
             }
 
+            top--;
+            tos = *top / tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Mod)
         {
             top--;
-            top[-1] = top[-1] % *top;
+            tos = *top % tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(ModChecked)
         {
-            // This block is required in order to ensure that the 'divisor' variable will be
-            // properly destructed before jumping by COMPUTED_GOTO_JUMP macro.
+            if (tos == 0)
             {
-                top--;
-
-                TNumber divisor = *top;
-                if (divisor == 0)
-                {
-                    throw Exceptions::ZeroDivisionException(std::nullopt);
-                }
-
-                top[-1] = top[-1] % divisor;
+                throw Exceptions::ZeroDivisionException(
+                    module.FindSourcePosition(std::distance(operations, op)));
             }
 
+            top--;
+            tos = *top % tos;
             COMPUTED_GOTO_NEXT_OPERATION();
         }
 
         COMPUTED_GOTO_CASE(Goto)
         {
+            if constexpr (Tiered)
+            {
+                // Backward jumps are only generated by tail calls, which jump to the start of the
+                // operator
+                if (op->value <= std::distance(operations, op))
+                {
+                    tiering->Count(module, op->value, variables.data());
+                }
+            }
+
             COMPUTED_GOTO_JUMP(op->value);
         }
 
         COMPUTED_GOTO_CASE(GotoIfTrue)
         {
+            bool condition = tos != 0;
             top--;
-            if (*top != 0)
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1170,8 +1653,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfFalse)
         {
+            bool condition = tos == 0;
             top--;
-            if (*top == 0)
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1180,8 +1665,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfEqual)
         {
+            bool condition = top[-1] == tos;
             top -= 2;
-            if (*top == top[1])
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1190,8 +1677,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfNotEqual)
         {
+            bool condition = top[-1] != tos;
             top -= 2;
-            if (*top != top[1])
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1200,8 +1689,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfLessThan)
         {
+            bool condition = top[-1] < tos;
             top -= 2;
-            if (*top < top[1])
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1210,8 +1701,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfLessThanOrEqual)
         {
+            bool condition = top[-1] <= tos;
             top -= 2;
-            if (*top <= top[1])
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1220,8 +1713,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfGreaterThan)
         {
+            bool condition = top[-1] > tos;
             top -= 2;
-            if (*top > top[1])
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1230,8 +1725,10 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(GotoIfGreaterThanOrEqual)
         {
+            bool condition = top[-1] >= tos;
             top -= 2;
-            if (*top >= top[1])
+            tos = *top;
+            if (condition)
             {
                 COMPUTED_GOTO_JUMP(op->value);
             }
@@ -1240,69 +1737,301 @@ TNumber ExecuteStackMachineModule(
 
         COMPUTED_GOTO_CASE(Call)
         {
-            // Check stack overflow
-            if (top + maxStackSizes[op->value] >= &*stack.begin() + stack.size())
-            {
-                throw Exceptions::StackOverflowException(std::nullopt);
-            }
+            // Spill the last operand
+            *top = tos;
+            top++;
 
-            if (ptrTop + 2 >= &*ptrStack.begin() + ptrStack.size())
+            if constexpr (Tiered)
             {
-                throw Exceptions::StackOverflowException(std::nullopt);
+                auto native = tiering->nativeFunctions[op->value].load(std::memory_order_acquire);
+                if (native != nullptr)
+                {
+                    // The native code takes the operands from the stack, and the returned value
+                    // replaces them
+                    top -= tiering->numOperands[op->value];
+                    tos = tiering->Call(native, &state, top);
+                    COMPUTED_GOTO_NEXT_OPERATION();
+                }
+
+                tiering->Count(module, op->value, variables.data());
             }
 
+            STACK_MACHINE_RESERVE_STACKS();
+
             // Push current program counter
             *ptrTop = static_cast<int>(std::distance(operations, op));
             ptrTop++;
 
-            // Push current stack bottom
-            *ptrTop = static_cast<int>(std::distance(&*stack.begin(), bottom));
+            // Push the distance to the current stack bottom, which is restored on return
+            *ptrTop = static_cast<int>(std::distance(bottom, top));
             ptrTop++;
 
             // Create new stack frame
             bottom = top;
 
+            if constexpr (Profiled)
+            {
+                profiler->Enter(profileIds[op->value]);
+            }
+
             // Branch
             COMPUTED_GOTO_JUMP(op->value);
         }
 
-        COMPUTED_GOTO_CASE(Return)
+        COMPUTED_GOTO_CASE(TailCall)
         {
-            // This block is required in order to ensure that the 'valueToBeReturned' variable will
-            // be properly destructed before jumping by COMPUTED_GOTO_JUMP macro.
+            // Spill the last operand
+            *top = tos;
+            top++;
+
+            if constexpr (Tiered)
             {
-                // Store returning value
-                TNumber valueToBeReturned = top[-1];
+                auto native = tiering->nativeFunctions[op->value].load(std::memory_order_acquire);
+                if (native != nullptr)
+                {
+                    // The following operations return the result of the native code
+                    top -= op[2].value;
+                    tos = tiering->Call(native, &state, top);
+                    COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(2);
+                }
+
+                tiering->Count(module, op->value, variables.data());
+            }
 
-                // Restore previous stack top while removing arguments from stack
-                // (We ensure space of returning value)
-                top = bottom - op->value + 1;
+            // The new frame never exceeds the one which Call would create
+            STACK_MACHINE_RESERVE_STACKS();
 
-                // Store returning value on stack
-                top[-1] = valueToBeReturned;
+            if constexpr (Profiled)
+            {
+                // Every activation is reported to the profiler, so the callee returns to the
+                // operations following this one as it does from Call
+                *ptrTop = static_cast<int>(std::distance(operations, op)) + 2;
+                ptrTop++;
+                *ptrTop = static_cast<int>(std::distance(bottom, top));
+                ptrTop++;
+                bottom = top;
+                profiler->Enter(profileIds[op->value]);
+            }
+            else
+            {
+                // Replace the operands of the current operator with the new ones. The return
+                // address stays the same, and the distance to the caller's bottom is adjusted.
+                int numOperands = op[2].value;
+                int delta = numOperands - op[1].value;
+                std::copy(top - numOperands, top, bottom - op[1].value);
+                bottom += delta;
+                top = bottom;
+                ptrTop[-1] += delta;
+            }
 
-                // Pop previous stack bottom
-                ptrTop--;
-                bottom = &*stack.begin() + *ptrTop;
+            // Branch
+            COMPUTED_GOTO_JUMP(op->value);
+        }
 
-                // Pop previous program counter
-                ptrTop--;
+        COMPUTED_GOTO_CASE(Return)
+        {
+            if constexpr (Profiled)
+            {
+                profiler->Exit();
             }
 
+            // Restore previous stack top while removing arguments from stack. The returning
+            // value stays in "tos".
+            top = bottom - op->value;
+
+            // Pop previous stack bottom
+            ptrTop--;
+            bottom -= *ptrTop;
+
+            // Pop previous program counter
+            ptrTop--;
+
             COMPUTED_GOTO_JUMP(*ptrTop + 1);
         }
 
         COMPUTED_GOTO_CASE(Halt)
         {
-            // Store variable's values to ExecutionState
-            for (size_t i = 0; i < variables.size(); i++)
+            return tos;
+        }
+
+        COMPUTED_GOTO_CASE(LoadMemo)
+        {
+            auto& table = memoizationTables[op->value];
+            const TNumber* memoized = table.Find(bottom - table.GetNumOperands());
+            if (memoized == nullptr)
+            {
+                COMPUTED_GOTO_NEXT_OPERATION();
+            }
+
+            // Return the memoized result as Return does
+            if constexpr (Profiled)
+            {
+                profiler->Exit();
+            }
+
+            tos = *memoized;
+            top = bottom - table.GetNumOperands();
+            ptrTop--;
+            bottom -= *ptrTop;
+            ptrTop--;
+            COMPUTED_GOTO_JUMP(*ptrTop + 1);
+        }
+
+        COMPUTED_GOTO_CASE(StoreMemo)
+        {
+            auto& table = memoizationTables[op->value];
+            table.Insert(bottom - table.GetNumOperands(), tos);
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(AddConst)
+        {
+            tos = tos + op->value;
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(SubConst)
+        {
+            tos = tos - op->value;
+            COMPUTED_GOTO_NEXT_OPERATION();
+        }
+
+        COMPUTED_GOTO_CASE(LoadArgAddConst)
+        {
+            *top = tos;
+            top++;
+            tos = bottom[-op->value] + op[1].value;
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(LoadArgSubConst)
+        {
+            *top = tos;
+            top++;
+            tos = bottom[-op->value] - op[1].value;
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(LoadArgAddArg)
+        {
+            *top = tos;
+            top++;
+            tos = bottom[-op->value] + bottom[-op[1].value];
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(LoadArgSubArg)
+        {
+            *top = tos;
+            top++;
+            tos = bottom[-op->value] - bottom[-op[1].value];
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(LoadArgMultArg)
+        {
+            *top = tos;
+            top++;
+            tos = bottom[-op->value] * bottom[-op[1].value];
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfEqualConst)
+        {
+            bool condition = tos == op[1].value;
+            top--;
+            tos = *top;
+            if (condition)
+            {
+                COMPUTED_GOTO_JUMP(op->value);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfNotEqualConst)
+        {
+            bool condition = tos != op[1].value;
+            top--;
+            tos = *top;
+            if (condition)
+            {
+                COMPUTED_GOTO_JUMP(op->value);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfLessThanConst)
+        {
+            bool condition = tos < op[1].value;
+            top--;
+            tos = *top;
+            if (condition)
             {
-                state.GetVariableSource().Set(module.GetVariables()[i], variables[i]);
+                COMPUTED_GOTO_JUMP(op->value);
             }
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
 
-            return top[-1];
+        COMPUTED_GOTO_CASE(GotoIfLessThanOrEqualConst)
+        {
+            bool condition = tos <= op[1].value;
+            top--;
+            tos = *top;
+            if (condition)
+            {
+                COMPUTED_GOTO_JUMP(op->value);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
         }
 
+        COMPUTED_GOTO_CASE(GotoIfGreaterThanConst)
+        {
+            bool condition = tos > op[1].value;
+            top--;
+            tos = *top;
+            if (condition)
+            {
+                COMPUTED_GOTO_JUMP(op->value);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(GotoIfGreaterThanOrEqualConst)
+        {
+            bool condition = tos >= op[1].value;
+            top--;
+            tos = *top;
+            if (condition)
+            {
+                COMPUTED_GOTO_JUMP(op->value);
+            }
+            COMPUTED_GOTO_NEXT_OPERATION_SKIPPING(1);
+        }
+
+        COMPUTED_GOTO_CASE(LoadArgReturn)
+        {
+            if constexpr (Profiled)
+            {
+                profiler->Exit();
+            }
+
+            // Store returning value
+            tos = bottom[-op->value];
+
+            // Restore previous stack top while removing arguments from stack
+            top = bottom - op[1].value;
+
+            // Pop previous stack bottom
+            ptrTop--;
+            bottom -= *ptrTop;
+
+            // Pop previous program counter
+            ptrTop--;
+
+            COMPUTED_GOTO_JUMP(*ptrTop + 1);
+        }
+
+        COMPUTED_GOTO_CASE(Operand)
         COMPUTED_GOTO_CASE(Lavel)
         COMPUTED_GOTO_DEFAULT()
         {
@@ -1311,4 +2040,138 @@ TNumber ExecuteStackMachineModule(
         }
     }
 }
+
+// Runs "ExecuteStackMachineModuleCore". When the stacks are guarded, a fault on their guard pages
+// jumps back to this function by siglongjmp, which only skips the frame of the main loop.
+template<bool Profiled, bool Tiered, typename TNumber, typename TVariableSource,
+         typename TGlobalArraySource, typename TInputSource, typename TPrinter,
+         typename TStackArray, typename TPtrStackArray>
+TNumber ExecuteStackMachineModuleGuarded(
+    const StackMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    StackMachineContext<TNumber, TStackArray, TPtrStackArray>& context,
+    const std::vector<TNumber*>& variables, Profiler* profiler, const int* profileIds,
+    TieringState<TNumber>* tiering, MemoizationTable<TNumber>* memoizationTables)
+{
+#ifdef USE_GUARD_PAGE
+    if constexpr (IsGuardedStackArray<TStackArray> || IsGuardedStackArray<TPtrStackArray>)
+    {
+        const GuardedMemory* stackMemory = nullptr;
+        const GuardedMemory* ptrStackMemory = nullptr;
+
+        if constexpr (IsGuardedStackArray<TStackArray>)
+        {
+            stackMemory = &context.GetStack().GetMemory();
+        }
+
+        if constexpr (IsGuardedStackArray<TPtrStackArray>)
+        {
+            ptrStackMemory = &context.GetPtrStack().GetMemory();
+        }
+
+        sigjmp_buf buffer;
+        GuardPageScope scope(stackMemory, ptrStackMemory, buffer);
+        if (sigsetjmp(buffer, 1) != 0)
+        {
+            // We reach here when the execution touches one of the guard pages
+            throw Exceptions::StackOverflowException(std::nullopt);
+        }
+
+        return ExecuteStackMachineModuleCore<Profiled, Tiered>(
+            module, state, context, variables, profiler, profileIds, tiering, memoizationTables);
+    }
+    else
+#endif // USE_GUARD_PAGE
+    {
+        return ExecuteStackMachineModuleCore<Profiled, Tiered>(
+            module, state, context, variables, profiler, profileIds, tiering, memoizationTables);
+    }
+}
+}
+
+#undef STACK_MACHINE_RESERVE_STACKS
+
+template<typename TNumber, typename TVariableSource, typename TGlobalArraySource,
+         typename TInputSource, typename TPrinter, typename TStackArray, typename TPtrStackArray>
+TNumber ExecuteStackMachineModule(
+    const StackMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    StackMachineContext<TNumber, TStackArray, TPtrStackArray>& context, Profiler* profiler,
+    StackMachineTieredCompiler<TNumber>* tieredCompiler)
+{
+    // The variables are accessed through their slots in ExecutionState
+    std::vector<TNumber*> variables(module.GetVariables().size());
+    for (size_t i = 0; i < variables.size(); i++)
+    {
+        variables[i] = state.GetVariableSource().GetSlot(module.GetVariables()[i]);
+    }
+
+    // Map the start address of each operator to its id in the profiler
+    std::vector<int> profileIds;
+    if (profiler != nullptr)
+    {
+        profileIds.resize(module.GetFlattenedOperations().size());
+
+        auto& userDefinedOperators = module.GetUserDefinedOperators();
+        for (size_t i = 0; i < userDefinedOperators.size(); i++)
+        {
+            profileIds[module.GetStartAddresses()[i]] =
+                profiler->GetOperatorId(userDefinedOperators[i].GetDefinition().GetName());
+        }
+    }
+
+    // The slots of the tables are allocated only when the module memoizes the operators
+    std::vector<MemoizationTable<TNumber>> memoizationTables;
+    for (auto& userDefined : module.GetUserDefinedOperators())
+    {
+        memoizationTables.emplace_back(userDefined.GetDefinition().GetNumOperands());
+    }
+
+    std::optional<TieringState<TNumber>> tiering;
+    if (tieredCompiler != nullptr && profiler == nullptr)
+    {
+        tiering.emplace(tieredCompiler, module, variables.data());
+    }
+
+    // The compilation must finish before the tables and the variables given to the compiler are
+    // destroyed. This waits even when the execution is exited by an exception or siglongjmp.
+    struct CompilationWaiter
+    {
+        const StackMachineModule<TNumber>& module;
+        std::optional<TieringState<TNumber>>& tiering;
+
+        ~CompilationWaiter()
+        {
+            if (tiering)
+            {
+                if (tiering->isCompilationStarted)
+                {
+                    tiering->compiler->Wait();
+                }
+
+                tiering->compiler->Finish(module, tiering->counters.data());
+            }
+        }
+    } waiter{ module, tiering };
+
+    TieringState<TNumber>* noTiering = nullptr;
+    if (profiler != nullptr)
+    {
+        return ExecuteStackMachineModuleGuarded<true, false>(module, state, context, variables,
+                                                             profiler, profileIds.data(),
+                                                             noTiering, memoizationTables.data());
+    }
+    else if (tiering)
+    {
+        return ExecuteStackMachineModuleGuarded<false, true>(module, state, context, variables,
+                                                             nullptr, nullptr, &*tiering,
+                                                             memoizationTables.data());
+    }
+    else
+    {
+        return ExecuteStackMachineModuleGuarded<false, false>(module, state, context, variables,
+                                                              nullptr, nullptr, noTiering,
+                                                              memoizationTables.data());
+    }
+}
 }
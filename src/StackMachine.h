@@ -11,9 +11,19 @@
 
 #include "Common.h"
 #include "ExecutionState.h"
+#include "GuardedStack.h"
 #include "Operators.h"
+#include "Profiler.h"
+#include "ThreadedCode.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 namespace calc4
@@ -49,14 +59,47 @@ enum class StackMachineOpcode : int8_t
     GotoIfGreaterThan,
     GotoIfGreaterThanOrEqual,
     Call,
+
+    // Calls an operator reusing the current frame. It takes two "Operand" slots, which hold the
+    // numbers of operands of the current operator and the callee. The following operations return
+    // the result as Call does, which are executed when the call is not replaced with a jump.
+    TailCall,
+
     Return,
     Halt,
+
+    // Memoization of the pure operator "value". LoadMemo returns the memoized result as Return does
+    // if the operator has been called with the current operands, and StoreMemo memoizes the value
+    // on the top of the stack as the result for them.
+    LoadMemo,
+    StoreMemo,
+
+    // Superinstructions, which fuse common sequences of operations. Some of them take an
+    // additional operand that is stored in the value of the following "Operand" slot.
+    AddConst,
+    SubConst,
+    LoadArgAddConst,
+    LoadArgSubConst,
+    LoadArgAddArg,
+    LoadArgSubArg,
+    LoadArgMultArg,
+    GotoIfEqualConst,
+    GotoIfNotEqualConst,
+    GotoIfLessThanConst,
+    GotoIfLessThanOrEqualConst,
+    GotoIfGreaterThanConst,
+    GotoIfGreaterThanOrEqualConst,
+    LoadArgReturn,
+    Operand,
+
     Lavel,
 };
 
+// Each operation is packed into eight bytes. Its 32-bit value is wide enough for jump targets,
+// constants and indices of large programs, while keeping the instruction stream compact.
 struct StackMachineOperation
 {
-    using ValueType = int16_t;
+    using ValueType = int32_t;
 
     StackMachineOpcode opcode;
     ValueType value;
@@ -69,18 +112,32 @@ struct StackMachineOperation
     }
 };
 
+static_assert(sizeof(StackMachineOperation) == 8,
+              "StackMachineOperation is expected to fit in eight bytes");
+
+// An entry of the source position table, which maps an operation to the position of the token
+// it was generated from. Only operations that may raise runtime errors or call user-defined
+// operators have entries, so the table stays small and the operations themselves stay compact.
+struct StackMachineSourcePosition
+{
+    int address;
+    CharPosition position;
+};
+
 struct StackMachineUserDefinedOperator
 {
 private:
     OperatorDefinition definition;
     std::vector<StackMachineOperation> operations;
     int maxStackSize;
+    std::vector<StackMachineSourcePosition> sourcePositions;
 
 public:
-    StackMachineUserDefinedOperator(const OperatorDefinition& definition,
-                                    const std::vector<StackMachineOperation>& operations,
-                                    int maxStackSize)
-        : definition(definition), operations(operations), maxStackSize(maxStackSize)
+    StackMachineUserDefinedOperator(
+        const OperatorDefinition& definition, const std::vector<StackMachineOperation>& operations,
+        int maxStackSize, const std::vector<StackMachineSourcePosition>& sourcePositions = {})
+        : definition(definition), operations(operations), maxStackSize(maxStackSize),
+          sourcePositions(sourcePositions)
     {
     }
 
@@ -98,34 +155,135 @@ public:
     {
         return maxStackSize;
     }
+
+    // Returns the source position table sorted by the addresses relative to this operator
+    const std::vector<StackMachineSourcePosition>& GetSourcePositions() const
+    {
+        return sourcePositions;
+    }
+};
+
+// An operation whose opcode is replaced with the address of its handler. This is used by the
+// computed goto dispatcher of the stack machine.
+struct StackMachineThreadedOperation
+{
+    const void* address;
+    StackMachineOperation::ValueType value;
+
+    static StackMachineThreadedOperation Create(const void* address,
+                                                const StackMachineOperation& operation)
+    {
+        return { address, operation.value };
+    }
 };
 
+using StackMachineThreadedCodeCache =
+    ThreadedCodeCache<StackMachineOperation, StackMachineThreadedOperation>;
+
 template<typename TNumber>
 class StackMachineModule
 {
 private:
     std::vector<StackMachineOperation> entryPoint;
+    int entryPointMaxStackSize;
     std::vector<TNumber> constTable;
     std::vector<StackMachineUserDefinedOperator> userDefinedOperators;
     std::vector<std::string> variables;
+    std::vector<StackMachineSourcePosition> entryPointSourcePositions;
+
+    // The following members are computed once on construction and shared by every execution
+    std::vector<StackMachineOperation> flattenedOperations;
+    std::vector<int> maxStackSizes;
+    std::vector<int> startAddresses;
+    std::vector<StackMachineSourcePosition> sourcePositions;
+    std::shared_ptr<StackMachineThreadedCodeCache> threadedCodeCache;
 
 public:
-    StackMachineModule(const std::vector<StackMachineOperation>& entryPoint,
-                       const std::vector<TNumber>& constTable,
-                       const std::vector<StackMachineUserDefinedOperator>& userDefinedOperators,
-                       const std::vector<std::string>& variables)
-        : entryPoint(entryPoint), constTable(constTable),
-          userDefinedOperators(userDefinedOperators), variables(variables)
+    StackMachineModule(
+        const std::vector<StackMachineOperation>& entryPoint, int entryPointMaxStackSize,
+        const std::vector<TNumber>& constTable,
+        const std::vector<StackMachineUserDefinedOperator>& userDefinedOperators,
+        const std::vector<std::string>& variables,
+        const std::vector<StackMachineSourcePosition>& entryPointSourcePositions = {})
+        : entryPoint(entryPoint), entryPointMaxStackSize(entryPointMaxStackSize),
+          constTable(constTable), userDefinedOperators(userDefinedOperators), variables(variables),
+          entryPointSourcePositions(entryPointSourcePositions),
+          threadedCodeCache(std::make_shared<StackMachineThreadedCodeCache>())
+    {
+        std::tie(flattenedOperations, maxStackSizes, startAddresses) = FlattenOperations();
+        sourcePositions = FlattenSourcePositions();
+    }
+
+    std::tuple<std::vector<StackMachineOperation>, std::vector<int>, std::vector<int>>
+    FlattenOperations() const;
+
+    // Merges the source position tables of the entry point and the user-defined operators into
+    // the one indexed by the addresses of the flattened operations
+    std::vector<StackMachineSourcePosition> FlattenSourcePositions() const;
+
+    // Returns the operations of the whole module, whose labels and call targets are resolved
+    const std::vector<StackMachineOperation>& GetFlattenedOperations() const
+    {
+        return flattenedOperations;
+    }
+
+    // Returns the maximum stack size of each user-defined operator indexed by its start address.
+    // The element at zero is the one of the entry point.
+    const std::vector<int>& GetMaxStackSizes() const
+    {
+        return maxStackSizes;
+    }
+
+    // Returns the start address of each user-defined operator in the flattened operations
+    const std::vector<int>& GetStartAddresses() const
+    {
+        return startAddresses;
+    }
+
+    // Returns the source position table of the flattened operations sorted by the addresses
+    const std::vector<StackMachineSourcePosition>& GetSourcePositions() const
+    {
+        return sourcePositions;
+    }
+
+    // Returns the position in the source code of the operation at the given address of the
+    // flattened operations. This is only used on error paths and by samplers, so the executor
+    // does not track positions while running.
+    std::optional<CharPosition> FindSourcePosition(size_t address) const
     {
+        auto it = std::lower_bound(sourcePositions.begin(), sourcePositions.end(), address,
+                                   [](auto& entry, size_t address) {
+                                       return static_cast<size_t>(entry.address) < address;
+                                   });
+        if (it != sourcePositions.end() && static_cast<size_t>(it->address) == address)
+        {
+            return it->position;
+        }
+
+        return std::nullopt;
     }
 
-    std::pair<std::vector<StackMachineOperation>, std::vector<int>> FlattenOperations() const;
+    const StackMachineThreadedOperation* GetThreadedOperations(
+        const void* const* dispatchTable) const
+    {
+        return threadedCodeCache->GetOrCreate(dispatchTable, flattenedOperations);
+    }
 
     const std::vector<StackMachineOperation>& GetEntryPoint() const
     {
         return entryPoint;
     }
 
+    int GetEntryPointMaxStackSize() const
+    {
+        return entryPointMaxStackSize;
+    }
+
+    const std::vector<StackMachineSourcePosition>& GetEntryPointSourcePositions() const
+    {
+        return entryPointSourcePositions;
+    }
+
     const std::vector<TNumber>& GetConstTable() const
     {
         return constTable;
@@ -142,9 +300,188 @@ public:
     }
 };
 
+// Owns the stacks used by the stack machine. Allocating and initializing them is expensive, so a
+// context can be reused across executions. The stacks are allocated lazily and grow on demand up
+// to the given maximum sizes. A context must not be shared among threads running concurrently.
+//
+// If the stacks are GuardedStackArray, the whole stacks are reserved on the first execution and
+// overflows are detected by their guard pages, so the executor does not check their bounds.
+template<typename TNumber, typename TStackArray = DefaultStackArray<TNumber>,
+         typename TPtrStackArray = DefaultStackArray<int>>
+class StackMachineContext
+{
+public:
+    static constexpr size_t DefaultMaxStackSize = 1 << 20;
+    static constexpr size_t DefaultMaxPtrStackSize = 1 << 20;
+    static constexpr size_t InitialStackSize = 1 << 10;
+
+private:
+    TStackArray stack;
+    TPtrStackArray ptrStack;
+    size_t maxStackSize;
+    size_t maxPtrStackSize;
+
+public:
+    StackMachineContext(size_t maxStackSize = DefaultMaxStackSize,
+                        size_t maxPtrStackSize = DefaultMaxPtrStackSize)
+        : maxStackSize(maxStackSize), maxPtrStackSize(maxPtrStackSize)
+    {
+    }
+
+    TStackArray& GetStack()
+    {
+        return stack;
+    }
+
+    TPtrStackArray& GetPtrStack()
+    {
+        return ptrStack;
+    }
+
+    // Grows the stack so that it has at least "requiredSize" elements. Returns false if the
+    // required size exceeds the maximum.
+    bool ReserveStack(size_t requiredSize)
+    {
+        return ReserveStackArray(stack, requiredSize, maxStackSize, InitialStackSize);
+    }
+
+    // Grows the pointer stack so that it has at least "requiredSize" elements. Returns false if
+    // the required size exceeds the maximum.
+    bool ReservePtrStack(size_t requiredSize)
+    {
+        return ReserveStackArray(ptrStack, requiredSize, maxPtrStackSize, InitialStackSize);
+    }
+};
+
+// Native code of a user-defined operator used by the tiered execution. It takes the execution
+// state and the pointer to the operands, which are stored in order.
+template<typename TNumber>
+using StackMachineNativeFunction = TNumber (*)(void* state, const TNumber* operands);
+
+// Compiles the user-defined operators of a module into native code for the tiered execution. The
+// stack machine starts interpreting the module and counts calls and back edges of each operator.
+// Once one of them exceeds the threshold, the stack machine requests the compilation, which runs
+// asynchronously, and switches calls to the native code when it becomes ready. A compiler may be
+// given to many executions, and carry the native code and the counts over between them.
+template<typename TNumber>
+class StackMachineTieredCompiler
+{
+public:
+    static constexpr uint32_t DefaultThreshold = 1000;
+
+private:
+    uint32_t threshold;
+
+public:
+    explicit StackMachineTieredCompiler(uint32_t threshold = DefaultThreshold)
+        : threshold(threshold)
+    {
+    }
+
+    virtual ~StackMachineTieredCompiler() = default;
+
+    // Returns the number of calls and back edges which makes an operator hot
+    uint32_t GetThreshold() const
+    {
+        return threshold;
+    }
+
+    // Called before an execution of the given module. The native code and the counts which the
+    // previous executions have left for the operators are stored into "nativeFunctions" and
+    // "counters", both indexed by the start addresses of the operators.
+    virtual void Prepare(const StackMachineModule<TNumber>& module, TNumber* const* variables,
+                         uint32_t* counters,
+                         std::atomic<StackMachineNativeFunction<TNumber>>* nativeFunctions)
+    {
+    }
+
+    // Starts compiling the user-defined operators of the given module. The native code shares the
+    // slots of the variables with the stack machine, whose addresses are given as "variables" in
+    // the order of the module's variables. Each compiled function is stored into
+    // "nativeFunctions" indexed by the start address of its operator.
+    virtual void Start(const StackMachineModule<TNumber>& module, TNumber* const* variables,
+                       std::atomic<StackMachineNativeFunction<TNumber>>* nativeFunctions) = 0;
+
+    // Waits for the compilation started by Start. This is called before the arguments given to
+    // Start are destroyed.
+    virtual void Wait() = 0;
+
+    // Called after an execution of the given module, even if it has failed, with the counts to be
+    // carried over to the next executions
+    virtual void Finish(const StackMachineModule<TNumber>& module, const uint32_t* counters) {}
+};
+
 struct StackMachineCodeGenerationOption
 {
     bool checkZeroDivision = false;
+    bool useSuperinstructions = true;
+
+    // Memoizes the results of pure operators
+    bool memoize = false;
+};
+
+// Code of the user-defined operators reused across the generation of modules, such as the ones for
+// the inputs of a REPL session. An operator is generated again only if its body has been replaced
+// since it was cached. The cached code refers to the constant table, the variables and the callees
+// through the tables local to each operator, which are relocated when a module is generated.
+template<typename TNumber>
+class StackMachineCodeCache
+{
+public:
+    struct Entry
+    {
+        std::shared_ptr<const Operator> op;
+        bool memoize;
+        std::vector<StackMachineOperation> operations;
+        int maxStackSize;
+        std::vector<StackMachineSourcePosition> sourcePositions;
+        std::vector<TNumber> constTable;
+        std::vector<std::string> variables;
+        std::vector<OperatorDefinition> callees;
+    };
+
+private:
+    std::optional<StackMachineCodeGenerationOption> option;
+    std::unordered_map<std::string, Entry> entries;
+    size_t numGeneratedOperators = 0;
+
+public:
+    // Discards the cached code if it has been generated with another option
+    void SetOption(const StackMachineCodeGenerationOption& newOption)
+    {
+        if (!option || option->checkZeroDivision != newOption.checkZeroDivision ||
+            option->useSuperinstructions != newOption.useSuperinstructions ||
+            option->memoize != newOption.memoize)
+        {
+            entries.clear();
+            option = newOption;
+        }
+    }
+
+    // Returns the cached code of the given body, or nullptr if there is no such code
+    const Entry* Find(const std::string& name, const std::shared_ptr<const Operator>& op,
+                      bool memoize) const
+    {
+        auto it = entries.find(name);
+        if (it == entries.end() || it->second.op != op || it->second.memoize != memoize)
+        {
+            return nullptr;
+        }
+
+        return &it->second;
+    }
+
+    const Entry& Insert(const std::string& name, Entry entry)
+    {
+        numGeneratedOperators++;
+        return entries[name] = std::move(entry);
+    }
+
+    // Returns the number of the operators generated since this cache was created
+    size_t GetNumGeneratedOperators() const
+    {
+        return numGeneratedOperators;
+    }
 };
 
 namespace
@@ -211,28 +548,135 @@ inline constexpr const char* ToString(StackMachineOpcode opcode)
         return "GotoIfGreaterThanOrEqual";
     case StackMachineOpcode::Call:
         return "Call";
+    case StackMachineOpcode::TailCall:
+        return "TailCall";
     case StackMachineOpcode::Return:
         return "Return";
     case StackMachineOpcode::Halt:
         return "Halt";
+    case StackMachineOpcode::LoadMemo:
+        return "LoadMemo";
+    case StackMachineOpcode::StoreMemo:
+        return "StoreMemo";
+    case StackMachineOpcode::AddConst:
+        return "AddConst";
+    case StackMachineOpcode::SubConst:
+        return "SubConst";
+    case StackMachineOpcode::LoadArgAddConst:
+        return "LoadArgAddConst";
+    case StackMachineOpcode::LoadArgSubConst:
+        return "LoadArgSubConst";
+    case StackMachineOpcode::LoadArgAddArg:
+        return "LoadArgAddArg";
+    case StackMachineOpcode::LoadArgSubArg:
+        return "LoadArgSubArg";
+    case StackMachineOpcode::LoadArgMultArg:
+        return "LoadArgMultArg";
+    case StackMachineOpcode::GotoIfEqualConst:
+        return "GotoIfEqualConst";
+    case StackMachineOpcode::GotoIfNotEqualConst:
+        return "GotoIfNotEqualConst";
+    case StackMachineOpcode::GotoIfLessThanConst:
+        return "GotoIfLessThanConst";
+    case StackMachineOpcode::GotoIfLessThanOrEqualConst:
+        return "GotoIfLessThanOrEqualConst";
+    case StackMachineOpcode::GotoIfGreaterThanConst:
+        return "GotoIfGreaterThanConst";
+    case StackMachineOpcode::GotoIfGreaterThanOrEqualConst:
+        return "GotoIfGreaterThanOrEqualConst";
+    case StackMachineOpcode::LoadArgReturn:
+        return "LoadArgReturn";
+    case StackMachineOpcode::Operand:
+        return "Operand";
     case StackMachineOpcode::Lavel:
         return "Lavel";
     default:
         return "<Unknown>";
     }
 }
+
+// Returns true if the value of the given opcode is a jump target
+inline constexpr bool IsJumpOpcode(StackMachineOpcode opcode)
+{
+    switch (opcode)
+    {
+    case StackMachineOpcode::Goto:
+    case StackMachineOpcode::GotoIfTrue:
+    case StackMachineOpcode::GotoIfFalse:
+    case StackMachineOpcode::GotoIfEqual:
+    case StackMachineOpcode::GotoIfNotEqual:
+    case StackMachineOpcode::GotoIfLessThan:
+    case StackMachineOpcode::GotoIfLessThanOrEqual:
+    case StackMachineOpcode::GotoIfGreaterThan:
+    case StackMachineOpcode::GotoIfGreaterThanOrEqual:
+    case StackMachineOpcode::GotoIfEqualConst:
+    case StackMachineOpcode::GotoIfNotEqualConst:
+    case StackMachineOpcode::GotoIfLessThanConst:
+    case StackMachineOpcode::GotoIfLessThanOrEqualConst:
+    case StackMachineOpcode::GotoIfGreaterThanConst:
+    case StackMachineOpcode::GotoIfGreaterThanOrEqualConst:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns the number of "Operand" slots following the given opcode
+inline constexpr int GetNumOperandSlots(StackMachineOpcode opcode)
+{
+    switch (opcode)
+    {
+    case StackMachineOpcode::LoadArgAddConst:
+    case StackMachineOpcode::LoadArgSubConst:
+    case StackMachineOpcode::LoadArgAddArg:
+    case StackMachineOpcode::LoadArgSubArg:
+    case StackMachineOpcode::LoadArgMultArg:
+    case StackMachineOpcode::GotoIfEqualConst:
+    case StackMachineOpcode::GotoIfNotEqualConst:
+    case StackMachineOpcode::GotoIfLessThanConst:
+    case StackMachineOpcode::GotoIfLessThanOrEqualConst:
+    case StackMachineOpcode::GotoIfGreaterThanConst:
+    case StackMachineOpcode::GotoIfGreaterThanOrEqualConst:
+    case StackMachineOpcode::LoadArgReturn:
+        return 1;
+    case StackMachineOpcode::TailCall:
+        return 2;
+    default:
+        return 0;
+    }
+}
 }
 
+// Generates the module of the given program. If "codeCache" is given, the code of the operators
+// cached in it is reused.
 template<typename TNumber>
 StackMachineModule<TNumber> GenerateStackMachineModule(
     const std::shared_ptr<const Operator>& op, const CompilationContext& context,
-    const StackMachineCodeGenerationOption& option);
+    const StackMachineCodeGenerationOption& option,
+    StackMachineCodeCache<TNumber>* codeCache = nullptr);
 
+// Executes the given module. If "tieredCompiler" is given, calls of hot user-defined operators
+// are switched to the native code compiled by it. Profiling disables the tiered execution, so that
+// every call is reported to the profiler.
 template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
          typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
          typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter,
-         typename TStackArray = std::vector<TNumber>, typename TPtrStackArray = std::vector<int>>
+         typename TStackArray = DefaultStackArray<TNumber>,
+         typename TPtrStackArray = DefaultStackArray<int>>
 TNumber ExecuteStackMachineModule(
     const StackMachineModule<TNumber>& module,
-    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state);
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state,
+    StackMachineContext<TNumber, TStackArray, TPtrStackArray>& context,
+    Profiler* profiler = nullptr, StackMachineTieredCompiler<TNumber>* tieredCompiler = nullptr);
+
+template<typename TNumber, typename TVariableSource = DefaultVariableSource<TNumber>,
+         typename TGlobalArraySource = DefaultGlobalArraySource<TNumber>,
+         typename TInputSource = DefaultInputSource, typename TPrinter = DefaultPrinter>
+TNumber ExecuteStackMachineModule(
+    const StackMachineModule<TNumber>& module,
+    ExecutionState<TNumber, TVariableSource, TGlobalArraySource, TInputSource, TPrinter>& state)
+{
+    StackMachineContext<TNumber> context;
+    return ExecuteStackMachineModule(module, state, context);
+}
 }
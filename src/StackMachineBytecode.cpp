@@ -0,0 +1,713 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "StackMachineBytecode.h"
+#include "Common.h"
+#include "Exceptions.h"
+#include "Operators.h"
+#include "StackMachine.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(__unix__) || defined(__APPLE__)
+
+#ifdef ENABLE_GMP
+#include "HybridInteger.h"
+#endif // ENABLE_GMP
+
+namespace calc4
+{
+#define InstantiateStackMachineBytecode(TNumber)                                                   \
+    template void WriteStackMachineBytecode(const StackMachineModule<TNumber>& module,             \
+                                            std::ostream& out);                                    \
+    template StackMachineModule<TNumber> ReadStackMachineBytecode(std::string_view bytecode)
+
+InstantiateStackMachineBytecode(int32_t);
+InstantiateStackMachineBytecode(int64_t);
+
+#ifdef ENABLE_INT128
+InstantiateStackMachineBytecode(__int128_t);
+#endif // ENABLE_INT128
+
+#ifdef ENABLE_GMP
+InstantiateStackMachineBytecode(HybridInteger);
+#endif // ENABLE_GMP
+
+/*****/
+
+MappedFile::MappedFile(const char* path)
+{
+#ifdef USE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        isOpen = true;
+        size = static_cast<size_t>(st.st_size);
+
+        if (size > 0)
+        {
+            void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                data = static_cast<const char*>(address);
+                isMapped = true;
+            }
+        }
+    }
+
+    close(fd);
+
+    if (!isOpen || isMapped || size == 0)
+    {
+        return;
+    }
+#endif // USE_MMAP
+
+    // Memory mapping is not available, so we read the whole file into the buffer
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+    {
+        isOpen = false;
+        return;
+    }
+
+    buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+    isOpen = true;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef USE_MMAP
+    if (isMapped)
+    {
+        munmap(const_cast<char*>(data), size);
+    }
+#endif // USE_MMAP
+}
+
+/*****/
+
+namespace
+{
+constexpr char Magic[8] = { 'C', 'A', 'L', 'C', '4', 'B', 'C', '\0' };
+constexpr uint32_t Version = 4;
+
+// Written in the native byte order, which allows us to detect bytecode from other platforms
+constexpr uint32_t ByteOrderMark = 0x01020304;
+
+// Each operation occupies eight bytes: the opcode, three padding bytes and the 32-bit value
+constexpr size_t OperationSize = 8;
+
+// Each entry of the source position table occupies 20 bytes: the address, the character index,
+// the line number and the column number
+constexpr size_t SourcePositionSize = 20;
+
+template<typename TNumber>
+constexpr int GetBytecodeIntegerSize()
+{
+#ifdef ENABLE_GMP
+    if constexpr (std::is_same_v<TNumber, HybridInteger>)
+    {
+        return InfinitePrecisionBytecodeIntegerSize;
+    }
+    else
+#endif // ENABLE_GMP
+    {
+        return static_cast<int>(sizeof(TNumber) * 8);
+    }
+}
+
+template<typename T>
+void WriteValue(std::ostream& out, const T& value)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void WriteString(std::ostream& out, std::string_view str)
+{
+    WriteValue(out, static_cast<uint32_t>(str.length()));
+    out.write(str.data(), str.length());
+}
+
+template<typename TNumber>
+void WriteNumber(std::ostream& out, const TNumber& value)
+{
+#ifdef ENABLE_GMP
+    if constexpr (std::is_same_v<TNumber, HybridInteger>)
+    {
+        WriteString(out, value.GetMpz().get_str(16));
+    }
+    else
+#endif // ENABLE_GMP
+    {
+        WriteValue(out, value);
+    }
+}
+
+void WriteOperations(std::ostream& out, const std::vector<StackMachineOperation>& operations)
+{
+    static constexpr char Padding[3] = {};
+
+    WriteValue(out, static_cast<uint32_t>(operations.size()));
+    for (auto& operation : operations)
+    {
+        WriteValue(out, static_cast<uint8_t>(operation.opcode));
+        out.write(Padding, sizeof(Padding));
+        WriteValue(out, static_cast<int32_t>(operation.value));
+    }
+}
+
+void WriteSourcePositions(std::ostream& out,
+                          const std::vector<StackMachineSourcePosition>& sourcePositions)
+{
+    WriteValue(out, static_cast<uint32_t>(sourcePositions.size()));
+    for (auto& entry : sourcePositions)
+    {
+        WriteValue(out, static_cast<int32_t>(entry.address));
+        WriteValue(out, static_cast<uint64_t>(entry.position.index));
+        WriteValue(out, static_cast<int32_t>(entry.position.lineNo));
+        WriteValue(out, static_cast<int32_t>(entry.position.charNo));
+    }
+}
+
+class BytecodeReader
+{
+private:
+    std::string_view bytecode;
+    size_t offset = 0;
+
+public:
+    BytecodeReader(std::string_view bytecode) : bytecode(bytecode) {}
+
+    bool Eof() const
+    {
+        return offset == bytecode.length();
+    }
+
+    std::string_view ReadBytes(size_t length)
+    {
+        if (length > bytecode.length() - offset)
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "unexpected end of file");
+        }
+
+        auto bytes = bytecode.substr(offset, length);
+        offset += length;
+        return bytes;
+    }
+
+    template<typename T>
+    T ReadValue()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        T value;
+        std::memcpy(&value, ReadBytes(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    std::string ReadString()
+    {
+        return std::string(ReadBytes(ReadValue<uint32_t>()));
+    }
+
+    template<typename TNumber>
+    TNumber ReadNumber()
+    {
+#ifdef ENABLE_GMP
+        if constexpr (std::is_same_v<TNumber, HybridInteger>)
+        {
+            mpz_class value;
+            if (value.set_str(ReadString(), 16) != 0)
+            {
+                throw Exceptions::InvalidBytecodeException(std::nullopt, "broken constant");
+            }
+
+            return value;
+        }
+        else
+#endif // ENABLE_GMP
+        {
+            return ReadValue<TNumber>();
+        }
+    }
+
+    std::vector<StackMachineOperation> ReadOperations()
+    {
+        uint32_t numOperations = ReadValue<uint32_t>();
+        if (numOperations > (bytecode.length() - offset) / OperationSize)
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "unexpected end of file");
+        }
+
+        std::vector<StackMachineOperation> operations(numOperations);
+        for (auto& operation : operations)
+        {
+            operation.opcode = static_cast<StackMachineOpcode>(ReadValue<uint8_t>());
+            ReadBytes(3);
+            operation.value = ReadValue<int32_t>();
+        }
+
+        return operations;
+    }
+
+    // The addresses must be sorted and refer to the given number of operations
+    std::vector<StackMachineSourcePosition> ReadSourcePositions(size_t numOperations)
+    {
+        uint32_t numEntries = ReadValue<uint32_t>();
+        if (numEntries > (bytecode.length() - offset) / SourcePositionSize)
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "unexpected end of file");
+        }
+
+        std::vector<StackMachineSourcePosition> sourcePositions(numEntries);
+        for (size_t i = 0; i < sourcePositions.size(); i++)
+        {
+            auto& entry = sourcePositions[i];
+            entry.address = ReadValue<int32_t>();
+            entry.position.index = static_cast<size_t>(ReadValue<uint64_t>());
+            entry.position.lineNo = ReadValue<int32_t>();
+            entry.position.charNo = ReadValue<int32_t>();
+
+            if (entry.address < 0 || static_cast<size_t>(entry.address) >= numOperations ||
+                (i > 0 && entry.address <= sourcePositions[i - 1].address))
+            {
+                throw Exceptions::InvalidBytecodeException(
+                    std::nullopt, "broken source position at " + std::to_string(i));
+            }
+        }
+
+        return sourcePositions;
+    }
+
+    void ReadHeader()
+    {
+        if (ReadBytes(sizeof(Magic)) != std::string_view(Magic, sizeof(Magic)))
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "not a bytecode file");
+        }
+
+        if (ReadValue<uint32_t>() != Version)
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "unsupported version");
+        }
+
+        if (ReadValue<uint32_t>() != ByteOrderMark)
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "unsupported byte order");
+        }
+    }
+};
+
+// Checks that the operations never refer to anything out of the module or out of the frame of
+// their operator, which takes "numOperands" operands (std::nullopt for the entry point, which has
+// no frame to return from). The depth of the stack is followed along every path of execution, so
+// that no operation pops a value which the frame does not have or pushes one beyond
+// "maxStackSize", and every jump lands on an operation.
+void ValidateOperations(const std::vector<StackMachineOperation>& operations,
+                        std::optional<int> numOperands, int maxStackSize, size_t numConstants,
+                        size_t numVariables,
+                        const std::vector<StackMachineUserDefinedOperator>& userDefinedOperators)
+{
+    auto IsInRange = [](int value, size_t size) {
+        return value >= 0 && static_cast<size_t>(value) < size;
+    };
+
+    // Arguments are addressed by their distances from the bottom of the frame, from 1 to the
+    // number of operands
+    bool isEntryPoint = !numOperands.has_value();
+    int numArguments = numOperands.value_or(0);
+    auto IsArgument = [numArguments](int value) { return value >= 1 && value <= numArguments; };
+
+    size_t numOperators = userDefinedOperators.size();
+    auto GetNumCalleeOperands = [&userDefinedOperators](int index) {
+        return userDefinedOperators[index].GetDefinition().GetNumOperands();
+    };
+
+    // Operand slots are not operations, so jumping to them is invalid
+    std::vector<bool> isOperation(operations.size(), false);
+
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        auto& operation = operations[i];
+        bool isValid;
+
+        switch (operation.opcode)
+        {
+        case StackMachineOpcode::LoadConstTable:
+            isValid = IsInRange(operation.value, numConstants);
+            break;
+        case StackMachineOpcode::LoadVariable:
+        case StackMachineOpcode::StoreVariable:
+            isValid = IsInRange(operation.value, numVariables);
+            break;
+        case StackMachineOpcode::LoadArg:
+        case StackMachineOpcode::StoreArg:
+        case StackMachineOpcode::LoadArgAddConst:
+        case StackMachineOpcode::LoadArgSubConst:
+        case StackMachineOpcode::LoadArgAddArg:
+        case StackMachineOpcode::LoadArgSubArg:
+        case StackMachineOpcode::LoadArgMultArg:
+        case StackMachineOpcode::LoadArgReturn:
+            isValid = IsArgument(operation.value);
+            break;
+        case StackMachineOpcode::Return:
+            isValid = !isEntryPoint && operation.value == numArguments;
+            break;
+        case StackMachineOpcode::Call:
+            isValid = IsInRange(operation.value, numOperators);
+            break;
+        case StackMachineOpcode::TailCall:
+            isValid = !isEntryPoint && IsInRange(operation.value, numOperators);
+            break;
+        case StackMachineOpcode::LoadMemo:
+        case StackMachineOpcode::StoreMemo:
+            // The memoization tables are looked up with the operands of the current frame
+            isValid = !isEntryPoint && IsInRange(operation.value, numOperators) &&
+                GetNumCalleeOperands(operation.value) == numArguments;
+            break;
+        case StackMachineOpcode::Operand:
+        case StackMachineOpcode::Lavel:
+            // Operand slots are skipped below
+            isValid = false;
+            break;
+        default:
+            isValid = static_cast<int>(operation.opcode) >= 0 &&
+                static_cast<int>(operation.opcode) < static_cast<int>(StackMachineOpcode::Lavel);
+            break;
+        }
+
+        if (IsJumpOpcode(operation.opcode))
+        {
+            isValid = IsInRange(operation.value, operations.size());
+        }
+
+        if (!isValid)
+        {
+            throw Exceptions::InvalidBytecodeException(
+                std::nullopt, "invalid operation at " + std::to_string(i));
+        }
+
+        size_t address = i;
+        isOperation[address] = true;
+        for (int j = 0; j < GetNumOperandSlots(operation.opcode); j++)
+        {
+            if (++i >= operations.size() || operations[i].opcode != StackMachineOpcode::Operand)
+            {
+                throw Exceptions::InvalidBytecodeException(
+                    std::nullopt, "operand is missing at " + std::to_string(i));
+            }
+        }
+
+        // The operand slots referring to the frames
+        switch (operation.opcode)
+        {
+        case StackMachineOpcode::LoadArgAddArg:
+        case StackMachineOpcode::LoadArgSubArg:
+        case StackMachineOpcode::LoadArgMultArg:
+            isValid = IsArgument(operations[address + 1].value);
+            break;
+        case StackMachineOpcode::LoadArgReturn:
+            isValid = operations[address + 1].value == numArguments;
+            break;
+        case StackMachineOpcode::TailCall:
+            isValid = operations[address + 1].value == numArguments &&
+                operations[address + 2].value == GetNumCalleeOperands(operation.value);
+            break;
+        default:
+            break;
+        }
+
+        if (!isValid)
+        {
+            throw Exceptions::InvalidBytecodeException(
+                std::nullopt, "invalid operation at " + std::to_string(address));
+        }
+    }
+
+    // The depth of the stack before each operation, which is the same on every path reaching it,
+    // or -1 if no path reaches it yet
+    std::vector<int> depths(operations.size(), -1);
+    std::vector<size_t> worklist;
+
+    auto Reach = [&](size_t address, int depth) {
+        if (address >= operations.size())
+        {
+            // Execution must not run past the end of the operations
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "missing terminator");
+        }
+
+        if (!isOperation[address])
+        {
+            throw Exceptions::InvalidBytecodeException(
+                std::nullopt, "invalid jump target " + std::to_string(address));
+        }
+
+        if (depths[address] < 0)
+        {
+            depths[address] = depth;
+            worklist.push_back(address);
+        }
+        else if (depths[address] != depth)
+        {
+            throw Exceptions::InvalidBytecodeException(
+                std::nullopt, "inconsistent stack depth at " + std::to_string(address));
+        }
+    };
+
+    Reach(0, 0);
+    while (!worklist.empty())
+    {
+        size_t address = worklist.back();
+        worklist.pop_back();
+
+        auto& operation = operations[address];
+        int numPopped = 0;
+        int numPushed = 0;
+        bool isTerminator = false;
+
+        switch (operation.opcode)
+        {
+        case StackMachineOpcode::Push:
+        case StackMachineOpcode::LoadConst:
+        case StackMachineOpcode::LoadConstTable:
+        case StackMachineOpcode::LoadArg:
+        case StackMachineOpcode::LoadVariable:
+        case StackMachineOpcode::Input:
+        case StackMachineOpcode::LoadArgAddConst:
+        case StackMachineOpcode::LoadArgSubConst:
+        case StackMachineOpcode::LoadArgAddArg:
+        case StackMachineOpcode::LoadArgSubArg:
+        case StackMachineOpcode::LoadArgMultArg:
+            numPushed = 1;
+            break;
+        case StackMachineOpcode::Pop:
+        case StackMachineOpcode::StoreArg:
+        case StackMachineOpcode::GotoIfTrue:
+        case StackMachineOpcode::GotoIfFalse:
+        case StackMachineOpcode::GotoIfEqualConst:
+        case StackMachineOpcode::GotoIfNotEqualConst:
+        case StackMachineOpcode::GotoIfLessThanConst:
+        case StackMachineOpcode::GotoIfLessThanOrEqualConst:
+        case StackMachineOpcode::GotoIfGreaterThanConst:
+        case StackMachineOpcode::GotoIfGreaterThanOrEqualConst:
+            numPopped = 1;
+            break;
+        case StackMachineOpcode::StoreVariable:
+        case StackMachineOpcode::LoadArrayElement:
+        case StackMachineOpcode::PrintChar:
+        case StackMachineOpcode::AddConst:
+        case StackMachineOpcode::SubConst:
+        case StackMachineOpcode::StoreMemo:
+            numPopped = 1;
+            numPushed = 1;
+            break;
+        case StackMachineOpcode::StoreArrayElement:
+        case StackMachineOpcode::Add:
+        case StackMachineOpcode::Sub:
+        case StackMachineOpcode::Mult:
+        case StackMachineOpcode::Div:
+        case StackMachineOpcode::DivChecked:
+        case StackMachineOpcode::Mod:
+        case StackMachineOpcode::ModChecked:
+            numPopped = 2;
+            numPushed = 1;
+            break;
+        case StackMachineOpcode::GotoIfEqual:
+        case StackMachineOpcode::GotoIfNotEqual:
+        case StackMachineOpcode::GotoIfLessThan:
+        case StackMachineOpcode::GotoIfLessThanOrEqual:
+        case StackMachineOpcode::GotoIfGreaterThan:
+        case StackMachineOpcode::GotoIfGreaterThanOrEqual:
+            numPopped = 2;
+            break;
+        case StackMachineOpcode::Call:
+        case StackMachineOpcode::TailCall:
+            // The operations following TailCall return the result when it is not replaced with a
+            // jump
+            numPopped = GetNumCalleeOperands(operation.value);
+            numPushed = 1;
+            break;
+        case StackMachineOpcode::Return:
+        case StackMachineOpcode::Halt:
+            numPopped = 1;
+            isTerminator = true;
+            break;
+        case StackMachineOpcode::LoadArgReturn:
+            isTerminator = true;
+            break;
+        default:
+            // Goto and LoadMemo
+            break;
+        }
+
+        int depth = depths[address];
+        if (depth < numPopped || depth - numPopped + numPushed > maxStackSize)
+        {
+            throw Exceptions::InvalidBytecodeException(
+                std::nullopt, "stack size exceeded at " + std::to_string(address));
+        }
+
+        depth += numPushed - numPopped;
+        if (IsJumpOpcode(operation.opcode))
+        {
+            Reach(operation.value, depth);
+        }
+
+        if (!isTerminator && operation.opcode != StackMachineOpcode::Goto)
+        {
+            Reach(address + 1 + GetNumOperandSlots(operation.opcode), depth);
+        }
+    }
+}
+}
+
+template<typename TNumber>
+void WriteStackMachineBytecode(const StackMachineModule<TNumber>& module, std::ostream& out)
+{
+    // Header
+    out.write(Magic, sizeof(Magic));
+    WriteValue(out, Version);
+    WriteValue(out, ByteOrderMark);
+    WriteValue(out, static_cast<int32_t>(GetBytecodeIntegerSize<TNumber>()));
+
+    // Const table
+    auto& constTable = module.GetConstTable();
+    WriteValue(out, static_cast<uint32_t>(constTable.size()));
+    for (auto& value : constTable)
+    {
+        WriteNumber(out, value);
+    }
+
+    // Variables
+    auto& variables = module.GetVariables();
+    WriteValue(out, static_cast<uint32_t>(variables.size()));
+    for (auto& variable : variables)
+    {
+        WriteString(out, variable);
+    }
+
+    // Entry point
+    WriteValue(out, static_cast<int32_t>(module.GetEntryPointMaxStackSize()));
+    WriteOperations(out, module.GetEntryPoint());
+    WriteSourcePositions(out, module.GetEntryPointSourcePositions());
+
+    // User-defined operators
+    auto& userDefinedOperators = module.GetUserDefinedOperators();
+    WriteValue(out, static_cast<uint32_t>(userDefinedOperators.size()));
+    for (auto& userDefined : userDefinedOperators)
+    {
+        WriteString(out, userDefined.GetDefinition().GetName());
+        WriteValue(out, static_cast<int32_t>(userDefined.GetDefinition().GetNumOperands()));
+        WriteValue(out, static_cast<int32_t>(userDefined.GetMaxStackSize()));
+        WriteOperations(out, userDefined.GetOperations());
+        WriteSourcePositions(out, userDefined.GetSourcePositions());
+    }
+}
+
+template<typename TNumber>
+StackMachineModule<TNumber> ReadStackMachineBytecode(std::string_view bytecode)
+{
+    BytecodeReader reader(bytecode);
+
+    // Header
+    reader.ReadHeader();
+    if (reader.ReadValue<int32_t>() != GetBytecodeIntegerSize<TNumber>())
+    {
+        throw Exceptions::InvalidBytecodeException(std::nullopt, "integer size mismatch");
+    }
+
+    // Const table
+    std::vector<TNumber> constTable;
+    for (uint32_t i = 0, numConstants = reader.ReadValue<uint32_t>(); i < numConstants; i++)
+    {
+        constTable.push_back(reader.ReadNumber<TNumber>());
+    }
+
+    // Variables
+    std::vector<std::string> variables;
+    for (uint32_t i = 0, numVariables = reader.ReadValue<uint32_t>(); i < numVariables; i++)
+    {
+        variables.push_back(reader.ReadString());
+    }
+
+    // Entry point
+    int entryPointMaxStackSize = reader.ReadValue<int32_t>();
+    auto entryPoint = reader.ReadOperations();
+    auto entryPointSourcePositions = reader.ReadSourcePositions(entryPoint.size());
+
+    // User-defined operators
+    std::vector<StackMachineUserDefinedOperator> userDefinedOperators;
+    for (uint32_t i = 0, numOperators = reader.ReadValue<uint32_t>(); i < numOperators; i++)
+    {
+        auto name = reader.ReadString();
+        int numOperands = reader.ReadValue<int32_t>();
+        int maxStackSize = reader.ReadValue<int32_t>();
+        auto operations = reader.ReadOperations();
+        auto sourcePositions = reader.ReadSourcePositions(operations.size());
+        userDefinedOperators.emplace_back(OperatorDefinition(name, numOperands), operations,
+                                          maxStackSize, sourcePositions);
+    }
+
+    if (!reader.Eof())
+    {
+        throw Exceptions::InvalidBytecodeException(std::nullopt, "trailing data");
+    }
+
+    // The arities of all the operators are checked first, since tail calls refer to them
+    for (auto& userDefined : userDefinedOperators)
+    {
+        if (userDefined.GetDefinition().GetNumOperands() < 0 || userDefined.GetMaxStackSize() < 0)
+        {
+            throw Exceptions::InvalidBytecodeException(std::nullopt, "broken operator");
+        }
+    }
+
+    ValidateOperations(entryPoint, std::nullopt, entryPointMaxStackSize, constTable.size(),
+                       variables.size(), userDefinedOperators);
+    for (auto& userDefined : userDefinedOperators)
+    {
+        ValidateOperations(userDefined.GetOperations(),
+                           userDefined.GetDefinition().GetNumOperands(),
+                           userDefined.GetMaxStackSize(), constTable.size(), variables.size(),
+                           userDefinedOperators);
+    }
+
+    return StackMachineModule<TNumber>(entryPoint, entryPointMaxStackSize, constTable,
+                                       userDefinedOperators, variables, entryPointSourcePositions);
+}
+
+int GetStackMachineBytecodeIntegerSize(std::string_view bytecode)
+{
+    BytecodeReader reader(bytecode);
+    reader.ReadHeader();
+    return reader.ReadValue<int32_t>();
+}
+}
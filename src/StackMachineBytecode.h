@@ -0,0 +1,67 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include "StackMachine.h"
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace calc4
+{
+// Integer size recorded in bytecode files for infinite-precision integers
+inline constexpr int InfinitePrecisionBytecodeIntegerSize = 0;
+
+// Read-only view of the whole content of a file. The file is memory-mapped where it is
+// supported, so that large bytecode files can be loaded without copying them.
+class MappedFile
+{
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    bool isOpen = false;
+    bool isMapped = false;
+    std::vector<char> buffer;
+
+public:
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool IsOpen() const
+    {
+        return isOpen;
+    }
+
+    std::string_view GetContent() const
+    {
+        return std::string_view(data, size);
+    }
+};
+
+// Writes the given module in the bytecode format, which consists of a header, the const table,
+// the variable names, the entry point and the user-defined operators. Operations are stored in
+// the same eight-byte layout as StackMachineOperation, and each sequence of operations is
+// followed by its source position table.
+template<typename TNumber>
+void WriteStackMachineBytecode(const StackMachineModule<TNumber>& module, std::ostream& out);
+
+// Reads a module from the given bytecode. The integer size of the bytecode must match TNumber.
+// Throws InvalidBytecodeException if the bytecode is broken.
+template<typename TNumber>
+StackMachineModule<TNumber> ReadStackMachineBytecode(std::string_view bytecode);
+
+// Returns the integer size recorded in the header of the given bytecode, which is 32, 64, 128 or
+// InfinitePrecisionBytecodeIntegerSize. Throws InvalidBytecodeException if the header is broken.
+int GetStackMachineBytecodeIntegerSize(std::string_view bytecode);
+}
@@ -38,16 +38,17 @@ private:
     int lineNo;
     int charNo;
     size_t originalIndex;
+    int sourceId;
 
 public:
-    StringReader(std::string_view text)
-        : text(text), index(0), lineNo(0), charNo(0), originalIndex(0)
+    StringReader(std::string_view text, int sourceId)
+        : text(text), index(0), lineNo(0), charNo(0), originalIndex(0), sourceId(sourceId)
     {
     }
 
     StringReader(std::string_view text, const CharPosition& originalPosition)
         : text(text), index(0), lineNo(originalPosition.lineNo), charNo(originalPosition.charNo),
-          originalIndex(originalPosition.index)
+          originalIndex(originalPosition.index), sourceId(originalPosition.sourceId)
     {
     }
 
@@ -131,7 +132,7 @@ public:
 
     CharPosition GetCurrentPosition() const
     {
-        return { originalIndex + index, lineNo, charNo };
+        return { originalIndex + index, lineNo, charNo, sourceId };
     }
 };
 
@@ -205,19 +206,21 @@ std::optional<DefinitionTextParts> SplitDefinitionText(StringReader& reader)
 class LexerImplement
 {
 public:
+    std::shared_ptr<const SourceText> source;
     StringReader reader;
     CompilationContext& context;
     const std::vector<std::string>& arguments;
 
     LexerImplement(std::string_view text, CompilationContext& context,
                    const std::vector<std::string>& arguments)
-        : reader(text), context(context), arguments(arguments)
+        : source(context.AddSource(text)), reader(text, source->id), context(context),
+          arguments(arguments)
     {
     }
 
-    LexerImplement(const StringReader& reader, CompilationContext& context,
-                   const std::vector<std::string>& arguments)
-        : reader(reader), context(context), arguments(arguments)
+    LexerImplement(const std::shared_ptr<const SourceText>& source, const StringReader& reader,
+                   CompilationContext& context, const std::vector<std::string>& arguments)
+        : source(source), reader(reader), context(context), arguments(arguments)
     {
     }
 
@@ -344,11 +347,11 @@ public:
 
         /* ***** Lex internal text ***** */
         StringReader internalTextReader(splitted->body.first, splitted->body.second);
-        auto tokens = LexerImplement(internalTextReader, context, arguments).Lex();
+        auto tokens = LexerImplement(source, internalTextReader, context, arguments).Lex();
 
         /* ***** Construct token ***** */
         return std::make_shared<DefineToken>(position, std::string(name.first), arguments, tokens,
-                                             std::move(supplementaryText));
+                                             source, std::move(supplementaryText));
     }
 
     std::shared_ptr<LoadVariableToken> LexLoadVariableToken()
@@ -429,7 +432,7 @@ public:
         reader.Read();
 
         /* ***** Lex internal text ***** */
-        LexerImplement implement(reader, context, arguments);
+        LexerImplement implement(source, reader, context, arguments);
         auto tokens = implement.Lex();
         reader = implement.reader;
 
@@ -745,7 +748,8 @@ void GenerateUserDefinedCodes(const std::vector<std::shared_ptr<Token>>& tokens,
         {
             auto op = ParseCore(define->GetTokens(), context);
             OperatorImplement implement(
-                context.GetOperatorImplement(define->GetName()).GetDefinition(), op);
+                context.GetOperatorImplement(define->GetName()).GetDefinition(), op,
+                define->GetSource());
             context.AddOperatorImplement(implement);
         }
     }
@@ -103,14 +103,16 @@ private:
     std::string name;
     std::vector<std::string> arguments;
     std::vector<std::shared_ptr<Token>> tokens;
+    std::shared_ptr<const SourceText> source;
     std::string supplementaryText;
 
 public:
     DefineToken(const CharPosition& position, const std::string& name,
                 const std::vector<std::string>& arguments,
                 const std::vector<std::shared_ptr<Token>>& tokens,
+                const std::shared_ptr<const SourceText>& source,
                 const std::string& supplementaryText)
-        : Token(position), name(name), arguments(arguments), tokens(tokens),
+        : Token(position), name(name), arguments(arguments), tokens(tokens), source(source),
           supplementaryText(supplementaryText)
     {
     }
@@ -130,6 +132,12 @@ public:
         return tokens;
     }
 
+    // Returns the source in which the operator is defined
+    const std::shared_ptr<const SourceText>& GetSource() const
+    {
+        return source;
+    }
+
     virtual std::shared_ptr<const Operator> CreateOperator(
         const std::vector<std::shared_ptr<const Operator>>& operands,
         CompilationContext& context) const override
@@ -341,7 +349,7 @@ public:
         const std::vector<std::shared_ptr<const Operator>>& operands,
         CompilationContext& context) const override
     {
-        return BinaryOperator::Create(operands[0], operands[1], type);
+        return BinaryOperator::Create(operands[0], operands[1], type, GetPosition());
     }
 
     MAKE_GET_SUPPLEMENTARY_TEXT;
@@ -414,7 +422,7 @@ public:
         const std::vector<std::shared_ptr<const Operator>>& operands,
         CompilationContext& context) const override
     {
-        return UserDefinedOperator::Create(definition, operands);
+        return UserDefinedOperator::Create(definition, operands, std::nullopt, GetPosition());
     }
 
     MAKE_GET_SUPPLEMENTARY_TEXT;
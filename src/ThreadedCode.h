@@ -0,0 +1,54 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace calc4
+{
+// Cache of the threaded codes of a module, whose opcodes are replaced with the addresses of their
+// handlers for the computed goto dispatchers. "TThreadedOperation::Create" converts each operation
+// given the address of its handler.
+template<typename TOperation, typename TThreadedOperation>
+class ThreadedCodeCache
+{
+private:
+    std::mutex mutex;
+
+    // Threaded codes are cached for each dispatch table, because each instantiation of the
+    // executor has its own handler addresses
+    std::unordered_map<const void* const*, std::vector<TThreadedOperation>> codes;
+
+public:
+    const TThreadedOperation* GetOrCreate(const void* const* dispatchTable,
+                                          const std::vector<TOperation>& operations)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = codes.find(dispatchTable);
+        if (it == codes.end())
+        {
+            std::vector<TThreadedOperation> code;
+            code.reserve(operations.size());
+            for (auto& operation : operations)
+            {
+                code.push_back(TThreadedOperation::Create(
+                    dispatchTable[static_cast<size_t>(operation.opcode)], operation));
+            }
+
+            it = codes.emplace(dispatchTable, std::move(code)).first;
+        }
+
+        return it->second.data();
+    }
+};
+}
@@ -8,6 +8,7 @@
  *****/
 
 #include "WasmTextEmitter.h"
+#include "CallGraph.h"
 #include "Operators.h"
 
 #include <algorithm>
@@ -1359,9 +1360,14 @@ ModuleDef LowerModuleToIR(const std::shared_ptr<const Operator>& mainOp,
     std::vector<OperatorInformation> infos;
     infos.emplace_back(OperatorDefinition("main", 0), mainOp, true);
 
+    // Operators which the main function cannot call are not emitted
+    auto reachableOperators = CallGraph(context).GetReachableOperators(mainOp);
     for (auto it = context.UserDefinedOperatorBegin(); it != context.UserDefinedOperatorEnd(); it++)
     {
-        infos.emplace_back(it->second.GetDefinition(), it->second.GetOperator(), false);
+        if (reachableOperators.count(it->first) > 0)
+        {
+            infos.emplace_back(it->second.GetDefinition(), it->second.GetOperator(), false);
+        }
     }
 
     // stable output
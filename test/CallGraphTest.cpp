@@ -0,0 +1,98 @@
+/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "CallGraph.h"
+#include "TestCommon.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Assert mutually recursive operators form a component which comes after its callees
+TEST(CallGraphTest, ComponentTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[leaf|x|x+1] D[odd|n|0] D[even|n|n==0?1?(n-1){odd}] "
+                      "D[odd|n|n==0?0?(n-1){even}{leaf}] D[self|n|n{self}] "
+                      "D[top|n|n{odd}+n{self}] 0",
+                      context);
+    Parse(tokens, context);
+    CallGraph callGraph(context);
+
+    ASSERT_FALSE(callGraph.IsRecursive("leaf"));
+    ASSERT_TRUE(callGraph.IsRecursive("even"));
+    ASSERT_TRUE(callGraph.IsRecursive("odd"));
+    ASSERT_TRUE(callGraph.IsRecursive("self"));
+    ASSERT_FALSE(callGraph.IsRecursive("top"));
+
+    auto components = callGraph.GetStronglyConnectedComponents();
+    ASSERT_EQ(4u, components.size());
+
+    auto Find = [&components](const std::string& name) {
+        return std::find_if(components.begin(), components.end(), [&name](auto& component) {
+            return std::find(component.begin(), component.end(), name) != component.end();
+        });
+    };
+    ASSERT_EQ(Find("even"), Find("odd"));
+    ASSERT_LT(Find("leaf"), Find("odd"));
+    ASSERT_LT(Find("odd"), Find("top"));
+    ASSERT_LT(Find("self"), Find("top"));
+    ASSERT_EQ((std::vector<std::string>{ "even", "leaf" }), callGraph.GetCallees("odd"));
+}
+
+// Assert the operators calling impure ones directly or indirectly are impure
+TEST(CallGraphTest, PurityTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[get|x|L[v]] D[put|x|x->0] D[print|x|x P] D[pure|x|x*2] D[b|x|x] "
+                      "D[a|x|x{b}{pure}] D[b|x|x{a}{get}] D[c|x|x{c}{pure}] 0",
+                      context);
+    Parse(tokens, context);
+    CallGraph callGraph(context);
+
+    ASSERT_EQ((std::unordered_set<std::string>{ "pure", "c" }), callGraph.GetPureOperators());
+    ASSERT_FALSE(callGraph.IsPure("a"));
+    ASSERT_FALSE(callGraph.IsPure("undefined"));
+}
+
+// Assert the reachability is computed in linear time even if the number of paths is exponential
+TEST(CallGraphTest, ReachabilityTest)
+{
+    using namespace calc4;
+
+    const int NumOperators = 64;
+    std::string source = "D[f0|x|x]";
+    for (int i = 1; i < NumOperators; i++)
+    {
+        auto callee = "f" + std::to_string(i - 1);
+        source += " D[f" + std::to_string(i) + "|x|x{" + callee + "}+x{" + callee + "}]";
+    }
+    source += " D[g|x|x{g}] 0";
+
+    CompilationContext context;
+    auto tokens = Lex(source, context);
+    Parse(tokens, context);
+    CallGraph callGraph(context);
+
+    tokens = Lex("1{f" + std::to_string(NumOperators - 1) + "}", context);
+    auto op = Parse(tokens, context);
+    ASSERT_EQ(static_cast<size_t>(NumOperators), callGraph.GetReachableOperators(op).size());
+    ASSERT_FALSE(callGraph.HasRecursiveCall(op));
+
+    tokens = Lex("1{f3}+1{g}", context);
+    op = Parse(tokens, context);
+    ASSERT_EQ((std::unordered_set<std::string>{ "f0", "f1", "f2", "f3", "g" }),
+              callGraph.GetReachableOperators(op));
+    ASSERT_TRUE(callGraph.HasRecursiveCall(op));
+}
@@ -46,7 +46,8 @@ ErrorTestCaseBase ErrorTestCaseBases[] = {
     { "", "", CreateValidator<CodeIsEmptyException>(), EnableAllConfigurations() },
     { "D[x||{x}] {x}", "", CreateValidator<StackOverflowException>(),
       [](IntegerType, ExecutorType executor, bool optimize, bool) {
-          return !optimize && executor == ExecutorType::StackMachine;
+          return !optimize && (executor == ExecutorType::StackMachine ||
+                               executor == ExecutorType::RegisterMachine);
       } },
 #ifndef _MSC_VER
     { "1/0", "", CreateValidator<ZeroDivisionException>(),
@@ -57,6 +58,14 @@ ErrorTestCaseBase ErrorTestCaseBases[] = {
       [](IntegerType, ExecutorType executor, bool, bool checkZeroDivision) {
           return checkZeroDivision;
       } },
+    { "D[first|x, y|x] 1{first}(1/0)", "", CreateValidator<ZeroDivisionException>(),
+      [](IntegerType, ExecutorType executor, bool, bool checkZeroDivision) {
+          return checkZeroDivision;
+      } },
+    { "D[inv|x|100/x] 0{inv}", "", CreateValidator<ZeroDivisionException>(),
+      [](IntegerType, ExecutorType executor, bool, bool checkZeroDivision) {
+          return checkZeroDivision;
+      } },
     { "1/L", "", CreateValidator<ZeroDivisionException>(),
       [](IntegerType, ExecutorType executor, bool, bool checkZeroDivision) {
           return checkZeroDivision;
@@ -97,6 +106,14 @@ ErrorTestCaseBase ErrorTestCaseBases[] = {
       [](IntegerType, ExecutorType executor, bool, bool checkZeroDivision) {
           return checkZeroDivision;
       } },
+    { "D[inv|x|x>=0?100/x?0] 0{inv}", "", CreateValidator<ZeroDivisionException>(),
+      [](IntegerType, ExecutorType executor, bool, bool checkZeroDivision) {
+          return checkZeroDivision;
+      } },
+    { "D[inv|x|x!=0?100/(x*x)?0] 4294967296{inv}", "", CreateValidator<ZeroDivisionException>(),
+      [](IntegerType integerType, ExecutorType executor, bool, bool checkZeroDivision) {
+          return integerType == IntegerType::Int64 && checkZeroDivision;
+      } },
 #endif // !_MSC_VER
     // clang-format on
 };
@@ -117,7 +134,7 @@ void OperateOneErrorTest(const ErrorTestCase& test)
     try
     {
         Execute<TNumber>(test.input, test.standardInput, test.optimize, test.checkZeroDivision,
-                         test.executorType);
+                         test.executorType, test.memoize);
         FAIL();
     }
     catch (Calc4Exception& e)
@@ -154,7 +171,7 @@ TEST_P(ErrorTest, ErrorTest)
 
 #ifdef ENABLE_GMP
     case IntegerType::GMP:
-        OperateOneErrorTest<mpz_class>(test);
+        OperateOneErrorTest<calc4::HybridInteger>(test);
         break;
 #endif // ENABLE_GMP
 
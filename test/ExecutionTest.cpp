@@ -57,7 +57,8 @@ template<typename TNumber>
 void OperateOneExecutionTest(const ExecutionTestCase& test)
 {
     auto [result, variables, memory, consoleOutput] = Execute<TNumber>(
-        test.input, test.standardInput, test.optimize, test.checkZeroDivision, test.executorType);
+        test.input, test.standardInput, test.optimize, test.checkZeroDivision, test.executorType,
+        test.memoize);
 
     const char* expectedConsoleOutput =
         test.expectedConsoleOutput != nullptr ? test.expectedConsoleOutput : "";
@@ -106,7 +107,7 @@ TEST_P(ExecutionTest, ExecutionTest)
 
 #ifdef ENABLE_GMP
     case IntegerType::GMP:
-        OperateOneExecutionTest<mpz_class>(test);
+        OperateOneExecutionTest<calc4::HybridInteger>(test);
         break;
 #endif // ENABLE_GMP
 
@@ -137,6 +137,19 @@ ExecutionTestCaseBase ExecutionTestCaseBases[] = {
     // Fast-path / fallback boundary (mix linear memory + sparse fallback)
     { "(1->131071)(2->131072)(131071@+131072@)", "", 3, nullptr, {}, { { 131071, 1 }, { 131072, 2 } } },
     { "(1->0)(2->(0-1))(0@+(0-1)@)", "", 3, nullptr, {}, { { 0, 1 }, { -1, 2 } } },
+
+    // Inlining must keep evaluating each operand once and in order
+    { "D[myadd|x, y|x + y] 1{myadd}2", "", 3 },
+    { "D[inc|x|x+1] D[inc2|x|x{inc}{inc}] 5{inc2}", "", 7 },
+    { "D[sub|x, y|y-x] (65P+1){sub}(66P+2)", "", 1, "AB" },
+    { "D[sel|c, x|c?x?0] 0{sel}(65P)", "", 0, "A" },
+    { "D[first|x, y|x] 1{first}(65P)", "", 1, "A" },
+    { "D[dbl|x|x+x] (65P+3){dbl}", "", 6, "A" },
+    { "D[f|x|L[v]*10+x] (2S[v]){f}", "", 22, nullptr, { { "v", 2 } } },
+
+    // Calls evaluated at compile time
+    { "D[fact|n|n<=1?1?n*(n-1){fact}] 10{fact}", "", 3628800 },
+    { "D[sum|n|n==0?0?n+(n-1){sum}] 3000{sum}", "", 4501500 },
     // clang-format on
 };
 }
@@ -0,0 +1,84 @@
+﻿/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#ifdef ENABLE_GMP
+
+#include "HybridInteger.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+
+namespace
+{
+std::string ToString(const calc4::HybridInteger& value)
+{
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+}
+
+// Assert arithmetic operations agree with mpz_class around the boundaries of int64_t
+TEST(HybridIntegerTest, ArithmeticTest)
+{
+    using namespace calc4;
+
+    constexpr int64_t Max = std::numeric_limits<int64_t>::max();
+    constexpr int64_t Min = std::numeric_limits<int64_t>::min();
+    const mpz_class values[] = {
+        0, 1, -1, 2, -2, 7, -7, Max, Max - 1, Min, Min + 1, mpz_class(Max) * 3, mpz_class(Min) * 5,
+    };
+
+    for (auto& a : values)
+    {
+        ASSERT_EQ(mpz_class(-a).get_str(), ToString(-HybridInteger(a))) << a;
+
+        for (auto& b : values)
+        {
+            HybridInteger x(a), y(b);
+            ASSERT_EQ(mpz_class(a + b).get_str(), ToString(x + y)) << a << " + " << b;
+            ASSERT_EQ(mpz_class(a - b).get_str(), ToString(x - y)) << a << " - " << b;
+            ASSERT_EQ(mpz_class(a * b).get_str(), ToString(x * y)) << a << " * " << b;
+            ASSERT_EQ(a == b, x == y) << a << " == " << b;
+            ASSERT_EQ(a < b, x < y) << a << " < " << b;
+
+            if (b != 0)
+            {
+                ASSERT_EQ(mpz_class(a / b).get_str(), ToString(x / y)) << a << " / " << b;
+                ASSERT_EQ(mpz_class(a % b).get_str(), ToString(x % y)) << a << " % " << b;
+            }
+        }
+    }
+}
+
+// Assert values are promoted on overflow and demoted again when they fit in int64_t
+TEST(HybridIntegerTest, NormalizationTest)
+{
+    using namespace calc4;
+
+    HybridInteger value = std::numeric_limits<int64_t>::max();
+    ASSERT_TRUE(value.FitsInt64());
+
+    value += 1;
+    ASSERT_FALSE(value.FitsInt64());
+    ASSERT_EQ("9223372036854775808", ToString(value));
+
+    value -= 2;
+    ASSERT_TRUE(value.FitsInt64());
+    ASSERT_EQ(std::numeric_limits<int64_t>::max() - 1, value.GetInt64());
+
+    HybridInteger copied = value * value;
+    ASSERT_FALSE(copied.FitsInt64());
+    ASSERT_EQ(copied / value, value);
+    ASSERT_TRUE((copied / value).FitsInt64());
+}
+
+#endif // ENABLE_GMP
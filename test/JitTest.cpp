@@ -0,0 +1,196 @@
+/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#ifdef ENABLE_JIT
+
+#include "TestCommon.h"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+
+// Assert a session compiles only the operators which have been defined or redefined, and the
+// callers of them, since the previous execution
+TEST(JitTest, SessionTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    ExecutionState<int64_t> state;
+    JITSession<int64_t> session;
+
+    auto Execute = [&](const char* source) {
+        auto tokens = Lex(source, context);
+        auto op = Optimize<int64_t>(context, Parse(tokens, context));
+        return EvaluateByJIT<int64_t>(context, state, op, { true, true }, &session);
+    };
+
+    // The operands are given by a variable, so that the calls are not precomputed
+    state.GetVariableSource().Set("", 10);
+    ASSERT_EQ(55, Execute("D[t|x|x<=0?0?x+(x-1){t}] D[u|x|x<=0?0?(x-1){u}+x{t}] L{t}"));
+    ASSERT_EQ(1u, session.GetNumGeneratedOperators());
+
+    // "t" is reused, and "u" is compiled for the first time
+    ASSERT_EQ(220, Execute("L{u}"));
+    ASSERT_EQ(2u, session.GetNumGeneratedOperators());
+    ASSERT_EQ(220, Execute("L{u}"));
+    ASSERT_EQ(2u, session.GetNumGeneratedOperators());
+
+    // Redefining "t" compiles "u" again, which has been linked to the old "t"
+    ASSERT_EQ(55, Execute("D[t|x|x<=0?0?1+(x-1){t}] L{u}"));
+    ASSERT_EQ(4u, session.GetNumGeneratedOperators());
+
+    // The callers which are not reachable at the redefinition are compiled again when they are
+    ASSERT_EQ(0, Execute("D[k|x|x<=0?0?(x-1){k}+x{u}] 0"));
+    ASSERT_EQ(4u, session.GetNumGeneratedOperators());
+    ASSERT_EQ(20, Execute("D[t|x|x<=0?0?2+(x-1){t}] L{t}"));
+    ASSERT_EQ(5u, session.GetNumGeneratedOperators());
+    ASSERT_EQ(440, Execute("L{k}"));
+    ASSERT_EQ(7u, session.GetNumGeneratedOperators());
+
+    // Errors do not break the session
+    ASSERT_THROW(Execute("D[inv|x|100/x] 0{inv}"), Exceptions::ZeroDivisionException);
+    ASSERT_EQ(440, Execute("L{k}"));
+    ASSERT_EQ(7u, session.GetNumGeneratedOperators());
+
+    // Changing the options discards the compiled code
+    auto op = Optimize<int64_t>(context, Parse(Lex("L{u}", context), context));
+    ASSERT_EQ(110, EvaluateByJIT<int64_t>(context, state, op, { true, false }, &session));
+    ASSERT_EQ(2u, session.GetNumGeneratedOperators());
+}
+
+// Assert the variables are kept consistent between the state and the code compiled before
+TEST(JitTest, SessionVariableTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    ExecutionState<int64_t> state;
+    JITSession<int64_t> session;
+
+    auto Execute = [&](const char* source) {
+        auto tokens = Lex(source, context);
+        auto op = Optimize<int64_t>(context, Parse(tokens, context));
+        return EvaluateByJIT<int64_t>(context, state, op, { true, true }, &session);
+    };
+
+    ASSERT_EQ(3, Execute("D[get|n|n<=0?L[v]?(n-1){get}] D[set|x|x<=0?0?xS[w]] 3S[v]"));
+    ASSERT_EQ(3, Execute("5{get}"));
+
+    state.GetVariableSource().Set("v", 7);
+    ASSERT_EQ(7, Execute("5{get}"));
+
+    ASSERT_EQ(4, Execute("4{set}"));
+    ASSERT_EQ(4, state.GetVariableSource().Get("w"));
+    ASSERT_EQ(11, Execute("5{get}+L[w]"));
+
+    // The code accesses the slots of the state given to each execution, and the values stored
+    // before an error are kept
+    ExecutionState<int64_t> another;
+    another.GetVariableSource().Set("v", 9);
+    auto op = Optimize<int64_t>(context, Parse(Lex("5{get}", context), context));
+    ASSERT_EQ(9, EvaluateByJIT<int64_t>(context, another, op, { true, true }, &session));
+
+    ASSERT_THROW(Execute("D[inv|x|100/x] (6S[w])+(L[z]{inv})"), Exceptions::ZeroDivisionException);
+    ASSERT_EQ(6, state.GetVariableSource().Get("w"));
+    ASSERT_EQ(7, Execute("5{get}"));
+}
+
+// Assert the indices in the dense region of the global array and the others access the same array
+// as TGlobalArraySource does
+TEST(JitTest, ArrayTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    ExecutionState<int64_t> state;
+
+    auto Execute = [&](const char* source) {
+        auto tokens = Lex(source, context);
+        auto op = Optimize<int64_t>(context, Parse(tokens, context));
+        return EvaluateByJIT<int64_t>(context, state, op, { true, true });
+    };
+
+    ASSERT_EQ(5, Execute("D[set|i, v|v->i] ((0-1){set}1)(0{set}2)(1023{set}3)(1024{set}4)"
+                         "(5->100000)"));
+    ASSERT_EQ(1, state.GetArraySource().Get(-1));
+    ASSERT_EQ(2, state.GetArraySource().Get(0));
+    ASSERT_EQ(3, state.GetArraySource().Get(1023));
+    ASSERT_EQ(4, state.GetArraySource().Get(1024));
+    ASSERT_EQ(5, state.GetArraySource().Get(100000));
+
+    state.GetArraySource().Set(1023, 30);
+    state.GetArraySource().Set(1024, 40);
+    ASSERT_EQ(78, Execute("D[get|i|i@] ((0-1){get})+(0{get})+(1023{get})+(1024@)+(100000@)"));
+
+#ifdef ENABLE_INT128
+    // 128-bit indices are truncated to 64 bits
+    ExecutionState<__int128_t> state128;
+    auto tokens = Lex("(7->(18446744073709551616+1023))((18446744073709551616+1022)@)", context);
+    auto op = Optimize<__int128_t>(context, Parse(tokens, context));
+    state128.GetArraySource().Set(1022, 6);
+    ASSERT_EQ(6, EvaluateByJIT<__int128_t>(context, state128, op, { true, true }));
+    ASSERT_EQ(7, state128.GetArraySource().Get(1023));
+#endif // ENABLE_INT128
+}
+
+// Assert new sessions load the code which the previous ones have stored in the cache instead of
+// compiling the operators again
+TEST(JitTest, ObjectCacheTest)
+{
+    using namespace calc4;
+
+    auto seed = ::testing::UnitTest::GetInstance()->random_seed();
+    auto directory =
+        std::filesystem::temp_directory_path() / ("calc4-jit-cache-test-" + std::to_string(seed));
+    std::filesystem::remove_all(directory);
+
+    auto Execute = [&](JITSession<int64_t>& session, const char* source, bool memoize) {
+        CompilationContext context;
+        ExecutionState<int64_t> state;
+        state.GetVariableSource().Set("", 10);
+
+        auto tokens = Lex(source, context);
+        auto op = Optimize<int64_t>(context, Parse(tokens, context));
+        return EvaluateByJIT<int64_t>(context, state, op,
+                                      { true, true, false, nullptr, memoize, directory.string() },
+                                      &session);
+    };
+
+    const char* source = "D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] D[f|x|x{fib}*2] L{f}+L[]{fib}";
+    for (bool memoize : { false, true })
+    {
+        JITSession<int64_t> first;
+        ASSERT_EQ(165, Execute(first, source, memoize));
+        ASSERT_EQ(2u, first.GetNumGeneratedOperators());
+
+        JITSession<int64_t> second;
+        ASSERT_EQ(165, Execute(second, source, memoize));
+        ASSERT_EQ(0u, second.GetNumGeneratedOperators());
+    }
+
+    // Redefined operators are compiled again, while the callers of them reuse the code, which
+    // refers to the callees by their symbols
+    JITSession<int64_t> session;
+    ASSERT_EQ(1536, Execute(session, "D[fib|n|n<=1?n?(n-1){fib}*2] D[f|x|x{fib}*2] L{f}+L[]{fib}",
+                            false));
+    ASSERT_EQ(1u, session.GetNumGeneratedOperators());
+
+    // Operators of the same body but of different numbers of operands do not share the code
+    JITSession<int64_t> unary;
+    ASSERT_EQ(0, Execute(unary, "D[h|x|0] D[g|x|x{h}] D[h|x|x<=0?x?(x-1){g}] L{g}", false));
+    ASSERT_EQ(2u, unary.GetNumGeneratedOperators());
+
+    JITSession<int64_t> binary;
+    ASSERT_EQ(0, Execute(binary, "D[h|x|0] D[g|x,y|x{h}] D[h|x|x<=0?x?(x-1){g}x] L{g}L", false));
+    ASSERT_EQ(2u, binary.GetNumGeneratedOperators());
+
+    std::filesystem::remove_all(directory);
+}
+
+#endif // ENABLE_JIT
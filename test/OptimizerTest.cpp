@@ -0,0 +1,186 @@
+/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "StackMachine.h"
+#include "TestCommon.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+
+namespace
+{
+size_t CountCalls(const calc4::StackMachineModule<int64_t>& module)
+{
+    using namespace calc4;
+
+    auto& operations = module.GetFlattenedOperations();
+    return std::count_if(operations.begin(), operations.end(), [](auto& operation) {
+        return operation.opcode == StackMachineOpcode::Call ||
+            operation.opcode == StackMachineOpcode::TailCall;
+    });
+}
+
+size_t CountZeroDivisionChecks(const calc4::StackMachineModule<int64_t>& module)
+{
+    using namespace calc4;
+
+    auto& operations = module.GetFlattenedOperations();
+    return std::count_if(operations.begin(), operations.end(), [](auto& operation) {
+        return operation.opcode == StackMachineOpcode::DivChecked ||
+            operation.opcode == StackMachineOpcode::ModChecked;
+    });
+}
+}
+
+// Assert small operators are inlined and the inlined code is precomputed again
+TEST(OptimizerTest, InliningTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[myadd|x, y|x + y] D[sq|x|x*x] 3{sq}{myadd}4", context);
+    auto op = Optimize<int64_t>(context, Parse(tokens, context));
+
+    auto precomputed = std::dynamic_pointer_cast<const PrecomputedOperator>(op);
+    ASSERT_NE(nullptr, precomputed);
+    ASSERT_EQ(13, precomputed->GetValue<int64_t>());
+
+    // Callers of inlined operators are inlined in turn, but recursive operators are not
+    tokens = Lex("D[f|n|n{myadd}1] L{f}", context);
+    op = Optimize<int64_t>(context, Parse(tokens, context));
+    ASSERT_EQ(0u, CountCalls(GenerateStackMachineModule<int64_t>(op, context, {})));
+
+    tokens = Lex("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] L{f}{fib}", context);
+    op = Optimize<int64_t>(context, Parse(tokens, context));
+    ASSERT_EQ(3u, CountCalls(GenerateStackMachineModule<int64_t>(op, context, {})));
+}
+
+// Assert redefined operators take effect in the operators which they have been inlined into
+TEST(OptimizerTest, RedefinitionTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[g|x|x+1] D[f|x|x{g}] 1{f}", context);
+    auto op = Optimize<int64_t>(context, Parse(tokens, context));
+
+    ExecutionState<int64_t> state;
+    ASSERT_EQ(2, Evaluate(context, state, op));
+
+    tokens = Lex("D[g|x|x+2] L{f}", context);
+    op = Optimize<int64_t>(context, Parse(tokens, context));
+    state.GetVariableSource().Set("", 1);
+    ASSERT_EQ(3, Evaluate(context, state, op));
+}
+
+// Assert calls of pure operators with constant operands are evaluated at compile time only if they
+// finish within the budget without errors
+TEST(OptimizerTest, ConstantCallTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[fact|n|n<=1?1?n*(n-1){fact}] D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] "
+                      "D[inv|x|100/x] D[get|x|L[v]+x] 0",
+                      context);
+    Parse(tokens, context);
+
+    auto Compile = [&context](const char* source) {
+        auto tokens = Lex(source, context);
+        return Optimize<int64_t>(context, Parse(tokens, context));
+    };
+
+    auto precomputed = std::dynamic_pointer_cast<const PrecomputedOperator>(Compile("10{fact}"));
+    ASSERT_NE(nullptr, precomputed);
+    ASSERT_EQ(3628800, precomputed->GetValue<int64_t>());
+
+    precomputed = std::dynamic_pointer_cast<const PrecomputedOperator>(Compile("(3{fib}){fact}"));
+    ASSERT_NE(nullptr, precomputed);
+    ASSERT_EQ(2, precomputed->GetValue<int64_t>());
+
+    // Exceeding the budget, errors and impure operators leave the calls to runtime
+    ASSERT_EQ(nullptr, std::dynamic_pointer_cast<const PrecomputedOperator>(Compile("50{fib}")));
+    ASSERT_EQ(nullptr, std::dynamic_pointer_cast<const PrecomputedOperator>(Compile("0{inv}")));
+    ASSERT_EQ(nullptr, std::dynamic_pointer_cast<const PrecomputedOperator>(Compile("1{get}")));
+}
+
+// Assert only the operators whose sources or callees have been redefined are optimized again
+TEST(OptimizerTest, IncrementalOptimizationTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto Compile = [&context](const char* source) {
+        auto tokens = Lex(source, context);
+        return Optimize<int64_t>(context, Parse(tokens, context));
+    };
+    auto GetBody = [&context](const char* name) {
+        return context.GetOperatorImplement(name).GetOperator();
+    };
+
+    Compile("D[g|x|x+1] D[f|x|x{g}*2] D[h|n|n<=0?0?(n-1){h}] 0");
+    auto f = GetBody("f");
+    auto g = GetBody("g");
+    auto h = GetBody("h");
+
+    // Defining another operator keeps the optimized ones
+    Compile("D[k|x|x{h}] 0");
+    ASSERT_EQ(f, GetBody("f"));
+    ASSERT_EQ(g, GetBody("g"));
+    ASSERT_EQ(h, GetBody("h"));
+
+    // Redefining "g" optimizes "f" again, into which "g" has been inlined
+    auto k = GetBody("k");
+    Compile("D[g|x|x+2] 0");
+    ASSERT_NE(f, GetBody("f"));
+    ASSERT_EQ(h, GetBody("h"));
+    ASSERT_EQ(k, GetBody("k"));
+
+    ExecutionState<int64_t> state;
+    ASSERT_EQ(8, Evaluate(context, state, Compile("2{f}")));
+}
+
+// Assert the checks for zero division are omitted only if the divisors are proven to be non-zero
+TEST(OptimizerTest, NonZeroDivisorTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto CountChecks = [&context](const char* source) {
+        auto tokens = Lex(source, context);
+        auto op = Optimize<int64_t>(context, Parse(tokens, context));
+        return CountZeroDivisionChecks(GenerateStackMachineModule<int64_t>(op, context, { true }));
+    };
+
+    // Conditions guarding the divisors
+    ASSERT_EQ(0u, CountChecks("D[f|x|x==0?0?100/x] L{f}"));
+    ASSERT_EQ(0u, CountChecks("D[f|x|x?100%x?0] L{f}"));
+    ASSERT_EQ(0u, CountChecks("D[g|x, y|(0<x)&&(y<0)?(x/y)+(y/x)?0] L{g}(L)"));
+    ASSERT_EQ(0u, CountChecks("D[f|x|(x!=0)&&(100/x>2)] L{f}"));
+    ASSERT_EQ(0u, CountChecks("D[f|x|(x<=0)||(100/x>2)] L{f}"));
+
+    // Ranges of arithmetic operations and constants
+    ASSERT_EQ(0u, CountChecks("D[f|x|x>=2?100/(x-1)?0] L{f}"));
+    ASSERT_EQ(0u, CountChecks("D[f|x|(x>0)&&(x<100)?100/(x*x)?0] L{f}"));
+    ASSERT_EQ(0u, CountChecks("D[f|x|100/(x==1?2?3)] L{f}"));
+    ASSERT_EQ(0u, CountChecks("L/(L>0?1?0-1)"));
+
+    // Divisors which may be zero
+    ASSERT_EQ(1u, CountChecks("D[f|x|100/x] L{f}"));
+    ASSERT_EQ(1u, CountChecks("D[f|x|x>=0?100/x?0] L{f}"));
+    ASSERT_EQ(1u, CountChecks("D[f|x|x>=1?100/(x+1)?0] L{f}"));
+    ASSERT_EQ(1u, CountChecks("D[f|x|x!=0?100/(x*x)?0] L{f}"));
+    ASSERT_EQ(1u, CountChecks("D[f|x|(x!=0)||(100/x)] L{f}"));
+    ASSERT_EQ(1u, CountChecks("L?1/L?0"));
+
+    ExecutionState<int64_t> state;
+    state.GetVariableSource().Set("", 4);
+    auto op = Optimize<int64_t>(context, Parse(Lex("D[f|x|x>=2?100/(x-1)?0] L{f}", context),
+                                               context));
+    ASSERT_EQ(33, Evaluate(context, state, op));
+}
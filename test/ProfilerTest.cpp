@@ -0,0 +1,128 @@
+/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "Profiler.h"
+#include "TestCommon.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+std::vector<ExecutorType> GetAllExecutors()
+{
+    return {
+#ifdef ENABLE_JIT
+        ExecutorType::JIT,
+#endif // ENABLE_JIT
+        ExecutorType::StackMachine,
+        ExecutorType::RegisterMachine,
+        ExecutorType::Interpreter,
+    };
+}
+
+int64_t ExecuteWithProfiler(const char* source, ExecutorType executor, calc4::Profiler& profiler)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex(source, context);
+    auto op = Parse(tokens, context);
+
+    ExecutionState<int64_t> state;
+    ProfilingScope scope(&profiler);
+
+    switch (executor)
+    {
+#ifdef ENABLE_JIT
+    case ExecutorType::JIT:
+        return EvaluateByJIT<int64_t>(context, state, op, { false, false, false, &profiler });
+#endif // ENABLE_JIT
+    case ExecutorType::StackMachine:
+    {
+        auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+        StackMachineContext<int64_t> machineContext;
+        return ExecuteStackMachineModule(module, state, machineContext, &profiler);
+    }
+    case ExecutorType::RegisterMachine:
+    {
+        auto module = GenerateRegisterMachineModule<int64_t>(op, context, {});
+        RegisterMachineContext<int64_t> machineContext;
+        return ExecuteRegisterMachineModule(module, state, machineContext, &profiler);
+    }
+    case ExecutorType::Interpreter:
+        return Evaluate<int64_t>(context, state, op, &profiler);
+    default:
+        UNREACHABLE();
+        return 0;
+    }
+}
+
+const calc4::Profiler::OperatorStatistics& FindStatistics(
+    const std::vector<calc4::Profiler::OperatorStatistics>& statistics, std::string_view name)
+{
+    return *std::find_if(statistics.begin(), statistics.end(),
+                         [name](auto& stat) { return stat.name == name; });
+}
+}
+
+// Assert every executor reports the same call counts and recursion depths
+TEST(ProfilerTest, CallCountTest)
+{
+    using namespace calc4;
+
+    for (auto executor : GetAllExecutors())
+    {
+        Profiler profiler;
+        ASSERT_EQ(610, ExecuteWithProfiler("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] 15{fib}",
+                                           executor, profiler));
+
+        auto statistics = profiler.GetStatistics();
+        ASSERT_EQ(static_cast<size_t>(1), statistics.size());
+        ASSERT_EQ("fib", statistics[0].name);
+        ASSERT_EQ(static_cast<uint64_t>(1973), statistics[0].numCalls);
+        ASSERT_EQ(15, statistics[0].maxRecursionDepth);
+        ASSERT_LE(statistics[0].selfTime, statistics[0].inclusiveTime);
+    }
+}
+
+// Assert mutual recursions are collapsed in the folded stacks
+TEST(ProfilerTest, MutualRecursionTest)
+{
+    using namespace calc4;
+
+    for (auto executor : GetAllExecutors())
+    {
+        Profiler profiler;
+
+        // "odd" is declared first so that "even" can call it
+        ASSERT_EQ(1, ExecuteWithProfiler("D[odd|n|0] D[even|n|n==0?1?(n-1){odd}] "
+                                         "D[odd|n|n==0?0?(n-1){even}] 10{even}",
+                                         executor, profiler));
+
+        auto statistics = profiler.GetStatistics();
+        ASSERT_EQ(static_cast<uint64_t>(6), FindStatistics(statistics, "even").numCalls);
+        ASSERT_EQ(static_cast<uint64_t>(5), FindStatistics(statistics, "odd").numCalls);
+        ASSERT_EQ(6, FindStatistics(statistics, "even").maxRecursionDepth);
+        ASSERT_EQ(5, FindStatistics(statistics, "odd").maxRecursionDepth);
+
+        std::ostringstream folded;
+        profiler.WriteFoldedStacks(folded);
+
+        std::istringstream lines(folded.str());
+        for (std::string line; std::getline(lines, line);)
+        {
+            auto stack = line.substr(0, line.find(' '));
+            ASSERT_TRUE(stack == "<main>" || stack == "<main>;even" || stack == "<main>;even;odd")
+                << stack;
+        }
+    }
+}
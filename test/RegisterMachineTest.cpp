@@ -0,0 +1,81 @@
+/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "RegisterMachine.h"
+#include "StackMachine.h"
+#include "TestCommon.h"
+#include <gtest/gtest.h>
+#include <string_view>
+
+// Assert ToString(RegisterMachineOpcode opcode) does not return an invalid string for all opcodes
+TEST(RegisterMachineTest, ToStringTest)
+{
+    using namespace calc4;
+
+    // Get an invalid string with a dummy value
+    std::string_view unknownText = ToString(static_cast<RegisterMachineOpcode>(-1));
+
+    // Here, we assume that RegisterMachineOpcode::Lavel is the last opcode
+    for (int i = 0; i <= static_cast<int>(RegisterMachineOpcode::Lavel); i++)
+    {
+        // The returned text should never be an invalid string
+        ASSERT_NE(unknownText, ToString(static_cast<RegisterMachineOpcode>(i)));
+    }
+}
+
+// Assert the register machine needs fewer operations than the stack machine
+TEST(RegisterMachineTest, NumOperationsTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] 20{fib}", context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+
+    auto stackMachineModule = GenerateStackMachineModule<int64_t>(op, context, { false, false });
+    auto registerMachineModule = GenerateRegisterMachineModule<int64_t>(op, context, {});
+    ASSERT_LT(registerMachineModule.GetFlattenedOperations().size(),
+              stackMachineModule.GetFlattenedOperations().size());
+
+    ExecutionState<int64_t> state;
+    ASSERT_EQ(6765, ExecuteRegisterMachineModule(registerMachineModule, state));
+}
+
+// Assert a context can be reused across executions and its registers grow on demand
+TEST(RegisterMachineTest, ReuseContextTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[sum|n|n==0?0?n+(n-1){sum}] L{sum}", context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+    auto module = GenerateRegisterMachineModule<int64_t>(op, context, {});
+
+    ExecutionState<int64_t> state;
+    RegisterMachineContext<int64_t> smallContext(1 << 10, 1 << 10);
+    RegisterMachineContext<int64_t> largeContext;
+
+    // A shallow recursion runs in both contexts
+    state.GetVariableSource().Set("", 100);
+    ASSERT_EQ(5050, ExecuteRegisterMachineModule(module, state, smallContext));
+    ASSERT_EQ(5050, ExecuteRegisterMachineModule(module, state, largeContext));
+
+    // A deep recursion overflows the small context but not the large one
+    state.GetVariableSource().Set("", 100000);
+    ASSERT_THROW(ExecuteRegisterMachineModule(module, state, smallContext),
+                 Exceptions::StackOverflowException);
+    ASSERT_EQ(5000050000, ExecuteRegisterMachineModule(module, state, largeContext));
+
+    // Contexts are still usable after the overflow
+    state.GetVariableSource().Set("", 10);
+    ASSERT_EQ(55, ExecuteRegisterMachineModule(module, state, smallContext));
+    ASSERT_EQ(55, ExecuteRegisterMachineModule(module, state, largeContext));
+}
@@ -0,0 +1,168 @@
+/*****
+ *
+ * The Calc4 Programming Language
+ *
+ * Copyright (C) 2018-2026 Yuya Watari
+ * This software is released under the MIT License, see LICENSE file for details
+ *
+ *****/
+
+#include "ReplCommon.h"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Assert errors raised in the operators defined by earlier inputs are printed with the lines
+// defining them
+TEST(ReplTest, ErrorInEarlierInputTest)
+{
+    using namespace calc4;
+
+    // The other executors do not report the positions of errors
+    std::vector<ExecutorType> executors = { ExecutorType::StackMachine,
+                                            ExecutorType::TreeTraversal };
+
+    const std::string expected = "1:14: Error: Zero division\n"
+                                 "       1 | D[f|x|1000000/x] 1\n"
+                                 "                        ^\n";
+    for (auto executor : executors)
+    {
+        Option option;
+        option.executorType = executor;
+        option.treeExecutorMode = TreeTraversalExecutorMode::Never;
+
+        CompilationContext context;
+        ExecutionState<int64_t> state;
+        ExecutorResources<int64_t> resources(option);
+        auto Execute = [&](const char* source) {
+            std::ostringstream out;
+            ExecuteSource<int64_t>(source, nullptr, context, state, resources, option, out);
+            return out.str();
+        };
+
+        Execute("D[f|x|1000000/x] 1");
+        ASSERT_EQ(expected, Execute("0{f}"));
+        ASSERT_EQ(expected, Execute("D[g|x|x{f}] 0{g}"));
+
+        // Errors in the current input are printed with it, including the ones failing to compile
+        ASSERT_EQ("1:2: Error: Zero division\n"
+                  "       1 | 1/0\n"
+                  "            ^\n",
+                  Execute("1/0"));
+        ASSERT_EQ(0u, Execute("1{h}").find("1:2: Error:"));
+    }
+}
+
+// Assert the context keeps the source of an input only while the operators defined in it are left
+TEST(ReplTest, SourceLifetimeTest)
+{
+    using namespace calc4;
+
+    Option option;
+    CompilationContext context;
+    ExecutionState<int64_t> state;
+    ExecutorResources<int64_t> resources(option);
+    auto Execute = [&](const char* source) {
+        std::ostringstream out;
+        ExecuteSource<int64_t>(source, nullptr, context, state, resources, option, out);
+    };
+
+    Execute("D[f|x|1000000/x] 1");
+    Execute("1+2");
+    ASSERT_NE(nullptr, context.FindSource(1));
+    ASSERT_EQ("D[f|x|1000000/x] 1", *context.FindSource(1));
+    ASSERT_EQ(nullptr, context.FindSource(2));
+
+    Execute("D[f|x|x] 1");
+    ASSERT_EQ(nullptr, context.FindSource(1));
+    ASSERT_NE(nullptr, context.FindSource(3));
+    ASSERT_EQ("D[f|x|x] 1", *context.FindSource(3));
+}
+
+// Assert redefining an operator updates the results of its callers folded by the optimization,
+// whatever order the names of the operators sort in
+TEST(ReplTest, RedefinitionTest)
+{
+    using namespace calc4;
+
+    std::vector<ExecutorType> executors = {
+#ifdef ENABLE_JIT
+        ExecutorType::JIT,
+        ExecutorType::Tiered,
+#endif // ENABLE_JIT
+        ExecutorType::StackMachine,
+        ExecutorType::RegisterMachine,
+        ExecutorType::TreeTraversal,
+    };
+
+    for (auto executor : executors)
+    {
+        for (auto names : { "fgh", "cba" })
+        {
+            Option option;
+            option.executorType = executor;
+
+            CompilationContext context;
+            ExecutionState<int64_t> state;
+            ExecutorResources<int64_t> resources(option);
+            auto Execute = [&](std::string source) {
+                for (auto& c : source)
+                {
+                    c = c == 'F' ? names[0] : c == 'G' ? names[1] : c == 'H' ? names[2] : c;
+                }
+
+                std::ostringstream out;
+                ExecuteSource<int64_t>(source, nullptr, context, state, resources, option, out);
+                auto result = out.str();
+                return result.substr(0, result.find('\n'));
+            };
+
+            Execute("D[H|x|x+1]");
+            Execute("D[G|x|x{H}*2]");
+            Execute("D[F||3{G}]");
+            ASSERT_EQ("8", Execute("{F}"));
+
+            Execute("D[H|x|x+10]");
+            ASSERT_EQ("26", Execute("{F}"));
+            ASSERT_EQ("26", Execute("{F}"));
+        }
+    }
+}
+
+#ifdef ENABLE_JIT
+// Assert the tiered executor keeps the operators compiled for earlier inputs, and compiles them
+// again only when they are redefined
+TEST(ReplTest, TieredCompilationReuseTest)
+{
+    using namespace calc4;
+
+    Option option;
+    option.executorType = ExecutorType::Tiered;
+
+    CompilationContext context;
+    ExecutionState<int64_t> state;
+    ExecutorResources<int64_t> resources(option);
+    auto Execute = [&](const char* source) {
+        std::ostringstream out;
+        ExecuteSource<int64_t>(source, nullptr, context, state, resources, option, out);
+        auto result = out.str();
+        return result.substr(0, result.find('\n'));
+    };
+
+    Execute("D[fib|n|n<=1?n+L[v]?(n-1){fib}+(n-2){fib}]");
+    ASSERT_EQ("6765", Execute("20{fib}"));
+    ASSERT_NE(nullptr, resources.tieredCompiler);
+    size_t numGeneratedOperators = resources.tieredCompiler->GetNumGeneratedOperators();
+    ASSERT_LT(0u, numGeneratedOperators);
+
+    // The compiled code reads the variables of the later executions
+    Execute("1S[v]");
+    ASSERT_EQ("17711", Execute("20{fib}"));
+    ASSERT_EQ(numGeneratedOperators, resources.tieredCompiler->GetNumGeneratedOperators());
+
+    Execute("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}]");
+    ASSERT_EQ("6765", Execute("20{fib}"));
+    ASSERT_LT(numGeneratedOperators, resources.tieredCompiler->GetNumGeneratedOperators());
+}
+#endif // ENABLE_JIT
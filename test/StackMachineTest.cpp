@@ -1,4 +1,4 @@
-/*****
+﻿/*****
  *
  * The Calc4 Programming Language
  *
@@ -8,9 +8,17 @@
  *****/
 
 #include "StackMachine.h"
+#include "StackMachineBytecode.h"
 #include "TestCommon.h"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
 #include <string_view>
+#include <unordered_set>
 
 // Assert ToString(StackMachineOpcode opcode) does not return an invalid string for all opcodes
 TEST(StackMachineTest, ToStringTest)
@@ -27,3 +35,653 @@ TEST(StackMachineTest, ToStringTest)
         ASSERT_NE(unknownText, ToString(static_cast<StackMachineOpcode>(i)));
     }
 }
+
+// Assert a module can be executed repeatedly, reusing its prepared code
+TEST(StackMachineTest, ReuseModuleTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] L{fib}", context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+
+    ExecutionState<int64_t> state;
+    int64_t expected[] = { 0, 1, 1, 2, 3, 5, 8, 13, 21, 34, 55 };
+    for (int64_t n = 0; n < static_cast<int64_t>(std::size(expected)); n++)
+    {
+        state.GetVariableSource().Set("", n);
+        ASSERT_EQ(expected[n], ExecuteStackMachineModule(module, state));
+    }
+
+    // Copies of a module share the prepared code
+    auto copied = module;
+    state.GetVariableSource().Set("", 20);
+    ASSERT_EQ(6765, ExecuteStackMachineModule(copied, state));
+}
+
+// Assert a context can be reused across executions and its stacks grow on demand
+TEST(StackMachineTest, ReuseContextTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[sum|n|n==0?0?n+(n-1){sum}] L{sum}", context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+
+    ExecutionState<int64_t> state;
+    StackMachineContext<int64_t> smallContext(1 << 10, 1 << 10);
+    StackMachineContext<int64_t> largeContext;
+
+    // A shallow recursion runs in both contexts
+    state.GetVariableSource().Set("", 100);
+    ASSERT_EQ(5050, ExecuteStackMachineModule(module, state, smallContext));
+    ASSERT_EQ(5050, ExecuteStackMachineModule(module, state, largeContext));
+
+    // A deep recursion overflows the small context but not the large one
+    state.GetVariableSource().Set("", 100000);
+    ASSERT_THROW(ExecuteStackMachineModule(module, state, smallContext),
+                 Exceptions::StackOverflowException);
+    ASSERT_EQ(5000050000, ExecuteStackMachineModule(module, state, largeContext));
+
+    // Contexts are still usable after the overflow
+    state.GetVariableSource().Set("", 10);
+    ASSERT_EQ(55, ExecuteStackMachineModule(module, state, smallContext));
+    ASSERT_EQ(55, ExecuteStackMachineModule(module, state, largeContext));
+}
+
+#ifdef USE_GUARD_PAGE
+// Assert overflows of guarded stacks are reported as StackOverflowException and the stacks are
+// still usable after the overflows
+TEST(StackMachineTest, GuardedStackTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[sum|n|n==0?0?n+(n-1){sum}] L{sum}", context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+
+    using GuardedContext =
+        StackMachineContext<int64_t, GuardedStackArray<int64_t>, GuardedStackArray<int>>;
+    ExecutionState<int64_t> state;
+    GuardedContext small(1 << 10, 1 << 10);
+
+    for (int64_t n : { 10, 100000, 20, 200000, 30 })
+    {
+        state.GetVariableSource().Set("", n);
+        if (n <= 100)
+        {
+            ASSERT_EQ(n * (n + 1) / 2, ExecuteStackMachineModule(module, state, small));
+        }
+        else
+        {
+            ASSERT_THROW(ExecuteStackMachineModule(module, state, small),
+                         Exceptions::StackOverflowException);
+        }
+    }
+
+    // Recursions deeper than the default maximum run with a larger reservation
+    GuardedContext large(1 << 24, 1 << 24);
+    state.GetVariableSource().Set("", 4000000);
+    ASSERT_EQ(int64_t(4000000) * 4000001 / 2, ExecuteStackMachineModule(module, state, large));
+}
+#endif // USE_GUARD_PAGE
+
+// Assert the peephole pass fuses common sequences into superinstructions
+TEST(StackMachineTest, SuperinstructionTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] 20{fib}", context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+
+    auto plain = GenerateStackMachineModule<int64_t>(op, context, { false, false });
+    auto fused = GenerateStackMachineModule<int64_t>(op, context, { false, true });
+    ASSERT_LT(fused.GetFlattenedOperations().size(), plain.GetFlattenedOperations().size());
+
+    auto HasOpcode = [](const StackMachineModule<int64_t>& module, StackMachineOpcode opcode) {
+        auto& operations = module.GetFlattenedOperations();
+        return std::any_of(operations.begin(), operations.end(),
+                           [opcode](auto& operation) { return operation.opcode == opcode; });
+    };
+
+    ASSERT_TRUE(HasOpcode(fused, StackMachineOpcode::LoadArgSubConst));
+    ASSERT_TRUE(HasOpcode(fused, StackMachineOpcode::LoadArgReturn));
+    ASSERT_FALSE(HasOpcode(plain, StackMachineOpcode::LoadArgSubConst));
+
+    ExecutionState<int64_t> state;
+    ASSERT_EQ(6765, ExecuteStackMachineModule(plain, state));
+    ASSERT_EQ(6765, ExecuteStackMachineModule(fused, state));
+}
+
+// Assert mutually recursive tail calls reuse the current frame and run in constant stack space
+TEST(StackMachineTest, TailCallTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[odd|n,a|0] D[even|n|n==0?1?(n-1){odd}n] D[odd|n,a|n==0?0?(n-1){even}] "
+                      "L{even}",
+                      context);
+    auto op = Parse(tokens, context);
+    op = Optimize<int64_t>(context, op);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+
+    auto& operations = module.GetFlattenedOperations();
+    ASSERT_EQ(2, std::count_if(operations.begin(), operations.end(), [](auto& operation) {
+                  return operation.opcode == StackMachineOpcode::TailCall;
+              }));
+
+    ExecutionState<int64_t> state;
+    StackMachineContext<int64_t> smallContext(1 << 10, 1 << 10);
+
+    for (int64_t n : { 0, 1, 10, 1000000, 1000001 })
+    {
+        state.GetVariableSource().Set("", n);
+        ASSERT_EQ(n % 2 == 0 ? 1 : 0, ExecuteStackMachineModule(module, state, smallContext));
+    }
+}
+
+// Assert only the operators without side effects are memoized, and exponential recursion finishes
+// quickly when memoized
+TEST(StackMachineTest, MemoizationTest)
+{
+    using namespace calc4;
+
+    const char* source = "D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] D[get|x|L[v]] "
+                         "D[count|x|(L[v]+1)S[v]] D[call|x|x{get}] 90{fib}";
+
+    CompilationContext context;
+    auto tokens = Lex(source, context);
+    Parse(tokens, context);
+    ASSERT_EQ(std::unordered_set<std::string>{ "fib" }, CallGraph(context).GetPureOperators());
+
+    for (auto executor : { ExecutorType::Interpreter, ExecutorType::StackMachine,
+#ifdef ENABLE_JIT
+                           ExecutorType::JIT
+#endif // ENABLE_JIT
+         })
+    {
+        auto [result, variables, memory, consoleOutput] =
+            Execute<int64_t>(source, "", true, true, executor, true);
+        ASSERT_EQ(INT64_C(2880067194370816120), result);
+    }
+
+    // Impure operators are executed every time even if their operands are the same
+    auto [result, variables, memory, consoleOutput] =
+        Execute<int64_t>("D[count|x|(L[v]+1)S[v]] D[twice|x|x{count}+(x{count})] 0{twice}{twice}",
+                         "", true, true, ExecutorType::StackMachine, true);
+    ASSERT_EQ(4, variables.Get("v"));
+}
+
+// Assert only the operators reachable from the entry point are generated
+TEST(StackMachineTest, DeadOperatorEliminationTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[unused|x|x{unused}] D[leaf|x|x+1] D[used|x|x{leaf}*2] D[other|x|x{leaf}] "
+                      "L{used}",
+                      context);
+    auto op = Parse(tokens, context);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+
+    std::unordered_set<std::string> names;
+    for (auto& userDefined : module.GetUserDefinedOperators())
+    {
+        names.insert(userDefined.GetDefinition().GetName());
+    }
+    ASSERT_EQ((std::unordered_set<std::string>{ "leaf", "used" }), names);
+
+    ExecutionState<int64_t> state;
+    state.GetVariableSource().Set("", 20);
+    ASSERT_EQ(42, ExecuteStackMachineModule(module, state));
+
+    // A program without calls needs no operators
+    tokens = Lex("1+2", context);
+    module = GenerateStackMachineModule<int64_t>(Parse(tokens, context), context, {});
+    ASSERT_TRUE(module.GetUserDefinedOperators().empty());
+}
+
+// Assert the code of the operators which have not been redefined is reused across modules
+TEST(StackMachineTest, CodeCacheTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    StackMachineCodeCache<int64_t> codeCache;
+    ExecutionState<int64_t> state;
+    auto Execute = [&](const char* source) {
+        auto tokens = Lex(source, context);
+        auto op = Optimize<int64_t>(context, Parse(tokens, context));
+        auto module = GenerateStackMachineModule<int64_t>(op, context, {}, &codeCache);
+        return ExecuteStackMachineModule(module, state);
+    };
+
+    // The constants exceeding 32 bits and the variables are relocated into each module
+    ASSERT_EQ(0, Execute("D[big|x|x+10000000000] D[count|n|n<=0?0?(L[c]+1)S[c]+(n-1){count}] "
+                         "D[sum|n|n<=0?0?n{big}+(n-1){sum}] 0"));
+    ASSERT_EQ(static_cast<size_t>(0), codeCache.GetNumGeneratedOperators());
+
+    state.GetVariableSource().Set("n", 3);
+    ASSERT_EQ(30000000006, Execute("L[n]{sum}"));
+    ASSERT_EQ(static_cast<size_t>(1), codeCache.GetNumGeneratedOperators());
+
+    ASSERT_EQ(30000000006 + 6, Execute("L[n]{sum}+L[n]{count}"));
+    ASSERT_EQ(static_cast<size_t>(2), codeCache.GetNumGeneratedOperators());
+    ASSERT_EQ(15 + 30000000006, Execute("L[n]{count}+L[n]{sum}"));
+    ASSERT_EQ(static_cast<size_t>(2), codeCache.GetNumGeneratedOperators());
+
+    // Redefined operators are generated again
+    ASSERT_EQ(0, Execute("D[sum|n|n<=0?0?n+(n-1){sum}] 0"));
+    ASSERT_EQ(6, Execute("L[n]{sum}"));
+    ASSERT_EQ(static_cast<size_t>(3), codeCache.GetNumGeneratedOperators());
+}
+
+// Assert programs exceeding the range of 16-bit operands are executed correctly. The generated
+// program has more than 100K operations, 40K variables and jump targets beyond 32K.
+TEST(StackMachineTest, LargeProgramTest)
+{
+    using namespace calc4;
+
+    static constexpr int NumGroups = 200;
+    static constexpr int NumVariablesPerGroup = 200;
+    static constexpr int NumVariables = NumGroups * NumVariablesPerGroup;
+
+    // Statements are split into groups to keep the sequences given to the parser short
+    std::string source = "D[f|n|n?(";
+    for (int i = 0; i < NumGroups; i++)
+    {
+        source += "(";
+        for (int j = 0; j < NumVariablesPerGroup; j++)
+        {
+            auto name = "v" + std::to_string(i * NumVariablesPerGroup + j);
+            source += "(L[" + name + "]+100000S[" + name + "])";
+        }
+        source += ")";
+    }
+    source += "L[v0])?0] 1{f}";
+
+    CompilationContext context;
+    auto tokens = Lex(source, context);
+    auto op = Parse(tokens, context);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, {});
+    ASSERT_GT(module.GetFlattenedOperations().size(), static_cast<size_t>(100000));
+    ASSERT_EQ(static_cast<size_t>(NumVariables), module.GetVariables().size());
+
+    for (auto optimize : { true, false })
+    {
+        for (auto executor : { ExecutorType::StackMachine, ExecutorType::RegisterMachine })
+        {
+            auto [result, variables, memory, consoleOutput] =
+                Execute<int64_t>(source.c_str(), "", optimize, true, executor);
+            ASSERT_EQ(100000, result);
+            ASSERT_EQ(100000, variables.Get("v0"));
+            ASSERT_EQ(100000, variables.Get("v" + std::to_string(NumVariables - 1)));
+        }
+    }
+}
+
+namespace
+{
+template<typename TNumber>
+std::string GenerateBytecode(std::string_view source)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex(source, context);
+    auto op = Parse(tokens, context);
+    op = Optimize<TNumber>(context, op);
+    auto module = GenerateStackMachineModule<TNumber>(op, context, { true, true });
+
+    std::ostringstream out;
+    WriteStackMachineBytecode(module, out);
+    return out.str();
+}
+}
+
+// Assert a module written as bytecode is executed in the same way after being read back
+TEST(StackMachineTest, BytecodeRoundTripTest)
+{
+    using namespace calc4;
+
+    {
+        auto bytecode =
+            GenerateBytecode<int64_t>("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] 72P 20{fib}S[x]");
+        ASSERT_EQ(64, GetStackMachineBytecodeIntegerSize(bytecode));
+
+        auto module = ReadStackMachineBytecode<int64_t>(bytecode);
+        ASSERT_EQ(std::vector<std::string>{ "x" }, module.GetVariables());
+
+        std::string consoleOutput;
+        BufferedInputSource inputSource("");
+        BufferedPrinter printer(&consoleOutput);
+        ExecutionState<int64_t, DefaultVariableSource<int64_t>, DefaultGlobalArraySource<int64_t>,
+                       BufferedInputSource, BufferedPrinter>
+            state(inputSource, printer);
+        ASSERT_EQ(6765, ExecuteStackMachineModule(module, state));
+        ASSERT_EQ(6765, state.GetVariableSource().Get("x"));
+        ASSERT_EQ("H", consoleOutput);
+
+        // Bytecode of a different integer size is rejected
+        ASSERT_THROW(ReadStackMachineBytecode<int32_t>(bytecode),
+                     Exceptions::InvalidBytecodeException);
+    }
+
+#ifdef ENABLE_GMP
+    {
+        auto bytecode = GenerateBytecode<HybridInteger>("D[pow|x,n|n==0?1?x*(x{pow}(n-1))] "
+                                                        "(100000000000000000000{pow}3)-1");
+        ASSERT_EQ(InfinitePrecisionBytecodeIntegerSize,
+                  GetStackMachineBytecodeIntegerSize(bytecode));
+
+        auto module = ReadStackMachineBytecode<HybridInteger>(bytecode);
+        ExecutionState<HybridInteger> state;
+        ASSERT_EQ(HybridInteger(
+                      mpz_class("999999999999999999999999999999999999999999999999999999999999")),
+                  ExecuteStackMachineModule(module, state));
+    }
+#endif // ENABLE_GMP
+}
+
+// Assert runtime errors point to the source positions recorded in the module and the bytecode
+TEST(StackMachineTest, SourcePositionTest)
+{
+    using namespace calc4;
+
+    auto bytecode = GenerateBytecode<int64_t>("D[f|x|10/x]\n1+0{f}");
+    auto module = ReadStackMachineBytecode<int64_t>(bytecode);
+
+    // The division inlined from "f" into the main program. "f" itself is no longer called, so it is
+    // not generated.
+    auto& sourcePositions = module.GetSourcePositions();
+    ASSERT_EQ(static_cast<size_t>(1), sourcePositions.size());
+    ASSERT_TRUE(std::is_sorted(
+        sourcePositions.begin(), sourcePositions.end(),
+        [](auto& a, auto& b) { return a.address < b.address; }));
+
+    for (auto& entry : sourcePositions)
+    {
+        auto position = module.FindSourcePosition(entry.address);
+        ASSERT_TRUE(position.has_value());
+        ASSERT_EQ(entry.position.index, position->index);
+    }
+
+    try
+    {
+        ExecutionState<int64_t> state;
+        ExecuteStackMachineModule(module, state);
+        FAIL();
+    }
+    catch (Exceptions::ZeroDivisionException& e)
+    {
+        ASSERT_TRUE(e.GetPosition().has_value());
+        ASSERT_EQ(0, e.GetPosition()->lineNo);
+        ASSERT_EQ(8, e.GetPosition()->charNo);
+    }
+}
+
+// Assert bytecode files are loaded through MappedFile
+TEST(StackMachineTest, BytecodeFileTest)
+{
+    using namespace calc4;
+
+    auto bytecode = GenerateBytecode<int32_t>("D[sum|n|n==0?0?n+(n-1){sum}] 100{sum}");
+    auto path = std::filesystem::temp_directory_path() / "calc4-bytecode-file-test.c4b";
+
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        ofs.write(bytecode.data(), bytecode.size());
+    }
+
+    {
+        MappedFile file(path.string().c_str());
+        ASSERT_TRUE(file.IsOpen());
+        ASSERT_EQ(bytecode, file.GetContent());
+
+        auto module = ReadStackMachineBytecode<int32_t>(file.GetContent());
+        ExecutionState<int32_t> state;
+        ASSERT_EQ(5050, ExecuteStackMachineModule(module, state));
+    }
+
+    std::filesystem::remove(path);
+    ASSERT_FALSE(MappedFile(path.string().c_str()).IsOpen());
+}
+
+// Assert broken bytecode is rejected instead of being executed
+TEST(StackMachineTest, InvalidBytecodeTest)
+{
+    using namespace calc4;
+
+    auto bytecode = GenerateBytecode<int64_t>("D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] 20{fib}");
+    ASSERT_NO_THROW(ReadStackMachineBytecode<int64_t>(bytecode));
+
+    // Empty, truncated and extended bytecode
+    ASSERT_THROW(ReadStackMachineBytecode<int64_t>(""), Exceptions::InvalidBytecodeException);
+    for (size_t length = 0; length < bytecode.length(); length++)
+    {
+        ASSERT_THROW(ReadStackMachineBytecode<int64_t>(bytecode.substr(0, length)),
+                     Exceptions::InvalidBytecodeException);
+    }
+    ASSERT_THROW(ReadStackMachineBytecode<int64_t>(bytecode + '\0'),
+                 Exceptions::InvalidBytecodeException);
+
+    // Broken magic
+    auto broken = bytecode;
+    broken[0] = 'X';
+    ASSERT_THROW(ReadStackMachineBytecode<int64_t>(broken), Exceptions::InvalidBytecodeException);
+
+    // Operations referring to anything out of the module
+    auto WriteAndRead = [](const std::vector<StackMachineOperation>& entryPoint,
+                           int maxStackSize = 1) {
+        StackMachineModule<int64_t> module(entryPoint, maxStackSize, {}, {}, {});
+        std::ostringstream out;
+        WriteStackMachineBytecode(module, out);
+        return ReadStackMachineBytecode<int64_t>(out.str());
+    };
+
+    using Op = StackMachineOperation;
+    using Opcode = StackMachineOpcode;
+    ASSERT_NO_THROW(WriteAndRead({ Op(Opcode::LoadConst, 1), Op(Opcode::Halt) }));
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadConstTable, 0), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadVariable, 0), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::Goto, 2), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::Lavel), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+
+    // Missing operand slots and terminators
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadArgReturn, 0) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadConst, 1) }), Exceptions::InvalidBytecodeException);
+
+    // Operations referring to anything out of the frame of their operator, which takes one operand
+    auto WriteAndReadOperator = [](const std::vector<StackMachineOperation>& operations,
+                                   const std::vector<StackMachineOperation>& entryPoint = {
+                                       Op(Opcode::LoadConst, 0), Op(Opcode::Halt) }) {
+        StackMachineUserDefinedOperator userDefined(OperatorDefinition("f", 1), operations, 2);
+        StackMachineModule<int64_t> module(entryPoint, 1, {}, { userDefined }, {});
+        std::ostringstream out;
+        WriteStackMachineBytecode(module, out);
+        return ReadStackMachineBytecode<int64_t>(out.str());
+    };
+
+    ASSERT_NO_THROW(WriteAndReadOperator({ Op(Opcode::LoadArg, 1), Op(Opcode::Return, 1) }));
+    ASSERT_NO_THROW(WriteAndReadOperator(
+        { Op(Opcode::LoadArgAddArg, 1), Op(Opcode::Operand, 1), Op(Opcode::Return, 1) }));
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArg, 0), Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArg, 2), Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::StoreArg, -1), Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArgMultArg, 1), Op(Opcode::Operand, 2),
+                                        Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArgReturn, 1), Op(Opcode::Operand, 2) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArg, 1), Op(Opcode::Return, 3) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArg, 1), Op(Opcode::TailCall, 0),
+                                        Op(Opcode::Operand, 1), Op(Opcode::Operand, 2),
+                                        Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadArg, 1), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+
+    // The entry point has no frame to return from
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadConst, 1), Op(Opcode::Return, 0) }),
+                 Exceptions::InvalidBytecodeException);
+    const std::vector<Op> body = { Op(Opcode::LoadArg, 1), Op(Opcode::Return, 1) };
+    ASSERT_NO_THROW(WriteAndReadOperator(
+        body, { Op(Opcode::LoadConst, 1), Op(Opcode::Call, 0), Op(Opcode::Halt) }));
+    ASSERT_THROW(WriteAndReadOperator(body, { Op(Opcode::LoadConst, 1), Op(Opcode::TailCall, 0),
+                                              Op(Opcode::Operand, 0), Op(Opcode::Operand, 1),
+                                              Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator(
+                     body, { Op(Opcode::LoadMemo, 0), Op(Opcode::LoadConst, 1), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+
+    // Stack underflows and overflows
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::Pop), Op(Opcode::LoadConst, 1), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadConst, 1), Op(Opcode::Add), Op(Opcode::Halt) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::Halt) }), Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+
+    const std::vector<Op> sum = { Op(Opcode::LoadConst, 1), Op(Opcode::LoadConst, 2),
+                                  Op(Opcode::Add), Op(Opcode::Halt) };
+    ASSERT_NO_THROW(WriteAndRead(sum, 2));
+    ASSERT_THROW(WriteAndRead(sum, 1), Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndReadOperator({ Op(Opcode::LoadArg, 1), Op(Opcode::LoadArg, 1),
+                                        Op(Opcode::LoadArg, 1), Op(Opcode::Add), Op(Opcode::Add),
+                                        Op(Opcode::Return, 1) }),
+                 Exceptions::InvalidBytecodeException);
+    ASSERT_NO_THROW(WriteAndReadOperator({ Op(Opcode::LoadMemo, 0), Op(Opcode::LoadArg, 1),
+                                           Op(Opcode::StoreMemo, 0), Op(Opcode::Return, 1) }));
+
+    // Jumps must land on operations with the same depth of the stack on every path
+    auto Jump = [](int target) {
+        return std::vector<Op>{ Op(Opcode::LoadConst, 1), Op(Opcode::GotoIfEqualConst, target),
+                                Op(Opcode::Operand, 1), Op(Opcode::LoadConst, 2),
+                                Op(Opcode::Halt) };
+    };
+    ASSERT_NO_THROW(WriteAndRead(Jump(3)));
+    ASSERT_THROW(WriteAndRead(Jump(2)), Exceptions::InvalidBytecodeException);
+    ASSERT_THROW(WriteAndRead({ Op(Opcode::LoadConst, 1), Op(Opcode::GotoIfTrue, 3),
+                                Op(Opcode::LoadConst, 2), Op(Opcode::LoadConst, 3),
+                                Op(Opcode::Halt) },
+                              2),
+                 Exceptions::InvalidBytecodeException);
+}
+
+#ifdef ENABLE_JIT
+// Assert the tiered execution gives the same results as the interpreter after promoting operators
+TEST(StackMachineTest, TieredExecutionTest)
+{
+    using namespace calc4;
+
+    const char* sources[] = {
+        "D[fib|n|n<=1?n?(n-1){fib}+(n-2){fib}] 25{fib}",
+        "D[add|x|(L[sum]+x)S[sum]] D[loop|n|n==0?0?(n{add}*0+(n-1){loop})] (1000{loop})+L[sum]",
+        "D[div|x|100/x] D[loop|n|n==0?0?(n{div}+(n-1){loop})] 100{loop}",
+    };
+
+    for (auto source : sources)
+    {
+        CompilationContext context;
+        auto tokens = Lex(source, context);
+        auto op = Parse(tokens, context);
+        auto module = GenerateStackMachineModule<int64_t>(op, context, { true });
+
+        ExecutionState<int64_t> expectedState;
+        int64_t expected = ExecuteStackMachineModule(module, expectedState);
+
+        for (bool synchronous : { true, false })
+        {
+            ExecutionState<int64_t> state;
+            StackMachineContext<int64_t> machineContext;
+            JITTieredCompiler<int64_t> compiler(context, { true, true }, 1, synchronous);
+            ASSERT_EQ(expected, ExecuteStackMachineModule(module, state, machineContext, nullptr,
+                                                          &compiler));
+            ASSERT_TRUE(compiler.IsCompiled());
+            ASSERT_EQ(expectedState.GetVariableSource().Get("sum"),
+                      state.GetVariableSource().Get("sum"));
+        }
+    }
+}
+
+// Assert the native code reports errors and short programs are never compiled
+TEST(StackMachineTest, TieredExecutionErrorTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[div|x|100/x] D[loop|n|n<0?0?(n{div}+(n-1){loop})] L{loop}", context);
+    auto op = Parse(tokens, context);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, { true });
+
+    ExecutionState<int64_t> state;
+    StackMachineContext<int64_t> machineContext;
+    {
+        JITTieredCompiler<int64_t> compiler(context, { true, true }, 1, true);
+        state.GetVariableSource().Set("", 100);
+        ASSERT_THROW(
+            ExecuteStackMachineModule(module, state, machineContext, nullptr, &compiler),
+            Exceptions::ZeroDivisionException);
+        ASSERT_TRUE(compiler.IsCompiled());
+    }
+    {
+        JITTieredCompiler<int64_t> compiler(context, { true, true });
+        state.GetVariableSource().Set("", -1);
+        ASSERT_EQ(0, ExecuteStackMachineModule(module, state, machineContext, nullptr, &compiler));
+        ASSERT_FALSE(compiler.IsCompiled());
+    }
+}
+
+// Assert deep recursions overflow with an exception whether the operators run on the stack
+// machine or in the native code
+TEST(StackMachineTest, TieredStackOverflowTest)
+{
+    using namespace calc4;
+
+    CompilationContext context;
+    auto tokens = Lex("D[f|x|x==0?0?((x-1){f}*3+1)%1000] L{f}", context);
+    auto op = Parse(tokens, context);
+    auto module = GenerateStackMachineModule<int64_t>(op, context, { true });
+
+    ExecutionState<int64_t> state;
+    StackMachineContext<int64_t> machineContext;
+    for (auto threshold : { 1u, 1000000u })
+    {
+        JITTieredCompiler<int64_t> compiler(context, { true, true }, threshold, true);
+        state.GetVariableSource().Set("", 1000);
+        ASSERT_EQ(ExecuteStackMachineModule(module, state, machineContext),
+                  ExecuteStackMachineModule(module, state, machineContext, nullptr, &compiler));
+
+        state.GetVariableSource().Set("", 1000000000);
+        ASSERT_THROW(
+            ExecuteStackMachineModule(module, state, machineContext, nullptr, &compiler),
+            Exceptions::StackOverflowException);
+        ASSERT_EQ(threshold == 1, compiler.IsCompiled());
+
+        // The stack machine keeps working after the overflow
+        state.GetVariableSource().Set("", 1000);
+        ASSERT_EQ(ExecuteStackMachineModule(module, state, machineContext),
+                  ExecuteStackMachineModule(module, state, machineContext, nullptr, &compiler));
+    }
+}
+#endif // ENABLE_JIT
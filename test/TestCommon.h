@@ -13,6 +13,7 @@
 #include "Exceptions.h"
 #include "Operators.h"
 #include "Optimizer.h"
+#include "RegisterMachine.h"
 #include "StackMachine.h"
 #include "SyntaxAnalysis.h"
 
@@ -21,10 +22,11 @@
 #endif // ENABLE_JIT
 
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 #ifdef ENABLE_GMP
-#include <gmpxx.h>
+#include "HybridInteger.h"
 #endif // ENABLE_GMP
 
 namespace
@@ -35,6 +37,7 @@ enum class ExecutorType
     JIT,
 #endif // ENABLE_JIT
     StackMachine,
+    RegisterMachine,
     Interpreter,
 };
 
@@ -66,11 +69,12 @@ struct TestCase : public TTestCaseBase
     ExecutorType executorType;
     bool optimize;
     bool checkZeroDivision;
+    bool memoize;
 
     TestCase(const TTestCaseBase& base, IntegerType integerType, ExecutorType executorType,
-             bool optimize, bool checkZeroDivision)
+             bool optimize, bool checkZeroDivision, bool memoize)
         : TTestCaseBase(base), integerType(integerType), executorType(executorType),
-          optimize(optimize), checkZeroDivision(checkZeroDivision)
+          optimize(optimize), checkZeroDivision(checkZeroDivision), memoize(memoize)
     {
     }
 };
@@ -80,26 +84,34 @@ std::vector<TTestCase> GenerateTestCases(const TContainer& testCaseBases)
 {
     std::vector<TTestCase> result;
 
+    // Memoization is independent of the optimization, so it is tested only with the optimized code
+    constexpr std::pair<bool, bool> OptimizeAndMemoize[] = {
+        { true, false },
+        { false, false },
+        { true, true },
+    };
+
     for (auto& base : testCaseBases)
     {
-        for (auto optimize : { true, false })
+        for (auto [optimize, memoize] : OptimizeAndMemoize)
         {
             for (auto checkZeroDivision : { true, false })
             {
                 for (auto executor : { ExecutorType::Interpreter, ExecutorType::StackMachine,
+                                       ExecutorType::RegisterMachine,
 #ifdef ENABLE_JIT
                                        ExecutorType::JIT
 #endif // ENABLE_JIT
                      })
                 {
                     result.emplace_back(base, IntegerType::Int32, executor, optimize,
-                                        checkZeroDivision);
+                                        checkZeroDivision, memoize);
                     result.emplace_back(base, IntegerType::Int64, executor, optimize,
-                                        checkZeroDivision);
+                                        checkZeroDivision, memoize);
 
 #ifdef ENABLE_INT128
                     result.emplace_back(base, IntegerType::Int128, executor, optimize,
-                                        checkZeroDivision);
+                                        checkZeroDivision, memoize);
 #endif // ENABLE_INT128
 
 #ifdef ENABLE_GMP
@@ -108,7 +120,7 @@ std::vector<TTestCase> GenerateTestCases(const TContainer& testCaseBases)
 #endif // ENABLE_JIT
                     {
                         result.emplace_back(base, IntegerType::GMP, executor, optimize,
-                                            checkZeroDivision);
+                                            checkZeroDivision, memoize);
                     }
 #endif // ENABLE_GMP
                 }
@@ -121,7 +133,8 @@ std::vector<TTestCase> GenerateTestCases(const TContainer& testCaseBases)
 
 template<typename TNumber>
 ExecutionResult<TNumber> Execute(const char* source, const char* standardInput, bool optimize,
-                                 bool checkZeroDivision, ExecutorType executor)
+                                 bool checkZeroDivision, ExecutorType executor,
+                                 bool memoize = false)
 {
     using namespace calc4;
 
@@ -146,26 +159,33 @@ ExecutionResult<TNumber> Execute(const char* source, const char* standardInput,
 #ifdef ENABLE_JIT
     case ExecutorType::JIT:
 #ifdef ENABLE_GMP
-        if constexpr (std::is_same_v<TNumber, mpz_class>)
+        if constexpr (std::is_same_v<TNumber, HybridInteger>)
         {
             throw "JIT does not support GMP";
         }
         else
 #endif // ENABLE_GMP
         {
-            result =
-                EvaluateByJIT<TNumber>(context, state, op, { optimize, checkZeroDivision, false });
+            result = EvaluateByJIT<TNumber>(
+                context, state, op, { optimize, checkZeroDivision, false, nullptr, memoize });
         }
         break;
 #endif // ENABLE_JIT
     case ExecutorType::StackMachine:
     {
-        auto module = GenerateStackMachineModule<TNumber>(op, context, { checkZeroDivision });
+        auto module = GenerateStackMachineModule<TNumber>(
+            op, context, { checkZeroDivision, optimize, memoize });
         result = ExecuteStackMachineModule(module, state);
         break;
     }
+    case ExecutorType::RegisterMachine:
+    {
+        auto module = GenerateRegisterMachineModule<TNumber>(op, context, { checkZeroDivision });
+        result = ExecuteRegisterMachineModule(module, state);
+        break;
+    }
     case ExecutorType::Interpreter:
-        result = Evaluate(context, state, op);
+        result = Evaluate(context, state, op, nullptr, memoize);
         break;
     default:
         UNREACHABLE();